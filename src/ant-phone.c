@@ -89,6 +89,7 @@
 #include "util.h"
 #include "client.h"
 #include "server.h"
+#include "logger.h"
 
 int main(int argc, char *argv[]) {
   struct option long_options[] = {
@@ -104,9 +105,13 @@ int main(int argc, char *argv[]) {
     {"call",     required_argument, 0, 'c'},
     {"sleep",    no_argument,       0, 's'},
     {"wakeup",   no_argument,       0, 'w'},
+    {"isdn",     required_argument, 0, 'b'},
+    {"latency",  no_argument,       0, 't'},
+    {"trace",    no_argument,       0, 'T'},
+    {"release-audio", no_argument,  0, 'R'},
     {0, 0, 0, 0}
   };
-  char *short_options = "hvrswd::i:o:m:l:c:";
+  char *short_options = "hvrswtTRd::i:o:m:l:c:b:";
   int option_index = 0;
   int c;
 
@@ -191,6 +196,15 @@ Options:\n\
   -s, --sleep             Put ISDN thread to sleep (to be able to remove CAPI\n\
                             modules before suspending the computer).\n\
   -w, --wakeup            Restart ISDN thread after sleep.\n\
+  -t, --latency           Print latency histograms of current or last call.\n\
+  -T, --trace             Write a media trace of each call for ant-replay.\n\
+  -R, --release-audio     Release sound devices kept open in standby.\n\
+  -b, --isdn=BACKEND[:OPTIONS]\n\
+                          ISDN backend: capi or loopback (simulated calls\n\
+                            without ISDN hardware), loopback options:\n\
+                            answer=MS,ring=SEC,hangup=SEC,jitter=MS,\n\
+                            skew=PPM,caller=NUMBER\n\
+                            default: capi\n\
 \n\
 Note: If arguments of --soundin and --soundout are equal, a full duplex\n\
       sound device is needed.\n"), argv[0]);
@@ -249,6 +263,28 @@ Note: If arguments of --soundin and --soundout are equal, a full duplex\n\
       }
       exit(0);
       break;
+    case 't':
+      if (client_query(LOCAL_MSG_LATENCY, stdout)) {
+	printf("\nAn error occured while calling a running " PACKAGE ".\n");
+      }
+      exit(0);
+      break;
+    case 'R':
+      printf(_("Releasing sound devices... "));
+      if (client_make_call(LOCAL_MSG_RELEASE, "")) {
+	printf("\nAn error occured while calling a running " PACKAGE ".\n");
+      } else {
+	printf(_("successful.\n"));
+      }
+      exit(0);
+      break;
+    case 'T': /* media trace of calls */
+      session.option_trace = 1;
+      break;
+    case 'b': /* ISDN backend */
+      if (isdn_set_backend(optarg) < 0)
+	exit(1);
+      break;
     case '?':
       exit(1);
     }
@@ -256,6 +292,10 @@ Note: If arguments of --soundin and --soundout are equal, a full duplex\n\
   /* no further arguments expected, so not handled */
  
   output_codeset_set("UTF-8"); /* GTK needs UTF-8 strings */
+
+  /* from now on, messages are printed by the logger thread */
+  if (!logger_init())
+    atexit(logger_deinit);
   
   if (session_init(&session, audio_device_name_in, audio_device_name_out,
 		   msn, msns))
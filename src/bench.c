@@ -0,0 +1,545 @@
+/*
+ * Micro-benchmarks of the media hot paths (make bench)
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "config.h"
+
+/* GNU headers */
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+  #include <stdlib.h>
+#endif
+#ifdef HAVE_UNISTD_H
+  #include <unistd.h>
+#endif
+#include <string.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  #include <linux/perf_event.h>
+#endif
+
+/* libsndfile */
+#include <sndfile.h>
+
+/* own header files */
+#include "globals.h"
+#include "session.h"
+#include "mediation.h"
+#include "fxgenerator.h"
+#include "recording.h"
+#include "g711.h"
+#include "mixer.h"
+#include "mediaclock.h"
+
+/*!
+ * @brief Minimum measurement time per benchmark (ns).
+ */
+#define BENCH_TIME 200000000ULL
+
+/*!
+ * @brief Samples of ISDN data processed per call (one CAPI block).
+ */
+#define BENCH_BLOCK ISDN_FRAGMENT_SIZE
+
+/*!
+ * @brief Benchmark function.
+ *
+ * @param arg benchmark specific argument.
+ * @param iterations number of iterations to run.
+ */
+typedef void (*bench_fnc_t)(void *arg, unsigned long iterations);
+
+/*!
+ * @brief Hardware counters, -1 if not available.
+ */
+typedef struct {
+  int cache_misses;         /*!< perf event fd for cache misses */
+  int cycles;               /*!< perf event fd for CPU cycles */
+} bench_counters_t;
+
+static bench_counters_t counters = { -1, -1 };
+
+static session_t bench_session;
+
+static unsigned char isdn_buf[BENCH_BLOCK];
+static unsigned char audio_buf[BENCH_BLOCK * 6 * 2 + 16];
+static short rec_buf[BENCH_BLOCK * 6 + 16];
+static short pcm_buf[BENCH_BLOCK];
+
+/*!
+ * @brief Sink for results, prevents optimizing benchmarks away.
+ */
+static volatile int bench_sink;
+
+/*--------------------------------------------------------------------------*/
+
+static uint64_t bench_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*--------------------------------------------------------------------------*/
+
+#if defined(HAVE_LINUX_PERF_EVENT_H) && defined(__NR_perf_event_open)
+/*!
+ * @brief Open a hardware counter for this process.
+ *
+ * @param config PERF_COUNT_HW_* event.
+ * @return file descriptor, -1 if not available.
+ */
+static int bench_counter_open(unsigned long long config)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Open hardware counters, if the kernel allows it.
+ */
+static void bench_counters_init(void)
+{
+#if defined(HAVE_LINUX_PERF_EVENT_H) && defined(__NR_perf_event_open)
+  counters.cache_misses = bench_counter_open(PERF_COUNT_HW_CACHE_MISSES);
+  counters.cycles = bench_counter_open(PERF_COUNT_HW_CPU_CYCLES);
+#endif
+  if (counters.cache_misses < 0)
+    printf("Hardware counters not available (perf_event_open)\n");
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void bench_counter_start(int fd _U_)
+{
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+}
+
+/*--------------------------------------------------------------------------*/
+
+static long long bench_counter_stop(int fd _U_)
+{
+  long long value = -1;
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &value, sizeof(value)) != sizeof(value))
+      value = -1;
+  }
+#endif
+  return value;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Run and report one benchmark.
+ *
+ * The iteration count is doubled until the run takes at least BENCH_TIME.
+ *
+ * @param name benchmark name.
+ * @param fnc benchmark function.
+ * @param arg argument to fnc.
+ * @param samples samples processed per iteration.
+ */
+static void bench_run(const char *name, bench_fnc_t fnc, void *arg,
+                      unsigned int samples)
+{
+  unsigned long iterations = 1;
+  uint64_t start, elapsed;
+  long long misses, cycles;
+  double total;
+
+  fnc(arg, 1); /* warm up caches and LUTs */
+
+  for (;;) {
+    bench_counter_start(counters.cache_misses);
+    bench_counter_start(counters.cycles);
+    start = bench_ns();
+    fnc(arg, iterations);
+    elapsed = bench_ns() - start;
+    misses = bench_counter_stop(counters.cache_misses);
+    cycles = bench_counter_stop(counters.cycles);
+    if (elapsed >= BENCH_TIME)
+      break;
+    iterations *= 2;
+  }
+
+  total = (double) iterations * samples;
+  printf("%-36s %9.2f ns/sample %9.2f Msamples/s", name,
+         elapsed / total, total * 1000.0 / elapsed);
+  if (cycles >= 0)
+    printf(" %7.2f cycles/sample", cycles / total);
+  if (misses >= 0)
+    printf(" %8.3f misses/ksample", misses * 1000.0 / total);
+  printf("\n");
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Set up session conversion tables for an audio format and rate.
+ *
+ * @param format ALSA format.
+ * @param speed audio sampling rate.
+ * @return 0 on success, -1 on error.
+ */
+static int bench_session_setup(int format, unsigned int speed)
+{
+  const mediation_LUT_t *lut;
+
+  if (!(lut = mediation_getLUT(format, format)))
+    return -1;
+  bench_session.audio_LUT_in = lut->LUT_in;
+  bench_session.audio_LUT_out = lut->LUT_out;
+  bench_session.audio_LUT_generate = lut->LUT_generate;
+  bench_session.audio_LUT_analyze = lut->LUT_analyze;
+  bench_session.audio_LUT_alaw2short = lut->LUT_alaw2short;
+
+  bench_session.audio_format_in = bench_session.audio_format_out = format;
+  bench_session.audio_speed_in = bench_session.audio_speed_out = speed;
+  bench_session.ratio_in = (double) speed / ISDN_SPEED;
+  bench_session.ratio_out = (double) ISDN_SPEED / speed;
+  bench_session.audio_sample_size_in = bench_session.audio_sample_size_out =
+    (format == SND_PCM_FORMAT_U8 || format == SND_PCM_FORMAT_S8 ||
+     format == SND_PCM_FORMAT_A_LAW || format == SND_PCM_FORMAT_MU_LAW) ? 1 : 2;
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void bench_isdn_to_audio(void *arg _U_, unsigned long iterations)
+{
+  unsigned int size;
+
+  while (iterations--)
+    convert_isdn_to_audio(&bench_session, isdn_buf, BENCH_BLOCK,
+                          audio_buf, &size, rec_buf, 1);
+  bench_sink = audio_buf[0];
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void bench_audio_to_isdn(void *arg _U_, unsigned long iterations)
+{
+  unsigned int size, audio_size;
+
+  audio_size = (unsigned int) (BENCH_BLOCK * bench_session.ratio_in) *
+               bench_session.audio_sample_size_in;
+
+  while (iterations--)
+    convert_audio_to_isdn(&bench_session, audio_buf, audio_size,
+                          isdn_buf, &size, rec_buf);
+  bench_sink = isdn_buf[0];
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void bench_fxgenerate(void *arg, unsigned long iterations)
+{
+  enum effect_t effect = (enum effect_t) (long) arg;
+  unsigned long pos = 0;
+  unsigned char x = 0;
+  int i;
+
+  while (iterations--)
+    for (i = 0; i < BENCH_BLOCK; ++i)
+      x ^= fxgenerate(&bench_session, effect, 5, pos++ / (double) ISDN_SPEED);
+  bench_sink = x;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void bench_recording(void *arg, unsigned long iterations)
+{
+  struct recorder_t *recorder = (struct recorder_t*) arg;
+  unsigned long i;
+
+  for (i = 0; i < iterations; ++i) {
+    recording_write(recorder, rec_buf, BENCH_BLOCK, RECORDING_LOCAL);
+    recording_write(recorder, rec_buf, BENCH_BLOCK, RECORDING_REMOTE);
+    if ((i & 15) == 15)
+      recording_flush(recorder, 0);
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void bench_linear2alaw(void *arg _U_, unsigned long iterations)
+{
+  unsigned char x = 0;
+  int i;
+
+  while (iterations--)
+    for (i = 0; i < BENCH_BLOCK; ++i)
+      x ^= linear2alaw(pcm_buf[i]);
+  bench_sink = x;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void bench_alaw2linear(void *arg _U_, unsigned long iterations)
+{
+  int x = 0;
+  int i;
+
+  while (iterations--)
+    for (i = 0; i < BENCH_BLOCK; ++i)
+      x ^= alaw2linear(isdn_buf[i]);
+  bench_sink = x;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void bench_linear2ulaw(void *arg _U_, unsigned long iterations)
+{
+  unsigned char x = 0;
+  int i;
+
+  while (iterations--)
+    for (i = 0; i < BENCH_BLOCK; ++i)
+      x ^= linear2ulaw(pcm_buf[i]);
+  bench_sink = x;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void bench_ulaw2linear(void *arg _U_, unsigned long iterations)
+{
+  int x = 0;
+  int i;
+
+  while (iterations--)
+    for (i = 0; i < BENCH_BLOCK; ++i)
+      x ^= ulaw2linear(isdn_buf[i]);
+  bench_sink = x;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void bench_alaw2ulaw(void *arg _U_, unsigned long iterations)
+{
+  unsigned char x = 0;
+  int i;
+
+  while (iterations--)
+    for (i = 0; i < BENCH_BLOCK; ++i)
+      x ^= alaw2ulaw(isdn_buf[i]) ^ ulaw2alaw(isdn_buf[i]);
+  bench_sink = x;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void bench_mixer(void *arg, unsigned long iterations)
+{
+  mixer_t *mixer = (mixer_t*) arg;
+  unsigned int p;
+
+  while (iterations--) {
+    for (p = 0; p < MIXER_MAX_PARTIES; ++p) {
+      if (mixer_party_active(mixer, p))
+        mixer_put(mixer, p, isdn_buf, MIXER_BLOCK);
+    }
+    mixer_mix(mixer);
+  }
+  bench_sink = mixer->out[MIXER_LOCAL][0];
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void bench_makeLUT(void *arg, unsigned long iterations)
+{
+  int format = (int) (long) arg;
+  unsigned char *in, *out, *generate, *analyze;
+  short *alaw2short;
+
+  while (iterations--) {
+    if (mediation_makeLUT(format, &in, format, &out,
+                          &generate, &analyze, &alaw2short))
+      return;
+    bench_sink = out[0];
+    free(in);
+    free(out);
+    free(generate);
+    free(analyze);
+    free(alaw2short);
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void bench_getLUT(void *arg, unsigned long iterations)
+{
+  int format = (int) (long) arg;
+  const mediation_LUT_t *lut;
+
+  while (iterations--) {
+    if (!(lut = mediation_getLUT(format, format)))
+      return;
+    bench_sink = lut->LUT_out[0];
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+int main(void)
+{
+  static const struct {
+    int format;
+    const char *name;
+  } formats[] = {
+    { SND_PCM_FORMAT_S16_LE, "S16_LE" },
+    { SND_PCM_FORMAT_S16_BE, "S16_BE" },
+    { SND_PCM_FORMAT_U16_LE, "U16_LE" },
+    { SND_PCM_FORMAT_U16_BE, "U16_BE" },
+    { SND_PCM_FORMAT_U8,     "U8" },
+    { SND_PCM_FORMAT_S8,     "S8" },
+    { SND_PCM_FORMAT_A_LAW,  "A_LAW" },
+    { SND_PCM_FORMAT_MU_LAW, "MU_LAW" }
+  };
+  static const unsigned int speeds[] = { 8000, 16000, 44100, 48000 };
+  static const struct {
+    enum effect_t effect;
+    const char *name;
+  } effects[] = {
+    { EFFECT_RING,      "ring" },
+    { EFFECT_RINGING,   "ringing" },
+    { EFFECT_TEST,      "test" },
+    { EFFECT_TOUCHTONE, "touchtone" },
+    { EFFECT_EMPTY,     "empty" }
+  };
+  static const unsigned int parties[] = { 3, MIXER_MAX_PARTIES };
+  struct recorder_t *recorder;
+  mixer_t *mixer;
+  SF_INFO sfinfo;
+  char name[64];
+  char filename[] = "/tmp/ant-bench-XXXXXX";
+  unsigned int f, s, i;
+  int fd;
+
+  for (i = 0; i < BENCH_BLOCK; ++i) {
+    isdn_buf[i] = (unsigned char) (i * 37);
+    pcm_buf[i] = (short) (i * 331 - 20000);
+  }
+
+  bench_counters_init();
+
+  printf("Block size %d samples, %.1f s minimum per benchmark\n\n",
+         BENCH_BLOCK, BENCH_TIME / 1e9);
+
+  /* conversions for every format and ratio */
+  for (f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+    for (s = 0; s < sizeof(speeds) / sizeof(speeds[0]); ++s) {
+      if (bench_session_setup(formats[f].format, speeds[s]) < 0)
+        return 1;
+      memset(audio_buf, 0x55, sizeof(audio_buf));
+      snprintf(name, sizeof(name), "isdn_to_audio %s %u",
+               formats[f].name, speeds[s]);
+      bench_run(name, bench_isdn_to_audio, NULL, BENCH_BLOCK);
+      snprintf(name, sizeof(name), "audio_to_isdn %s %u",
+               formats[f].name, speeds[s]);
+      bench_run(name, bench_audio_to_isdn, NULL, BENCH_BLOCK);
+    }
+  }
+  printf("\n");
+
+  /* effects */
+  bench_session_setup(SND_PCM_FORMAT_S16_LE, ISDN_SPEED);
+  for (i = 0; i < sizeof(effects) / sizeof(effects[0]); ++i) {
+    snprintf(name, sizeof(name), "fxgenerate %s", effects[i].name);
+    bench_run(name, bench_fxgenerate, (void*) (long) effects[i].effect,
+              BENCH_BLOCK);
+  }
+  printf("\n");
+
+  /* recording to a temporary file */
+  recorder = (struct recorder_t*) malloc(sizeof(struct recorder_t));
+  fd = mkstemp(filename);
+  if (recorder && fd >= 0) {
+    recording_init(recorder);
+    memset(&sfinfo, 0, sizeof(sfinfo));
+    sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+    sfinfo.channels = 2;
+    sfinfo.samplerate = ISDN_SPEED;
+    recorder->sf = sf_open_fd(fd, SFM_WRITE, &sfinfo, 1);
+    if (recorder->sf) {
+      recorder->start_time = media_time_coarse();
+      bench_run("recording_write+flush", bench_recording, recorder,
+                2 * BENCH_BLOCK);
+      recording_flush(recorder, 1);
+      sf_close(recorder->sf);
+    }
+    unlink(filename);
+  }
+  free(recorder);
+  printf("\n");
+
+  /* G.711 */
+  bench_run("linear2alaw", bench_linear2alaw, NULL, BENCH_BLOCK);
+  bench_run("alaw2linear", bench_alaw2linear, NULL, BENCH_BLOCK);
+  bench_run("linear2ulaw", bench_linear2ulaw, NULL, BENCH_BLOCK);
+  bench_run("ulaw2linear", bench_ulaw2linear, NULL, BENCH_BLOCK);
+  bench_run("alaw2ulaw+ulaw2alaw", bench_alaw2ulaw, NULL, BENCH_BLOCK);
+  printf("\n");
+
+  /* conference mixing, "sample" is one sample to every party */
+  mixer = (mixer_t*) malloc(sizeof(mixer_t));
+  if (mixer && mixer_init(mixer) == 0) {
+    for (i = 0; i < sizeof(parties) / sizeof(parties[0]); ++i) {
+      for (s = 0; s < MIXER_MAX_PARTIES; ++s)
+        mixer_set_party(mixer, s, s < parties[i]);
+      snprintf(name, sizeof(name), "mixer_mix %u parties", parties[i]);
+      bench_run(name, bench_mixer, mixer, MIXER_BLOCK);
+    }
+    mixer_free(mixer);
+  }
+  free(mixer);
+  printf("\n");
+
+  /* look-up table construction, "sample" is one table set */
+  for (f = 0; f < sizeof(formats) / sizeof(formats[0]); ++f) {
+    snprintf(name, sizeof(name), "mediation_makeLUT %s", formats[f].name);
+    bench_run(name, bench_makeLUT, (void*) (long) formats[f].format, 1);
+    snprintf(name, sizeof(name), "mediation_getLUT %s", formats[f].name);
+    bench_run(name, bench_getLUT, (void*) (long) formats[f].format, 1);
+  }
+
+  mediation_freeLUTs();
+  return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Preallocated pool of data buffers
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#ifdef HAVE_STDLIB_H
+  #include <stdlib.h>
+#endif
+
+#include "bufpool.h"
+#include "globals.h"
+
+/*--------------------------------------------------------------------------*/
+
+int bufpool_init(bufpool_t *pool, unsigned int count, unsigned int buffer_size)
+{
+  unsigned int i;
+
+  memset(pool, 0, sizeof(bufpool_t));
+
+  /* keep buffers aligned for any sample type */
+  buffer_size = (buffer_size + 15) & ~15U;
+
+  pool->buffers = (buffer_t*) calloc(count, sizeof(buffer_t));
+  pool->memory = (unsigned char*) malloc(count * buffer_size);
+  pool->lock = g_mutex_new();
+  if (!pool->buffers || !pool->memory || !pool->lock) {
+    errprintf("BUFPOOL: Cannot allocate %u buffers of %u bytes\n",
+              count, buffer_size);
+    bufpool_free(pool);
+    return -1;
+  }
+
+  pool->count = count;
+  pool->buffer_size = buffer_size;
+  for (i = 0; i < count; ++i) {
+    pool->buffers[i].data = pool->memory + i * buffer_size;
+    pool->buffers[i].size = buffer_size;
+    pool->buffers[i].pool = pool;
+    pool->buffers[i].next = pool->free_list;
+    pool->free_list = &pool->buffers[i];
+  }
+  pool->free_count = count;
+
+  dbgprintf(2, "BUFPOOL: Allocated %u buffers of %u bytes\n",
+            count, buffer_size);
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void bufpool_free(bufpool_t *pool)
+{
+  if (pool->count && pool->free_count != pool->count) {
+    errprintf("BUFPOOL: %u buffers still in use at free\n",
+              pool->count - pool->free_count);
+  }
+  if (pool->exhausted) {
+    dbgprintf(1, "BUFPOOL: Pool was exhausted %lu times\n", pool->exhausted);
+  }
+
+  free(pool->buffers);
+  free(pool->memory);
+  if (pool->lock)
+    g_mutex_free(pool->lock);
+  memset(pool, 0, sizeof(bufpool_t));
+}
+
+/*--------------------------------------------------------------------------*/
+
+buffer_t *bufpool_get(bufpool_t *pool)
+{
+  buffer_t *buffer;
+
+  if (!pool->lock)
+    return NULL;
+
+  g_mutex_lock(pool->lock);
+  buffer = pool->free_list;
+  if (buffer) {
+    pool->free_list = buffer->next;
+    pool->free_count--;
+  } else {
+    pool->exhausted++;
+  }
+  g_mutex_unlock(pool->lock);
+
+  if (buffer) {
+    buffer->next = NULL;
+    buffer->length = 0;
+  }
+  return buffer;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void bufpool_put(buffer_t *buffer)
+{
+  bufpool_t *pool;
+
+  if (!buffer)
+    return;
+
+  pool = buffer->pool;
+  g_mutex_lock(pool->lock);
+  buffer->next = pool->free_list;
+  pool->free_list = buffer;
+  pool->free_count++;
+  g_mutex_unlock(pool->lock);
+}
+
+/*--------------------------------------------------------------------------*/
@@ -0,0 +1,100 @@
+/*
+ * Preallocated pool of data buffers
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ANT_BUFPOOL_H
+#define _ANT_BUFPOOL_H
+
+#include <stdint.h>
+
+/* GTK */
+#include <gtk/gtk.h>
+
+struct bufpool_t;
+
+/*!
+ * @brief Data buffer (fragment) from a buffer pool.
+ *
+ * A buffer is handed between pipeline stages by pointer and has one
+ * owner at a time, the last one returns it with bufpool_put().
+ */
+typedef struct buffer_t {
+  unsigned char *data;        /*!< buffer memory */
+  unsigned int size;          /*!< capacity in bytes */
+  unsigned int length;        /*!< bytes used */
+  uint64_t timestamp;         /*!< time data was received (us), for
+                                   latency statistics */
+  struct bufpool_t *pool;     /*!< owning pool */
+  struct buffer_t *next;      /*!< next free buffer (free list) */
+} buffer_t;
+
+/*!
+ * @brief Buffer pool, all memory is allocated once in bufpool_init().
+ */
+typedef struct bufpool_t {
+  buffer_t *buffers;          /*!< buffer descriptors */
+  unsigned char *memory;      /*!< memory of all buffers */
+  unsigned int count;         /*!< number of buffers */
+  unsigned int buffer_size;   /*!< size of each buffer in bytes */
+  buffer_t *free_list;        /*!< list of free buffers */
+  unsigned int free_count;    /*!< number of free buffers */
+  unsigned long exhausted;    /*!< how often bufpool_get() failed */
+  GMutex *lock;               /*!< lock protecting the free list */
+} bufpool_t;
+
+/*!
+ * @brief Allocate buffer pool (constructor).
+ *
+ * @param pool pool to initialize.
+ * @param count number of buffers.
+ * @param buffer_size size of each buffer in bytes.
+ * @return 0 on success, -1 on error.
+ */
+int bufpool_init(bufpool_t *pool, unsigned int count, unsigned int buffer_size);
+
+/*!
+ * @brief Free buffer pool memory (destructor).
+ *
+ * @note All buffers must have been returned to the pool.
+ *
+ * @param pool pool to free.
+ */
+void bufpool_free(bufpool_t *pool);
+
+/*!
+ * @brief Get a free buffer from the pool.
+ *
+ * Never allocates memory, may be called from any thread.
+ *
+ * @param pool pool.
+ * @return buffer with length 0, NULL if exhausted.
+ */
+buffer_t *bufpool_get(bufpool_t *pool);
+
+/*!
+ * @brief Return a buffer to its pool.
+ *
+ * May be called from any thread.
+ *
+ * @param buffer buffer (may be NULL).
+ */
+void bufpool_put(buffer_t *buffer);
+
+#endif /* _ANT_BUFPOOL_H */
@@ -0,0 +1,157 @@
+/*
+ * Table of the calls of a session
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#ifdef HAVE_STDLIB_H
+  #include <stdlib.h>
+#endif
+
+#include "globals.h"
+#include "call.h"
+
+/*--------------------------------------------------------------------------*/
+
+int call_table_init(call_table_t *table)
+{
+  unsigned int i;
+
+  memset(table, 0, sizeof(call_table_t));
+  for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+    latency_reset(&table->call[i].latency);
+    if (!(table->call[i].recorder =
+          (struct recorder_t *) malloc(sizeof(struct recorder_t))) ||
+        recording_init(table->call[i].recorder) < 0) {
+      errprintf("CALL: Cannot allocate recorder\n");
+      call_table_deinit(table);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void call_table_deinit(call_table_t *table)
+{
+  unsigned int i;
+
+  for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+    call_free(&table->call[i]);
+    free(table->call[i].recorder);
+    table->call[i].recorder = NULL;
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+call_t *call_get(call_table_t *table, unsigned int id)
+{
+  return id < ISDN_MAX_CALLS ? &table->call[id] : NULL;
+}
+
+/*--------------------------------------------------------------------------*/
+
+unsigned int call_id(call_table_t *table, call_t *call)
+{
+  return (unsigned int) (call - table->call);
+}
+
+/*--------------------------------------------------------------------------*/
+
+call_t *call_find(call_table_t *table, enum call_state_t state,
+                  call_t *exclude)
+{
+  call_t *result = NULL;
+  unsigned int i;
+
+  for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+    if (table->call[i].state == state && &table->call[i] != exclude &&
+        (!result || table->call[i].serial > result->serial))
+      result = &table->call[i];
+  }
+  return result;
+}
+
+/*--------------------------------------------------------------------------*/
+
+unsigned int call_count(call_table_t *table)
+{
+  unsigned int i, count = 0;
+
+  for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+    if (table->call[i].state != CALL_FREE)
+      count++;
+  }
+  return count;
+}
+
+/*--------------------------------------------------------------------------*/
+
+call_t *call_open(call_table_t *table, unsigned int id,
+                  enum call_state_t state, const char *from, const char *to)
+{
+  call_t *call = call_get(table, id);
+
+  if (!call)
+    return NULL;
+
+  call_free(call);
+  call->from = strdup(from);
+  call->to = strdup(to);
+  call->hangup_reason = NULL;
+  call->vcon_time = 0;
+  call->cid_row = NULL;
+  call->conference = 0;
+  call_set_state(table, call, state);
+  return call;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void call_set_state(call_table_t *table, call_t *call,
+                    enum call_state_t state)
+{
+  call->state = state;
+  call->serial = ++table->serial;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void call_set_from(call_t *call, const char *from)
+{
+  char *old = call->from;
+
+  call->from = strdup(from);
+  free(old);
+}
+
+/*--------------------------------------------------------------------------*/
+
+void call_free(call_t *call)
+{
+  free(call->from);
+  free(call->to);
+  call->from = NULL;
+  call->to = NULL;
+  call->state = CALL_FREE;
+}
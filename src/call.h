@@ -0,0 +1,166 @@
+/*
+ * Table of the calls of a session
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ANT_CALL_H
+#define _ANT_CALL_H
+
+#include <time.h>
+
+/* GTK */
+#include <gtk/gtk.h>
+
+#include "recording.h"
+#include "latency.h"
+#include "isdn.h"
+
+/*!
+ * @brief Call states (seen from the session).
+ */
+enum call_state_t {
+  CALL_FREE,        /*!< slot unused */
+  CALL_RINGING,     /*!< incoming call, not answered yet */
+  CALL_DIALING,     /*!< outgoing call, not connected yet */
+  CALL_ACTIVE,      /*!< connected, audio is routed to this call (in a
+                         conference, to several calls) */
+  CALL_HELD         /*!< connected, on hold (no audio) */
+};
+
+/*!
+ * @brief One call of a session.
+ *
+ * Everything which belongs to a single connection: numbers, caller id
+ * line, recorder and latency statistics. The audio devices and the engine
+ * are shared, only one call at a time is connected to them (or all
+ * members of a conference, through the mixer).
+ */
+typedef struct {
+  enum call_state_t state;            /*!< state of the call */
+  unsigned int serial;                /*!< last change of state, the most
+                                         recent call has the highest */
+  char *from;                         /*!< caller's number */
+  char *to;                           /*!< callee's number */
+  char *hangup_reason;                /*!< reason for hangup */
+  time_t vcon_time;                   /*!< start of conversation, 0 before */
+  gpointer cid_row;                   /*!< row data of the caller id line */
+  struct recorder_t *recorder;        /*!< recorder of this call */
+  latency_t latency;                  /*!< latency histograms of this call */
+  int conference;                     /*!< member of the conference */
+} call_t;
+
+/*!
+ * @brief Call table, indexed by ISDN call number.
+ */
+typedef struct {
+  call_t call[ISDN_MAX_CALLS];        /*!< calls */
+  unsigned int serial;                /*!< last serial given out */
+} call_table_t;
+
+/*!
+ * @brief Initialize call table, all calls free.
+ *
+ * @param table call table.
+ * @return 0 on success, -1 otherwise.
+ */
+int call_table_init(call_table_t *table);
+
+/*!
+ * @brief Free call table.
+ *
+ * @param table call table.
+ */
+void call_table_deinit(call_table_t *table);
+
+/*!
+ * @brief Get call by ISDN call number.
+ *
+ * @param table call table.
+ * @param id ISDN call number.
+ * @return call, NULL if id is out of range.
+ */
+call_t *call_get(call_table_t *table, unsigned int id);
+
+/*!
+ * @brief Get ISDN call number of a call.
+ *
+ * @param table call table.
+ * @param call call in table.
+ * @return ISDN call number.
+ */
+unsigned int call_id(call_table_t *table, call_t *call);
+
+/*!
+ * @brief Find the most recent call in a state.
+ *
+ * @param table call table.
+ * @param state state to look for.
+ * @param exclude call to skip (may be NULL).
+ * @return call, NULL if there is none.
+ */
+call_t *call_find(call_table_t *table, enum call_state_t state,
+                  call_t *exclude);
+
+/*!
+ * @brief Count calls in use.
+ *
+ * @param table call table.
+ * @return number of calls which are not free.
+ */
+unsigned int call_count(call_table_t *table);
+
+/*!
+ * @brief Take a call into use.
+ *
+ * @param table call table.
+ * @param id ISDN call number.
+ * @param state initial state.
+ * @param from caller's number.
+ * @param to callee's number.
+ * @return call, NULL if id is out of range.
+ */
+call_t *call_open(call_table_t *table, unsigned int id,
+                  enum call_state_t state, const char *from, const char *to);
+
+/*!
+ * @brief Set state of a call, making it the most recent one.
+ *
+ * @param table call table.
+ * @param call call.
+ * @param state new state.
+ */
+void call_set_state(call_table_t *table, call_t *call,
+                    enum call_state_t state);
+
+/*!
+ * @brief Replace caller's number.
+ *
+ * @param call call.
+ * @param from new number.
+ */
+void call_set_from(call_t *call, const char *from);
+
+/*!
+ * @brief Release a call (recorder must be closed already).
+ *
+ * @param call call.
+ */
+void call_free(call_t *call);
+
+#endif /* _ANT_CALL_H */
@@ -564,20 +564,23 @@ static char *cid_timestring(time_t t) {
 }
 
 /*
- * insert new entry at end of list
+ * insert new entry at end of list, dated now
  *
  * from == NULL, if still unknown
+ *
+ * returns the row data identifying the new row (see cid_row_find())
  */
-void cid_add_line(session_t *session,
-		  enum call_type_t ct, gchar *from, gchar *to) {
+gpointer cid_add_line(session_t *session,
+		      enum call_type_t ct, gchar *from, gchar *to) {
   gchar *line[CID_COL_NUMBER];
   char *typestring;
+  gpointer rowdata;
 
   GdkPixmap *pixmap;
   GdkBitmap *bitmap;
  
   /* First: date */
-  line[CID_COL_TIME] = cid_timestring(session->ring_time);
+  line[CID_COL_TIME] = cid_timestring(time(NULL));
 
   line[CID_COL_FLAGS] = "";
   line[CID_COL_TYPE] = ""; /* call type */
@@ -592,9 +595,10 @@ void cid_add_line(session_t *session,
 
   /* create line */
   session->cid_num = gtk_clist_append(GTK_CLIST(session->cid_list), line) + 1;
+  rowdata = cid_row_new();
   gtk_clist_set_row_data_full(GTK_CLIST(session->cid_list),
                               session->cid_num - 1,
-			      cid_row_new(), cid_row_destroy);
+			      rowdata, cid_row_destroy);
 
   cid_normalize(session);
 
@@ -615,44 +619,62 @@ void cid_add_line(session_t *session,
 
   /* clean up */
   free(line[CID_COL_TIME]);
+
+  return rowdata;
+}
+
+/*
+ * find row by row data returned from cid_add_line()
+ *
+ * returns -1 if the row is gone (deleted or normalized away)
+ */
+int cid_row_find(session_t *session, gpointer rowdata) {
+  if (!rowdata)
+    return -1;
+  return gtk_clist_find_row_from_data(GTK_CLIST(session->cid_list), rowdata);
 }
 
 /*
- * set "date" field in last line
+ * set "date" field in row
  */
-void cid_set_date(session_t *session, time_t date) {
-  if (date) {
+void cid_set_date(session_t *session, int row, time_t date) {
+  if (date && row >= 0) {
     char *temp;
     gtk_clist_set_text(GTK_CLIST(session->cid_list),
-	               session->cid_num - 1, CID_COL_TIME,
+	               row, CID_COL_TIME,
 		       temp = cid_timestring(date));
     free(temp);
   }
 }
 
 /*
- * set "from" field in last line
+ * set "from" field in row
  */
-void cid_set_from(session_t *session, gchar *from) {
-  if (from)
+void cid_set_from(session_t *session, int row, gchar *from) {
+  if (from && row >= 0)
     gtk_clist_set_text(GTK_CLIST(session->cid_list),
-		       session->cid_num - 1, CID_COL_FROM, from);
+		       row, CID_COL_FROM, from);
 }
 
 /*
- * complete last line with "duration"
+ * complete row with "duration"
  *
- * if message == NULL, current time will be used to calculate a duration
+ * if message == NULL, time since start will be displayed as duration
  * if message != NULL, this string will be displayed in the Duration field (#4)
  */
-void cid_set_duration(session_t *session, gchar *message) {
-  char *buf = timediff_str(time(NULL), session->vcon_time);
-  
+void cid_set_duration(session_t *session, int row, time_t start,
+                      gchar *message) {
+  char *buf;
+
+  if (row < 0)
+    return;
+
+  buf = timediff_str(time(NULL), start);
   if (message)
-    gtk_clist_set_text(GTK_CLIST(session->cid_list), session->cid_num - 1,
+    gtk_clist_set_text(GTK_CLIST(session->cid_list), row,
 	               CID_COL_DURATION, message);
   else
-    gtk_clist_set_text(GTK_CLIST(session->cid_list), session->cid_num - 1,
+    gtk_clist_set_text(GTK_CLIST(session->cid_list), row,
 	               CID_COL_DURATION, buf);
   free(buf);
 }
@@ -940,6 +962,8 @@ char* cid_get_record_filename(session_t* session, int row) {
 void cid_row_mark_record(session_t* session, int row) {
   char* fn;
   
+  if (row < 0)
+    return;
   if ((fn = cid_get_record_filename(session, row))) {
     gtk_clist_set_pixmap(GTK_CLIST(session->cid_list), row, CID_COL_FLAGS,
         session->symbol_record_pixmap, session->symbol_record_bitmap);
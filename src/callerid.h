@@ -56,11 +56,13 @@ struct cid_row_t {
 
 void cid_toggle_cb(GtkWidget *widget, gpointer data, guint action);
 GtkWidget *cid_new(session_t *session);
-void cid_add_line(session_t *session,
-		  enum call_type_t ct, gchar *from, gchar *to);
-void cid_set_date(session_t *session, time_t date);
-void cid_set_from(session_t *session, gchar *from);
-void cid_set_duration(session_t *session, gchar *message);
+gpointer cid_add_line(session_t *session,
+		      enum call_type_t ct, gchar *from, gchar *to);
+int cid_row_find(session_t *session, gpointer rowdata);
+void cid_set_date(session_t *session, int row, time_t date);
+void cid_set_from(session_t *session, int row, gchar *from);
+void cid_set_duration(session_t *session, int row, time_t start,
+                      gchar *message);
 void cid_jump_to_end(session_t *session);
 void cid_normalize(session_t *session);
 void cid_add_saved_line(session_t *session, char *date, char *type,
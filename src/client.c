@@ -38,17 +38,14 @@
 #include "util.h"
 
 /*
- * (try to) connect to server and issue call command
+ * connect to server
  *
- * returns 0 on success, -1 otherwise
+ * returns socket on success, -1 otherwise
  */
-int client_make_call(char message, char *number) {
+static int client_connect(void) {
   int sock;
   struct sockaddr_un local_name;
-  size_t size;
   char *filename;
-  int bytes;
-  char *msg;
 
   sock = socket(PF_LOCAL, SOCK_STREAM, 0);
   if (sock < 0) {
@@ -60,25 +57,73 @@ int client_make_call(char message, char *number) {
 
   local_name.sun_family = AF_LOCAL;
   strncpy(local_name.sun_path, filename, sizeof(local_name.sun_path));
-  size = SUN_LEN(&local_name);
+  free(filename);
 
   if (connect(sock, (struct sockaddr *) &local_name, sizeof(local_name)) < 0) {
     perror("client: local connect()");
+    close(sock);
     return -1;
   }
+
+  return sock;
+}
+
+/*
+ * (try to) connect to server and issue call command
+ *
+ * returns 0 on success, -1 otherwise
+ */
+int client_make_call(char message, char *number) {
+  int sock;
+  int bytes;
+  char *msg;
+
+  if ((sock = client_connect()) < 0)
+    return -1;
   
   if (asprintf(&msg, "%c%s", message, number) < 0) {
     errprintf("asprintf error");
+    close(sock);
     return -1;
   }
   bytes = write(sock, msg, 1 + strlen(number) + 1);
+  free(msg);
   if (bytes < 0) {
     perror("socket write");
+    close(sock);
     return -1;
   }
-  free(msg);
 
   close(sock);
-  free(filename);
   return 0;
 }
+
+/*
+ * issue command and copy the reply of the server to file
+ *
+ * returns 0 on success, -1 otherwise
+ */
+int client_query(char message, FILE *file) {
+  int sock;
+  int bytes;
+  char buffer[SERVER_INBUF_SIZE];
+
+  if ((sock = client_connect()) < 0)
+    return -1;
+
+  buffer[0] = message;
+  buffer[1] = '\0';
+  if (write(sock, buffer, 2) < 0) {
+    perror("socket write");
+    close(sock);
+    return -1;
+  }
+
+  while ((bytes = read(sock, buffer, sizeof(buffer))) > 0)
+    fwrite(buffer, 1, bytes, file);
+  if (bytes < 0)
+    perror("socket read");
+
+  close(sock);
+  return bytes < 0 ? -1 : 0;
+}
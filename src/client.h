@@ -22,4 +22,7 @@
  *
  */
 
+#include <stdio.h>
+
 int client_make_call(char message, char *number);
+int client_query(char message, FILE *file);
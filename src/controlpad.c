@@ -181,6 +181,7 @@ static void controlpad_button_cb(GtkWidget *button, gpointer data) {
 
   switch (session->state) {
   case STATE_READY: /* manipulate dial box */
+  case STATE_HOLD: /* consultation call */
     if ((*c >= '0' && *c <= '9') || *c == '*' || *c == '#') { /* new char */
       gtk_entry_append_text(GTK_ENTRY(GTK_COMBO(session->dial_number_box)
 				      ->entry), c);
@@ -221,7 +222,10 @@ static void controlpad_button_cb(GtkWidget *button, gpointer data) {
   case STATE_CONVERSATION: /* touchtones */
     if ((*c >= '0' && *c <= '9') || *c == '*' || *c == '#') { /* new tt */
 #define TOUCHTONE_LENGTH 0.1
-      session->touchtone_countdown_isdn = TOUCHTONE_LENGTH * ISDN_SPEED;
+      /* the controller sends the digit if it can, otherwise mix it in */
+      if (isdn_send_dtmf(&session->isdn,
+                         call_id(&session->calls, session->call), c) < 0)
+        session->touchtone_countdown_isdn = TOUCHTONE_LENGTH * ISDN_SPEED;
       session->touchtone_countdown_audio =
 	TOUCHTONE_LENGTH * session->audio_speed_out;
       session->touchtone_index = 
@@ -248,6 +252,21 @@ static void controlpad_mute_cb(GtkWidget *button, gpointer data) {
   }
 }
 
+/*
+ * called when conference button has been toggled
+ */
+static void controlpad_conference_cb(GtkWidget *button, gpointer data) {
+  session_t *session = (session_t *) data;
+  int active = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(button));
+
+  if (active != session->conference &&
+      session_set_conference(session, active) < 0) {
+    /* not possible now, show the real state */
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(button),
+                                 session->conference);
+  }
+}
+
 /*
  * called when record / local / remote checkbutton has been toggled
  */
@@ -271,7 +290,8 @@ static void controlpad_record_cb(GtkWidget *button, gpointer data) {
 
       if (session->state == STATE_CONVERSATION) {
         if (session_start_recording(session) == 0) {
-          cid_row_mark_record(session, session->cid_num - 1);
+          cid_row_mark_record(session, cid_row_find(session,
+                                                    session->call->cid_row));
         }
       }
     } else { /* don't record! */
@@ -324,6 +344,7 @@ GtkWidget *controlpad_new(session_t *session) {
   GtkWidget *table;
   GtkWidget *button;
 
+  GtkWidget *vbox;
   GtkWidget *recordframe;
   GtkWidget *recordbox;
   GtkWidget *record_checkbutton;
@@ -421,8 +442,12 @@ GtkWidget *controlpad_new(session_t *session) {
     gtk_table_set_col_spacing(GTK_TABLE(table), i, i < 2 ? 5 : 15);
   }
 
+  vbox = gtk_vbox_new(FALSE, 5);
+  gtk_box_pack_start(GTK_BOX(hbox), vbox, TRUE, FALSE, 5);
+  gtk_widget_show(vbox);
+
   recordframe = gtk_frame_new(_("Recording"));
-  gtk_box_pack_start(GTK_BOX(hbox), recordframe, TRUE, FALSE, 5);
+  gtk_box_pack_start(GTK_BOX(vbox), recordframe, TRUE, FALSE, 0);
   gtk_widget_show(recordframe);
 
   recordbox = gtk_table_new(2, 3, FALSE);
@@ -478,6 +503,18 @@ GtkWidget *controlpad_new(session_t *session) {
     gtk_widget_set_sensitive(record_checkbutton_remote, FALSE);
   }
 
+  /* sensitive only with calls to join, see session_update_buttons() */
+  button = gtk_toggle_button_new_with_label(_("Conference"));
+  gtk_tooltips_set_tip(tooltips, button,
+                       _("Talk to the held calls and the current call at once"),
+                       NULL);
+  gtk_box_pack_start(GTK_BOX(vbox), button, FALSE, FALSE, 0);
+  gtk_widget_set_sensitive(button, FALSE);
+  gtk_widget_show(button);
+  gtk_signal_connect(GTK_OBJECT(button), "toggled",
+                     GTK_SIGNAL_FUNC(controlpad_conference_cb), session);
+  session->conference_button = button;
+
   return frame;
 }
 
@@ -0,0 +1,1232 @@
+/*
+ * Audio engine: single event loop for capture, playback and effects
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "config.h"
+
+/* regular GNU system includes */
+#include <string.h>
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+  #include <stdlib.h>
+#endif
+#include <errno.h>
+#include <poll.h>
+#include <math.h>
+
+/* GTK */
+#include <gtk/gtk.h>
+
+/* libsndfile */
+#include <sndfile.h>
+
+/* own header files */
+#include "globals.h"
+#include "engine.h"
+#include "sound.h"
+#include "isdn.h"
+#include "mediation.h"
+#include "fxgenerator.h"
+#include "g711.h"
+#include "latency.h"
+#include "trace.h"
+#include "probes.h"
+#include "mixer.h"
+#include "mediaclock.h"
+
+/*!
+ * @brief Maximum number of poll descriptors (wake-up pipe and both PCMs).
+ */
+#define ENGINE_MAX_FDS 16
+
+/*!
+ * @brief Number of A-law samples converted at once.
+ */
+#define ENGINE_CHUNK 512
+
+/*!
+ * @brief Maximum length of one received ISDN data block (maxBDataLen).
+ */
+#define ENGINE_ISDN_BLOCK_SIZE (2 * ISDN_FRAGMENT_SIZE)
+
+/*!
+ * @brief Periods of silence queued for playback when capture and playback
+ * start together. This is the round trip delay through the devices.
+ */
+#define ENGINE_DUPLEX_PERIODS 2
+
+/*!
+ * @brief Working buffers of the engine thread (from session->audio_pool).
+ */
+typedef struct {
+  buffer_t *capture;              /*!< audio input buffer */
+  buffer_t *playback;             /*!< audio output buffer */
+  unsigned int playback_count;    /*!< frames in playback buffer */
+  unsigned int playback_ptr;      /*!< frames already written from playback buffer */
+  buffer_t *isdn;                 /*!< A-law data (captured or effect) */
+  buffer_t *rec;                  /*!< recording temporary (shorts) */
+  buffer_t *sndfile;              /*!< buffer for sound file samples */
+} engine_buffers_t;
+
+/*!
+ * @brief Recover from audio error.
+ *
+ * @param session session.
+ * @param audio PCM handle.
+ * @param err ALSA error code.
+ * @return 0 on success, ALSA error code on error.
+ */
+static int engine_pcm_recover(session_t *session, snd_pcm_t *audio, int err);
+
+/*!
+ * @brief Drop all ISDN data queued for playback (reader side).
+ *
+ * @param session session.
+ */
+static void engine_queue_discard(session_t *session);
+
+/*!
+ * @brief Get working buffers from session->audio_pool.
+ *
+ * @param session session.
+ * @param buf engine buffers to fill.
+ * @return 0 on success, -1 if the pool is exhausted.
+ */
+static int engine_buffers_get(session_t *session, engine_buffers_t *buf);
+
+/*!
+ * @brief Return working buffers to session->audio_pool.
+ *
+ * @param buf engine buffers.
+ */
+static void engine_buffers_put(engine_buffers_t *buf);
+
+/*!
+ * @brief Record result of a playback write in the call trace.
+ *
+ * @param session session.
+ * @param frames frames to write.
+ * @param result engine_pcm_writei() or engine_mmap_commit() result.
+ */
+static void engine_trace_write(session_t *session, int frames, int result);
+
+/*!
+ * @brief Write interleaved frames to playback, with either access mode.
+ *
+ * @param session session.
+ * @param data frames to write.
+ * @param frames number of frames.
+ * @return frames written or ALSA error code (like snd_pcm_writei()).
+ */
+static snd_pcm_sframes_t engine_pcm_writei(session_t *session,
+                                           unsigned char *data,
+                                           snd_pcm_uframes_t frames);
+
+/*!
+ * @brief Get a contiguous part of the device buffer (mmap access).
+ *
+ * The area must be passed to engine_mmap_commit() afterwards.
+ *
+ * @param pcm PCM handle.
+ * @param min minimum number of frames needed.
+ * @param max maximum number of frames wanted.
+ * @param framesize bytes per frame.
+ * @param data filled with the address of the first frame.
+ * @param offset filled with the offset for snd_pcm_mmap_commit().
+ * @return number of frames, 0 if less than min frames are available
+ *         contiguously (nothing to commit then), ALSA error code on error.
+ */
+static snd_pcm_sframes_t engine_mmap_begin(snd_pcm_t *pcm,
+                                           snd_pcm_uframes_t min,
+                                           snd_pcm_uframes_t max,
+                                           unsigned int framesize,
+                                           unsigned char **data,
+                                           snd_pcm_uframes_t *offset);
+
+/*!
+ * @brief Commit frames accessed after engine_mmap_begin(), starting
+ * playback once a period is queued.
+ *
+ * @param session session.
+ * @param pcm PCM handle.
+ * @param offset offset from engine_mmap_begin().
+ * @param frames frames read or written.
+ * @return frames committed or ALSA error code.
+ */
+static snd_pcm_sframes_t engine_mmap_commit(session_t *session,
+                                            snd_pcm_t *pcm,
+                                            snd_pcm_uframes_t offset,
+                                            snd_pcm_uframes_t frames);
+
+/*!
+ * @brief Make sure audio capture is running.
+ *
+ * @param session session.
+ * @return 0 on success, ALSA error code on error.
+ */
+static int engine_capture_start(session_t *session);
+
+/*!
+ * @brief Set the start threshold of playback.
+ *
+ * @param pcm playback PCM handle.
+ * @param frames threshold, 0 for never (start explicitly).
+ * @return 0 on success, ALSA error code on error.
+ */
+static int engine_start_threshold(snd_pcm_t *pcm, snd_pcm_uframes_t frames);
+
+/*!
+ * @brief Queue silence for playback.
+ *
+ * @param session session.
+ * @param buf engine buffers.
+ * @param frames number of frames.
+ * @return 0 on success, ALSA error code on error.
+ */
+static int engine_silence(session_t *session, engine_buffers_t *buf,
+                          snd_pcm_uframes_t frames);
+
+/*!
+ * @brief (Re)start capture and playback on the same period boundary.
+ *
+ * Both devices are prepared, ENGINE_DUPLEX_PERIODS of silence are queued
+ * for playback and both are started. Linked devices are started by the
+ * driver at once, otherwise playback is started first and padded by the
+ * time capture started later, measured from the trigger timestamps. The
+ * resulting round trip delay is stored in session->audio_duplex_delay.
+ *
+ * @param session session.
+ * @param buf engine buffers.
+ * @return 0 on success, ALSA error code on error.
+ */
+static int engine_duplex_start(session_t *session, engine_buffers_t *buf);
+
+/*!
+ * @brief Restart capture after an error, in conversation together with
+ * playback (see engine_duplex_start()).
+ *
+ * @param session session.
+ * @param buf engine buffers.
+ * @param mode audio state the engine runs in.
+ * @return 0 on success, ALSA error code on error.
+ */
+static int engine_capture_restart(session_t *session, engine_buffers_t *buf,
+                                  enum audio_t mode);
+
+/*!
+ * @brief Read all available captured audio and pass it on.
+ *
+ * In conversation, data is sent to ISDN, otherwise it is only converted
+ * to update line level check.
+ *
+ * @param session session.
+ * @param buf engine buffers.
+ * @param mode audio state the engine runs in.
+ * @return 0 on success, -1 on unrecoverable error.
+ */
+static int engine_capture(session_t *session, engine_buffers_t *buf,
+                          enum audio_t mode);
+
+/*!
+ * @brief Convert one block of ISDN data and write it to playback.
+ *
+ * @param session session.
+ * @param buf engine buffers.
+ * @param data bit-inverse A-law samples.
+ * @param length number of samples.
+ * @param received time the data arrived (media_time()).
+ */
+static void engine_playback_block(session_t *session, engine_buffers_t *buf,
+                                  unsigned char *data, unsigned int length,
+                                  uint64_t received);
+
+/*!
+ * @brief Write queued ISDN data to playback.
+ *
+ * @param session session.
+ * @param buf engine buffers.
+ */
+static void engine_playback_isdn(session_t *session, engine_buffers_t *buf);
+
+/*!
+ * @brief Mix captured audio with the conference and distribute the mix.
+ *
+ * Every mixed block goes to all conference calls and, as the mix of the
+ * remote parties, directly to playback.
+ *
+ * @param session session.
+ * @param buf engine buffers, buf->isdn holds the captured samples.
+ * @param length number of captured samples.
+ */
+static void engine_conference(session_t *session, engine_buffers_t *buf,
+                              unsigned int length);
+
+/*!
+ * @brief Generate next piece of the current effect as A-law to buf->isdn.
+ *
+ * @param session session.
+ * @param buf engine buffers.
+ * @param effectpos position within effect in frames (updated).
+ * @return number of samples generated, 0 at end of file, -1 on error.
+ */
+static int engine_effect_generate(session_t *session, engine_buffers_t *buf,
+                                  unsigned long *effectpos);
+
+/*!
+ * @brief Fill playback with the current effect as far as possible.
+ *
+ * @param session session.
+ * @param buf engine buffers.
+ * @param effectpos position within effect in frames (updated).
+ * @return 0 on success, 1 at end of effect, -1 on error.
+ */
+static int engine_playback_effect(session_t *session, engine_buffers_t *buf,
+                                  unsigned long *effectpos);
+
+/*!
+ * @brief Engine thread main function.
+ *
+ * @param data session.
+ */
+static gpointer engine_thread(gpointer data);
+
+/*--------------------------------------------------------------------------*/
+
+int engine_init(session_t *session)
+{
+  if (ringbuf_init(&session->isdn_rx,
+                   ENGINE_ISDN_QUEUE_LEN * sizeof(buffer_t*)) < 0)
+    return -1;
+
+  /* one more than the queue holds, for the block being filled */
+  if (bufpool_init(&session->isdn_pool, ENGINE_ISDN_QUEUE_LEN + 1,
+                   ENGINE_ISDN_BLOCK_SIZE) < 0) {
+    ringbuf_free(&session->isdn_rx);
+    return -1;
+  }
+
+  if (mixer_init(&session->mixer) < 0) {
+    bufpool_free(&session->isdn_pool);
+    ringbuf_free(&session->isdn_rx);
+    return -1;
+  }
+  session->conference = 0;
+
+  thread_init(&session->thread_audio);
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void engine_deinit(session_t *session)
+{
+  thread_deinit(&session->thread_audio);
+  engine_queue_discard(session);
+  mixer_free(&session->mixer);
+  bufpool_free(&session->isdn_pool);
+  ringbuf_free(&session->isdn_rx);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int engine_pool_init(session_t *session)
+{
+  unsigned int size, n;
+
+  /* one period of captured audio */
+  size = session->fragment_size_in * session->audio_sample_size_in;
+
+  /* ... converted to A-law, and as shorts for recording */
+  n = 2 * ((session->fragment_size_in * ISDN_SPEED +
+            session->audio_speed_in - 1) / session->audio_speed_in + 1);
+  if (n > size)
+    size = n;
+
+  /* one chunk of A-law converted to playback */
+  n = ENGINE_CHUNK *
+      ((session->audio_speed_out + ISDN_SPEED - 1) / ISDN_SPEED) *
+      session->audio_sample_size_out;
+  if (n > size)
+    size = n;
+
+  /* stereo sound file samples, and recording shorts for one chunk */
+  n = 2 * ENGINE_CHUNK * sizeof(short);
+  if (n > size)
+    size = n;
+
+  return bufpool_init(&session->audio_pool, ENGINE_POOL_BUFFERS, size);
+}
+
+/*--------------------------------------------------------------------------*/
+
+void engine_pool_free(session_t *session)
+{
+  bufpool_free(&session->audio_pool);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int engine_start(session_t *session)
+{
+  g_atomic_int_set(&session->audio_failed, 0);
+  if (thread_start(&session->thread_audio, engine_thread, session) < 0)
+    return -1;
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void engine_stop(session_t *session)
+{
+  thread_stop(&session->thread_audio);
+}
+
+/*--------------------------------------------------------------------------*/
+
+void engine_isdn_data(session_t *session, unsigned int call,
+                      void *data, unsigned int length)
+{
+  buffer_t *buffer;
+
+  if (mixer_party_active(&session->mixer, MIXER_PARTY(call))) {
+    /* conference member, mixed in as capture clocks the engine */
+    mixer_put(&session->mixer, MIXER_PARTY(call), data, length);
+    return;
+  }
+
+  if (call_get(&session->calls, call) != session->call)
+    return; /* held call, nobody listens */
+
+  trace_event(&session->trace, TRACE_ISDN_DATA, data, length, NULL, 0);
+
+  if (session->audio_state != AUDIO_CONVERSATION)
+    return; /* nobody to play it */
+
+  if (length > session->isdn_pool.buffer_size)
+    length = session->isdn_pool.buffer_size;
+
+  if (ringbuf_space(&session->isdn_rx) < sizeof(buffer) ||
+      !(buffer = bufpool_get(&session->isdn_pool))) {
+    dbgprintf(2, "AUDIO: Playback queue full, dropping ISDN data\n");
+    return;
+  }
+
+  /* the only copy: CAPI reuses its buffer after DATA_B3_RESP */
+  memcpy(buffer->data, data, length);
+  buffer->length = length;
+  buffer->timestamp = media_time();
+  ringbuf_write(&session->isdn_rx, &buffer, sizeof(buffer));
+
+  thread_wakeup(&session->thread_audio);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void engine_queue_discard(session_t *session)
+{
+  buffer_t *buffer;
+
+  while (ringbuf_read(&session->isdn_rx, &buffer, sizeof(buffer)) ==
+         sizeof(buffer))
+    bufpool_put(buffer);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int engine_buffers_get(session_t *session, engine_buffers_t *buf)
+{
+  buf->capture = bufpool_get(&session->audio_pool);
+  buf->playback = bufpool_get(&session->audio_pool);
+  buf->isdn = bufpool_get(&session->audio_pool);
+  buf->rec = bufpool_get(&session->audio_pool);
+  buf->sndfile = bufpool_get(&session->audio_pool);
+  buf->playback_count = 0;
+  buf->playback_ptr = 0;
+
+  if (!buf->capture || !buf->playback || !buf->isdn || !buf->rec ||
+      !buf->sndfile) {
+    engine_buffers_put(buf);
+    return -1;
+  }
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void engine_buffers_put(engine_buffers_t *buf)
+{
+  bufpool_put(buf->capture);
+  bufpool_put(buf->playback);
+  bufpool_put(buf->isdn);
+  bufpool_put(buf->rec);
+  bufpool_put(buf->sndfile);
+  memset(buf, 0, sizeof(engine_buffers_t));
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int engine_pcm_recover(session_t *session, snd_pcm_t *audio, int err)
+{
+  int err2;
+
+  ANT_PROBE2(pcm_recover, audio == session->audio_out, err);
+  if (err == -EBADFD) {
+    dbgprintf(1, "AUDIO: Preparing audio for I/O\n");
+    return snd_pcm_prepare(audio);
+  } else {
+    err2 = snd_pcm_recover(audio, err, 1);
+    if (err2 != 0)
+      return err2;
+    dbgprintf(2, "AUDIO: snd_pcm_recover from error %s on %s\n",
+              snd_strerror(err),
+              (audio == session->audio_out) ? "output" : "input");
+    return 0;
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void engine_trace_write(session_t *session, int frames, int result)
+{
+  int32_t data[2];
+
+  data[0] = frames;
+  data[1] = result;
+  trace_event(&session->trace, TRACE_AUDIO_WRITE, data, sizeof(data),
+              NULL, 0);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static snd_pcm_sframes_t engine_pcm_writei(session_t *session,
+                                           unsigned char *data,
+                                           snd_pcm_uframes_t frames)
+{
+  if (session->audio_mmap_out)
+    return snd_pcm_mmap_writei(session->audio_out, data, frames);
+  return snd_pcm_writei(session->audio_out, data, frames);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static snd_pcm_sframes_t engine_mmap_begin(snd_pcm_t *pcm,
+                                           snd_pcm_uframes_t min,
+                                           snd_pcm_uframes_t max,
+                                           unsigned int framesize,
+                                           unsigned char **data,
+                                           snd_pcm_uframes_t *offset)
+{
+  const snd_pcm_channel_area_t *areas;
+  snd_pcm_uframes_t frames = max;
+  snd_pcm_sframes_t avail;
+  int err;
+
+  avail = snd_pcm_avail_update(pcm);
+  if (avail < 0)
+    return avail;
+  if ((snd_pcm_uframes_t) avail < min)
+    return 0;
+  if ((snd_pcm_uframes_t) avail < frames)
+    frames = avail;
+
+  if ((err = snd_pcm_mmap_begin(pcm, &areas, offset, &frames)) < 0)
+    return err;
+  if (frames < min) {
+    /* wraps around the end of the buffer */
+    snd_pcm_mmap_commit(pcm, *offset, 0);
+    return 0;
+  }
+
+  /* interleaved (and mono): all samples follow each other in area 0 */
+  *data = (unsigned char*) areas[0].addr +
+          areas[0].first / 8 + *offset * framesize;
+  return frames;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static snd_pcm_sframes_t engine_mmap_commit(session_t *session,
+                                            snd_pcm_t *pcm,
+                                            snd_pcm_uframes_t offset,
+                                            snd_pcm_uframes_t frames)
+{
+  snd_pcm_sframes_t result, delay;
+
+  result = snd_pcm_mmap_commit(pcm, offset, frames);
+  if (result >= 0 && (snd_pcm_uframes_t) result != frames)
+    result = -EPIPE;
+
+  /* unlike snd_pcm_writei(), committing never starts the device */
+  if (result > 0 && pcm == session->audio_out &&
+      snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED &&
+      snd_pcm_delay(pcm, &delay) >= 0 &&
+      delay >= session->fragment_size_out)
+    snd_pcm_start(pcm);
+
+  return result;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int engine_capture_start(session_t *session)
+{
+  int err;
+
+  switch (snd_pcm_state(session->audio_in)) {
+  case SND_PCM_STATE_RUNNING:
+    return 0;
+  case SND_PCM_STATE_PREPARED:
+    break;
+  default:
+    if ((err = snd_pcm_prepare(session->audio_in)) < 0) {
+      errprintf("AUDIO: Cannot prepare audio capture: %s\n", snd_strerror(err));
+      return err;
+    }
+    break;
+  }
+
+  if ((err = snd_pcm_start(session->audio_in)) < 0) {
+    errprintf("AUDIO: Cannot start audio capture: %s\n", snd_strerror(err));
+    return err;
+  }
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int engine_start_threshold(snd_pcm_t *pcm, snd_pcm_uframes_t frames)
+{
+  snd_pcm_sw_params_t *swparams;
+  int err;
+
+  snd_pcm_sw_params_alloca(&swparams);
+  if ((err = snd_pcm_sw_params_current(pcm, swparams)) < 0)
+    return err;
+  if (frames == 0 &&
+      (err = snd_pcm_sw_params_get_boundary(swparams, &frames)) < 0)
+    return err;
+  if ((err = snd_pcm_sw_params_set_start_threshold(pcm, swparams,
+                                                   frames)) < 0)
+    return err;
+  return snd_pcm_sw_params(pcm, swparams);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int engine_silence(session_t *session, engine_buffers_t *buf,
+                          snd_pcm_uframes_t frames)
+{
+  unsigned int framesize = session->audio_sample_size_out;
+  snd_pcm_uframes_t chunk = buf->playback->size / framesize;
+  snd_pcm_sframes_t err;
+
+  snd_pcm_format_set_silence(session->audio_format_out, buf->playback->data,
+                             chunk);
+  while (frames > 0) {
+    err = engine_pcm_writei(session, buf->playback->data,
+                            frames < chunk ? frames : chunk);
+    engine_trace_write(session, frames < chunk ? frames : chunk, err);
+    if (err == -EAGAIN || err == 0)
+      break; /* buffer full, the margin is as large as it gets */
+    if (err < 0)
+      return err;
+    frames -= err;
+  }
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int engine_duplex_start(session_t *session, engine_buffers_t *buf)
+{
+  snd_pcm_t *in = session->audio_in, *out = session->audio_out;
+  snd_pcm_uframes_t margin = ENGINE_DUPLEX_PERIODS * session->fragment_size_out;
+  snd_pcm_sframes_t skew = 0;
+  uint64_t time_in = 0, time_out = 0;
+  int err;
+
+  /* a capture error also restarts playback, to keep the alignment */
+  if (snd_pcm_state(out) != SND_PCM_STATE_PREPARED) {
+    snd_pcm_drop(out);
+    if ((err = snd_pcm_prepare(out)) < 0)
+      goto error;
+  }
+  /* linked: already prepared together with playback */
+  if (snd_pcm_state(in) != SND_PCM_STATE_PREPARED) {
+    snd_pcm_drop(in);
+    if ((err = snd_pcm_prepare(in)) < 0)
+      goto error;
+  }
+
+  /* data left in the playback buffer is late already */
+  buf->playback_count = 0;
+  buf->playback_ptr = 0;
+
+  /* writing the margin must not start playback on its own */
+  if ((err = engine_start_threshold(out, 0)) < 0 ||
+      (err = engine_silence(session, buf, margin)) < 0)
+    goto error;
+
+  if (session->audio_linked) {
+    /* starts playback at the same time */
+    err = snd_pcm_start(in);
+  } else {
+    /* as close together as we can, then compensate what is left */
+    if ((err = snd_pcm_start(out)) >= 0) {
+      time_out = media_time();
+      err = snd_pcm_start(in);
+      time_in = media_time();
+    }
+    if (err >= 0) {
+      if (media_pcm_trigger_time(out, &time_out) < 0 ||
+          media_pcm_trigger_time(in, &time_in) < 0) {
+        dbgprintf(2, "AUDIO: No trigger timestamps, measuring start skew\n");
+      }
+      if (time_in > time_out)
+        skew = (snd_pcm_sframes_t) ((time_in - time_out) *
+                                    session->audio_speed_out / 1000000);
+      /* playback already consumed this much of the margin */
+      if (skew > 0 && (err = engine_silence(session, buf, skew)) < 0)
+        goto error;
+    }
+  }
+  engine_start_threshold(out, session->fragment_size_out);
+  if (err < 0)
+    goto error;
+
+  session->audio_duplex_delay =
+    (unsigned int) ((uint64_t) margin * 1000000 / session->audio_speed_out);
+  dbgprintf(1, "AUDIO: Duplex start (%s), skew %ld frames, "
+            "round trip %u us\n",
+            session->audio_linked ? "linked" : "software aligned",
+            (long) skew, session->audio_duplex_delay);
+  return 0;
+
+ error:
+  errprintf("AUDIO: Cannot start audio capture and playback: %s\n",
+            snd_strerror(err));
+  return err;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int engine_capture_restart(session_t *session, engine_buffers_t *buf,
+                                  enum audio_t mode)
+{
+  if (mode == AUDIO_CONVERSATION)
+    return engine_duplex_start(session, buf);
+  return engine_capture_start(session);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int engine_capture(session_t *session, engine_buffers_t *buf,
+                          enum audio_t mode)
+{
+  int frames, err;
+  unsigned int count, outsize;
+  int bytes_per_frame = session->audio_sample_size_in;
+  unsigned char *data;
+  snd_pcm_uframes_t offset = 0;
+  snd_pcm_sframes_t delay;
+  uint64_t read_time, now, stamp, age;
+  int32_t result;
+
+  count = session->fragment_size_in;
+  if (count * bytes_per_frame > buf->capture->size)
+    count = buf->capture->size / bytes_per_frame;
+
+  for (;;) {
+    if (session->audio_mmap_in) {
+      /* convert in place from the device buffer */
+      frames = engine_mmap_begin(session->audio_in, 1, count,
+                                 bytes_per_frame, &data, &offset);
+    } else {
+      data = buf->capture->data;
+      frames = snd_pcm_readi(session->audio_in, data, count);
+    }
+    if (frames == -EAGAIN || frames == 0)
+      return 0;
+
+    result = frames;
+    trace_event(&session->trace, TRACE_AUDIO_READ, &result, sizeof(result),
+                data, frames > 0 ? frames * bytes_per_frame : 0);
+
+    if (frames < 0) {
+      err = engine_pcm_recover(session, session->audio_in, frames);
+      if (err >= 0)
+        err = engine_capture_restart(session, buf, mode);
+      if (err < 0) {
+        errprintf("AUDIO: Unrecoverable PCM read error %s, terminating\n",
+                  snd_strerror(err));
+        return -1;
+      }
+      return 0;
+    }
+
+    read_time = media_time();
+
+    /* process the data, this also updates llcheck */
+    convert_audio_to_isdn(session,
+                          data, frames * bytes_per_frame,
+                          buf->isdn->data, &outsize,
+                          (short*) buf->rec->data);
+
+    if (session->audio_mmap_in &&
+        (err = engine_mmap_commit(session, session->audio_in,
+                                  offset, frames)) < 0) {
+      /* overrun while converting, the data may be damaged but is used */
+      err = engine_pcm_recover(session, session->audio_in, err);
+      if (err >= 0)
+        err = engine_capture_restart(session, buf, mode);
+      if (err < 0) {
+        errprintf("AUDIO: Unrecoverable PCM read error %s, terminating\n",
+                  snd_strerror(err));
+        return -1;
+      }
+    }
+
+    if (mode == AUDIO_CONVERSATION) {
+      isdn_speed_addsamples(&session->audio_in_speed, frames);
+
+      /* oldest sample read was captured before the frames still buffered,
+         at the time the device stamped the delay if it does so */
+      if (media_pcm_time(session->audio_in, &delay, &stamp) < 0) {
+        if (snd_pcm_delay(session->audio_in, &delay) < 0)
+          delay = 0;
+        stamp = read_time;
+      }
+      if (delay < 0)
+        delay = 0;
+      age = (uint64_t) (delay + frames) * 1000000 / session->audio_speed_in;
+      if (stamp < read_time)
+        age += read_time - stamp;
+      now = media_time();
+      latency_add(&session->call->latency, LATENCY_TX_CAPTURE, age);
+      latency_add(&session->call->latency, LATENCY_TX_CONVERT,
+                  now - read_time);
+      session->call->latency.tx_origin = read_time - age;
+
+      /* dump the audio to ISDN */
+      if (session->conference)
+        engine_conference(session, buf, outsize);
+      else
+        isdn_send_data(&session->isdn,
+                       call_id(&session->calls, session->call),
+                       buf->isdn->data, outsize);
+
+      if (debug > 1) {
+        isdn_speed_debug(&session->audio_in_speed, 1, "AUDIO: in");
+      }
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void engine_playback_block(session_t *session, engine_buffers_t *buf,
+                                  unsigned char *data, unsigned int length,
+                                  uint64_t received)
+{
+  unsigned int ptr, outsize, size, frames;
+  unsigned int framesize = session->audio_sample_size_out;
+  int err;
+  unsigned char *out;
+  snd_pcm_uframes_t offset = 0;
+  snd_pcm_sframes_t mapped = 0, delay;
+  uint64_t start, converted, now, playback;
+
+  start = media_time();
+
+  /* convert straight into the device buffer if the block fits without
+     wrapping, otherwise into the playback buffer and write it from there */
+  frames = (unsigned int) floor((double) length * session->ratio_in);
+  if (session->audio_mmap_out && frames > 0)
+    mapped = engine_mmap_begin(session->audio_out, frames, frames,
+                               framesize, &out, &offset);
+  if (mapped <= 0)
+    out = buf->playback->data;
+
+  convert_isdn_to_audio(session, data, length,
+                        out, &outsize,
+                        (short*) buf->rec->data,
+                        1);
+  outsize /= framesize;
+  converted = media_time();
+
+  ptr = 0;
+  if (mapped > 0) {
+    err = engine_mmap_commit(session, session->audio_out, offset, outsize);
+    engine_trace_write(session, outsize, err);
+    if (err < 0) {
+      err = engine_pcm_recover(session, session->audio_out, err);
+      if (err < 0)
+        errprintf("AUDIO: Error writing to audio: %s\n", snd_strerror(err));
+    } else {
+      ptr = outsize;
+      isdn_speed_addsamples(&session->audio_out_speed, outsize);
+
+      if (debug > 1) {
+        isdn_speed_debug(&session->audio_out_speed, 2, "AUDIO: out");
+      }
+    }
+  }
+
+  /* dump the ISDN data to audio */
+  while (mapped <= 0 && ptr < outsize) {
+    size = outsize - ptr;
+    err = engine_pcm_writei(session,
+                            buf->playback->data + ptr * framesize,
+                            size);
+    engine_trace_write(session, size, err);
+    if (err == -EAGAIN) {
+      /* playback buffer full */
+      dbgprintf(2, "AUDIO: Clock unsynchronized, skipping audio buffer\n");
+      isdn_speed_addsamples(&session->audio_out_speed, size);
+      break;
+    } else if (err < 0) {
+      err = engine_pcm_recover(session, session->audio_out, err);
+      if (err >= 0) {
+        /* write one frame doubled to catch up */
+        err = engine_pcm_writei(session,
+                                buf->playback->data + ptr * framesize,
+                                size);
+        engine_trace_write(session, size, err);
+        continue; /* retry */
+      }
+      /* TODO: handle error better and/or stop audio */
+      errprintf("AUDIO: Error writing to audio: %s\n", snd_strerror(err));
+      break;
+    } else {
+      /* some data written */
+      ptr += err;
+      isdn_speed_addsamples(&session->audio_out_speed, err);
+
+      if (debug > 1) {
+        isdn_speed_debug(&session->audio_out_speed, 2, "AUDIO: out");
+      }
+    }
+  }
+
+  now = media_time();
+  latency_add(&session->call->latency, LATENCY_RX_QUEUE, start - received);
+  latency_add(&session->call->latency, LATENCY_RX_CONVERT,
+              converted - start);
+  latency_add(&session->call->latency, LATENCY_RX_WRITE, now - converted);
+
+  /* first sample of the block plays after everything queued before it */
+  if (ptr == outsize &&
+      snd_pcm_delay(session->audio_out, &delay) >= 0 && delay >= 0) {
+    playback = delay > (snd_pcm_sframes_t) outsize ?
+      (uint64_t) (delay - outsize) * 1000000 / session->audio_speed_out : 0;
+    latency_add(&session->call->latency, LATENCY_RX_PLAYBACK, playback);
+    latency_add(&session->call->latency, LATENCY_WIRE_TO_EAR,
+                now - received + playback);
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void engine_playback_isdn(session_t *session, engine_buffers_t *buf)
+{
+  buffer_t *buffer;
+
+  while (ringbuf_read(&session->isdn_rx, &buffer, sizeof(buffer)) ==
+         sizeof(buffer)) {
+    engine_playback_block(session, buf, buffer->data, buffer->length,
+                          buffer->timestamp);
+    bufpool_put(buffer);
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void engine_conference(session_t *session, engine_buffers_t *buf,
+                              unsigned int length)
+{
+  mixer_t *mixer = &session->mixer;
+  unsigned int party;
+  uint64_t now = media_time();
+
+  mixer_put(mixer, MIXER_LOCAL, buf->isdn->data, length);
+
+  while (mixer_mix(mixer) == 0) {
+    for (party = MIXER_PARTY(0); party < MIXER_MAX_PARTIES; party++) {
+      if (!mixer_party_active(mixer, party))
+        continue;
+      /* every party hears the same capture */
+      call_get(&session->calls, party - MIXER_PARTY(0))->latency.tx_origin =
+        session->call->latency.tx_origin;
+      isdn_send_data(&session->isdn, party - MIXER_PARTY(0),
+                     mixer->out[party], MIXER_BLOCK);
+    }
+    engine_playback_block(session, buf, mixer->out[MIXER_LOCAL], MIXER_BLOCK,
+                          now);
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int engine_effect_generate(session_t *session, engine_buffers_t *buf,
+                                  unsigned long *effectpos)
+{
+  int i;
+  int just_read;                      /* read count from sndfile */
+  int sample;                         /* linear sample to convert to A-law */
+  short *samples = (short*) buf->sndfile->data;
+  unsigned char *alaw = buf->isdn->data;
+
+  switch (session->effect) {
+  case EFFECT_SOUNDFILE:
+    just_read = sf_readf_short(session->effect_sndfile,
+                               samples,
+                               ENGINE_CHUNK);
+    /* convert samples to alaw */
+    for (i = 0; i < just_read; ++i) {
+      sample = ((int) samples[2*i]) + ((int) samples[2*i+1]);
+      if (sample < -32768)
+        sample = -32768;
+      else if (sample > 32767)
+        sample = 32767;
+      alaw[i] = linear2alaw(sample);
+    }
+    return just_read > 0 ? just_read : 0;
+
+  case EFFECT_RING:     /* somebody's calling */
+  case EFFECT_RINGING:  /* waiting for the other end to pick up the phone */
+  case EFFECT_TEST:     /* play test sound (e.g. line level check) */
+  case EFFECT_TOUCHTONE:/* play a touchtone */
+  case EFFECT_EMPTY:    /* silence for llcheck */
+    for (i = 0; i < ENGINE_CHUNK; ++i)
+      alaw[i] = fxgenerate(session,
+                           session->effect,
+                           session->touchtone_index,
+                           (*effectpos)++ / 8000.0);
+    return ENGINE_CHUNK;
+
+  default:
+    errprintf("EFFECT: Unknown effect %d to play, exiting thread\n",
+              session->effect);
+    return -1;
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int engine_playback_effect(session_t *session, engine_buffers_t *buf,
+                                  unsigned long *effectpos)
+{
+  unsigned int framesize = session->audio_sample_size_out;
+  unsigned int sndcount;
+  int count, err;
+
+  for (;;) {
+    if (buf->playback_ptr >= buf->playback_count) {
+      count = engine_effect_generate(session, buf, effectpos);
+      if (count <= 0)
+        return count < 0 ? -1 : 1;
+
+      /* convert A-law to audio */
+      convert_isdn_to_audio(session,
+                            buf->isdn->data, count,
+                            buf->playback->data, &sndcount,
+                            (short*) buf->rec->data, 0);
+      buf->playback_count = sndcount / framesize;
+      buf->playback_ptr = 0;
+    }
+
+    /* play it! */
+    err = engine_pcm_writei(session,
+                            buf->playback->data + buf->playback_ptr * framesize,
+                            buf->playback_count - buf->playback_ptr);
+    if (err == -EAGAIN) {
+      return 0; /* device buffer full, wait for next poll */
+    } else if (err < 0) {
+      err = engine_pcm_recover(session, session->audio_out, err);
+      if (err >= 0)
+        continue; /* retry */
+      errprintf("EFFECT: Error writing effect to audio device: %s\n",
+                snd_strerror(err));
+      return -1;
+    }
+    buf->playback_ptr += err;
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+static gpointer engine_thread(gpointer data)
+{
+  session_t *session = (session_t *) data;
+  enum audio_t mode = session->audio_state;
+  engine_buffers_t buf;
+  struct pollfd fds[ENGINE_MAX_FDS];
+  unsigned short revents;
+  int nfds, nin, nout;
+  unsigned long effectpos = 0;        /* position within effect in frames */
+  int draining = 0;                   /* effect finished, draining playback */
+  int result = 0;
+  int err;
+
+  dbgprintf(1, "AUDIO: Starting audio engine (%s)\n",
+            mode == AUDIO_CONVERSATION ? "conversation" : "effect");
+
+  /* the engine never blocks on a device, poll() does the waiting */
+  snd_pcm_nonblock(session->audio_in, 1);
+  snd_pcm_nonblock(session->audio_out, 1);
+
+  /* all working memory was preallocated when the devices were opened */
+  if (engine_buffers_get(session, &buf) < 0) {
+    errprintf("AUDIO: No buffers for audio engine\n");
+    return (gpointer) 1;
+  }
+
+  if (mode == AUDIO_CONVERSATION) {
+    isdn_speed_init(&session->audio_out_speed, session->audio_speed_out);
+    isdn_speed_init(&session->audio_in_speed, session->audio_speed_in);
+    /* drop data left over from previous call */
+    engine_queue_discard(session);
+  }
+
+  /* poll on wake-up pipe, capture and (for effects) playback; during
+     conversation, playback is driven by ISDN data arriving, the wake-up
+     pipe also interrupts poll() immediately on thread_stop() */
+  fds[0].fd = thread_wakeup_fd(&session->thread_audio);
+  fds[0].events = POLLIN;
+  nin = snd_pcm_poll_descriptors_count(session->audio_in);
+  nout = mode == AUDIO_EFFECT ?
+         snd_pcm_poll_descriptors_count(session->audio_out) : 0;
+  if (nin <= 0 || nout < 0 || 1 + nin + nout > ENGINE_MAX_FDS) {
+    errprintf("AUDIO: Cannot get poll descriptors of audio device(s)\n");
+    engine_buffers_put(&buf);
+    return (gpointer) 1;
+  }
+  snd_pcm_poll_descriptors(session->audio_in, fds + 1, nin);
+  if (nout)
+    snd_pcm_poll_descriptors(session->audio_out, fds + 1 + nin, nout);
+  nfds = 1 + nin + nout;
+
+  if (mode == AUDIO_CONVERSATION) {
+    /* the driver starts linked devices on the same period boundary,
+       only possible on the same card */
+    session->audio_linked = 0;
+    if (audio_same_card(session->audio_in, session->audio_out)) {
+      if ((err = snd_pcm_link(session->audio_in, session->audio_out)) < 0) {
+        dbgprintf(1, "AUDIO: Cannot link capture and playback: %s\n",
+                  snd_strerror(err));
+      } else {
+        session->audio_linked = 1;
+      }
+    }
+    err = engine_duplex_start(session, &buf);
+    if (err < 0 && session->audio_linked) {
+      dbgprintf(1, "AUDIO: Linked start failed, starting devices separately\n");
+      snd_pcm_unlink(session->audio_in);
+      session->audio_linked = 0;
+      err = engine_duplex_start(session, &buf);
+    }
+    if (err < 0) {
+      errprintf("AUDIO: Cannot start conversation audio, terminating\n");
+      session_audio_failed(session);
+      result = 1;
+    }
+  } else {
+    if (snd_pcm_state(session->audio_out) == SND_PCM_STATE_SETUP)
+      snd_pcm_prepare(session->audio_out);
+    engine_capture_start(session);
+  }
+
+  while (!result && !thread_is_stopping(&session->thread_audio)) {
+    if (poll(fds, nfds, ENGINE_POLL_TIMEOUT) < 0) {
+      if (errno == EINTR)
+        continue;
+      errprintf("AUDIO: Error polling audio device(s): %s\n", strerror(errno));
+      result = 1;
+      break;
+    }
+
+    if (fds[0].revents & POLLIN)
+      thread_wakeup_clear(&session->thread_audio);
+
+    /* capture */
+    revents = 0;
+    snd_pcm_poll_descriptors_revents(session->audio_in, fds + 1, nin, &revents);
+    if (revents & (POLLIN | POLLERR)) {
+      if (engine_capture(session, &buf, mode) < 0) {
+        if (mode == AUDIO_CONVERSATION)
+          session_audio_failed(session);
+        result = 5;
+        break;
+      }
+    }
+
+    /* playback */
+    if (mode == AUDIO_CONVERSATION) {
+      engine_playback_isdn(session, &buf);
+    } else if (draining) {
+      if (snd_pcm_state(session->audio_out) != SND_PCM_STATE_DRAINING)
+        break;
+    } else {
+      revents = 0;
+      snd_pcm_poll_descriptors_revents(session->audio_out, fds + 1 + nin, nout,
+                                       &revents);
+      if (revents & (POLLOUT | POLLERR)) {
+        err = engine_playback_effect(session, &buf, &effectpos);
+        if (err > 0) {
+          dbgprintf(1 ,"EFFECT: End-of-file reached, stopping playback\n");
+          /* drain output buffer in order not to cut last seconds of
+             playback, capture keeps waking us up to check the state */
+          if (snd_pcm_drain(session->audio_out) != -EAGAIN)
+            break;
+          draining = 1;
+          nfds = 1 + nin;
+        } else if (err < 0) {
+          result = 1;
+          break;
+        }
+      }
+    }
+  }
+
+  if (mode == AUDIO_EFFECT) {
+    if (session->effect == EFFECT_SOUNDFILE) {
+      /* signalise we have stopped playback */
+      sf_close(session->effect_sndfile);
+      session->effect_sndfile = 0;
+    }
+    session->effect = EFFECT_NONE;
+  }
+
+  /* stop audio (devices closed elsewhere) */
+  audio_stop(session->audio_in, session->audio_out);
+  if (session->audio_linked) {
+    /* effects start playback on their own */
+    snd_pcm_unlink(session->audio_in);
+    session->audio_linked = 0;
+  }
+
+  engine_buffers_put(&buf);
+
+  dbgprintf(1, "AUDIO: Stopping audio engine\n");
+
+  return (gpointer) (long) result;
+}
+
+/*--------------------------------------------------------------------------*/
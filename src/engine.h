@@ -0,0 +1,116 @@
+/*
+ * Audio engine: single event loop for capture, playback and effects
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ANT_ENGINE_H
+#define _ANT_ENGINE_H
+
+#include "session.h"
+
+/*!
+ * @brief Number of ISDN data blocks waiting for playback.
+ *
+ * 64 blocks of 128 A-law samples are about one second at ISDN speed.
+ */
+#define ENGINE_ISDN_QUEUE_LEN 64
+
+/*!
+ * @brief Number of buffers in the audio engine pool.
+ */
+#define ENGINE_POOL_BUFFERS 8
+
+/*!
+ * @brief Maximum time to sleep in poll() without any event (ms).
+ *
+ * Only a safety net, stop requests and ISDN data wake up the engine
+ * immediately.
+ */
+#define ENGINE_POLL_TIMEOUT 50
+
+/*!
+ * @brief Initialize audio engine data in session (queue, ISDN buffer pool,
+ * thread handle).
+ *
+ * @param session session.
+ * @return 0 on success, -1 on error.
+ */
+int engine_init(session_t *session);
+
+/*!
+ * @brief Free audio engine data in session.
+ *
+ * @param session session.
+ */
+void engine_deinit(session_t *session);
+
+/*!
+ * @brief Allocate the engine working buffers for the opened audio devices.
+ *
+ * Buffers are sized from the negotiated period sizes and formats, so that
+ * no memory is allocated while audio is running.
+ *
+ * @param session session with opened audio devices.
+ * @return 0 on success, -1 on error.
+ */
+int engine_pool_init(session_t *session);
+
+/*!
+ * @brief Free the engine working buffers (engine must be stopped).
+ *
+ * @param session session.
+ */
+void engine_pool_free(session_t *session);
+
+/*!
+ * @brief Start the audio engine thread for the current audio state.
+ *
+ * In AUDIO_CONVERSATION state, the engine moves captured audio to ISDN
+ * and queued ISDN data to playback, or mixes them in a conference. In AUDIO_EFFECT state, it plays
+ * session->effect and reads capture for line level check.
+ *
+ * @param session session.
+ * @return 0 on success (or already running), -1 on error.
+ */
+int engine_start(session_t *session);
+
+/*!
+ * @brief Stop the audio engine thread, if running.
+ *
+ * @param session session.
+ */
+void engine_stop(session_t *session);
+
+/*!
+ * @brief Queue ISDN data for playback and wake up the engine.
+ *
+ * Called from the ISDN thread. Data is copied once into a pool buffer
+ * which is handed to the engine by pointer. Never blocks or allocates,
+ * data which doesn't fit into the queue are dropped.
+ *
+ * @param session session.
+ * @param call ISDN call number. Data of conference calls goes to the
+ *        mixer, data of other calls than the audio call is dropped.
+ * @param data received ISDN data (bit-inverse A-law).
+ * @param length length of data in bytes.
+ */
+void engine_isdn_data(session_t *session, unsigned int call,
+                      void *data, unsigned int length);
+
+#endif /* _ANT_ENGINE_H */
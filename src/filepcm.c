@@ -0,0 +1,506 @@
+/*
+ * File-backed ALSA PCM for audio without sound hardware
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "config.h"
+
+/* GNU headers */
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+  #include <stdlib.h>
+#endif
+#ifdef HAVE_UNISTD_H
+  #include <unistd.h>
+#endif
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+
+/* ALSA I/O plugin SDK */
+#include <alsa/asoundlib.h>
+#include <alsa/pcm_external.h>
+
+/* libsndfile */
+#include <sndfile.h>
+
+/* own header files */
+#include "globals.h"
+#include "filepcm.h"
+#include "util.h"
+#include "mediaclock.h"
+
+/*!
+ * @brief Frames converted at once for channel mixing.
+ */
+#define FILEPCM_CHUNK 256
+
+/*!
+ * @brief File-backed PCM state.
+ */
+typedef struct {
+  snd_pcm_ioplug_t io;        /*!< ALSA I/O plugin (must be first) */
+
+  char *filename;             /*!< sound file name */
+  SNDFILE *sf;                /*!< sound file */
+  SF_INFO sfinfo;             /*!< sound file format */
+  FILE *timestamps;           /*!< playback timestamp log (or NULL) */
+
+  double ppm;                 /*!< simulated clock deviation */
+  double speed;               /*!< simulated time / real time */
+  int loop;                   /*!< rewind capture file at end */
+  int log_timestamps;         /*!< write playback timestamp log */
+
+  int timer_fd;               /*!< timer for poll(), one tick per period */
+  uint64_t start;             /*!< real start time (us) */
+  snd_pcm_uframes_t position; /*!< device position since start (frames) */
+  snd_pcm_uframes_t transferred; /*!< frames transferred since prepare */
+
+  short mix[FILEPCM_CHUNK * 8]; /*!< capture channel mixing buffer */
+} filepcm_t;
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Simulated device frames per real second.
+ *
+ * @param pcm file PCM.
+ * @return frame rate.
+ */
+static double filepcm_rate(filepcm_t *pcm)
+{
+  return pcm->io.rate * (1.0 + pcm->ppm * 1e-6) * pcm->speed;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Arm the poll timer.
+ *
+ * @param pcm file PCM.
+ * @param immediate fire first tick immediately, otherwise after one period.
+ */
+static void filepcm_timer(filepcm_t *pcm, int immediate)
+{
+  struct itimerspec spec;
+  uint64_t ns;
+
+  ns = (uint64_t) (pcm->io.period_size * 1e9 / filepcm_rate(pcm));
+  if (ns == 0)
+    ns = 1;
+  spec.it_interval.tv_sec = ns / 1000000000;
+  spec.it_interval.tv_nsec = ns % 1000000000;
+  if (immediate) {
+    spec.it_value.tv_sec = 0;
+    spec.it_value.tv_nsec = 1;
+  } else {
+    spec.it_value = spec.it_interval;
+  }
+  timerfd_settime(pcm->timer_fd, 0, &spec, NULL);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int filepcm_start(snd_pcm_ioplug_t *io)
+{
+  filepcm_t *pcm = (filepcm_t*) io->private_data;
+
+  pcm->start = media_time();
+  pcm->position = 0;
+  filepcm_timer(pcm, 0);
+
+  if (pcm->timestamps) {
+    fprintf(pcm->timestamps, "# start %llu rate %u factor %.9f\n",
+            (unsigned long long) pcm->start, io->rate,
+            (1.0 + pcm->ppm * 1e-6) * pcm->speed);
+  }
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int filepcm_stop(snd_pcm_ioplug_t *io)
+{
+  filepcm_t *pcm = (filepcm_t*) io->private_data;
+  struct itimerspec spec;
+
+  memset(&spec, 0, sizeof(spec));
+  timerfd_settime(pcm->timer_fd, 0, &spec, NULL);
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static snd_pcm_sframes_t filepcm_pointer(snd_pcm_ioplug_t *io)
+{
+  filepcm_t *pcm = (filepcm_t*) io->private_data;
+  snd_pcm_uframes_t position;
+
+  if (io->state == SND_PCM_STATE_RUNNING ||
+      io->state == SND_PCM_STATE_DRAINING) {
+    position = (snd_pcm_uframes_t)
+      ((media_time() - pcm->start) * 1e-6 * filepcm_rate(pcm));
+
+    if (io->stream == SND_PCM_STREAM_PLAYBACK) {
+      /* device played everything written: underrun (or drained) */
+      if (position > pcm->transferred)
+        return -EPIPE;
+    } else {
+      /* application didn't read in time: overrun */
+      if (position > pcm->transferred + io->buffer_size)
+        return -EPIPE;
+    }
+    pcm->position = position;
+  }
+
+  return pcm->position % io->buffer_size;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Read mono samples from the capture file.
+ *
+ * @param pcm file PCM.
+ * @param buf buffer for samples.
+ * @param frames number of frames to read.
+ */
+static void filepcm_read(filepcm_t *pcm, short *buf, snd_pcm_uframes_t frames)
+{
+  int channels = pcm->sfinfo.channels;
+  sf_count_t count, chunk, i;
+  int c, sample;
+
+  while (frames > 0) {
+    chunk = frames;
+    if (chunk > FILEPCM_CHUNK)
+      chunk = FILEPCM_CHUNK;
+
+    if (channels == 1) {
+      count = sf_readf_short(pcm->sf, buf, chunk);
+    } else {
+      count = sf_readf_short(pcm->sf, pcm->mix, chunk);
+      for (i = 0; i < count; ++i) {
+        sample = 0;
+        for (c = 0; c < channels; ++c)
+          sample += pcm->mix[i * channels + c];
+        buf[i] = sample / channels;
+      }
+    }
+
+    if (count <= 0) {
+      if (pcm->loop && sf_seek(pcm->sf, 0, SEEK_SET) == 0 &&
+          pcm->sfinfo.frames > 0)
+        continue;
+      /* end of file, silence */
+      memset(buf, 0, frames * sizeof(short));
+      return;
+    }
+    buf += count;
+    frames -= count;
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+static snd_pcm_sframes_t filepcm_transfer(snd_pcm_ioplug_t *io,
+                                          const snd_pcm_channel_area_t *areas,
+                                          snd_pcm_uframes_t offset,
+                                          snd_pcm_uframes_t size)
+{
+  filepcm_t *pcm = (filepcm_t*) io->private_data;
+  short *buf = (short*) ((char*) areas->addr +
+                         (areas->first + areas->step * offset) / 8);
+
+  if (io->stream == SND_PCM_STREAM_PLAYBACK) {
+    if (pcm->timestamps) {
+      fprintf(pcm->timestamps, "%llu %lu %lu\n",
+              (unsigned long long) media_time(),
+              (unsigned long) pcm->transferred, (unsigned long) size);
+    }
+    sf_writef_short(pcm->sf, buf, size);
+  } else {
+    filepcm_read(pcm, buf, size);
+  }
+
+  pcm->transferred += size;
+  return size;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int filepcm_close(snd_pcm_ioplug_t *io)
+{
+  filepcm_t *pcm = (filepcm_t*) io->private_data;
+
+  if (pcm->sf)
+    sf_close(pcm->sf);
+  if (pcm->timestamps)
+    fclose(pcm->timestamps);
+  if (pcm->timer_fd >= 0)
+    close(pcm->timer_fd);
+  free(pcm->filename);
+  free(pcm);
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int filepcm_hw_params(snd_pcm_ioplug_t *io,
+                             snd_pcm_hw_params_t *params _U_)
+{
+  filepcm_t *pcm = (filepcm_t*) io->private_data;
+  char *name;
+
+  if (io->stream == SND_PCM_STREAM_CAPTURE || pcm->sf)
+    return 0;
+
+  /* rate is known now, create playback file */
+  pcm->sfinfo.samplerate = io->rate;
+  pcm->sfinfo.channels = io->channels;
+  pcm->sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+  pcm->sf = sf_open(pcm->filename, SFM_WRITE, &pcm->sfinfo);
+  if (!pcm->sf) {
+    errprintf("AUDIO: Cannot create %s: %s\n", pcm->filename, sf_strerror(NULL));
+    return -EIO;
+  }
+
+  if (pcm->log_timestamps) {
+    name = (char*) malloc(strlen(pcm->filename) +
+                          strlen(FILEPCM_TIMESTAMP_SUFFIX) + 1);
+    if (name) {
+      strcpy(name, pcm->filename);
+      strcat(name, FILEPCM_TIMESTAMP_SUFFIX);
+      pcm->timestamps = fopen(name, "w");
+      if (!pcm->timestamps)
+        errprintf("AUDIO: Cannot create %s: %s\n", name, strerror(errno));
+      free(name);
+    }
+  }
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int filepcm_prepare(snd_pcm_ioplug_t *io)
+{
+  filepcm_t *pcm = (filepcm_t*) io->private_data;
+
+  pcm->position = 0;
+  pcm->transferred = 0;
+
+  /* a prepared PCM is ready for I/O at once (playback buffer empty) */
+  filepcm_timer(pcm, 1);
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int filepcm_poll_revents(snd_pcm_ioplug_t *io,
+                                struct pollfd *pfd, unsigned int nfds,
+                                unsigned short *revents)
+{
+  uint64_t expirations;
+  snd_pcm_sframes_t avail;
+
+  if (nfds != 1 || !(pfd->revents & POLLIN)) {
+    *revents = 0;
+    return 0;
+  }
+
+  if (read(pfd->fd, &expirations, sizeof(expirations)) < 0 &&
+      errno != EAGAIN)
+    return -errno;
+
+  avail = snd_pcm_avail_update(io->pcm);
+  if (avail < 0)
+    *revents = POLLERR;
+  else if ((snd_pcm_uframes_t) avail >= io->period_size)
+    *revents = io->stream == SND_PCM_STREAM_PLAYBACK ? POLLOUT : POLLIN;
+  else
+    *revents = 0;
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static const snd_pcm_ioplug_callback_t filepcm_callback = {
+  .start = filepcm_start,
+  .stop = filepcm_stop,
+  .pointer = filepcm_pointer,
+  .transfer = filepcm_transfer,
+  .close = filepcm_close,
+  .hw_params = filepcm_hw_params,
+  .prepare = filepcm_prepare,
+  .poll_revents = filepcm_poll_revents,
+};
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Parse the device spec into the PCM state.
+ *
+ * @param pcm file PCM.
+ * @param spec "FILENAME[,name=value]...".
+ * @return 0 on success, -1 on error.
+ */
+static int filepcm_parse(filepcm_t *pcm, const char *spec)
+{
+  char *option, *value, *next;
+
+  pcm->ppm = 0.0;
+  pcm->speed = 1.0;
+  pcm->loop = 1;
+  pcm->log_timestamps = 1;
+
+  pcm->filename = strdup(spec);
+  if (!pcm->filename)
+    return -1;
+
+  option = strchr(pcm->filename, ',');
+  if (option)
+    *option++ = '\0';
+
+  for (; option && *option; option = next) {
+    next = strchr(option, ',');
+    if (next)
+      *next++ = '\0';
+    value = strchr(option, '=');
+    if (!value) {
+      errprintf("AUDIO: Option %s of %s needs a value\n", option, spec);
+      return -1;
+    }
+    *value++ = '\0';
+
+    if (!strcmp(option, "ppm")) {
+      pcm->ppm = strtod(value, NULL);
+    } else if (!strcmp(option, "speed") && strtod(value, NULL) > 0.0) {
+      pcm->speed = strtod(value, NULL);
+    } else if (!strcmp(option, "loop")) {
+      pcm->loop = atoi(value);
+    } else if (!strcmp(option, "ts")) {
+      pcm->log_timestamps = atoi(value);
+    } else {
+      errprintf("AUDIO: Invalid option %s=%s of %s\n", option, value, spec);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+int filepcm_open(snd_pcm_t **pcm_handle, const char *spec,
+                 snd_pcm_stream_t stream, int mode)
+{
+  static const unsigned int access_list[] = {
+    SND_PCM_ACCESS_RW_INTERLEAVED,
+    SND_PCM_ACCESS_MMAP_INTERLEAVED
+  };
+  static const unsigned int format_list[] = {
+    SND_PCM_FORMAT_S16
+  };
+  filepcm_t *pcm;
+  int err;
+
+  pcm = (filepcm_t*) calloc(1, sizeof(filepcm_t));
+  if (!pcm)
+    return -ENOMEM;
+  pcm->timer_fd = -1;
+
+  if (filepcm_parse(pcm, spec) < 0) {
+    err = -EINVAL;
+    goto error;
+  }
+
+  if (stream == SND_PCM_STREAM_CAPTURE) {
+    pcm->sf = sf_open(pcm->filename, SFM_READ, &pcm->sfinfo);
+    if (!pcm->sf) {
+      errprintf("AUDIO: Cannot open %s: %s\n", pcm->filename, sf_strerror(NULL));
+      err = -ENOENT;
+      goto error;
+    }
+    if (pcm->sfinfo.channels < 1 || pcm->sfinfo.channels > 8) {
+      errprintf("AUDIO: Unsupported channel count %d in %s\n",
+                pcm->sfinfo.channels, pcm->filename);
+      err = -EINVAL;
+      goto error;
+    }
+  }
+
+  pcm->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (pcm->timer_fd < 0) {
+    err = -errno;
+    goto error;
+  }
+
+  pcm->io.version = SND_PCM_IOPLUG_VERSION;
+  pcm->io.name = "ANT file PCM";
+  pcm->io.callback = &filepcm_callback;
+  pcm->io.private_data = pcm;
+  pcm->io.poll_fd = pcm->timer_fd;
+  pcm->io.poll_events = POLLIN;  /* timer, see filepcm_poll_revents() */
+  pcm->io.mmap_rw = 0;
+#ifdef SND_PCM_IOPLUG_FLAG_BOUNDARY_WA
+  /* pointer() returns position within buffer */
+  pcm->io.flags = SND_PCM_IOPLUG_FLAG_BOUNDARY_WA;
+#endif
+
+  if ((err = snd_pcm_ioplug_create(&pcm->io, pcm->filename, stream, mode)) < 0)
+    goto error;
+
+  /* from now on, snd_pcm_close() frees everything */
+  *pcm_handle = pcm->io.pcm;
+
+  if ((err = snd_pcm_ioplug_set_param_list(&pcm->io, SND_PCM_IOPLUG_HW_ACCESS,
+                                           2, access_list)) < 0 ||
+      (err = snd_pcm_ioplug_set_param_list(&pcm->io, SND_PCM_IOPLUG_HW_FORMAT,
+                                           1, format_list)) < 0 ||
+      (err = snd_pcm_ioplug_set_param_minmax(&pcm->io, SND_PCM_IOPLUG_HW_CHANNELS,
+                                             1, 1)) < 0 ||
+      (err = snd_pcm_ioplug_set_param_minmax(&pcm->io, SND_PCM_IOPLUG_HW_RATE,
+               stream == SND_PCM_STREAM_CAPTURE ? pcm->sfinfo.samplerate : 8000,
+               stream == SND_PCM_STREAM_CAPTURE ? pcm->sfinfo.samplerate : 48000)) < 0 ||
+      (err = snd_pcm_ioplug_set_param_minmax(&pcm->io, SND_PCM_IOPLUG_HW_PERIOD_BYTES,
+                                             64, 64 * 1024)) < 0 ||
+      (err = snd_pcm_ioplug_set_param_minmax(&pcm->io, SND_PCM_IOPLUG_HW_PERIODS,
+                                             2, 64)) < 0) {
+    snd_pcm_close(*pcm_handle);
+    *pcm_handle = NULL;
+    return err;
+  }
+
+  dbgprintf(1, "AUDIO: File %s for %s, clock %+.1f ppm, speed %.2f\n",
+            pcm->filename,
+            stream == SND_PCM_STREAM_CAPTURE ? "capture" : "playback",
+            pcm->ppm, pcm->speed);
+  return 0;
+
+error:
+  if (pcm->sf)
+    sf_close(pcm->sf);
+  if (pcm->timer_fd >= 0)
+    close(pcm->timer_fd);
+  free(pcm->filename);
+  free(pcm);
+  return err;
+}
+
+/*--------------------------------------------------------------------------*/
@@ -0,0 +1,65 @@
+/*
+ * File-backed ALSA PCM for audio without sound hardware
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ANT_FILEPCM_H
+#define _ANT_FILEPCM_H
+
+#include <alsa/asoundlib.h>
+
+/*!
+ * @brief Prefix of audio device names handled by filepcm_open().
+ */
+#define FILEPCM_PREFIX "file:"
+
+/*!
+ * @brief Suffix appended to playback file name for the timestamp log.
+ */
+#define FILEPCM_TIMESTAMP_SUFFIX ".ts"
+
+/*!
+ * @brief Open a file-backed PCM.
+ *
+ * The PCM is a regular snd_pcm_t (ALSA I/O plugin created in-process),
+ * so all snd_pcm_*() functions including poll() work unchanged. The
+ * simulated device clock runs at the negotiated rate, deviated by ppm
+ * and optionally scaled to run faster than real time.
+ *
+ * Capture reads mono 16 bit samples from a sound file (multiple channels
+ * are mixed down), rewinding at end of file. The rate is the one of the
+ * file. Playback writes a 16 bit WAV file at the negotiated rate and,
+ * unless disabled, a text log with one line per write:
+ * "<write time us> <first frame> <frames>", preceded by a line
+ * "# start <time us> rate <rate> factor <clock factor>" on each start.
+ * Frame n of a start is played at start time + n / (rate * factor)
+ * in simulated time, so latency can be computed offline.
+ *
+ * Spec: "FILENAME[,ppm=N][,speed=X][,loop=0|1][,ts=0|1]"
+ *
+ * @param pcm PCM handle to return.
+ * @param spec file name and options (after FILEPCM_PREFIX).
+ * @param stream SND_PCM_STREAM_CAPTURE or SND_PCM_STREAM_PLAYBACK.
+ * @param mode open mode (e.g. SND_PCM_NONBLOCK).
+ * @return 0 on success, ALSA error code otherwise.
+ */
+int filepcm_open(snd_pcm_t **pcm, const char *spec,
+                 snd_pcm_stream_t stream, int mode);
+
+#endif /* _ANT_FILEPCM_H */
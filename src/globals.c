@@ -22,6 +22,7 @@
  */
 
 #include "globals.h"
+#include "logger.h"
 
 #include <stdarg.h>
 #include <stdio.h>
@@ -30,13 +31,14 @@
 
 /*--------------------------------------------------------------------------*/
 
-void msgprintf(int level _U_, const char *format, ...)
+void msgprintf(int level, const char *format, ...)
 {
   va_list args;
   va_start(args, format);
 
   /* for now just dump to stderr, TODO maybe make some elaborate UI for debug log */
-  vfprintf(stderr, format, args);
+  if (logger_vlog(level, format, args) < 0)
+    vfprintf(stderr, format, args);
 
   va_end(args);
 }
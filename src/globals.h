@@ -38,14 +38,27 @@ extern int debug;
 /*!
  * @brief Output a message.
  *
+ * While the logger is running, the message is queued and printed by the
+ * logger thread (see logger.h), so the calling thread never blocks.
+ *
  * @param level message level (0=error, 1..n=debug).
  * @param format printf-like format for following arguments.
  */
 void msgprintf(int level, const char *format, ...)
     __attribute__ ((format (printf, 2, 3)));
 
+/*!
+ * @brief Highest debug level compiled in (configure --with-max-debug-level).
+ *
+ * Debug messages above this level are removed at compile time.
+ */
+#ifndef MAX_DEBUG_LEVEL
+#define MAX_DEBUG_LEVEL 4
+#endif
+
 #define dbgprintf(level, ...) \
-  if (level <= debug) msgprintf(level, __VA_ARGS__)
+  if ((level) <= MAX_DEBUG_LEVEL && (level) <= debug) \
+    msgprintf(level, __VA_ARGS__)
 
 #define errprintf(...) \
   msgprintf(0, __VA_ARGS__)
@@ -313,7 +313,7 @@ static gint timeout_callback(gpointer data)
   }
 
   if (session->state == STATE_CONVERSATION) {
-    char *timediff = timediff_str(time(NULL), session->vcon_time);
+    char *timediff = timediff_str(time(NULL), session->call->vcon_time);
     char *buf;
 
     if (0 > asprintf(&buf, "%s %s",
@@ -431,8 +431,7 @@ static void cb_info_window(GtkWidget *widget _U_, gpointer data,
 			   guint action _U_)
 {
   session_t *session = (session_t *) data;
-  int inactive = session->option_release_devices &&
-    (session->state == STATE_READY || session->state == STATE_RINGING_QUIET);
+  int inactive = session->audio_state == AUDIO_DISCONNECTED;
   struct info_row_t rows[] = {
     { N_("Sound input device:"), strdup(session->audio_device_name_in)},
     { N_("Input speed:"), inactive ? strdup(_("[inactive]")) :
@@ -704,7 +703,7 @@ static gint entry_key_cb(GtkWidget *entry, GdkEventKey *event, gpointer data)
   session_t *session = (session_t *) data;
 
   if (event->keyval == GDK_KP_Enter) { /* catch keyboard keypad Enter */
-    gtk_button_clicked(GTK_BUTTON(session->pick_up_button));
+    gtk_handle_dial_entry(entry, session);
     /* the keyboard keypad Enter generates an unneeded character, so
        discard it: */
     gtk_signal_emit_stop_by_name(GTK_OBJECT(entry), "key-press-event");
@@ -786,11 +785,9 @@ static GtkWidget *get_dial_box(session_t *session)
   gtk_widget_show(session->call_pick_up_button);
 
   /* activate dial button when pressing enter in entry widget */
-  gtk_signal_connect_object(GTK_OBJECT(GTK_COMBO(session->dial_number_box)
-				       ->entry),
-			    "activate",
-			    GTK_SIGNAL_FUNC(gtk_button_clicked),
-			    GTK_OBJECT(session->pick_up_button));
+  gtk_signal_connect(GTK_OBJECT(GTK_COMBO(session->dial_number_box)->entry),
+                     "activate", GTK_SIGNAL_FUNC(gtk_handle_dial_entry),
+                     (gpointer) session);
   /* handle special keys */
   gtk_signal_connect(GTK_OBJECT(GTK_COMBO(session->dial_number_box)->entry),
                      "key-press-event", GTK_SIGNAL_FUNC(entry_key_cb), session);
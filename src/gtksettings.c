@@ -55,6 +55,26 @@ static char *filter_device_name(char *name)
   return res;
 }
 
+/*
+ * show the negotiated buffer and period times of the sound devices
+ * (from the last time they were opened)
+ */
+static void gtksettings_timing_show(GtkWidget *label, session_t *session) {
+  char *s;
+
+  if (!session->audio_timing_in.buffer_time) {
+    gtk_label_set_text(GTK_LABEL(label), _("[inactive]"));
+    return;
+  }
+  asprintf(&s, _("in %.1f / %.1f ms, out %.1f / %.1f ms"),
+	   session->audio_timing_in.buffer_time / 1000.0,
+	   session->audio_timing_in.period_time / 1000.0,
+	   session->audio_timing_out.buffer_time / 1000.0,
+	   session->audio_timing_out.period_time / 1000.0);
+  gtk_label_set_text(GTK_LABEL(label), s);
+  free(s);
+}
+
 /*
  * Load all settings from widgets into session
  * -> used by gtksettings_cb_ok and gtksettings_cb_save
@@ -72,6 +92,7 @@ static int gtksettings_try(GtkWidget *widget) {
   int successful = 1;
   GtkWidget *entry;
   GtkWidget *button;
+  GtkWidget *label;
   GSList *list;
 
   /* exec_on_incoming */
@@ -208,6 +229,24 @@ static int gtksettings_try(GtkWidget *widget) {
     errprintf(
 	    "gtksettings_cb_ok: Error getting release_devices state.\n");
 
+  /* standby time */
+  entry = (GtkWidget *) gtk_object_get_data(GTK_OBJECT(widget),
+					    "standby_entry");
+  if (entry)
+    session->option_standby_time =
+      strtoul(gtk_entry_get_text(GTK_ENTRY(entry)), NULL, 0);
+  else
+    errprintf("gtksettings_cb_ok: Error getting standby time.\n");
+
+  /* latency mode */
+  entry = (GtkWidget *) gtk_object_get_data(GTK_OBJECT(widget),
+					    "latency_combo");
+  if (entry && gtk_combo_box_get_active(GTK_COMBO_BOX(entry)) >= 0)
+    session->option_latency_mode =
+      gtk_combo_box_get_active(GTK_COMBO_BOX(entry));
+  else
+    errprintf("gtksettings_cb_ok: Error getting latency mode.\n");
+
   if (!session->option_release_devices) {
     if (session_set_audio_state(session, AUDIO_IDLE) < 0) {
       successful = 0;
@@ -222,6 +261,11 @@ static int gtksettings_try(GtkWidget *widget) {
     session_set_state(session, STATE_READY); /* update everything */
   }
 
+  label = (GtkWidget *) gtk_object_get_data(GTK_OBJECT(widget),
+					    "timing_label");
+  if (label)
+    gtksettings_timing_show(label, session);
+
   if (session->state == STATE_READY) {
     /* try to apply msn settings */
     if (isdn_setMSN(&session->isdn, session->msn) ||
@@ -262,6 +306,131 @@ static void gtksettings_cb_ok(GtkWidget *window) {
   }
 }
 
+/*
+ * calibration job, probed in a worker thread (the probe takes several
+ * seconds and the main loop must keep handling ISDN events meanwhile)
+ */
+typedef struct {
+  session_t *session;     /* session */
+  GtkWidget *window;      /* settings window, combo and label are */
+  GtkWidget *combo;       /* referenced while running, the window may be */
+  GtkWidget *label;       /* closed meanwhile */
+  char *in;               /* capture device */
+  char *out;              /* playback device */
+  audio_timing_t timing;  /* result */
+  int result;             /* 0 on success */
+  int stopped;            /* the session needed the devices meanwhile */
+} gtksettings_calibration_t;
+
+/*
+ * back in the main loop after calibration: store and show the result,
+ * give the devices back to the session
+ */
+static gboolean gtksettings_calibrate_done(gpointer data) {
+  gtksettings_calibration_t *job = (gtksettings_calibration_t *) data;
+  session_t *session = job->session;
+  char *s;
+
+  /* the worker is done, release its handle */
+  thread_stop(&session->thread_calibrate);
+
+  if (!job->result) {
+    settings_latency_write(job->in, job->out, &job->timing);
+    gtk_combo_box_set_active(GTK_COMBO_BOX(job->combo), AUDIO_LATENCY_LOW);
+    asprintf(&s, _("%.1f / %.1f ms"), job->timing.buffer_time / 1000.0,
+	     job->timing.period_time / 1000.0);
+    gtk_label_set_text(GTK_LABEL(job->label), s);
+    free(s);
+  } else if (job->stopped) {
+    gtk_label_set_text(GTK_LABEL(job->label), _("Calibration aborted"));
+  } else {
+    gtk_label_set_text(GTK_LABEL(job->label), _("Calibration failed"));
+  }
+  gtk_widget_set_sensitive(job->window, TRUE);
+
+  /* a call may have come in meanwhile, it owns the session then;
+     otherwise READY reopens or releases the devices as configured */
+  if (session->state == STATE_SERVICE)
+    session_set_state(session, STATE_READY);
+
+  gtk_widget_unref(job->label);
+  gtk_widget_unref(job->combo);
+  gtk_widget_unref(job->window);
+  free(job->in);
+  free(job->out);
+  free(job);
+  return FALSE;
+}
+
+/*
+ * calibration worker thread (session->thread_calibrate): stopped when the
+ * session opens the devices or exits, the result is dropped then
+ */
+static gpointer gtksettings_calibrate_thread(gpointer data) {
+  gtksettings_calibration_t *job = (gtksettings_calibration_t *) data;
+  thread_t *thread = &job->session->thread_calibrate;
+
+  job->result = audio_calibrate(job->in, job->out, default_audio_priorities,
+				ISDN_SPEED, &job->timing, thread);
+  job->stopped = thread_is_stopping(thread);
+  g_idle_add(gtksettings_calibrate_done, job);
+  return NULL;
+}
+
+/*
+ * clicked "Calibrate" at settings dialog (gtksettings_cb): find the
+ * smallest buffer the selected devices sustain and store it for them
+ */
+static void gtksettings_cb_calibrate(GtkWidget *window) {
+  session_t *session = gtk_object_get_data(GTK_OBJECT(window), "session");
+  GtkWidget *entry_in = gtk_object_get_data(GTK_OBJECT(window),
+					    "audio_device_name_in_entry");
+  GtkWidget *entry_out = gtk_object_get_data(GTK_OBJECT(window),
+					     "audio_device_name_out_entry");
+  GtkWidget *ok_window;
+  gtksettings_calibration_t *job;
+
+  if (session->state != STATE_READY || !session->audio_device_name_in) {
+    ok_window = ok_dialog_get(_("ANT Note"),
+			      _("Calibration is only possible while idle."),
+			      GTK_JUSTIFY_CENTER);
+    gtk_window_set_modal(GTK_WINDOW(ok_window), TRUE);
+    gtk_widget_show(ok_window);
+    return;
+  }
+
+  if (!(job = (gtksettings_calibration_t *)
+	calloc(1, sizeof(gtksettings_calibration_t)))) {
+    errprintf("GTK: Cannot allocate calibration job\n");
+    return;
+  }
+  job->session = session;
+  job->window = window;
+  job->combo = gtk_object_get_data(GTK_OBJECT(window), "latency_combo");
+  job->label = gtk_object_get_data(GTK_OBJECT(window), "calibrate_label");
+  job->in = filter_device_name(
+    strdup(gtk_entry_get_text(GTK_ENTRY(GTK_BIN(entry_in)->child))));
+  job->out = filter_device_name(
+    strdup(gtk_entry_get_text(GTK_ENTRY(GTK_BIN(entry_out)->child))));
+
+  /* the probe needs the devices for itself, no dialing meanwhile */
+  session_set_audio_state(session, AUDIO_DISCONNECTED);
+  session_set_state(session, STATE_SERVICE);
+
+  gtk_label_set_text(GTK_LABEL(job->label), _("Calibrating..."));
+  gtk_widget_set_sensitive(window, FALSE);
+  gtk_widget_ref(window);
+  gtk_widget_ref(job->combo);
+  gtk_widget_ref(job->label);
+
+  if (thread_start(&session->thread_calibrate, gtksettings_calibrate_thread,
+		   job)) {
+    errprintf("GTK: Cannot start calibration thread\n");
+    job->result = -1;
+    gtksettings_calibrate_done(job);
+  }
+}
+
 /* clicked "Save" button at settings dialog (gtksettings_cb) */
 static void gtksettings_cb_save(GtkWidget *widget) {
   session_t *session = gtk_object_get_data(GTK_OBJECT(widget),
@@ -318,6 +487,11 @@ void gtksettings_cb(GtkWidget *widget _U_, gpointer data, guint action _U_) {
   GtkWidget *audio_device_name_in_entry; /* sound devices page */
   GtkWidget *audio_device_name_out_entry;
   GtkWidget *release_checkbutton; 
+  GtkWidget *standby_entry;
+  GtkWidget *latency_combo;
+  GtkWidget *calibrate_label;
+  GtkWidget *timing_label;
+  GtkWidget *hbox;
   GtkWidget *recformat_radiobutton; /* recording format */
 
   GtkWidget *cid_calls_merge_checkbutton;
@@ -560,7 +734,7 @@ void gtksettings_cb(GtkWidget *widget _U_, gpointer data, guint action _U_) {
   gtk_box_pack_start(GTK_BOX(vbox), frame, FALSE, FALSE, 0);
   gtk_widget_show(frame);
 
-  table = gtk_table_new(3,2, FALSE); /* rows, columns, not homogeneous */
+  table = gtk_table_new(6,2, FALSE); /* rows, columns, not homogeneous */
   gtk_container_add(GTK_CONTAINER(frame), table);
   gtk_container_set_border_width(GTK_CONTAINER(table), 5);
   gtk_table_set_row_spacings(GTK_TABLE(table), 5);
@@ -602,6 +776,62 @@ void gtksettings_cb(GtkWidget *widget _U_, gpointer data, guint action _U_) {
   gtk_table_attach_defaults(GTK_TABLE(table), release_checkbutton, 0,2,2,3);
   gtk_widget_show(release_checkbutton);
 
+  label = gtk_label_new(_("Standby before release (seconds):"));
+  gtk_table_attach_defaults(GTK_TABLE(table), label, 0,1,3,4);
+  gtk_misc_set_alignment(GTK_MISC(label), 1, 0.5);
+  gtk_widget_show(label);
+
+  standby_entry = gtk_entry_new();
+  gtk_table_attach_defaults(GTK_TABLE(table), standby_entry, 1,2,3,4);
+  asprintf(&s, "%u", session->option_standby_time);
+  gtk_entry_set_text(GTK_ENTRY(standby_entry), s);
+  free(s);
+  gtk_widget_set_sensitive(standby_entry, session->option_release_devices);
+  gtk_signal_connect(GTK_OBJECT(release_checkbutton), "toggled",
+                     GTK_SIGNAL_FUNC(toggle_sensitive_register),
+		     standby_entry);
+  gtk_widget_show(standby_entry);
+
+  label = gtk_label_new(_("Latency:"));
+  gtk_table_attach_defaults(GTK_TABLE(table), label, 0,1,4,5);
+  gtk_misc_set_alignment(GTK_MISC(label), 1, 0.5);
+  gtk_widget_show(label);
+
+  hbox = gtk_hbox_new(FALSE, 5);
+  gtk_table_attach_defaults(GTK_TABLE(table), hbox, 1,2,4,5);
+  gtk_widget_show(hbox);
+
+  latency_combo = gtk_combo_box_new_text(); /* audio_latency_t order */
+  gtk_combo_box_append_text(GTK_COMBO_BOX(latency_combo), _("Low"));
+  gtk_combo_box_append_text(GTK_COMBO_BOX(latency_combo), _("Normal"));
+  gtk_combo_box_append_text(GTK_COMBO_BOX(latency_combo), _("Safe"));
+  gtk_combo_box_set_active(GTK_COMBO_BOX(latency_combo),
+			   session->option_latency_mode);
+  gtk_box_pack_start(GTK_BOX(hbox), latency_combo, FALSE, FALSE, 0);
+  gtk_widget_show(latency_combo);
+
+  button = gtk_button_new_with_label(_("Calibrate"));
+  gtk_box_pack_start(GTK_BOX(hbox), button, FALSE, FALSE, 0);
+  gtk_signal_connect_object(GTK_OBJECT(button), "clicked",
+			    GTK_SIGNAL_FUNC(gtksettings_cb_calibrate),
+			    GTK_OBJECT(window));
+  gtk_widget_show(button);
+
+  calibrate_label = gtk_label_new("");
+  gtk_box_pack_start(GTK_BOX(hbox), calibrate_label, FALSE, FALSE, 0);
+  gtk_widget_show(calibrate_label);
+
+  label = gtk_label_new(_("Buffer / period:"));
+  gtk_table_attach_defaults(GTK_TABLE(table), label, 0,1,5,6);
+  gtk_misc_set_alignment(GTK_MISC(label), 1, 0.5);
+  gtk_widget_show(label);
+
+  timing_label = gtk_label_new("");
+  gtk_misc_set_alignment(GTK_MISC(timing_label), 0, 0.5);
+  gtksettings_timing_show(timing_label, session);
+  gtk_table_attach_defaults(GTK_TABLE(table), timing_label, 1,2,5,6);
+  gtk_widget_show(timing_label);
+
   /* action area */
   button_box = gtk_hbutton_box_new();
   gtk_container_add(GTK_CONTAINER(GTK_DIALOG(window)->action_area),
@@ -640,6 +870,14 @@ void gtksettings_cb(GtkWidget *widget _U_, gpointer data, guint action _U_) {
 		      (gpointer) audio_device_name_out_entry);
   gtk_object_set_data(GTK_OBJECT(window), "release_checkbutton",
 		      (gpointer) release_checkbutton);
+  gtk_object_set_data(GTK_OBJECT(window), "standby_entry",
+		      (gpointer) standby_entry);
+  gtk_object_set_data(GTK_OBJECT(window), "latency_combo",
+		      (gpointer) latency_combo);
+  gtk_object_set_data(GTK_OBJECT(window), "calibrate_label",
+		      (gpointer) calibrate_label);
+  gtk_object_set_data(GTK_OBJECT(window), "timing_label",
+		      (gpointer) timing_label);
 
   gtk_signal_connect_object(GTK_OBJECT(button), "clicked",
 			    GTK_SIGNAL_FUNC(gtksettings_cb_ok),
@@ -42,6 +42,8 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <poll.h>
+#include <math.h>
 
 /* ISDN CAPI header */
 #include <capi20.h>
@@ -49,11 +51,42 @@
 /* own header files */
 #include "globals.h"
 #include "isdn.h"
+#include "isdnloop.h"
+#include "probes.h"
+#include "mediaclock.h"
 
 static char* calls_filenames[] =
 { "/var/lib/isdn/calls", "/var/log/isdn/calls", "/var/log/isdn.log" };
 char* isdn_calls_filename_from_config = NULL;
 
+/*!
+ * @brief PLCI part of an NCCI.
+ */
+#define ISDN_NCCI_PLCI(ncci) ((ncci) & 0xffff)
+
+/*!
+ * @brief Maximum number of CAPI messages processed per wake-up of the
+ * reply thread, before it looks at stop requests and activation again.
+ */
+#define ISDN_REPLY_BATCH 64
+
+/*!
+ * @brief Interval to check the CAPI queue (ms), only if the CAPI library
+ * offers no file descriptor to poll on.
+ */
+#define ISDN_REPLY_POLL_INTERVAL 20
+
+/*!
+ * @brief CAPI facility selector of DTMF.
+ */
+#define ISDN_FACILITY_DTMF 1
+
+/*!
+ * @brief Functions of the DTMF facility.
+ */
+#define ISDN_DTMF_LISTEN_START 1
+#define ISDN_DTMF_SEND 3
+
 
 /*!
  * @brief Initiate listen on ISDN device.
@@ -65,7 +98,9 @@ char* isdn_calls_filename_from_config = NULL;
 static int isdn_listen(isdn_t *isdn, unsigned int controller);
 
 /*!
- * @brief Check if listening on MSN.
+ * @brief Check if listening on MSN (isdn->lock held).
+ *
+ * Walks the compiled listen set, no allocation, no parsing.
  *
  * @param isdn ISDN device structure.
  * @param msn local MSN to check.
@@ -73,29 +108,87 @@ static int isdn_listen(isdn_t *isdn, unsigned int controller);
  */
 static int isdn_is_listening(isdn_t *isdn, char *msn);
 
+/*!
+ * @brief Compile a listen set string into a digit trie.
+ *
+ * @param msns comma- or semicolon-separated MSNs, '*' at the end of an
+ *        entry matches any rest.
+ * @param set compiled set (filled in).
+ * @return number of invalid entries (reported and left out), -1 if out
+ *         of memory.
+ */
+static int isdn_msn_compile(const char *msns, isdn_msn_set_t *set);
+
+/*!
+ * @brief Free a compiled listen set.
+ *
+ * @param set compiled set.
+ */
+static void isdn_msn_free(isdn_msn_set_t *set);
+
 /*!
  * @brief Set local number on ISDN connection object.
  *
- * @param isdn ISDN device structure.
+ * @param call ISDN call.
  * @param number local number (in ISDN format).
  */
-static void isdn_set_local_number(isdn_t *isdn, char *number);
+static void isdn_set_local_number(isdn_call_t *call, char *number);
 
 /*!
  * @brief Set remote number on ISDN connection object.
  *
- * @param isdn ISDN device structure.
+ * @param call ISDN call.
  * @param number remote number (in ISDN format).
  */
-static void isdn_set_remote_number(isdn_t *isdn, char *number);
+static void isdn_set_remote_number(isdn_call_t *call, char *number);
+
+/*!
+ * @brief Get an idle call for a new connection (isdn->lock held).
+ *
+ * @param isdn ISDN device structure.
+ * @return call, NULL if all calls are in use.
+ */
+static isdn_call_t *isdn_call_alloc(isdn_t *isdn);
+
+/*!
+ * @brief Find the call of a physical connection (isdn->lock held).
+ *
+ * @param isdn ISDN device structure.
+ * @param plci PLCI (or the PLCI part of an NCCI).
+ * @return call, NULL if no call uses the PLCI.
+ */
+static isdn_call_t *isdn_call_by_plci(isdn_t *isdn, unsigned int plci);
+
+/*!
+ * @brief Find the call of a logical connection.
+ *
+ * Used by the media path without isdn->lock, the NCCI of a call only
+ * changes while it is not connected.
+ *
+ * @param isdn ISDN device structure.
+ * @param ncci NCCI.
+ * @return call, NULL if no call uses the NCCI.
+ */
+static isdn_call_t *isdn_call_by_ncci(isdn_t *isdn, unsigned int ncci);
+
+/*!
+ * @brief Mark call idle and notify the application (isdn->lock held).
+ *
+ * @param isdn ISDN device structure.
+ * @param call ISDN call.
+ * @param error CAPI error number, 0 for normal disconnect.
+ */
+static void isdn_call_release(isdn_t *isdn, isdn_call_t *call,
+                              unsigned int error);
 
 /*!
  * @brief Trigger disconnect on ISDN connection.
  *
  * @param isdn ISDN device structure.
+ * @param call ISDN call.
  * @return 0 on success, -1 on error.
  */
-static int isdn_trigger_disconnect(isdn_t *isdn);
+static int isdn_trigger_disconnect(isdn_t *isdn, isdn_call_t *call);
 
 /*!
  * @brief Handle CAPI confirmation message.
@@ -113,13 +206,163 @@ static void isdn_handle_confirmation(isdn_t *isdn, _cmsg *msg);
  */
 static void isdn_handle_indication(isdn_t *isdn, _cmsg *msg);
 
+/*!
+ * @brief Handle CAPI DATA_B3 indication (media path).
+ *
+ * Called without isdn->lock held, so a busy signalling path never
+ * delays the acknowledgement of received data. The data is passed to
+ * the application (which copies it) and DATA_B3_RESP is sent at once
+ * to free the CAPI receive buffer.
+ *
+ * @param isdn ISDN device structure.
+ * @param msg message to process.
+ */
+static void isdn_handle_data_indication(isdn_t *isdn, _cmsg *msg);
+
+/*!
+ * @brief Handle CAPI DATA_B3 confirmation (media path).
+ *
+ * Releases the confirmed block and sends queued data. Called without
+ * isdn->lock held.
+ *
+ * @param isdn ISDN device structure.
+ * @param msg message to process.
+ */
+static void isdn_handle_data_confirmation(isdn_t *isdn, _cmsg *msg);
+
+/*!
+ * @brief Reset outgoing data window (call with data_lock held).
+ *
+ * @param call ISDN call.
+ */
+static void isdn_tx_reset(isdn_call_t *call);
+
+/*!
+ * @brief Send a DTMF FACILITY_REQ on the logical connection of a call.
+ *
+ * @param isdn ISDN device structure.
+ * @param call ISDN call (connected).
+ * @param function ISDN_DTMF_LISTEN_START or ISDN_DTMF_SEND.
+ * @param digits digits to send, "" to listen.
+ * @return 0 on success, -1 otherwise.
+ */
+static int isdn_dtmf_request(isdn_t *isdn, isdn_call_t *call,
+                             unsigned int function, const char *digits);
+
+/*!
+ * @brief Add a measurement point and update the rate estimate.
+ *
+ * @param speed speed measurement (samples and delta of the point set).
+ */
+static void isdn_speed_point(isdn_speed_t *speed);
+
+/*!
+ * @brief Allocate the next CAPI message number.
+ *
+ * Requests go out from several threads under different locks (lock for
+ * signalling, data_lock for data), so the counter is atomic.
+ *
+ * @param isdn ISDN device structure.
+ * @return message number (16 bit).
+ */
+static unsigned int isdn_msgno(isdn_t *isdn);
+
+/*!
+ * @brief Send queued data while free blocks are available (call with
+ *        data_lock held).
+ *
+ * @param isdn ISDN device structure.
+ * @param call ISDN call.
+ */
+static void isdn_tx_flush(isdn_t *isdn, isdn_call_t *call);
+
+/*!
+ * @brief Get the next CAPI message and process it.
+ *
+ * @param isdn ISDN device structure.
+ * @return 0 if a message was processed, 1 if the queue is empty, -1 on
+ *         error.
+ */
+static int isdn_reply_dispatch(isdn_t *isdn);
+
 /*!
  * @brief ISDN processing thread.
  *
+ * Sleeps in poll() on the CAPI file descriptor and the thread's wake-up
+ * pipe, then drains the CAPI queue. Activation changes and thread_stop()
+ * take effect immediately.
+ *
  * @param param ISDN device structure.
  */
 static gpointer isdn_reply_thread(gpointer param);
 
+/*!
+ * @brief Read the profiles of all controllers into isdn->ctrl.
+ *
+ * @param isdn ISDN device structure.
+ * @return number of controllers with voice capability, -1 on error.
+ */
+static int isdn_capi_profiles(isdn_t *isdn);
+
+/*!
+ * @brief Listen on all controllers with voice capability.
+ *
+ * @param isdn ISDN device structure.
+ * @return 0 on success, -1 on error.
+ */
+static int isdn_capi_listen_all(isdn_t *isdn);
+
+/*!
+ * @brief Pick the controller for an outgoing call (isdn->lock held).
+ *
+ * Only controllers with voice capability are used, the one with the most
+ * free B-channels wins (the lowest number on a tie).
+ *
+ * @param isdn ISDN device structure.
+ * @return controller number, 0 if no B-channel is free.
+ */
+static unsigned int isdn_capi_controller(isdn_t *isdn);
+
+static int isdn_capi_open(isdn_t *isdn);
+static int isdn_capi_close(isdn_t *isdn);
+static int isdn_capi_activate(isdn_t *isdn, unsigned int active);
+static int isdn_capi_dial(isdn_t *isdn, unsigned int controller, char *number);
+static int isdn_capi_hangup(isdn_t *isdn, unsigned int call);
+static int isdn_capi_pickup(isdn_t *isdn, unsigned int call);
+static int isdn_capi_send_data(isdn_t *isdn, unsigned int call,
+                               unsigned char *data, unsigned int datalen);
+static int isdn_capi_send_dtmf(isdn_t *isdn, unsigned int call,
+                               const char *digits);
+
+/*!
+ * @brief ISDN backend using a CAPI 2.0 controller.
+ */
+static const isdn_backend_t isdn_capi_backend = {
+  "capi",
+  NULL,
+  isdn_capi_open,
+  isdn_capi_close,
+  isdn_capi_activate,
+  isdn_capi_dial,
+  isdn_capi_hangup,
+  isdn_capi_pickup,
+  isdn_capi_send_data,
+  isdn_capi_send_dtmf
+};
+
+/*!
+ * @brief Available ISDN backends, first one is the default.
+ */
+static const isdn_backend_t *isdn_backends[] = {
+  &isdn_capi_backend,
+  &isdn_loop_backend
+};
+
+/*!
+ * @brief Backend used by open_isdn_device().
+ */
+static const isdn_backend_t *isdn_backend = &isdn_capi_backend;
+
 /*--------------------------------------------------------------------------*/
 
 static int isdn_listen(isdn_t *isdn, unsigned int controller)
@@ -132,7 +375,7 @@ static int isdn_listen(isdn_t *isdn, unsigned int controller)
           isdn->info_mask, isdn->cip_mask);
 
   g_mutex_lock(isdn->data_lock);
-  info = LISTEN_REQ(&CMSG, isdn->appl_id, isdn->msg_no++, controller,
+  info = LISTEN_REQ(&CMSG, isdn->appl_id, isdn_msgno(isdn), controller,
                      isdn->info_mask, isdn->cip_mask, 0, NULL, NULL);
   g_mutex_unlock(isdn->data_lock);
 
@@ -145,9 +388,9 @@ static int isdn_listen(isdn_t *isdn, unsigned int controller)
 
 /*--------------------------------------------------------------------------*/
 
-static void isdn_set_remote_number(isdn_t *isdn, char *number)
+static void isdn_set_remote_number(isdn_call_t *call, char *number)
 {
-  char *tmp, *tofree = isdn->remote_number;
+  char *tmp, *tofree = call->remote_number;
 
   if (number) {
     /* Number format:
@@ -158,15 +401,15 @@ static void isdn_set_remote_number(isdn_t *isdn, char *number)
      */
     int len = number[0] - 2;
     if (len <= 0) {
-      isdn->remote_number = 0;
+      call->remote_number = 0;
     } else {
       tmp = (char*) malloc(len + 1);
       memcpy(tmp, number + 3, len);
       tmp[len] = 0;
-      isdn->remote_number = tmp;
+      call->remote_number = tmp;
     }
   } else {
-    isdn->remote_number = 0;
+    call->remote_number = 0;
   }
 
   if (tofree)
@@ -175,9 +418,9 @@ static void isdn_set_remote_number(isdn_t *isdn, char *number)
 
 /*--------------------------------------------------------------------------*/
 
-static void isdn_set_local_number(isdn_t *isdn, char *number)
+static void isdn_set_local_number(isdn_call_t *call, char *number)
 {
-  char *tmp, *tofree = isdn->local_number;
+  char *tmp, *tofree = call->local_number;
 
   if (number) {
     /* Number format:
@@ -187,15 +430,15 @@ static void isdn_set_local_number(isdn_t *isdn, char *number)
      */
     int len = number[0] - 1;
     if (len <= 0) {
-      isdn->local_number = 0;
+      call->local_number = 0;
     } else {
       tmp = (char*) malloc(len + 1);
       memcpy(tmp, number + 2, len);
       tmp[len] = 0;
-      isdn->local_number = tmp;
+      call->local_number = tmp;
     }
   } else {
-    isdn->local_number = 0;
+    call->local_number = 0;
   }
 
   if (tofree)
@@ -206,75 +449,177 @@ static void isdn_set_local_number(isdn_t *isdn, char *number)
 
 static int isdn_is_listening(isdn_t *isdn, char *msn)
 {
-  char *cur, *p, *end, *tocheck;
-  int wildcard, msnlen;
+  const isdn_msn_node_t *node = isdn->listen.node;
+  const char *p = msn;
+  unsigned int n = 0;
 
-  if (!msn || !*msn || strcmp(msn, "0") == 0 || !isdn->listen_msns) {
+  if (!msn || !*msn || strcmp(msn, "0") == 0 || !node) {
     /* empty MSN or no MSNS set, accept */
     return TRUE;
   }
 
-  p = isdn->listen_msns;
-  tocheck = isdn->local_number;
-  msnlen = strlen(tocheck);
-
-  dbgprintf(1, "Checking MSN '%s' against listen set '%s'\n", tocheck, p);
+  dbgprintf(2, "Checking MSN '%s' against listen set\n", msn);
 
   for (;;) {
-    /* process next entry */
+    if (node[n].wildcard)
+      return TRUE;  /* prefix matched, wildcard allowed */
+    if (!*p)
+      return node[n].exact;
+    if (*p < '0' || *p > '9' || !(n = node[n].next[*p - '0']))
+      return FALSE; /* no entry continues with this digit */
+    ++p;
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int isdn_msn_compile(const char *msns, isdn_msn_set_t *set)
+{
+  const char *p, *cur, *end, *q;
+  unsigned int n, digits = 0;
+  int invalid = 0;
+
+  set->node = NULL;
+  set->count = 0;
+
+  /* one node per digit at most, plus the root */
+  for (p = msns; *p; ++p) {
+    if (isdigit((unsigned char) *p))
+      ++digits;
+  }
+  set->node = (isdn_msn_node_t*) calloc(digits + 1, sizeof(isdn_msn_node_t));
+  if (!set->node) {
+    errprintf("ISDN: Cannot allocate MSN listen set\n");
+    return -1;
+  }
+  set->count = 1;
 
+  for (p = msns;;) {
     /* position to next MSN */
-    while (*p && (*p == ',' || *p == ';' || isspace(*p)))
+    while (*p && (*p == ',' || *p == ';' || isspace((unsigned char) *p)))
       ++p;
     if (!*p)
       break;
 
-    cur = p;
-
     /* find end of MSN in listen set */
+    cur = p;
     while (*p && *p != ',' && *p != ';')
       ++p;
     end = p;
-
-    while (end > cur && isspace(*(end-1)))
+    while (end > cur && isspace((unsigned char) *(end-1)))
       --end;
 
-    if (end == cur)
-      continue;   /* empty entry */
+    /* digits, optionally followed by a single '*' */
+    for (q = cur; q < end && isdigit((unsigned char) *q); ++q)
+      ;
+    if (q < end && !(*q == '*' && q + 1 == end)) {
+      errprintf("ISDN: Invalid MSN '%.*s' in listen set, ignored\n",
+                (int) (end - cur), cur);
+      ++invalid;
+      continue;
+    }
 
-    /* OK, entry is between cur and end */
-    if (*(end-1) == '*') {
-      wildcard = 1;
-      --end;
-    } else {
-      wildcard = 0;
+    /* insert the digits, then mark the end */
+    n = 0;
+    for (q = cur; q < end && isdigit((unsigned char) *q); ++q) {
+      if (!set->node[n].next[*q - '0'])
+        set->node[n].next[*q - '0'] = set->count++;
+      n = set->node[n].next[*q - '0'];
     }
+    if (q < end)
+      set->node[n].wildcard = 1;
+    else
+      set->node[n].exact = 1;
+  }
 
-    /* check prefix */
-    if (msnlen < (end - cur))
-      continue;     /* MSN too short, cannot match */
-    if (strncmp(tocheck, cur, (end-cur)) != 0)
-      continue;     /* prefix doesn't match */
+  dbgprintf(2, "ISDN: Listen set '%s' compiled to %u nodes\n",
+            msns, set->count);
+  return invalid;
+}
 
-    if (wildcard)
-      return TRUE;  /* prefix matched, wildcard allowed */
-    if (msnlen == (end-cur))
-      return TRUE;  /* exact match */
+/*--------------------------------------------------------------------------*/
+
+static void isdn_msn_free(isdn_msn_set_t *set)
+{
+  free(set->node);
+  set->node = NULL;
+  set->count = 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static isdn_call_t *isdn_call_alloc(isdn_t *isdn)
+{
+  isdn_call_t *call;
+  unsigned int i;
+
+  for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+    call = &isdn->call[i];
+    if (call->state == ISDN_IDLE) {
+      call->plci = 0;
+      call->ncci = 0;
+      call->controller = 0;
+      isdn_set_remote_number(call, NULL);
+      isdn_set_local_number(call, NULL);
+      return call;
+    }
+  }
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static isdn_call_t *isdn_call_by_plci(isdn_t *isdn, unsigned int plci)
+{
+  unsigned int i;
+
+  for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+    if (isdn->call[i].state != ISDN_IDLE && isdn->call[i].plci == plci)
+      return &isdn->call[i];
+  }
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static isdn_call_t *isdn_call_by_ncci(isdn_t *isdn, unsigned int ncci)
+{
+  unsigned int i;
+
+  for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+    if (isdn->call[i].ncci == ncci && isdn->call[i].state != ISDN_IDLE)
+      return &isdn->call[i];
   }
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------*/
 
-  /* no matching entry found */
-  return FALSE;
+static void isdn_call_release(isdn_t *isdn, isdn_call_t *call,
+                              unsigned int error)
+{
+  call->state = ISDN_IDLE;
+  call->plci = 0;
+  call->ncci = 0;
+
+  if (error != 0) {
+    isdn->callback->info_error(isdn->cb_context,
+                               ISDN_CALL_NUMBER(isdn, call), error);
+  } else {
+    isdn->callback->info_disconnected(isdn->cb_context,
+                                      ISDN_CALL_NUMBER(isdn, call));
+  }
 }
 
 /*--------------------------------------------------------------------------*/
 
-static int isdn_trigger_disconnect(isdn_t *isdn)
+static int isdn_trigger_disconnect(isdn_t *isdn, isdn_call_t *call)
 {
   unsigned int info;
   int result = 0;
   _cmsg CMSG;  /* structure for the message */
 
-  switch (isdn->state) {
+  switch (call->state) {
     case ISDN_CONNECT_WAIT:
     case ISDN_CONNECT_ACTIVE:
     case ISDN_DISCONNECT_B3_REQ:
@@ -283,21 +628,20 @@ static int isdn_trigger_disconnect(isdn_t *isdn)
       /* no data channel yet or no reply to data disconnect, do physical disconnect */
       {
         dbgprintf(1, "CAPI 2.0: DISCONNECT_REQ ApplID %d plci 0x%x\n",
-                  isdn->appl_id, isdn->active_plci);
+                  isdn->appl_id, call->plci);
 
         g_mutex_lock(isdn->data_lock);
-        info = DISCONNECT_REQ(&CMSG, isdn->appl_id, isdn->msg_no++,
-                              isdn->active_plci,  /* physical connection ID */
+        info = DISCONNECT_REQ(&CMSG, isdn->appl_id, isdn_msgno(isdn),
+                              call->plci,  /* physical connection ID */
                               0, 0, 0, 0 /* additional info */);
         g_mutex_unlock(isdn->data_lock);
 
         if (info != 0) {
           errprintf("CAPI 2.0: DISCONNECT_REQ failed, RC=0x%x\n", info);
-          isdn->state = ISDN_IDLE;
-          isdn->callback->info_error(isdn->cb_context, info);
+          isdn_call_release(isdn, call, info);
           result = -1;
         } else {
-          isdn->state = ISDN_DISCONNECT_ACTIVE;
+          call->state = ISDN_DISCONNECT_ACTIVE;
         }
       }
       break;
@@ -307,11 +651,11 @@ static int isdn_trigger_disconnect(isdn_t *isdn)
       /* both data and physical connection active, tear down data channel */
       {
         dbgprintf(1, "CAPI 2.0: DISCONNECT_B3_REQ ApplID %d ncci 0x%x\n",
-                  isdn->appl_id, isdn->active_ncci);
+                  isdn->appl_id, call->ncci);
 
         g_mutex_lock(isdn->data_lock);
-        info = DISCONNECT_B3_REQ(&CMSG, isdn->appl_id, isdn->msg_no++,
-                                 isdn->active_ncci,  /* logical connection ID */
+        info = DISCONNECT_B3_REQ(&CMSG, isdn->appl_id, isdn_msgno(isdn),
+                                 call->ncci,  /* logical connection ID */
                                  NULL /* NCPI */);
         g_mutex_unlock(isdn->data_lock);
 
@@ -320,24 +664,23 @@ static int isdn_trigger_disconnect(isdn_t *isdn)
 
           /* retry with disconnect on whole connection */
           dbgprintf(1, "CAPI 2.0: DISCONNECT_REQ ApplID %d plci 0x%x\n",
-                    isdn->appl_id, isdn->active_plci);
+                    isdn->appl_id, call->plci);
 
           g_mutex_lock(isdn->data_lock);
-          info = DISCONNECT_REQ(&CMSG, isdn->appl_id, isdn->msg_no++,
-                                 isdn->active_plci,  /* physical connection ID */
+          info = DISCONNECT_REQ(&CMSG, isdn->appl_id, isdn_msgno(isdn),
+                                 call->plci,  /* physical connection ID */
                                  0, 0, 0, 0 /* additional info */);
           g_mutex_unlock(isdn->data_lock);
 
           if (info != 0) {
             errprintf("CAPI 2.0: DISCONNECT_REQ failed, RC=0x%x\n", info);
-            isdn->state = ISDN_IDLE;
-            isdn->callback->info_error(isdn->cb_context, info);
+            isdn_call_release(isdn, call, info);
             result = -1;
           } else {
-            isdn->state = ISDN_DISCONNECT_ACTIVE;
+            call->state = ISDN_DISCONNECT_ACTIVE;
           }
         } else {
-          isdn->state = ISDN_DISCONNECT_B3_REQ;
+          call->state = ISDN_DISCONNECT_B3_REQ;
         }
       }
       break;
@@ -346,11 +689,11 @@ static int isdn_trigger_disconnect(isdn_t *isdn)
       /* reject the call */
       {
         dbgprintf(2, "CAPI 2.0: CONNECT_RESP ApplID %d msgno %d plci 0x%x reject %d\n",
-                  isdn->appl_id, isdn->msg_no, isdn->active_plci, 3);
+                  isdn->appl_id, isdn->msg_no, call->plci, 3);
 
         g_mutex_lock(isdn->data_lock);
-        info = CONNECT_RESP(&CMSG, isdn->appl_id, isdn->msg_no++,
-                            isdn->active_plci, 3 /* reject */,
+        info = CONNECT_RESP(&CMSG, isdn->appl_id, isdn_msgno(isdn),
+                            call->plci, 3 /* reject */,
                             0 /* B1protocol: default */,
                             0 /* B2protocol: default */,
                             0 /* default B3protocol */,
@@ -360,18 +703,15 @@ static int isdn_trigger_disconnect(isdn_t *isdn)
                             NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL /* additional info */);
         g_mutex_unlock(isdn->data_lock);
 
-        isdn->state = ISDN_IDLE;
-        if (info != 0) {
+        if (info != 0)
           errprintf("CAPI 2.0: CONNECT_RESP failed, RC=0x%x\n", info);
-          isdn->callback->info_error(isdn->cb_context, info);
-        } else {
-          isdn->callback->info_disconnected(isdn->cb_context);
-        }
+        isdn_call_release(isdn, call, info);
       }
       break;
 
     default:
-      errprintf("ISDN in unexpected state %d on disconnect\n", isdn->state);
+      errprintf("ISDN call %u in unexpected state %d on disconnect\n",
+                ISDN_CALL_NUMBER(isdn, call), call->state);
       result = -1;
       break;
   }
@@ -383,7 +723,11 @@ static int isdn_trigger_disconnect(isdn_t *isdn)
 
 static void isdn_handle_confirmation(isdn_t *isdn, _cmsg *msg)
 {
-  unsigned int info, plci, ncci, controller;
+  unsigned int info, plci, ncci, controller, selector, i;
+  _cstruct param;
+  isdn_call_t *call;
+
+  ANT_PROBE3(capi_message, msg->Command, msg->Subcommand, msg->Messagenumber);
 
   switch (msg->Command) {
 
@@ -396,12 +740,16 @@ static void isdn_handle_confirmation(isdn_t *isdn, _cmsg *msg)
         dbgprintf(2, "CAPI 2.0: ALERT_CONF ApplID %d plci 0x%x info 0x%x\n",
                   isdn->appl_id, plci, info);
 
-        if (info != 0 && info != 3) {
+        if (!(call = isdn_call_by_plci(isdn, plci))) {
+          errprintf("CAPI 2.0: ALERT_CONF for unknown plci 0x%x\n", plci);
+        } else if (info != 0 && info != 3) {
           /* connection error */
-          isdn->state = ISDN_IDLE;
+          call->state = ISDN_IDLE;
         } else {
           /* may ring now */
-          isdn->callback->info_ring(isdn->cb_context, isdn->remote_number, isdn->local_number);
+          isdn->callback->info_ring(isdn->cb_context,
+                                    ISDN_CALL_NUMBER(isdn, call),
+                                    call->remote_number, call->local_number);
         }
       }
       break;
@@ -412,17 +760,26 @@ static void isdn_handle_confirmation(isdn_t *isdn, _cmsg *msg)
         plci = CONNECT_CONF_PLCI(msg);
         info = CONNECT_CONF_INFO(msg);
 
-        dbgprintf(2, "CAPI 2.0: CONNECT_CONF ApplID %d plci 0x%x info 0x%x\n",
-                  isdn->appl_id, plci, info);
+        dbgprintf(2, "CAPI 2.0: CONNECT_CONF ApplID %d msgno %d plci 0x%x info 0x%x\n",
+                  isdn->appl_id, msg->Messagenumber, plci, info);
 
-        if (info != 0) {
+        /* the PLCI is new, find the call by the number of the request */
+        for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+          call = &isdn->call[i];
+          if (call->state == ISDN_CONNECT_REQ &&
+              call->req_msgno == msg->Messagenumber)
+            break;
+        }
+        if (i == ISDN_MAX_CALLS) {
+          errprintf("CAPI 2.0: CONNECT_CONF for unknown request %d\n",
+                    msg->Messagenumber);
+        } else if (info != 0) {
           /* connection error */
-          isdn->state = ISDN_IDLE;
-          isdn->callback->info_error(isdn->cb_context, info);
+          isdn_call_release(isdn, call, info);
         } else {
           /* CONNECT_ACTIVE_IND comes later, when connection actually established */
-          isdn->state = ISDN_CONNECT_WAIT;
-          isdn->active_plci = plci;
+          call->state = ISDN_CONNECT_WAIT;
+          call->plci = plci;
         }
       }
       break;
@@ -436,19 +793,22 @@ static void isdn_handle_confirmation(isdn_t *isdn, _cmsg *msg)
         dbgprintf(2, "CAPI 2.0: CONNECT_B3_CONF ApplID %d ncci 0x%x info 0x%x\n",
                   isdn->appl_id, ncci, info);
 
-        if (isdn->state == ISDN_CONNECT_ACTIVE) {
+        if (!(call = isdn_call_by_plci(isdn, ISDN_NCCI_PLCI(ncci)))) {
+          errprintf("CAPI 2.0: CONNECT_B3_CONF for unknown ncci 0x%x\n", ncci);
+        } else if (call->state == ISDN_CONNECT_ACTIVE) {
           if (info != 0) {
             /* connection error */
-            isdn->callback->info_error(isdn->cb_context, info);
-            isdn_trigger_disconnect(isdn);
+            isdn->callback->info_error(isdn->cb_context,
+                                       ISDN_CALL_NUMBER(isdn, call), info);
+            isdn_trigger_disconnect(isdn, call);
           } else {
             /* CONNECT_B3_ACTIVE_IND comes later, when connection actually established */
-            isdn->active_ncci = ncci;
-            isdn->state = ISDN_CONNECT_B3_WAIT;
+            call->ncci = ncci;
+            call->state = ISDN_CONNECT_B3_WAIT;
           }
         } else {
           /* wrong connection state for B3 connect, trigger disconnect */
-          isdn_trigger_disconnect(isdn);
+          isdn_trigger_disconnect(isdn, call);
         }
       }
       break;
@@ -477,14 +837,17 @@ static void isdn_handle_confirmation(isdn_t *isdn, _cmsg *msg)
         dbgprintf(2, "CAPI 2.0: DISCONNECT_B3_CONF ApplID %d ncci 0x%x info 0x%x\n",
                   isdn->appl_id, ncci, info);
 
-        if (info != 0) {
+        if (!(call = isdn_call_by_plci(isdn, ISDN_NCCI_PLCI(ncci)))) {
+          errprintf("CAPI 2.0: DISCONNECT_B3_CONF for unknown ncci 0x%x\n", ncci);
+        } else if (info != 0) {
           /* error, most probably NCCI not known */
-          isdn->callback->info_error(isdn->cb_context, info);
-          isdn->state = ISDN_DISCONNECT_B3_WAIT;
-          isdn_trigger_disconnect(isdn);
+          isdn->callback->info_error(isdn->cb_context,
+                                     ISDN_CALL_NUMBER(isdn, call), info);
+          call->state = ISDN_DISCONNECT_B3_WAIT;
+          isdn_trigger_disconnect(isdn, call);
         } else {
           /* DISCONNECT_B3_ACTIVE_IND comes later, when connection actually closed */
-          isdn->state = ISDN_DISCONNECT_B3_WAIT;
+          call->state = ISDN_DISCONNECT_B3_WAIT;
         }
       }
       break;
@@ -498,23 +861,51 @@ static void isdn_handle_confirmation(isdn_t *isdn, _cmsg *msg)
         dbgprintf(2, "CAPI 2.0: DISCONNECT_CONF ApplID %d plci 0x%x info 0x%x\n",
                   isdn->appl_id, plci, info);
 
-        if (info != 0) {
+        if (!(call = isdn_call_by_plci(isdn, plci))) {
+          errprintf("CAPI 2.0: DISCONNECT_CONF for unknown plci 0x%x\n", plci);
+        } else if (info != 0) {
           /* connection error */
-          isdn->state = ISDN_IDLE;
-          isdn->callback->info_error(isdn->cb_context, info);
+          isdn_call_release(isdn, call, info);
         } else {
           /* DISCONNECT_ACTIVE_IND comes later, when connection actually closed */
-          isdn->state = ISDN_DISCONNECT_WAIT;
+          call->state = ISDN_DISCONNECT_WAIT;
         }
       }
       break;
 
     case CAPI_DATA_B3:
-      /* sent data acknowledged, NOP */
+      /* sent data acknowledged, handled in isdn_handle_data_confirmation() */
       break;
 
     case CAPI_FACILITY:
-      /* TODO */
+      /* facility request confirmed, only DTMF is used */
+      {
+        ncci = FACILITY_CONF_NCCI(msg);
+        info = FACILITY_CONF_INFO(msg);
+        selector = FACILITY_CONF_FACILITYSELECTOR(msg);
+        param = FACILITY_CONF_FACILITYCONFIRMATIONPARAMETER(msg);
+
+        /* DTMF information: 0 ok, 1 incorrect digit, 2 unknown function */
+        if (info == 0 && selector == ISDN_FACILITY_DTMF && param && param[0] >= 2)
+          info = param[1] | (param[2] << 8);
+
+        dbgprintf(2, "CAPI 2.0: FACILITY_CONF ApplID %d ncci 0x%x selector %d info 0x%x\n",
+                  isdn->appl_id, ncci, selector, info);
+
+        if (selector != ISDN_FACILITY_DTMF)
+          break;
+
+        if (!(call = isdn_call_by_plci(isdn, ISDN_NCCI_PLCI(ncci)))) {
+          errprintf("CAPI 2.0: FACILITY_CONF for unknown ncci 0x%x\n", ncci);
+        } else if (info != 0) {
+          /* the tones are generated in software from now on */
+          errprintf("CAPI 2.0: DTMF facility failed on ncci 0x%x, info 0x%x\n",
+                    ncci, info);
+          call->dtmf = 0;
+        } else {
+          call->dtmf = 1;
+        }
+      }
       break;
   }
 }
@@ -523,10 +914,13 @@ static void isdn_handle_confirmation(isdn_t *isdn, _cmsg *msg)
 
 static void isdn_handle_indication(isdn_t *isdn, _cmsg *msg)
 {
-  unsigned int info, plci, ncci, flags, datalen, datahandle, cip, reject;
+  unsigned int info, plci, ncci, cip, reject, selector, i, n;
   char *number, *called;
-  _cstruct ncpi;
-  void *data;
+  char digits[ISDN_DTMF_MAX_DIGITS + 1];
+  _cstruct ncpi, param;
+  isdn_call_t *call;
+
+  ANT_PROBE3(capi_message, msg->Command, msg->Subcommand, msg->Messagenumber);
 
   switch (msg->Command) {
     case CAPI_CONNECT:
@@ -542,37 +936,40 @@ static void isdn_handle_indication(isdn_t *isdn, _cmsg *msg)
                   isdn->appl_id, plci, cip);
 
         reject = 0;
+        call = NULL;
         if (cip != 16 && cip != 1 && cip != 4) {
           /* not telephony */
           reject = 1; /* ignore */
-        } else if (isdn->state != ISDN_IDLE) {
+        } else if (!(call = isdn_call_alloc(isdn))) {
           reject = 3; /* user busy */
         } else {
           /* check called number, if in listening MSN set */
-          isdn_set_remote_number(isdn, number);
-          isdn_set_local_number(isdn, called);
-          if (!isdn_is_listening(isdn, isdn->local_number))
+          isdn_set_remote_number(call, number);
+          isdn_set_local_number(call, called);
+          if (!isdn_is_listening(isdn, call->local_number))
             reject = 1; /* ignore here */
         }
 
         if (!reject) {
-          /* may ring now */
-          isdn->active_plci = plci;
+          /* may ring now (call waiting, if other calls exist) */
+          call->plci = plci;
+          call->controller = plci & 0x7f;
 
           /* tell the network, we are interested in the call and ring */
-          dbgprintf(2, "CAPI 2.0: ALERT_REQ ApplID %d msgno %d plci 0x%x\n",
-                    isdn->appl_id, isdn->msg_no, plci);
+          dbgprintf(2, "CAPI 2.0: ALERT_REQ ApplID %d msgno %d plci 0x%x call %u\n",
+                    isdn->appl_id, isdn->msg_no, plci,
+                    ISDN_CALL_NUMBER(isdn, call));
 
           g_mutex_lock(isdn->data_lock);
-          info = ALERT_REQ(msg, isdn->appl_id, isdn->msg_no++, plci,
+          info = ALERT_REQ(msg, isdn->appl_id, isdn_msgno(isdn), plci,
                            NULL, NULL, NULL, NULL, NULL);
           g_mutex_unlock(isdn->data_lock);
 
           if (info == 0) {
-            isdn->state = ISDN_RINGING;
-            isdn->active_plci = plci;
+            call->state = ISDN_RINGING;
           } else {
             errprintf("CAPI 2.0: ALERT_REQ failed, RC=0x%x, rejecting call\n", info);
+            call->plci = 0;
             reject = 3;
           }
         }
@@ -583,7 +980,7 @@ static void isdn_handle_indication(isdn_t *isdn, _cmsg *msg)
                     isdn->appl_id, isdn->msg_no, plci, reject);
 
           g_mutex_lock(isdn->data_lock);
-          CONNECT_RESP(msg, isdn->appl_id, isdn->msg_no++,
+          CONNECT_RESP(msg, isdn->appl_id, isdn_msgno(isdn),
                       plci, reject,
                       0 /* B1protocol: default */,
                       0 /* B2protocol: default */,
@@ -606,47 +1003,40 @@ static void isdn_handle_indication(isdn_t *isdn, _cmsg *msg)
         dbgprintf(2, "CAPI 2.0: CONNECT_ACTIVE_IND ApplID %d plci 0x%x\n",
                   isdn->appl_id, plci);
 
-        if (plci != isdn->active_plci) {
-          /* connect on wrong PLCI??? */
-          errprintf("CAPI 2.0: CONNECT_ACTIVE_IND wrong plci 0x%x, expected 0x%x\n",
-                    plci, isdn->active_plci);
+        /* answer the info message */
+        g_mutex_lock(isdn->data_lock);
+        CONNECT_ACTIVE_RESP(msg, isdn->appl_id, isdn_msgno(isdn), plci);
+        g_mutex_unlock(isdn->data_lock);
 
-          g_mutex_lock(isdn->data_lock);
-          CONNECT_ACTIVE_RESP(msg, isdn->appl_id, isdn->msg_no++, plci);
-          g_mutex_unlock(isdn->data_lock);
+        if (!(call = isdn_call_by_plci(isdn, plci))) {
+          /* connect on wrong PLCI??? */
+          errprintf("CAPI 2.0: CONNECT_ACTIVE_IND for unknown plci 0x%x\n",
+                    plci);
+        } else if (call->state == ISDN_INCOMING_WAIT) {
+          /* B-channel will be established by remote side */
+          call->state = ISDN_CONNECT_ACTIVE;
         } else {
-          if (isdn->state != ISDN_INCOMING_WAIT) {
-            isdn_set_remote_number(isdn, number);
-          }
+          isdn_set_remote_number(call, number);
+
+          /* request connection for B-channel */
+          dbgprintf(2, "CAPI 2.0: CONNECT_B3_REQ ApplID %d msgno %d plci 0x%x\n",
+                    isdn->appl_id, isdn->msg_no, call->plci);
 
-          /* answer the info message */
           g_mutex_lock(isdn->data_lock);
-          CONNECT_ACTIVE_RESP(msg, isdn->appl_id, isdn->msg_no++, plci);
+          info = CONNECT_B3_REQ(msg, isdn->appl_id, isdn_msgno(isdn), call->plci, NULL);
           g_mutex_unlock(isdn->data_lock);
 
-          if (isdn->state == ISDN_INCOMING_WAIT) {
-            /* B-channel will be established by remote side */
-            isdn->state = ISDN_CONNECT_ACTIVE;
+          if (info != 0) {
+            /* connection error */
+            errprintf("CAPI 2.0: CONNECT_B3_REQ failed, RC=0x%x\n", info);
+            isdn->callback->info_error(isdn->cb_context,
+                                       ISDN_CALL_NUMBER(isdn, call), info);
+            isdn_set_remote_number(call, 0);
+            /* initiate hangup on PLCI */
+            isdn_trigger_disconnect(isdn, call);
           } else {
-            /* request connection for B-channel */
-            dbgprintf(2, "CAPI 2.0: CONNECT_B3_REQ ApplID %d msgno %d plci 0x%x\n",
-                      isdn->appl_id, isdn->msg_no, isdn->active_plci);
-
-            g_mutex_lock(isdn->data_lock);
-            info = CONNECT_B3_REQ(msg, isdn->appl_id, isdn->msg_no++, isdn->active_plci, NULL);
-            g_mutex_unlock(isdn->data_lock);
-
-            if (info != 0) {
-              /* connection error */
-              errprintf("CAPI 2.0: CONNECT_B3_REQ failed, RC=0x%x\n", info);
-              isdn->callback->info_error(isdn->cb_context, info);
-              isdn_set_remote_number(isdn, 0);
-              /* initiate hangup on PLCI */
-              isdn_trigger_disconnect(isdn);
-            } else {
-              /* wait for CONNECT_B3, then announce result to application via callback */
-              isdn->state = ISDN_CONNECT_ACTIVE;
-            }
+            /* wait for CONNECT_B3, then announce result to application via callback */
+            call->state = ISDN_CONNECT_ACTIVE;
           }
         }
       }
@@ -657,23 +1047,37 @@ static void isdn_handle_indication(isdn_t *isdn, _cmsg *msg)
       {
         ncci = CONNECT_B3_ACTIVE_IND_NCCI(msg);
 
-        if (ncci != isdn->active_ncci) {
+        dbgprintf(2, "CAPI 2.0: CONNECT_B3_ACTIVE_IND ApplID %d msgno %d ncci 0x%x\n",
+                  isdn->appl_id, isdn->msg_no, ncci);
+
+        /* answer the info message */
+        g_mutex_lock(isdn->data_lock);
+        CONNECT_B3_ACTIVE_RESP(msg, isdn->appl_id, isdn_msgno(isdn), ncci);
+        g_mutex_unlock(isdn->data_lock);
+
+        call = isdn_call_by_plci(isdn, ISDN_NCCI_PLCI(ncci));
+        if (!call || ncci != call->ncci) {
           /* connect on wrong NCCI??? */
-          errprintf("CAPI 2.0: CONNECT_B3_ACTIVE_IND wrong ncci 0x%x, expected %d\n",
-                    ncci, isdn->active_ncci);
+          errprintf("CAPI 2.0: CONNECT_B3_ACTIVE_IND for unknown ncci 0x%x\n",
+                    ncci);
         } else {
-          dbgprintf(2, "CAPI 2.0: CONNECT_B3_ACTIVE_IND ApplID %d msgno %d ncci 0x%x\n",
-                    isdn->appl_id, isdn->msg_no, ncci);
-
-          /* answer the info message */
           g_mutex_lock(isdn->data_lock);
-          CONNECT_B3_ACTIVE_RESP(msg, isdn->appl_id, isdn->msg_no++, ncci);
+          isdn_tx_reset(call);
           g_mutex_unlock(isdn->data_lock);
-          isdn->state = ISDN_CONNECTED;
+          call->state = ISDN_CONNECTED;
 
           /* notify application about successful call establishment */
-          isdn_speed_init(&isdn->in_speed);
-          isdn->callback->info_connected(isdn->cb_context, isdn->remote_number);
+          isdn_speed_init(&call->in_speed, ISDN_SPEED);
+          isdn->callback->info_connected(isdn->cb_context,
+                                         ISDN_CALL_NUMBER(isdn, call),
+                                         call->remote_number);
+
+          /* let the controller detect DTMF, if it can */
+          call->dtmf = 0;
+          if (call->controller >= 1 &&
+              call->controller <= ISDN_MAX_CONTROLLERS &&
+              isdn->ctrl[call->controller - 1].dtmf)
+            isdn_dtmf_request(isdn, call, ISDN_DTMF_LISTEN_START, "");
         }
       }
       break;
@@ -689,18 +1093,13 @@ static void isdn_handle_indication(isdn_t *isdn, _cmsg *msg)
 
         /* answer the info message */
         g_mutex_lock(isdn->data_lock);
-        DISCONNECT_RESP(msg, isdn->appl_id, isdn->msg_no++, plci);
+        DISCONNECT_RESP(msg, isdn->appl_id, isdn_msgno(isdn), plci);
         g_mutex_unlock(isdn->data_lock);
 
-        if (plci != isdn->active_plci) {
+        if (!(call = isdn_call_by_plci(isdn, plci))) {
           /* disconnect on wrong PLCI??? */
-          errprintf("CAPI 2.0: DISCONNECT_IND wrong PLCI %d, expected %d\n",
-                    plci, isdn->active_plci);
+          errprintf("CAPI 2.0: DISCONNECT_IND for unknown plci 0x%x\n", plci);
         } else {
-          isdn->state = ISDN_IDLE;
-          isdn->active_ncci = 0;
-          isdn->active_plci = 0;
-
           if ((info & 0xff00) == 0x3400) {
             /* network provides reason in lower byte */
             switch (info) {
@@ -715,11 +1114,7 @@ static void isdn_handle_indication(isdn_t *isdn, _cmsg *msg)
           }
 
           /* notify application */
-          if (info != 0) {
-            isdn->callback->info_error(isdn->cb_context, info);
-          } else {
-            isdn->callback->info_disconnected(isdn->cb_context);
-          }
+          isdn_call_release(isdn, call, info);
         }
       }
       break;
@@ -735,52 +1130,38 @@ static void isdn_handle_indication(isdn_t *isdn, _cmsg *msg)
 
         /* answer the info message */
         g_mutex_lock(isdn->data_lock);
-        DISCONNECT_B3_RESP(msg, isdn->appl_id, isdn->msg_no++, ncci);
+        DISCONNECT_B3_RESP(msg, isdn->appl_id, isdn_msgno(isdn), ncci);
         g_mutex_unlock(isdn->data_lock);
 
-        if (ncci != isdn->active_ncci) {
+        call = isdn_call_by_plci(isdn, ISDN_NCCI_PLCI(ncci));
+        if (!call || ncci != call->ncci) {
           /* disconnect on wrong NCCI??? */
-          errprintf("CAPI 2.0: DISCONNECT_B3_IND wrong ncci 0x%x, expected 0x%x\n",
-                    ncci, isdn->active_ncci);
+          errprintf("CAPI 2.0: DISCONNECT_B3_IND for unknown ncci 0x%x\n",
+                    ncci);
         } else {
-          isdn->active_ncci = 0;
-          if (isdn->state == ISDN_CONNECTED || isdn->state == ISDN_CONNECT_B3_WAIT) {
+          g_mutex_lock(isdn->data_lock);
+          dbgprintf(1, "CAPI 2.0: Call %u TX %lu blocks sent, %lu confirmed, "
+                    "%lu failed, %lu bytes dropped, max %u in flight, "
+                    "max %u bytes queued\n",
+                    ISDN_CALL_NUMBER(isdn, call),
+                    call->tx.stats.blocks_sent, call->tx.stats.blocks_confirmed,
+                    call->tx.stats.blocks_failed, call->tx.stats.bytes_dropped,
+                    call->tx.stats.in_flight_max, call->tx.stats.queued_max);
+          g_mutex_unlock(isdn->data_lock);
+          call->ncci = 0;
+          if (call->state == ISDN_CONNECTED || call->state == ISDN_CONNECT_B3_WAIT) {
             /* passive disconnect, DISCONNECT_IND comes later */
-            isdn->state = ISDN_DISCONNECT_ACTIVE;
+            call->state = ISDN_DISCONNECT_ACTIVE;
           } else {
             /* active disconnect, needs to send DISCONNECT_REQ */
-            isdn_trigger_disconnect(isdn);
+            isdn_trigger_disconnect(isdn, call);
           }
         }
       }
       break;
 
     case CAPI_DATA_B3:
-      /* data arrived */
-      {
-        ncci = DATA_B3_IND_NCCI(msg);
-        data = DATA_B3_IND_DATA(msg);
-        datalen = DATA_B3_IND_DATALENGTH(msg);
-        datahandle = DATA_B3_IND_DATAHANDLE(msg);
-        flags = DATA_B3_IND_FLAGS(msg);
-
-        dbgprintf(flags ? 2 : 3, "CAPI 2.0: DATA_B3_IND ApplID %d msgno %d ncci 0x%x data 0x%lx+%d flags 0x%x\n",
-                  isdn->appl_id, isdn->msg_no, ncci, (long) data, datalen, flags);
-
-        isdn_speed_addsamples(&isdn->in_speed, datalen);
-
-        /* TODO: process flags */
-        isdn->callback->info_data(isdn->cb_context, data, datalen);
-
-        /* answer the info message */
-        g_mutex_lock(isdn->data_lock);
-        DATA_B3_RESP(msg, isdn->appl_id, isdn->msg_no++, ncci, datahandle);
-        g_mutex_unlock(isdn->data_lock);
-
-        if (debug > 1) {
-          isdn_speed_debug(&isdn->in_speed, 2, "CAPI 2.0: in");
-        }
-      }
+      /* data arrived, handled in isdn_handle_data_indication() */
       break;
 
     case CAPI_CONNECT_B3:
@@ -794,21 +1175,56 @@ static void isdn_handle_indication(isdn_t *isdn, _cmsg *msg)
 
         /* answer the info message */
         g_mutex_lock(isdn->data_lock);
-        CONNECT_B3_RESP(msg, isdn->appl_id, isdn->msg_no++, ncci, 0, ncpi);
+        CONNECT_B3_RESP(msg, isdn->appl_id, isdn_msgno(isdn), ncci, 0, ncpi);
         g_mutex_unlock(isdn->data_lock);
 
-        if (isdn->state == ISDN_CONNECT_ACTIVE) {
+        if (!(call = isdn_call_by_plci(isdn, ISDN_NCCI_PLCI(ncci)))) {
+          errprintf("CAPI 2.0: CONNECT_B3_IND for unknown ncci 0x%x\n", ncci);
+        } else if (call->state == ISDN_CONNECT_ACTIVE) {
           /* CONNECT_B3_ACTIVE_IND comes later, when connection actually established */
-          isdn->active_ncci = ncci;
-          isdn->state = ISDN_CONNECT_B3_WAIT;
+          call->ncci = ncci;
+          call->state = ISDN_CONNECT_B3_WAIT;
         } else {
           /* wrong connection state for B3 connect, trigger disconnect */
-          isdn_trigger_disconnect(isdn);
+          isdn_trigger_disconnect(isdn, call);
         }
       }
       break;
 
     case CAPI_FACILITY:
+      /* facility indication, only DTMF is used */
+      {
+        ncci = FACILITY_IND_NCCI(msg);
+        selector = FACILITY_IND_FACILITYSELECTOR(msg);
+        param = FACILITY_IND_FACILITYINDICATIONPARAMETER(msg);
+
+        dbgprintf(2, "CAPI 2.0: FACILITY_IND ApplID %d msgno %d ncci 0x%x selector %d\n",
+                  isdn->appl_id, isdn->msg_no, ncci, selector);
+
+        g_mutex_lock(isdn->data_lock);
+        FACILITY_RESP(msg, isdn->appl_id, isdn_msgno(isdn), ncci, selector, NULL);
+        g_mutex_unlock(isdn->data_lock);
+
+        if (selector != ISDN_FACILITY_DTMF || !param)
+          break;
+
+        /* keep the digits, drop fax tones ('X', 'Y') and anything else */
+        for (i = 0, n = 0; i < param[0] && n < ISDN_DTMF_MAX_DIGITS; ++i) {
+          if (isdigit(param[i + 1]) || param[i + 1] == '*' ||
+              param[i + 1] == '#' || (param[i + 1] >= 'A' && param[i + 1] <= 'D'))
+            digits[n++] = param[i + 1];
+        }
+        digits[n] = '\0';
+
+        if (!(call = isdn_call_by_plci(isdn, ISDN_NCCI_PLCI(ncci)))) {
+          errprintf("CAPI 2.0: FACILITY_IND for unknown ncci 0x%x\n", ncci);
+        } else if (n > 0 && call->state == ISDN_CONNECTED) {
+          isdn->callback->info_dtmf(isdn->cb_context,
+                                    ISDN_CALL_NUMBER(isdn, call), digits);
+        }
+      }
+      break;
+
     case CAPI_INFO:
       break;
   }
@@ -816,116 +1232,314 @@ static void isdn_handle_indication(isdn_t *isdn, _cmsg *msg)
 
 /*--------------------------------------------------------------------------*/
 
-static gpointer isdn_reply_thread(gpointer param)
+static void isdn_handle_data_indication(isdn_t *isdn, _cmsg *msg)
 {
-  isdn_t *isdn = (isdn_t*) param;
-  _cmsg msg;
-  unsigned int info;
+  unsigned int ncci, datalen, datahandle, flags;
+  void *data;
+  isdn_call_t *call;
 
-  /* timeout is needed, since CAPI release doesn't release waitformessage as it should */
-  struct timeval timeout;
+  ncci = DATA_B3_IND_NCCI(msg);
+  data = DATA_B3_IND_DATA(msg);
+  datalen = DATA_B3_IND_DATALENGTH(msg);
+  datahandle = DATA_B3_IND_DATAHANDLE(msg);
+  flags = DATA_B3_IND_FLAGS(msg);
 
-  while (!thread_is_stopping(&isdn->reply_thread)) {
-    /* process CAPI messages and call callbacks */
-    timeout.tv_sec = 1;
-    timeout.tv_usec = 0;
-    info = capi20_waitformessage(isdn->appl_id, &timeout);
-
-    if (info != CapiNoError) {
-      if (isdn->appl_id == 0) {
-        /* ISDN inactive, retry later */
-        sleep(1);
-      }
-      continue;
-    }
+  ANT_PROBE3(data_b3_ind, datahandle, datalen, flags);
 
-    g_mutex_lock(isdn->data_lock);
+  dbgprintf(flags ? 2 : 3, "CAPI 2.0: DATA_B3_IND ApplID %d msgno %d ncci 0x%x data 0x%lx+%d flags 0x%x\n",
+            isdn->appl_id, isdn->msg_no, ncci, (long) data, datalen, flags);
 
-    info = CAPI_GET_CMSG(&msg, isdn->appl_id);
+  /* TODO: process flags */
+  call = isdn_call_by_ncci(isdn, ncci);
+  if (call && call->state == ISDN_CONNECTED) {
+    isdn_speed_addsamples(&call->in_speed, datalen);
 
-    g_mutex_unlock(isdn->data_lock);
+    /* only queues the data, see isdn_callback_t */
+    isdn->callback->info_data(isdn->cb_context, ISDN_CALL_NUMBER(isdn, call),
+                              data, datalen);
+  }
 
-    g_mutex_lock(isdn->lock);
+  /* answer the info message, this releases the data buffer */
+  g_mutex_lock(isdn->data_lock);
+  DATA_B3_RESP(msg, isdn->appl_id, isdn_msgno(isdn), ncci, datahandle);
+  g_mutex_unlock(isdn->data_lock);
 
-    switch (info) {
-      case CapiNoError:
-        /* process the message */
-        switch (msg.Subcommand) {
-          case CAPI_CONF:
-            /* confirmation message */
-            isdn_handle_confirmation(isdn, &msg);
-            break;
+  if (debug > 1 && call) {
+    isdn_speed_debug(&call->in_speed, 2, "CAPI 2.0: in");
+  }
+}
 
-          case CAPI_IND:
-            /* indication message */
-            isdn_handle_indication(isdn, &msg);
-            break;
-        }
-        break;
+/*--------------------------------------------------------------------------*/
 
-      case CapiReceiveQueueEmpty:
-        errprintf("CAPI 2.0: Empty queue, even if message pending\n");
-        break;
+static void isdn_handle_data_confirmation(isdn_t *isdn, _cmsg *msg)
+{
+  unsigned int ncci, handle, info, i;
+  isdn_tx_block_t *block;
+  isdn_call_t *call;
 
-      default:
-        /* error */
-        errprintf("CAPI 2.0: Error while receiving next message, stopping ISDN, RC=0x%x\n", info);
-        isdn->reply_thread.stop_flag = 1;
-        break;
+  ncci = DATA_B3_CONF_NCCI(msg);
+  handle = DATA_B3_CONF_DATAHANDLE(msg);
+  info = DATA_B3_CONF_INFO(msg);
+
+  ANT_PROBE2(data_b3_conf, handle, info);
+
+  dbgprintf(3, "CAPI 2.0: DATA_B3_CONF ApplID %d ncci 0x%x handle %d info 0x%x\n",
+            isdn->appl_id, ncci, handle, info);
+
+  if (!(call = isdn_call_by_ncci(isdn, ncci))) {
+    dbgprintf(2, "CAPI 2.0: DATA_B3_CONF for unknown ncci 0x%x\n", ncci);
+    return;
+  }
+
+  g_mutex_lock(isdn->data_lock);
+
+  for (i = 0; i < ISDN_TX_BLOCKS; ++i) {
+    block = &call->tx.block[i];
+    if (block->state == ISDN_TX_SENT && block->handle == handle) {
+      block->state = ISDN_TX_FREE;
+      call->tx.stats.in_flight--;
+      if (info != 0)
+        call->tx.stats.blocks_failed++;
+      else
+        call->tx.stats.blocks_confirmed++;
+      break;
     }
+  }
+  if (i == ISDN_TX_BLOCKS) {
+    dbgprintf(2, "CAPI 2.0: DATA_B3_CONF for unknown handle %d\n", handle);
+  }
 
-    g_mutex_unlock(isdn->lock);
+  /* window has space again */
+  isdn_tx_flush(isdn, call);
+
+  g_mutex_unlock(isdn->data_lock);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static unsigned int isdn_msgno(isdn_t *isdn)
+{
+  return (unsigned int) g_atomic_int_exchange_and_add(&isdn->msg_no, 1) &
+         0xffff;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void isdn_tx_reset(isdn_call_t *call)
+{
+  unsigned int i;
+
+  for (i = 0; i < ISDN_TX_BLOCKS; ++i)
+    call->tx.block[i].state = ISDN_TX_FREE;
+  call->tx.filling = -1;
+  call->tx.queue_head = 0;
+  call->tx.queue_count = 0;
+  memset(&call->tx.stats, 0, sizeof(call->tx.stats));
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void isdn_tx_flush(isdn_t *isdn, isdn_call_t *call)
+{
+  isdn_tx_t *tx = &call->tx;
+  isdn_tx_block_t *block;
+  _cmsg CMSG;  /* structure for the message */
+  unsigned int info, msgno;
+  uint64_t now;
+
+  while (tx->queue_count > 0 &&
+         tx->stats.in_flight < ISDN_TX_WINDOW &&
+         call->state == ISDN_CONNECTED) {
+    block = &tx->block[tx->queue[tx->queue_head]];
+
+    msgno = isdn_msgno(isdn);
+    block->handle = tx->handle++ & 0xffff;
+
+    dbgprintf(3, "CAPI 2.0: DATA_B3_REQ ApplID %d ncci 0x%x handle %d in flight %d\n",
+              isdn->appl_id, call->ncci, block->handle, tx->stats.in_flight);
+
+    ANT_PROBE3(data_b3_req, block->handle, block->length,
+               tx->stats.in_flight);
+
+    /* block stays valid until DATA_B3_CONF */
+    info = DATA_B3_REQ(&CMSG, isdn->appl_id, msgno,
+                        call->ncci, block->data, block->length,
+                        block->handle,
+                        0x0);  /* flags */
+    if (info == CapiSendQueueFull || info == CapiMsgBusy) {
+      /* keep the block queued, retried on the next DATA_B3_CONF or send */
+      dbgprintf(2, "CAPI 2.0: DATA_B3_REQ refused, RC=0x%x, retrying later\n",
+                info);
+      break;
+    }
+
+    tx->queue_head = (tx->queue_head + 1) % ISDN_TX_BLOCKS;
+    tx->queue_count--;
+
+    if (info != 0) {
+      dbgprintf(1, "CAPI 2.0: DATA_B3_REQ failed, RC=0x%x\n", info);
+      tx->stats.blocks_failed++;
+      block->state = ISDN_TX_FREE;
+      continue;
+    }
+
+    block->state = ISDN_TX_SENT;
+    tx->stats.blocks_sent++;
+    if (++tx->stats.in_flight > tx->stats.in_flight_max)
+      tx->stats.in_flight_max = tx->stats.in_flight;
+
+    if (call->latency) {
+      now = media_time();
+      latency_add(call->latency, LATENCY_TX_QUEUE, now - block->filled);
+      if (block->origin)
+        latency_add(call->latency, LATENCY_MOUTH_TO_WIRE, now - block->origin);
+    }
   }
 
-  return 0;
+  tx->stats.queued = tx->queue_count * ISDN_FRAGMENT_SIZE +
+                     (tx->filling >= 0 ? tx->block[tx->filling].length : 0);
+  if (tx->stats.queued > tx->stats.queued_max)
+    tx->stats.queued_max = tx->stats.queued;
 }
 
 /*--------------------------------------------------------------------------*/
 
-int open_isdn_device(isdn_t *isdn, isdn_callback_t *callbacks, void *context)
+static int isdn_reply_dispatch(isdn_t *isdn)
 {
+  _cmsg msg;
   unsigned int info;
 
-  unsigned char buf[64];
-  unsigned int numControllers, i, appl_id;
-  unsigned int bChannels, dtmf, fax, faxExt, suppServ, transp;
-  _cdword buf2[4];
+  g_mutex_lock(isdn->data_lock);
 
-  memset(isdn, 0, sizeof(isdn_t));
+  info = CAPI_GET_CMSG(&msg, isdn->appl_id);
 
-  info = CAPI20_ISINSTALLED();
-  if (info != 0) {
-    errprintf("CAPI 2.0: not installed, RC=0x%x\n", info);
+  g_mutex_unlock(isdn->data_lock);
+
+  if (info == CapiReceiveQueueEmpty)
+    return 1;
+  if (info != CapiNoError) {
+    errprintf("CAPI 2.0: Error while receiving next message, RC=0x%x\n", info);
     return -1;
   }
 
-  isdn->lock = g_mutex_new();
-  if (!isdn->lock) {
-    errprintf("Cannot allocate ISDN mutex\n");
-    return -1;
+  if (isdn->trace)
+    trace_event(isdn->trace, TRACE_CAPI_MESSAGE,
+                msg.m, CAPIMSG_LEN(msg.m), NULL, 0);
+
+  if (msg.Command == CAPI_DATA_B3) {
+    /* media fast path, don't wait for signalling */
+    if (msg.Subcommand == CAPI_IND)
+      isdn_handle_data_indication(isdn, &msg);
+    else if (msg.Subcommand == CAPI_CONF)
+      isdn_handle_data_confirmation(isdn, &msg);
+    return 0;
   }
-  isdn->data_lock = g_mutex_new();
-  if (!isdn->data_lock) {
-    g_mutex_free(isdn->lock);
-    isdn->lock = 0;
-    errprintf("Cannot allocate data mutex\n");
-    return -1;
+
+  g_mutex_lock(isdn->lock);
+
+  switch (msg.Subcommand) {
+    case CAPI_CONF:
+      /* confirmation message */
+      isdn_handle_confirmation(isdn, &msg);
+      break;
+
+    case CAPI_IND:
+      /* indication message */
+      isdn_handle_indication(isdn, &msg);
+      break;
+  }
+
+  g_mutex_unlock(isdn->lock);
+
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static gpointer isdn_reply_thread(gpointer param)
+{
+  isdn_t *isdn = (isdn_t*) param;
+  struct pollfd fds[2];
+  unsigned int appl_id, n;
+  int nfds, timeout, result;
+
+  fds[0].fd = thread_wakeup_fd(&isdn->reply_thread);
+  fds[0].events = POLLIN;
+
+  while (!thread_is_stopping(&isdn->reply_thread)) {
+    /* (de)activation wakes us up to pick up the application ID */
+    appl_id = isdn->appl_id;
+    nfds = 1;
+    timeout = -1;
+    if (appl_id != 0) {
+      fds[1].fd = capi20_fileno(appl_id);
+      fds[1].events = POLLIN;
+      if (fds[1].fd >= 0)
+        nfds = 2;
+      else
+        timeout = ISDN_REPLY_POLL_INTERVAL;
+    }
+
+    if (poll(fds, nfds, timeout) < 0) {
+      if (errno == EINTR)
+        continue;
+      errprintf("CAPI 2.0: Error waiting for messages, stopping ISDN: %s\n",
+                strerror(errno));
+      break;
+    }
+
+    if (fds[0].revents & POLLIN)
+      thread_wakeup_clear(&isdn->reply_thread);
+
+    if (appl_id == 0 || appl_id != isdn->appl_id ||
+        (nfds == 2 && !(fds[1].revents & POLLIN)))
+      continue;
+
+    /* process everything queued, a batch at a time */
+    for (n = 0; n < ISDN_REPLY_BATCH; ++n) {
+      if (thread_is_stopping(&isdn->reply_thread))
+        break;
+      result = isdn_reply_dispatch(isdn);
+      if (result > 0)
+        break;
+      if (result < 0) {
+        if (isdn->appl_id == appl_id) {
+          /* not just released meanwhile */
+          errprintf("CAPI 2.0: Stopping ISDN\n");
+          isdn->reply_thread.stop_flag = 1;
+        }
+        break;
+      }
+    }
   }
 
-  info = CAPI20_GET_PROFILE (0, buf);
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int isdn_capi_profiles(isdn_t *isdn)
+{
+  isdn_controller_t *ctrl;
+  unsigned char buf[64];
+  unsigned int info, i;
+  _cdword buf2[4];
+  int voice = 0;
+
+  info = CAPI20_GET_PROFILE(0, buf);
   if (info != 0) {
     errprintf("CAPI 2.0: error getting profile, RC=0x%x\n", info);
     return -1;
   }
-  numControllers = buf[0] + (buf[1] << 8);
+  isdn->ctrl_count = buf[0] + (buf[1] << 8);
 
-  if (numControllers == 0) {
+  if (isdn->ctrl_count == 0) {
     errprintf("CAPI 2.0: No ISDN controllers installed\n");
     return -1;
   }
 
   if (debug) {
-    dbgprintf(1, "CAPI 2.0: Controllers found: %d\n", numControllers);
+    dbgprintf(1, "CAPI 2.0: Controllers found: %d\n", isdn->ctrl_count);
     if (capi20_get_manufacturer(0,buf)) {
       dbgprintf(1, "CAPI 2.0: Manufacturer: %s\n", buf);
     }
@@ -935,8 +1549,13 @@ int open_isdn_device(isdn_t *isdn, isdn_callback_t *callbacks, void *context)
     }
   }
 
+  if (isdn->ctrl_count > ISDN_MAX_CONTROLLERS) {
+    errprintf("CAPI 2.0: Using only the first %d of %d controllers\n",
+              ISDN_MAX_CONTROLLERS, isdn->ctrl_count);
+    isdn->ctrl_count = ISDN_MAX_CONTROLLERS;
+  }
 
-  for (i = 1; i <= numControllers; ++i)
+  for (i = 1; i <= isdn->ctrl_count; ++i)
   {
     if (debug) {
       if (capi20_get_manufacturer(i, buf)) {
@@ -955,39 +1574,96 @@ int open_isdn_device(isdn_t *isdn, isdn_callback_t *callbacks, void *context)
       return -1;
     }
 
-    bChannels = buf[2] + (buf[3]<<8);
+    ctrl = &isdn->ctrl[i - 1];
+    ctrl->b_channels = buf[2] + (buf[3]<<8);
+    ctrl->dtmf = (buf[4] & 0x08) ? 1 : 0;
+    ctrl->supp_serv = (buf[4] & 0x10) ? 1 : 0;
+    /* B1 64 kbit/s transparent, B2 and B3 transparent: what we dial with */
+    ctrl->voice = (buf[8] & 0x02 && buf[12] & 0x02 && buf[16] & 0x01) ? 1 : 0;
+    ctrl->fax = (buf[8] & 0x10 && buf[12] & 0x10 && buf[16] & 0x10) ? 1 : 0;
+    ctrl->fax_ext = (buf[8] & 0x10 && buf[12] & 0x10 && buf[16] & 0x20) ? 1 : 0;
+
+    dbgprintf(1, "CAPI 2.0: Controller %d: Bchan %d, DTMF %d, FAX %d/%d, "
+              "transp %d, suppServ %d\n", i, ctrl->b_channels, ctrl->dtmf,
+              ctrl->fax, ctrl->fax_ext, ctrl->voice, ctrl->supp_serv);
+
+    if (ctrl->voice && ctrl->b_channels)
+      voice++;
+  }
 
-    if (buf[4] & 0x08)
-      dtmf = 1;
-    else
-      dtmf = 0;
+  return voice;
+}
 
-    if (buf[4] & 0x10)
-      suppServ = 1;
-    else
-      suppServ = 0;
+/*--------------------------------------------------------------------------*/
 
-    if (buf[8] & 0x02 && buf[12] & 0x02 && buf[16] & 0x01)
-      transp = 1;
-    else
-      transp = 0;
+static int isdn_capi_listen_all(isdn_t *isdn)
+{
+  unsigned int i;
 
-    if (buf[8] & 0x10 && buf[12] & 0x10 && buf[16] & 0x10)
-      fax = 1;
-    else
-      fax = 0;
+  for (i = 1; i <= isdn->ctrl_count; ++i) {
+    if (!isdn->ctrl[i - 1].voice || !isdn->ctrl[i - 1].b_channels) {
+      dbgprintf(1, "CAPI 2.0: Controller %d can't do voice, not listening\n",
+                i);
+      continue;
+    }
+    if (isdn_listen(isdn, i) < 0) {
+      errprintf("CAPI 2.0: Error listening on controller %d\n", i);
+      return -1;
+    }
+  }
+  return 0;
+}
 
-    if (buf[8] & 0x10 && buf[12] & 0x10 && buf[16] & 0x20)
-      faxExt = 1;
-    else
-      faxExt = 0;
+/*--------------------------------------------------------------------------*/
+
+static unsigned int isdn_capi_controller(isdn_t *isdn)
+{
+  unsigned int used[ISDN_MAX_CONTROLLERS];
+  unsigned int i, controller = 0;
+  int free_channels, best = 0;
+
+  memset(used, 0, sizeof(used));
+  for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+    if (isdn->call[i].state != ISDN_IDLE &&
+        isdn->call[i].controller >= 1 &&
+        isdn->call[i].controller <= isdn->ctrl_count)
+      used[isdn->call[i].controller - 1]++;
+  }
+
+  for (i = 1; i <= isdn->ctrl_count; ++i) {
+    if (!isdn->ctrl[i - 1].voice)
+      continue;
+    free_channels = (int) isdn->ctrl[i - 1].b_channels - (int) used[i - 1];
+    if (free_channels > best) {
+      best = free_channels;
+      controller = i;
+    }
+  }
+  return controller;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int isdn_capi_open(isdn_t *isdn)
+{
+  unsigned int info, appl_id;
+  int voice;
+
+  info = CAPI20_ISINSTALLED();
+  if (info != 0) {
+    errprintf("CAPI 2.0: not installed, RC=0x%x\n", info);
+    return -1;
+  }
 
-    dbgprintf(1, "CAPI 2.0: Bchan %d, DTMF %d, FAX %d/%d, transp %d, suppServ %d\n",
-            bChannels, dtmf, fax, faxExt, transp, suppServ);
+  if ((voice = isdn_capi_profiles(isdn)) < 0)
+    return -1;
+  if (voice == 0) {
+    errprintf("CAPI 2.0: No controller with voice capability\n");
+    return -1;
   }
 
-  info = capi20_register(2 /*maxLogicalConnection*/,
-                         7 /*maxBDataBlocks*/,
+  info = capi20_register(ISDN_MAX_CALLS /*maxLogicalConnection*/,
+                         ISDN_TX_WINDOW /*maxBDataBlocks*/,
                          2 * ISDN_FRAGMENT_SIZE /*maxBDataLen*/,
                          &appl_id);
 
@@ -998,11 +1674,7 @@ int open_isdn_device(isdn_t *isdn, isdn_callback_t *callbacks, void *context)
   dbgprintf(1, "CAPI 2.0: Received application ID %d\n", appl_id);
 
   isdn->appl_id = appl_id;
-  isdn->ctrl_count = numControllers;
-  isdn->callback = callbacks;
-  isdn->cb_context = context;
-  isdn->msg_no = 0;
-  thread_init(&isdn->reply_thread);
+  g_atomic_int_set(&isdn->msg_no, 0);
 
   /* INFO and CIP masks as defined in Chapter 5.37 of CAPI 2.0 specs */
 
@@ -1014,14 +1686,9 @@ int open_isdn_device(isdn_t *isdn, isdn_callback_t *callbacks, void *context)
   /*isdn->cip_mask = 0x00010000;*/
   /* all services would be: 0x1FFF03FF */
 
-  /* activate listening on all controllers */
-  for (i = 1; i <= numControllers; ++i) {
-    /* TODO: listen only if the controller has voice capability */
-    if (isdn_listen(isdn, i) < 0) {
-      errprintf("CAPI 2.0: Error listening on controller %d\n", i);
-      return -1;
-    }
-  }
+  /* activate listening on all controllers with voice capability */
+  if (isdn_capi_listen_all(isdn) < 0)
+    return -1;
 
   thread_start(&isdn->reply_thread, isdn_reply_thread, isdn);
 
@@ -1030,11 +1697,14 @@ int open_isdn_device(isdn_t *isdn, isdn_callback_t *callbacks, void *context)
 
 /*--------------------------------------------------------------------------*/
 
-int close_isdn_device(isdn_t *isdn)
+static int isdn_capi_close(isdn_t *isdn)
 {
   unsigned int info;
   int result = 0;
 
+  /* returns at once: the thread waits in poll() on its wake-up pipe */
+  thread_stop(&isdn->reply_thread);
+
   if (isdn->appl_id != 0) {
     info = capi20_release(isdn->appl_id);
     if (info != 0) {
@@ -1042,66 +1712,37 @@ int close_isdn_device(isdn_t *isdn)
       result = -1;
     }
   }
-
-  thread_stop(&isdn->reply_thread);
-
   isdn->appl_id = 0;
-  if (isdn->own_msn) {
-    free(isdn->own_msn);
-    isdn->own_msn = 0;
-  }
-  if (isdn->listen_msns) {
-    free(isdn->listen_msns);
-    isdn->listen_msns = 0;
-  }
-  if (isdn->lock) {
-    g_mutex_free(isdn->lock);
-    isdn->lock = 0;
-  }
 
   return result;
 }
 
 /*--------------------------------------------------------------------------*/
 
-int activate_isdn_device(isdn_t *isdn, unsigned int active)
+static int isdn_capi_activate(isdn_t *isdn, unsigned int active)
 {
-  unsigned int info, appl_id, numControllers, i;
-  unsigned char buf[64];
+  unsigned int info, appl_id;
   int result = 0;
 
   dbgprintf(1, "CAPI 2.0: activate %d\n", active);
   if (active) {
-    /* activate */
+    /* activate, with the profiles read on open */
     if (isdn->appl_id == 0) {
-      info = CAPI20_GET_PROFILE (0, buf);
-      if (info != 0) {
-        errprintf("CAPI 2.0: error getting profile, RC=0x%x\n", info);
-        result = -1;
-      } else {
-        numControllers = buf[0] + (buf[1] << 8);
-
-        info = capi20_register(2 /*maxLogicalConnection*/,
-                              7 /*maxBDataBlocks*/,
-                              2 * ISDN_FRAGMENT_SIZE /*maxBDataLen*/,
-                              &appl_id);
-
-        if (appl_id == 0 || info != 0) {
-          errprintf("CAPI 2.0: Error registering application, RC=0x%x\n", info);
-          return -1;
-        }
-        dbgprintf(1, "CAPI 2.0: Received application ID %d\n", appl_id);
-        isdn->appl_id = appl_id;
-
-        /* activate listening on all controllers */
-        for (i = 1; i <= numControllers; ++i) {
-          /* TODO: listen only if the controller has voice capability */
-          if (isdn_listen(isdn, i) < 0) {
-            errprintf("CAPI 2.0: Error listening on controller %d\n", i);
-            return -1;
-          }
-        }
+      info = capi20_register(ISDN_MAX_CALLS /*maxLogicalConnection*/,
+                             ISDN_TX_WINDOW /*maxBDataBlocks*/,
+                             2 * ISDN_FRAGMENT_SIZE /*maxBDataLen*/,
+                             &appl_id);
+
+      if (appl_id == 0 || info != 0) {
+        errprintf("CAPI 2.0: Error registering application, RC=0x%x\n", info);
+        return -1;
       }
+      dbgprintf(1, "CAPI 2.0: Received application ID %d\n", appl_id);
+      isdn->appl_id = appl_id;
+      thread_wakeup(&isdn->reply_thread);
+
+      if (isdn_capi_listen_all(isdn) < 0)
+        return -1;
     }
   } else {
     /* deactivate */
@@ -1112,6 +1753,8 @@ int activate_isdn_device(isdn_t *isdn, unsigned int active)
         result = -1;
       }
       isdn->appl_id = 0;
+      /* stop polling the released application's descriptor */
+      thread_wakeup(&isdn->reply_thread);
     }
   }
 
@@ -1120,32 +1763,37 @@ int activate_isdn_device(isdn_t *isdn, unsigned int active)
 
 /*--------------------------------------------------------------------------*/
 
-int isdn_dial(isdn_t *isdn, unsigned int controller, char *number)
+static int isdn_capi_dial(isdn_t *isdn, unsigned int controller, char *number)
 {
   _cmsg CMSG;  /* structure for the message */
   unsigned int info, msgno;
-  int result = 0;
+  int result;
   char *called_nr, *calling_nr;
+  isdn_call_t *call;
 
   g_mutex_lock(isdn->lock);
 
-  if (isdn->state != ISDN_IDLE) {
-    errprintf("ISDN connection or disconnect in progress, cannot dial (state %d)\n", isdn->state);
+  /* least loaded controller which can do voice */
+  if (controller == 0)
+    controller = isdn_capi_controller(isdn);
+
+  if (!(call = isdn_call_alloc(isdn))) {
+    errprintf("ISDN: All %d calls in use, cannot dial\n", ISDN_MAX_CALLS);
+    result = -1;
+  } else if (controller == 0) {
+    errprintf("CAPI 2.0: No free B-channel on a voice capable controller\n");
     result = -1;
   } else {
-    msgno = isdn->msg_no++;
+    result = ISDN_CALL_NUMBER(isdn, call);
+    msgno = isdn_msgno(isdn);
 
-    if (controller == 0) {
-      // TODO: pick proper controller which has voice capability
-      controller = 1;
-    }
-
-    dbgprintf(1, "CAPI 2.0: CONNECT_REQ ApplID %d ctrl %d CIP %d Called %s\n",
-            isdn->appl_id, controller, 16, number);
+    dbgprintf(1, "CAPI 2.0: CONNECT_REQ ApplID %d ctrl %d CIP %d Called %s call %d\n",
+            isdn->appl_id, controller, 16, number, result);
 
     called_nr = (char*) malloc(strlen(number) + 3);
     if (!called_nr) {
       errprintf("Cannot allocate memory for called number\n");
+      g_mutex_unlock(isdn->lock);
       return -1;
     }
     called_nr[0] = strlen(number) + 1;
@@ -1185,7 +1833,10 @@ int isdn_dial(isdn_t *isdn, unsigned int controller, char *number)
       free(calling_nr);
 
     if (info == 0) {
-      isdn->state = ISDN_CONNECT_REQ;
+      /* CONNECT_CONF is matched by message number */
+      call->state = ISDN_CONNECT_REQ;
+      call->controller = controller;
+      call->req_msgno = msgno;
     } else {
       errprintf("CAPI 2.0: CONNECT_REQ failed, RC=0x%x\n", info);
       result = -1;
@@ -1199,52 +1850,157 @@ int isdn_dial(isdn_t *isdn, unsigned int controller, char *number)
 
 /*--------------------------------------------------------------------------*/
 
-int isdn_send_data(isdn_t *isdn, unsigned char *data, unsigned int datalen)
+static int isdn_dtmf_request(isdn_t *isdn, isdn_call_t *call,
+                             unsigned int function, const char *digits)
 {
-  int result = 0;
   _cmsg CMSG;  /* structure for the message */
-  unsigned int info, msgno = isdn->msg_no++;
+  unsigned char param[9 + ISDN_DTMF_MAX_DIGITS];
+  unsigned int info, n = strlen(digits);
 
-  if (isdn->state != ISDN_CONNECTED) {
-    dbgprintf(3, "ISDN data send while not connected (state %d)\n", isdn->state);
+  if (n > ISDN_DTMF_MAX_DIGITS)
     return -1;
-  }
 
-  dbgprintf(3, "CAPI 2.0: DATA_B3_REQ ApplID %d ncci 0x%x data 0x%lx+%d\n",
-            isdn->appl_id, isdn->active_ncci, (long) data, datalen);
+  /* function, tone duration, gap duration, digits, DTMF characteristics */
+  param[0] = 8 + n;
+  param[1] = function & 0xff;
+  param[2] = function >> 8;
+  param[3] = param[5] = ISDN_DTMF_DURATION & 0xff;
+  param[4] = param[6] = ISDN_DTMF_DURATION >> 8;
+  param[7] = n;
+  memcpy(&param[8], digits, n);
+  param[8 + n] = 0;
+
+  dbgprintf(2, "CAPI 2.0: FACILITY_REQ ApplID %d msgno %d ncci 0x%x DTMF function %u '%s'\n",
+            isdn->appl_id, isdn->msg_no, call->ncci, function, digits);
 
   g_mutex_lock(isdn->data_lock);
-  info = DATA_B3_REQ(&CMSG, isdn->appl_id, msgno,
-                      isdn->active_ncci, data, datalen,
-                      msgno, /* as data handle */
-                      0x0);  /* flags */
+  info = FACILITY_REQ(&CMSG, isdn->appl_id, isdn_msgno(isdn), call->ncci,
+                      ISDN_FACILITY_DTMF, param);
   g_mutex_unlock(isdn->data_lock);
 
   if (info != 0) {
-    if (isdn->state == ISDN_CONNECTED) {
-      dbgprintf(1, "CAPI 2.0: DATA_B3_REQ failed (too fast audio?), RC=0x%x\n", info);
-    } else {
-      dbgprintf(3, "CAPI 2.0: DATA_B3_REQ failed (ISDN disconnected, OK), RC=0x%x\n", info);
-    }
+    errprintf("CAPI 2.0: FACILITY_REQ failed, RC=0x%x\n", info);
+    return -1;
+  }
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int isdn_capi_send_dtmf(isdn_t *isdn, unsigned int call_number,
+                               const char *digits)
+{
+  isdn_call_t *call = &isdn->call[call_number];
+  int result;
+
+  g_mutex_lock(isdn->lock);
+
+  if (call->state != ISDN_CONNECTED || !call->dtmf) {
+    /* no DTMF facility, or not confirmed (yet) */
     result = -1;
+  } else {
+    result = isdn_dtmf_request(isdn, call, ISDN_DTMF_SEND, digits);
   }
 
+  g_mutex_unlock(isdn->lock);
+
   return result;
 }
 
 /*--------------------------------------------------------------------------*/
 
-int isdn_hangup(isdn_t *isdn)
+static int isdn_capi_send_data(isdn_t *isdn, unsigned int call_number,
+                               unsigned char *data, unsigned int datalen)
 {
+  isdn_call_t *call = &isdn->call[call_number];
+  isdn_tx_t *tx = &call->tx;
+  isdn_tx_block_t *block;
+  unsigned int i, size;
+  int result = 0;
+
+  if (call->state != ISDN_CONNECTED) {
+    dbgprintf(3, "ISDN data send while not connected (call %u state %d)\n",
+              call_number, call->state);
+    return -1;
+  }
+
+  g_mutex_lock(isdn->data_lock);
+
+  while (datalen > 0) {
+    if (tx->filling < 0) {
+      /* start a new block */
+      for (i = 0; i < ISDN_TX_BLOCKS; ++i) {
+        if (tx->block[i].state == ISDN_TX_FREE)
+          break;
+      }
+      if (i == ISDN_TX_BLOCKS || tx->queue_count >= ISDN_TX_QUEUE_BLOCKS) {
+        /* queue full, drop oldest queued block and reuse it */
+        i = tx->queue[tx->queue_head];
+        tx->queue_head = (tx->queue_head + 1) % ISDN_TX_BLOCKS;
+        tx->queue_count--;
+        tx->stats.bytes_dropped += tx->block[i].length;
+        dbgprintf(2, "CAPI 2.0: TX queue full (%d in flight), dropping %d bytes\n",
+                  tx->stats.in_flight, tx->block[i].length);
+        result = -1;
+      }
+      tx->filling = i;
+      tx->block[i].state = ISDN_TX_FILLING;
+      tx->block[i].length = 0;
+      if (call->latency) {
+        tx->block[i].filled = media_time();
+        tx->block[i].origin = call->latency->tx_origin;
+      }
+    }
+
+    /* coalesce into the block */
+    block = &tx->block[tx->filling];
+    size = ISDN_FRAGMENT_SIZE - block->length;
+    if (size > datalen)
+      size = datalen;
+    memcpy(block->data + block->length, data, size);
+    block->length += size;
+    data += size;
+    datalen -= size;
+
+    if (block->length == ISDN_FRAGMENT_SIZE) {
+      block->state = ISDN_TX_QUEUED;
+      tx->queue[(tx->queue_head + tx->queue_count) % ISDN_TX_BLOCKS] = tx->filling;
+      tx->queue_count++;
+      tx->filling = -1;
+    }
+  }
+
+  isdn_tx_flush(isdn, call);
+
+  g_mutex_unlock(isdn->data_lock);
+
+  return result;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void isdn_get_tx_stats(isdn_t *isdn, unsigned int call,
+                       isdn_tx_stats_t *stats)
+{
+  g_mutex_lock(isdn->data_lock);
+  *stats = isdn->call[call].tx.stats;
+  g_mutex_unlock(isdn->data_lock);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int isdn_capi_hangup(isdn_t *isdn, unsigned int call_number)
+{
+  isdn_call_t *call = &isdn->call[call_number];
   int result = 0;
 
   g_mutex_lock(isdn->lock);
 
-  if (isdn->state == ISDN_IDLE) {
-    errprintf("ISDN hangup called, even if connection idle\n");
+  if (call->state == ISDN_IDLE) {
+    errprintf("ISDN hangup called, even if call %u idle\n", call_number);
     result = -1;
   } else {
-    result = isdn_trigger_disconnect(isdn);
+    result = isdn_trigger_disconnect(isdn, call);
   }
 
   g_mutex_unlock(isdn->lock);
@@ -1254,22 +2010,23 @@ int isdn_hangup(isdn_t *isdn)
 
 /*--------------------------------------------------------------------------*/
 
-int isdn_pickup(isdn_t *isdn _U_)
+static int isdn_capi_pickup(isdn_t *isdn, unsigned int call_number)
 {
   _cmsg CMSG;  /* structure for the message */
+  isdn_call_t *call = &isdn->call[call_number];
   int result = 0;
   unsigned int info;
   unsigned char localnum[4];
 
   g_mutex_lock(isdn->lock);
 
-  if (isdn->state != ISDN_RINGING) {
-    errprintf("ISDN pickup called, even if not ringing\n");
+  if (call->state != ISDN_RINGING) {
+    errprintf("ISDN pickup called, even if call %u not ringing\n", call_number);
     result = -1;
   } else {
     /* answer the call via CONNECT_RESP */
     dbgprintf(2, "CAPI 2.0: CONNECT_RESP ApplID %d msgno %d plci 0x%x reject %d\n",
-              isdn->appl_id, isdn->msg_no, isdn->active_plci, 0);
+              isdn->appl_id, isdn->msg_no, call->plci, 0);
 
     localnum[0] = 0x00;
     localnum[1] = 0x00;
@@ -1277,8 +2034,8 @@ int isdn_pickup(isdn_t *isdn _U_)
     localnum[3] = 0x00;
 
     g_mutex_lock(isdn->data_lock);
-    info = CONNECT_RESP(&CMSG, isdn->appl_id, isdn->msg_no++,
-                        isdn->active_plci, 0,
+    info = CONNECT_RESP(&CMSG, isdn->appl_id, isdn_msgno(isdn),
+                        call->plci, 0,
                         1 /* B1protocol: originate */,
                         1 /* B2protocol: transparent */,
                         0 /* default B3protocol */,
@@ -1291,11 +2048,11 @@ int isdn_pickup(isdn_t *isdn _U_)
 
     if (info != 0) {
       errprintf("CAPI 2.0: CONNECT_RESP failed, RC=0x%x\n", info);
-      isdn->state = ISDN_IDLE;
+      call->state = ISDN_IDLE;
       result = -1;
     } else {
       /* connection initiated, wait for CONNECT_ACTIVE_IND */
-      isdn->state = ISDN_INCOMING_WAIT;
+      call->state = ISDN_INCOMING_WAIT;
     }
   }
 
@@ -1306,6 +2063,164 @@ int isdn_pickup(isdn_t *isdn _U_)
 
 /*--------------------------------------------------------------------------*/
 
+int isdn_set_backend(const char *spec)
+{
+  const isdn_backend_t *backend;
+  const char *options;
+  size_t len;
+  unsigned int i;
+
+  options = strchr(spec, ':');
+  len = options ? (size_t) (options++ - spec) : strlen(spec);
+
+  for (i = 0; i < sizeof(isdn_backends) / sizeof(isdn_backends[0]); ++i) {
+    backend = isdn_backends[i];
+    if (strlen(backend->name) != len || strncmp(backend->name, spec, len))
+      continue;
+
+    if (options && *options) {
+      if (!backend->configure) {
+        errprintf("ISDN: Backend %s has no options\n", backend->name);
+        return -1;
+      }
+      if (backend->configure(options) < 0)
+        return -1;
+    }
+    isdn_backend = backend;
+    dbgprintf(1, "ISDN: Using %s backend\n", backend->name);
+    return 0;
+  }
+
+  errprintf("ISDN: Unknown backend %.*s\n", (int) len, spec);
+  return -1;
+}
+
+/*--------------------------------------------------------------------------*/
+
+int open_isdn_device(isdn_t *isdn, isdn_callback_t *callbacks, void *context)
+{
+  memset(isdn, 0, sizeof(isdn_t));
+
+  isdn->lock = g_mutex_new();
+  if (!isdn->lock) {
+    errprintf("Cannot allocate ISDN mutex\n");
+    return -1;
+  }
+  isdn->data_lock = g_mutex_new();
+  if (!isdn->data_lock) {
+    g_mutex_free(isdn->lock);
+    isdn->lock = 0;
+    errprintf("Cannot allocate data mutex\n");
+    return -1;
+  }
+
+  isdn->backend = isdn_backend;
+  isdn->callback = callbacks;
+  isdn->cb_context = context;
+  thread_init(&isdn->reply_thread);
+
+  return isdn->backend->open(isdn);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int close_isdn_device(isdn_t *isdn)
+{
+  unsigned int i;
+  int result = 0;
+
+  if (isdn->backend)
+    result = isdn->backend->close(isdn);
+
+  thread_deinit(&isdn->reply_thread);
+
+  for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+    isdn_set_remote_number(&isdn->call[i], NULL);
+    isdn_set_local_number(&isdn->call[i], NULL);
+  }
+  if (isdn->own_msn) {
+    free(isdn->own_msn);
+    isdn->own_msn = 0;
+  }
+  isdn_msn_free(&isdn->listen);
+  if (isdn->lock) {
+    g_mutex_free(isdn->lock);
+    isdn->lock = 0;
+  }
+  if (isdn->data_lock) {
+    g_mutex_free(isdn->data_lock);
+    isdn->data_lock = 0;
+  }
+
+  return result;
+}
+
+/*--------------------------------------------------------------------------*/
+
+int activate_isdn_device(isdn_t *isdn, unsigned int active)
+{
+  return isdn->backend->activate(isdn, active);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int isdn_dial(isdn_t *isdn, unsigned int controller, char *number)
+{
+  return isdn->backend->dial(isdn, controller, number);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int isdn_send_data(isdn_t *isdn, unsigned int call,
+                   unsigned char *data, unsigned int datalen)
+{
+  if (call >= ISDN_MAX_CALLS)
+    return -1;
+  return isdn->backend->send_data(isdn, call, data, datalen);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int isdn_send_dtmf(isdn_t *isdn, unsigned int call, const char *digits)
+{
+  if (call >= ISDN_MAX_CALLS || !isdn->backend->send_dtmf)
+    return -1;
+  return isdn->backend->send_dtmf(isdn, call, digits);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int isdn_hangup(isdn_t *isdn, unsigned int call)
+{
+  if (call >= ISDN_MAX_CALLS)
+    return -1;
+  return isdn->backend->hangup(isdn, call);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int isdn_pickup(isdn_t *isdn, unsigned int call)
+{
+  if (call >= ISDN_MAX_CALLS)
+    return -1;
+  return isdn->backend->pickup(isdn, call);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int isdn_is_idle(isdn_t *isdn)
+{
+  unsigned int i;
+
+  for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+    if (isdn->call[i].state != ISDN_IDLE)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/*--------------------------------------------------------------------------*/
+
 int isdn_setMSN(isdn_t *isdn, char *msn)
 {
   char *to_free = isdn->own_msn;
@@ -1322,13 +2237,24 @@ int isdn_setMSN(isdn_t *isdn, char *msn)
 
 /*--------------------------------------------------------------------------*/
 
-int isdn_setMSNs(isdn_t *isdn _U_, char *msns _U_)
+int isdn_setMSNs(isdn_t *isdn, char *msns)
 {
-  if (isdn->listen_msns)
-    free(isdn->listen_msns);
+  isdn_msn_set_t set, old;
+  int invalid;
 
-  isdn->listen_msns = msns ? strdup(msns) : strdup(DEFAULT_MSNS);
-  return 0;
+  if ((invalid = isdn_msn_compile(msns ? msns : DEFAULT_MSNS, &set)) < 0)
+    return -1;
+
+  /* the reply thread checks incoming calls with the lock held */
+  if (isdn->lock)
+    g_mutex_lock(isdn->lock);
+  old = isdn->listen;
+  isdn->listen = set;
+  if (isdn->lock)
+    g_mutex_unlock(isdn->lock);
+
+  isdn_msn_free(&old);
+  return invalid ? -1 : 0;
 }
 
 /*--------------------------------------------------------------------------*/
@@ -1355,28 +2281,84 @@ char* isdn_get_calls_filename(void) {
 
 /*--------------------------------------------------------------------------*/
 
-void isdn_speed_init(isdn_speed_t *speed)
+void isdn_speed_init(isdn_speed_t *speed, unsigned int nominal)
 {
-  speed->samples = 0;
-  speed->delta = 0;
-  speed->start = 0;
-  speed->debug = 0;
+  memset(speed, 0, sizeof(isdn_speed_t));
+  speed->nominal = nominal ? nominal : ISDN_SPEED;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void isdn_speed_point(isdn_speed_t *speed)
+{
+  unsigned int i, j, n;
+  double x, y, mx = 0, my = 0, sxx = 0, sxy = 0, ssr = 0, slope;
+  double x0, y0;
+
+  speed->point_time[speed->point_head] = speed->delta;
+  speed->point_samples[speed->point_head] = speed->samples;
+  speed->point_head = (speed->point_head + 1) % ISDN_SPEED_POINTS;
+  if (speed->point_count < ISDN_SPEED_POINTS)
+    speed->point_count++;
+
+  n = speed->point_count;
+  if (n < ISDN_SPEED_MIN_POINTS)
+    return;
+
+  /* least squares fit of samples over seconds, relative to the oldest
+     point to keep the sums small */
+  j = (speed->point_head + ISDN_SPEED_POINTS - n) % ISDN_SPEED_POINTS;
+  x0 = speed->point_time[j] * 1e-6;
+  y0 = speed->point_samples[j];
+  for (i = 0; i < n; ++i, j = (j + 1) % ISDN_SPEED_POINTS) {
+    mx += speed->point_time[j] * 1e-6 - x0;
+    my += speed->point_samples[j] - y0;
+  }
+  mx /= n;
+  my /= n;
+
+  j = (speed->point_head + ISDN_SPEED_POINTS - n) % ISDN_SPEED_POINTS;
+  for (i = 0; i < n; ++i, j = (j + 1) % ISDN_SPEED_POINTS) {
+    x = speed->point_time[j] * 1e-6 - x0 - mx;
+    y = speed->point_samples[j] - y0 - my;
+    sxx += x * x;
+    sxy += x * y;
+  }
+  if (sxx <= 0)
+    return;
+  slope = sxy / sxx;
+
+  j = (speed->point_head + ISDN_SPEED_POINTS - n) % ISDN_SPEED_POINTS;
+  for (i = 0; i < n; ++i, j = (j + 1) % ISDN_SPEED_POINTS) {
+    x = speed->point_time[j] * 1e-6 - x0 - mx;
+    y = speed->point_samples[j] - y0 - my - slope * x;
+    ssr += y * y;
+  }
+
+  speed->rate = slope;
+  speed->ppm = (slope / speed->nominal - 1.0) * 1e6;
+  speed->error_ppm = sqrt(ssr / (n - 2) / sxx) / speed->nominal * 1e6;
 }
 
 /*--------------------------------------------------------------------------*/
 
 void isdn_speed_addsamples(isdn_speed_t *speed, unsigned int samples)
 {
-  uint64_t time = microsec_time();
-  if (speed->start) {
-    speed->samples += samples;
-    speed->delta = time - speed->start;
-  } else {
-    speed->start = time;
-    speed->samples = 0;
-    speed->delta = 0;
-    speed->debug = 0;
+  if (!speed->start) {
+    /* first block only starts the clock */
+    speed->start = media_time();
+    isdn_speed_point(speed);
+    return;
   }
+
+  speed->samples += samples;
+  speed->pending += samples;
+  if (speed->pending < speed->nominal / ISDN_SPEED_POINT_RATE)
+    return;
+
+  speed->pending = 0;
+  speed->delta = media_time() - speed->start;
+  isdn_speed_point(speed);
 }
 
 /*--------------------------------------------------------------------------*/
@@ -1385,10 +2367,10 @@ void isdn_speed_debug(isdn_speed_t *speed, int level, char *prefix)
 {
   uint64_t curtime = speed->start + speed->delta;
 
-  if (curtime >= speed->debug + 1000000 && speed->delta) {
+  if (curtime >= speed->debug + 1000000 && speed->rate > 0) {
     speed->debug = curtime;
-    dbgprintf(level, "%s speed: %.3f samples/sec\n", prefix,
-              speed->samples * 1000000.0 / speed->delta);
+    dbgprintf(level, "%s speed: %.3f samples/sec (%+.1f ppm, +/- %.1f)\n",
+              prefix, speed->rate, speed->ppm, speed->error_ppm);
   }
 }
 
@@ -28,6 +28,8 @@
 #include "config.h"
 #include "thread.h"
 #include "util.h"
+#include "latency.h"
+#include "trace.h"
 
 /*!
  * @brief 0 (master MSN) or MSN to use as identification on outgoing calls.
@@ -43,11 +45,54 @@
 
 #define ISDN_SPEED 8000
 
+/*!
+ * @brief Maximum number of simultaneous calls (logical connections).
+ *
+ * Passed as maxLogicalConnection to capi20_register(). A basic rate
+ * controller offers two B-channels, multi-port controllers more.
+ */
+#define ISDN_MAX_CALLS 8
+
+/*!
+ * @brief Maximum number of controllers whose profiles are kept.
+ */
+#define ISDN_MAX_CONTROLLERS 16
+
 /*!
  * @brief Fragment size to send to ISDN device.
  */
 #define ISDN_FRAGMENT_SIZE  128
 
+/*!
+ * @brief Maximum number of unconfirmed DATA_B3_REQ blocks.
+ *
+ * Must match maxBDataBlocks passed to capi20_register().
+ */
+#define ISDN_TX_WINDOW 7
+
+/*!
+ * @brief Maximum number of filled blocks waiting for a free slot in the window.
+ *
+ * Oldest data beyond this limit is dropped to keep latency bounded.
+ */
+#define ISDN_TX_QUEUE_BLOCKS 8
+
+/*!
+ * @brief Total number of transmit blocks (window, queue and one being filled).
+ */
+#define ISDN_TX_BLOCKS (ISDN_TX_WINDOW + ISDN_TX_QUEUE_BLOCKS + 1)
+
+/*!
+ * @brief Maximum number of DTMF digits sent or received at once.
+ */
+#define ISDN_DTMF_MAX_DIGITS 32
+
+/*!
+ * @brief Duration of a DTMF tone and of the gap after it (ms), when sent by
+ * the controller.
+ */
+#define ISDN_DTMF_DURATION 100
+
 #define ISDN_CONFIG_FILENAME "/etc/isdn/isdn.conf"
 
 extern char* isdn_calls_filename_from_config;
@@ -57,63 +102,181 @@ extern char* isdn_calls_filename_from_config;
  *
  * The callbacks described in this structure run within the context
  * of the calling thread. They need to send messages to other threads
- * properly synchronized.
+ * properly synchronized. Each call is identified by its number
+ * (0..ISDN_MAX_CALLS-1), as returned by isdn_dial() or passed to
+ * info_ring().
  */
 typedef struct {
   /*!
    * @brief Callback when connection established.
    *
    * @param context context given at initialization time.
+   * @param call call number.
    * @param number remote party number (may be NULL).
    */
-  void (*info_connected)(void *context, char *number);
+  void (*info_connected)(void *context, unsigned int call, char *number);
 
   /*!
    * @brief Callback when ISDN data received.
    *
+   * Called without holding the ISDN lock, DATA_B3_RESP is sent right
+   * after it returns. The callback must not block; it should only copy
+   * the data into a queue for the media thread, since the data pointer
+   * is invalid after return.
+   *
    * @param context context given at initialization time.
+   * @param call call number.
    * @param data pointer to received data.
    * @param length length of received data (in bytes).
    */
-  void (*info_data)(void *context, void *data, unsigned int length);
+  void (*info_data)(void *context, unsigned int call,
+                    void *data, unsigned int length);
 
   /*!
    * @brief Callback when connection disconnected.
    *
+   * The call number is free for new calls afterwards.
+   *
    * @param context context given at initialization time.
+   * @param call call number.
    */
-  void (*info_disconnected)(void *context);
+  void (*info_disconnected)(void *context, unsigned int call);
 
   /*!
    * @brief Callback when connection attempt fails with error.
    *
+   * The call number is free for new calls afterwards.
+   *
    * @param context context given at initialization time.
+   * @param call call number.
    * @param error CAPI error number.
    */
-  void (*info_error)(void *context, unsigned int error);
+  void (*info_error)(void *context, unsigned int call, unsigned int error);
 
   /*!
    * @brief Callback called on RING from other side.
    *
+   * May come while other calls exist (call waiting).
+   *
    * @param context context given at initialization time.
+   * @param call call number of the new call.
    * @param callee remote party number (may be NULL).
    * @param called called (our) number (may be NULL).
    */
-  void (*info_ring)(void *context, char *callee, char *called);
+  void (*info_ring)(void *context, unsigned int call,
+                    char *callee, char *called);
+
+  /*!
+   * @brief Callback when the controller detected DTMF digits.
+   *
+   * Only called for calls on controllers with the DTMF facility.
+   *
+   * @param context context given at initialization time.
+   * @param call call number.
+   * @param digits received digits ('0'-'9', '*', '#', 'A'-'D').
+   */
+  void (*info_dtmf)(void *context, unsigned int call, char *digits);
 
 } isdn_callback_t;
 
+/*!
+ * @brief Measurement points in the sliding window of the rate estimator.
+ */
+#define ISDN_SPEED_POINTS 32
+
+/*!
+ * @brief Measurement points per second at the nominal rate. The clock is
+ * read only once per point, not for every block.
+ */
+#define ISDN_SPEED_POINT_RATE 10
+
+/*!
+ * @brief Points needed before the estimator gives a rate.
+ */
+#define ISDN_SPEED_MIN_POINTS 4
+
 /*!
  * @brief Speed measurmenets.
+ *
+ * The rate is estimated by linear regression of the sample count over
+ * time in a sliding window of ISDN_SPEED_POINTS points, so it follows
+ * drift during a call instead of averaging over the whole call.
  */
 typedef struct {
   unsigned long samples;/*!< total sample count (after first frame) */
-  uint64_t delta;       /*!< how long did it take to send/receive samples */
+  uint64_t delta;       /*!< how long did it take to send/receive samples
+                             (until the last point) */
 
   uint64_t start;       /*!< input start time in microseconds (for delta computation) */
   uint64_t debug;       /*!< debug timepoint */
+
+  unsigned int nominal; /*!< nominal rate in samples/sec */
+  unsigned int pending; /*!< samples since the last point */
+  uint64_t point_time[ISDN_SPEED_POINTS];         /*!< time of point (since start) */
+  unsigned long point_samples[ISDN_SPEED_POINTS]; /*!< samples at point */
+  unsigned int point_head;  /*!< index of the next point */
+  unsigned int point_count; /*!< number of points in the window */
+
+  double rate;          /*!< estimated rate in samples/sec, 0 until
+                             ISDN_SPEED_MIN_POINTS points are known */
+  double ppm;           /*!< deviation of rate from nominal in ppm */
+  double error_ppm;     /*!< standard error of ppm (confidence of the
+                             estimate, the smaller the better) */
 } isdn_speed_t;
 
+/*!
+ * @brief Statistics of the outgoing B-channel data path.
+ */
+typedef struct {
+  unsigned long blocks_sent;      /*!< DATA_B3_REQ sent successfully */
+  unsigned long blocks_confirmed; /*!< DATA_B3_CONF received */
+  unsigned long blocks_failed;    /*!< DATA_B3_REQ or DATA_B3_CONF with error */
+  unsigned long bytes_dropped;    /*!< bytes dropped due to full queue */
+  unsigned int in_flight;         /*!< blocks currently unconfirmed */
+  unsigned int in_flight_max;     /*!< maximum of unconfirmed blocks */
+  unsigned int queued;            /*!< bytes currently waiting in queue */
+  unsigned int queued_max;        /*!< maximum of bytes waiting in queue */
+} isdn_tx_stats_t;
+
+/*!
+ * @brief State of a transmit block.
+ */
+typedef enum {
+  ISDN_TX_FREE = 0,         /*!< unused */
+  ISDN_TX_FILLING,          /*!< data being appended */
+  ISDN_TX_QUEUED,           /*!< full, waiting for a slot in the window */
+  ISDN_TX_SENT              /*!< owned by the controller until DATA_B3_CONF */
+} isdn_tx_block_state_t;
+
+/*!
+ * @brief One DATA_B3_REQ block.
+ */
+typedef struct {
+  unsigned char data[ISDN_FRAGMENT_SIZE]; /*!< block data */
+  unsigned int length;                    /*!< bytes filled */
+  unsigned int handle;                    /*!< data handle used for request */
+  isdn_tx_block_state_t state;            /*!< block state */
+  uint64_t filled;                        /*!< time first data was appended */
+  uint64_t origin;                        /*!< capture time of first data,
+                                               0 if unknown */
+} isdn_tx_block_t;
+
+/*!
+ * @brief Outgoing B-channel transmitter (protected by isdn_t data_lock).
+ *
+ * Data is copied exactly once, directly into the block which is later
+ * passed to DATA_B3_REQ.
+ */
+typedef struct {
+  isdn_tx_block_t block[ISDN_TX_BLOCKS];  /*!< all blocks */
+  int filling;                            /*!< index of block being filled, -1 if none */
+  unsigned int queue[ISDN_TX_BLOCKS];     /*!< FIFO of queued block indices */
+  unsigned int queue_head;                /*!< index of oldest entry in queue */
+  unsigned int queue_count;               /*!< number of queued blocks */
+  unsigned int handle;                    /*!< next data handle */
+  isdn_tx_stats_t stats;                  /*!< statistics */
+} isdn_tx_t;
+
 /*!
  * @brief ISDN connection state.
  */
@@ -134,28 +297,88 @@ typedef enum {
 } isdn_state_t;
 
 /*!
- * @brief ISDN handle wrapping CAPI interface.
+ * @brief Node of the compiled MSN listen set (a digit trie).
+ */
+typedef struct {
+  unsigned int next[10];    /*!< child node per digit, 0 if none (the root
+                                 is never a child) */
+  unsigned char exact;      /*!< an MSN ends here */
+  unsigned char wildcard;   /*!< every number continuing here matches */
+} isdn_msn_node_t;
+
+/*!
+ * @brief Compiled MSN listen set.
+ */
+typedef struct {
+  isdn_msn_node_t *node;    /*!< nodes, node[0] is the root; NULL accepts
+                                 every number */
+  unsigned int count;       /*!< number of nodes */
+} isdn_msn_set_t;
+
+/*!
+ * @brief Capabilities of a controller (from its CAPI profile).
+ */
+typedef struct {
+  unsigned int b_channels;  /*!< number of B-channels */
+  unsigned int dtmf;        /*!< DTMF facility supported */
+  unsigned int supp_serv;   /*!< supplementary services supported */
+  unsigned int fax;         /*!< G3 fax supported */
+  unsigned int fax_ext;     /*!< G3 fax with extensions supported */
+  unsigned int voice;       /*!< transparent B1/B2/B3, usable for telephony */
+} isdn_controller_t;
+
+/*!
+ * @brief State of one call (protected by isdn_t lock, tx by data_lock).
+ */
+typedef struct {
+  isdn_state_t state;       /*!< current connection state */
+  unsigned int controller;  /*!< controller of the call */
+  unsigned int plci;        /*!< physical connection PLCI (0 until known) */
+  unsigned int ncci;        /*!< logical connection NCCI (0 until known) */
+  unsigned int req_msgno;   /*!< message number of CONNECT_REQ, to match
+                                 CONNECT_CONF */
+  char *remote_number;      /*!< remote party number */
+  char *local_number;       /*!< local number (currently only for ring) */
+  isdn_tx_t tx;             /*!< outgoing data window (protected by data_lock) */
+  isdn_speed_t in_speed;    /*!< ISDN data input speed */
+  unsigned int dtmf;        /*!< DTMF facility of the controller confirmed
+                                 for this call */
+  latency_t *latency;       /*!< latency statistics of the call to update,
+                                 may be NULL */
+} isdn_call_t;
+
+/*!
+ * @brief Call number of a call of an ISDN handle (for backends).
+ */
+#define ISDN_CALL_NUMBER(isdn, c) ((unsigned int) ((c) - (isdn)->call))
+
+struct isdn_backend_t;
+
+/*!
+ * @brief ISDN handle wrapping CAPI interface (or another backend).
  */
 typedef struct {
   /* NOTE: all parts private! Do not access them directly! */
 
+  const struct isdn_backend_t *backend; /*!< backend implementing requests */
+  void *backend_data;       /*!< private data of backend */
+
   unsigned int appl_id;     /*!< CAPI application ID */
-  unsigned int msg_no;      /*!< CAPI message serial number */
+  volatile gint msg_no;     /*!< CAPI message serial number, see
+                                 isdn_msgno() */
 
-  isdn_state_t state;       /*!< current connection state */
+  isdn_call_t call[ISDN_MAX_CALLS]; /*!< calls, ISDN_IDLE if unused */
 
-  unsigned int ctrl_count;  /*!< controller count */
+  unsigned int ctrl_count;  /*!< controller count (at most
+                                 ISDN_MAX_CONTROLLERS are used) */
+  isdn_controller_t ctrl[ISDN_MAX_CONTROLLERS]; /*!< profiles of controllers
+                                 1 .. ctrl_count, by controller - 1 */
   char *own_msn;            /*!< own MSN (for originating calls) */
-  char *listen_msns;        /*!< set of comma-delimited MSNs or * for all/wildcard at end */
+  isdn_msn_set_t listen;    /*!< MSNs to listen on (protected by lock) */
 
   unsigned int info_mask;   /*!< info mask for received info from CAPI */
   unsigned int cip_mask;    /*!< CIP mask for listening on services */
 
-  unsigned int active_plci; /*!< active physical connection PLCI (if off-hook) */
-  unsigned int active_ncci; /*!< active logical connection NCCI (if off-hook) */
-  char *remote_number;      /*!< remote party number */
-  char *local_number;       /*!< local number (currently only for ring) */
-
   GMutex *lock;             /*!< lock protecting this structure */
   thread_t reply_thread;    /*!< thread for processing ISDN replies */
 
@@ -164,11 +387,55 @@ typedef struct {
 
   GMutex *data_lock;        /*!< ISDN request/reply lock */
 
-  isdn_speed_t in_speed;    /*!< ISDN data input speed */
+  trace_t *trace;           /*!< trace of received messages, may be NULL */
 } isdn_t;
 
 /*!
- * @brief Open ISDN device via CAPI interface.
+ * @brief ISDN backend, implements the requests of the public ISDN API.
+ *
+ * A backend reports events via the isdn_callback_t of the handle, the
+ * same way and from the same kind of thread as the CAPI backend does:
+ * signalling callbacks with isdn->lock held, info_data without it.
+ * Generic parts of isdn_t (locks, callbacks, MSNs, reply_thread handle)
+ * are set up by open_isdn_device() before open() is called.
+ */
+typedef struct isdn_backend_t {
+  const char *name;         /*!< backend name for isdn_set_backend() */
+
+  /*!
+   * @brief Parse backend options (may be NULL if there are none).
+   *
+   * @param options comma-separated list of name=value pairs.
+   * @return 0 on success, -1 on error.
+   */
+  int (*configure)(const char *options);
+
+  int (*open)(isdn_t *isdn);          /*!< see open_isdn_device() */
+  int (*close)(isdn_t *isdn);         /*!< see close_isdn_device() */
+  int (*activate)(isdn_t *isdn, unsigned int active); /*!< see activate_isdn_device() */
+  int (*dial)(isdn_t *isdn, unsigned int controller, char *number); /*!< see isdn_dial() */
+  int (*hangup)(isdn_t *isdn, unsigned int call); /*!< see isdn_hangup() */
+  int (*pickup)(isdn_t *isdn, unsigned int call); /*!< see isdn_pickup() */
+  int (*send_data)(isdn_t *isdn, unsigned int call,
+                   unsigned char *data, unsigned int datalen); /*!< see isdn_send_data() */
+  int (*send_dtmf)(isdn_t *isdn, unsigned int call,
+                   const char *digits); /*!< see isdn_send_dtmf(), NULL if
+                                             the backend has no DTMF */
+} isdn_backend_t;
+
+/*!
+ * @brief Select the backend used by subsequent open_isdn_device() calls.
+ *
+ * Known backends are "capi" (default) and "loopback" (see isdnloop.h).
+ *
+ * @param spec backend name, optionally followed by ':' and options,
+ *             e.g., "loopback:answer=2,jitter=5".
+ * @return 0 on success, -1 on unknown backend or invalid options.
+ */
+int isdn_set_backend(const char *spec);
+
+/*!
+ * @brief Open ISDN device via CAPI interface (or the selected backend).
  *
  * @param isdn handle to fill in.
  * @param callbacks ISDN callbacks to call for various ISDN events.
@@ -197,37 +464,83 @@ int activate_isdn_device(isdn_t *isdn, unsigned int active);
 /*!
  * @brief Initiate voice call on ISDN device.
  *
+ * Other calls may exist, as long as a call number and a B-channel
+ * are free.
+ *
  * @param isdn device handle.
- * @param controller ISDN controller number or 0 to use first available.
+ * @param controller ISDN controller number or 0 to use the voice capable
+ *        controller with the most free B-channels.
  * @param number number to call.
- * @return 0 on success, less than 0 on error.
+ * @return call number on success, less than 0 on error.
  */
 int isdn_dial(isdn_t *isdn, unsigned int controller, char *number);
 
 /*!
- * @brief Hang up current call on ISDN device.
+ * @brief Hang up (or reject) a call on ISDN device.
  *
  * @param isdn device handle.
+ * @param call call number.
  * @return 0 on success, less than 0 on error.
  */
-int isdn_hangup(isdn_t *isdn);
+int isdn_hangup(isdn_t *isdn, unsigned int call);
 
 /*!
- * @brief Pick up pending call on ISDN device.
+ * @brief Pick up a ringing call on ISDN device.
  *
  * @param isdn device handle.
+ * @param call call number.
  * @return 0 on success, less than 0 on error.
  */
-int isdn_pickup(isdn_t *isdn);
+int isdn_pickup(isdn_t *isdn, unsigned int call);
+
+/*!
+ * @brief Check if there is no call at all on ISDN device.
+ *
+ * @param isdn device handle.
+ * @return TRUE if all calls are idle, FALSE otherwise.
+ */
+int isdn_is_idle(isdn_t *isdn);
 
 /*!
  * @brief Send data over ISDN connection, after it's established.
  *
+ * Data is coalesced into blocks of ISDN_FRAGMENT_SIZE bytes and sent as
+ * long as less than ISDN_TX_WINDOW blocks are unconfirmed. Up to
+ * ISDN_TX_QUEUE_BLOCKS full blocks wait for the window, the oldest one is
+ * dropped if more are needed.
+ *
  * @param isdn device handle.
- * @param data pointer to data.
+ * @param call call number.
+ * @param data pointer to data (copied).
  * @param datalen data length.
+ * @return 0 on success, -1 if not connected or data was dropped.
+ */
+int isdn_send_data(isdn_t *isdn, unsigned int call,
+                   unsigned char *data, unsigned int datalen);
+
+/*!
+ * @brief Send DTMF digits via the DTMF facility of the controller.
+ *
+ * The controller generates the tones in-band. Fails if the controller
+ * doesn't support DTMF, the application has to generate the tones itself
+ * then.
+ *
+ * @param isdn device handle.
+ * @param call call number (connected).
+ * @param digits digits to send ('0'-'9', '*', '#', 'A'-'D').
+ * @return 0 on success, -1 if the controller can't send the digits.
  */
-int isdn_send_data(isdn_t *isdn, unsigned char *data, unsigned int datalen);
+int isdn_send_dtmf(isdn_t *isdn, unsigned int call, const char *digits);
+
+/*!
+ * @brief Get statistics of the outgoing data path of a call.
+ *
+ * @param isdn device handle.
+ * @param call call number.
+ * @param stats filled with statistics.
+ */
+void isdn_get_tx_stats(isdn_t *isdn, unsigned int call,
+                       isdn_tx_stats_t *stats);
 
 /*!
  * @brief Sets originating MSN for the specified ISDN device.
@@ -241,9 +554,15 @@ int isdn_setMSN(isdn_t *isdn, char *msn);
 /*!
  * @brief Sets MSNs to listen on for the specified ISDN device.
  *
+ * The set is compiled into a digit trie, so that incoming calls are
+ * checked in time proportional to the length of the called number.
+ * Entries are digits, optionally followed by '*' matching any rest.
+ * Invalid entries are reported and left out.
+ *
  * @param isdn device handle.
- * @param msns comma-separated set of MSNs to listen on ('*' for any).
- * @return 0 on success, -1 otherwise.
+ * @param msns comma- or semicolon-separated set of MSNs to listen on
+ *        ('*' for any).
+ * @return 0 on success, -1 if there were invalid entries.
  */
 int isdn_setMSNs(isdn_t *isdn, char *msns);
 
@@ -258,12 +577,17 @@ char* isdn_get_calls_filename(void);
  * @brief Initialize speed measurement structure.
  *
  * @param speed structure to initialize.
+ * @param nominal nominal rate in samples/sec (e.g. ISDN_SPEED).
  */
-void isdn_speed_init(isdn_speed_t *speed);
+void isdn_speed_init(isdn_speed_t *speed, unsigned int nominal);
 
 /*!
  * @brief Add bytes sent/received to measurement structure.
  *
+ * The first call only starts the measurement. Cheap: the clock is read
+ * and the estimate updated once per ISDN_SPEED_POINT_RATE-th second of
+ * samples.
+ *
  * @param speed structure to modify.
  * @param samples sample count.
  */
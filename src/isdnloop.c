@@ -0,0 +1,679 @@
+/*
+ * Loopback ISDN backend, simulates calls without ISDN hardware
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "config.h"
+
+/* GNU headers */
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#include <string.h>
+#include <time.h>
+
+/* own header files */
+#include "globals.h"
+#include "isdnloop.h"
+#include "ringbuf.h"
+#include "mediaclock.h"
+
+/*!
+ * @brief Duration of one data block at ISDN speed (us).
+ */
+#define ISDN_LOOP_BLOCK_US (ISDN_FRAGMENT_SIZE * 1000000.0 / ISDN_SPEED)
+
+/*!
+ * @brief Maximum lag of data delivery before the schedule is reset (us).
+ */
+#define ISDN_LOOP_MAX_LAG 1000000
+
+/*!
+ * @brief Loopback backend configuration.
+ */
+typedef struct {
+  unsigned int answer;      /*!< answer delay (ms) */
+  unsigned int ring;        /*!< ring interval (s), 0 = never */
+  unsigned int hangup;      /*!< remote hangup after (s), 0 = never */
+  unsigned int waiting;     /*!< second call after connect (s), 0 = never */
+  unsigned int jitter;      /*!< maximum data block jitter (us) */
+  int skew;                 /*!< remote clock deviation (ppm) */
+  char caller[32];          /*!< number of simulated caller */
+} isdn_loop_config_t;
+
+/*!
+ * @brief Simulated remote side of one call.
+ */
+typedef struct {
+  uint64_t event_time;      /*!< time of pending connect/disconnect, 0 = none */
+  uint64_t hangup_time;     /*!< time of remote hangup, 0 = none */
+  uint64_t data_start;      /*!< start of data schedule */
+  uint64_t data_next;       /*!< delivery time of next data block */
+  unsigned long blocks;     /*!< data blocks delivered since data_start */
+  ringbuf_t echo;           /*!< data sent, to be echoed back */
+} isdn_loop_call_t;
+
+/*!
+ * @brief Loopback backend state (isdn_t backend_data).
+ */
+typedef struct {
+  unsigned int active;      /*!< listening for (simulated) calls */
+  uint64_t ring_time;       /*!< time of next incoming call, 0 = none */
+  uint64_t waiting_time;    /*!< time of next waiting call, 0 = none */
+  unsigned int seed;        /*!< jitter random generator state */
+  isdn_loop_call_t call[ISDN_MAX_CALLS]; /*!< per call state */
+  unsigned char block[ISDN_FRAGMENT_SIZE]; /*!< data block being delivered */
+} isdn_loop_t;
+
+static isdn_loop_config_t isdn_loop_config = {
+  ISDN_LOOP_DEFAULT_ANSWER, 0, 0, 0, 0, 0, ISDN_LOOP_DEFAULT_CALLER
+};
+
+static int isdn_loop_configure(const char *options);
+static int isdn_loop_open(isdn_t *isdn);
+static int isdn_loop_close(isdn_t *isdn);
+static int isdn_loop_activate(isdn_t *isdn, unsigned int active);
+static int isdn_loop_dial(isdn_t *isdn, unsigned int controller, char *number);
+static int isdn_loop_hangup(isdn_t *isdn, unsigned int call);
+static int isdn_loop_pickup(isdn_t *isdn, unsigned int call);
+static int isdn_loop_send_data(isdn_t *isdn, unsigned int call,
+                               unsigned char *data, unsigned int datalen);
+
+const isdn_backend_t isdn_loop_backend = {
+  "loopback",
+  isdn_loop_configure,
+  isdn_loop_open,
+  isdn_loop_close,
+  isdn_loop_activate,
+  isdn_loop_dial,
+  isdn_loop_hangup,
+  isdn_loop_pickup,
+  isdn_loop_send_data,
+  NULL
+};
+
+/*--------------------------------------------------------------------------*/
+
+static int isdn_loop_configure(const char *options)
+{
+  isdn_loop_config_t config = isdn_loop_config;
+  char *copy, *item, *value, *next;
+  long number;
+  int result = 0;
+
+  copy = strdup(options);
+  if (!copy)
+    return -1;
+
+  for (item = copy; item && *item; item = next) {
+    next = strchr(item, ',');
+    if (next)
+      *next++ = '\0';
+
+    value = strchr(item, '=');
+    if (!value) {
+      errprintf("LOOPBACK: Option %s needs a value\n", item);
+      result = -1;
+      break;
+    }
+    *value++ = '\0';
+    number = strtol(value, NULL, 10);
+
+    if (!strcmp(item, "answer") && number >= 0) {
+      config.answer = number;
+    } else if (!strcmp(item, "ring") && number >= 0) {
+      config.ring = number;
+    } else if (!strcmp(item, "hangup") && number >= 0) {
+      config.hangup = number;
+    } else if (!strcmp(item, "waiting") && number >= 0) {
+      config.waiting = number;
+    } else if (!strcmp(item, "jitter") && number >= 0) {
+      config.jitter = number * 1000;
+    } else if (!strcmp(item, "skew") && number > -1000000) {
+      config.skew = number;
+    } else if (!strcmp(item, "caller")) {
+      snprintf(config.caller, sizeof(config.caller), "%s", value);
+    } else {
+      errprintf("LOOPBACK: Invalid option %s=%s\n", item, value);
+      result = -1;
+      break;
+    }
+  }
+
+  free(copy);
+  if (result == 0)
+    isdn_loop_config = config;
+  return result;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Replace a number string in the ISDN handle.
+ *
+ * @param dest number to replace.
+ * @param number new number (may be NULL).
+ */
+static void isdn_loop_set_number(char **dest, const char *number)
+{
+  if (*dest)
+    free(*dest);
+  *dest = number ? strdup(number) : NULL;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Get an idle call for a new connection (isdn->lock held).
+ *
+ * @param isdn ISDN handle.
+ * @return call, NULL if all calls are in use.
+ */
+static isdn_call_t *isdn_loop_call_alloc(isdn_t *isdn)
+{
+  unsigned int i;
+
+  for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+    if (isdn->call[i].state == ISDN_IDLE)
+      return &isdn->call[i];
+  }
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Compute delivery time of a data block.
+ *
+ * Blocks are scheduled on the (skewed) remote clock from the start of the
+ * connection, so rounding errors don't accumulate. Jitter only delays a
+ * single block.
+ *
+ * @param loop loopback state.
+ * @param remote remote side of the call.
+ * @param block block number since data_start.
+ * @return delivery time in microseconds.
+ */
+static uint64_t isdn_loop_block_time(isdn_loop_t *loop,
+                                     isdn_loop_call_t *remote,
+                                     unsigned long block)
+{
+  uint64_t t;
+
+  t = remote->data_start + (uint64_t)
+    (block * ISDN_LOOP_BLOCK_US / (1.0 + isdn_loop_config.skew * 1e-6));
+  if (isdn_loop_config.jitter)
+    t += rand_r(&loop->seed) % (isdn_loop_config.jitter + 1);
+  return t;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Simulate an incoming call (isdn->lock held).
+ *
+ * @param isdn ISDN handle.
+ * @return 0 on success, -1 if no call is free.
+ */
+static int isdn_loop_ring(isdn_t *isdn)
+{
+  isdn_call_t *call;
+
+  if (!(call = isdn_loop_call_alloc(isdn)))
+    return -1;
+
+  isdn_loop_set_number(&call->remote_number, isdn_loop_config.caller);
+  isdn_loop_set_number(&call->local_number, isdn->own_msn);
+  dbgprintf(1, "LOOPBACK: RING from %s, call %u\n", call->remote_number,
+            ISDN_CALL_NUMBER(isdn, call));
+
+  call->state = ISDN_RINGING;
+  isdn->callback->info_ring(isdn->cb_context, ISDN_CALL_NUMBER(isdn, call),
+                            call->remote_number, call->local_number);
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Establish the simulated connection (isdn->lock held).
+ *
+ * @param isdn ISDN handle.
+ * @param loop loopback state.
+ * @param call call to connect.
+ * @param now current time.
+ */
+static void isdn_loop_connect(isdn_t *isdn, isdn_loop_t *loop,
+                              isdn_call_t *call, uint64_t now)
+{
+  unsigned int number = ISDN_CALL_NUMBER(isdn, call);
+  isdn_loop_call_t *remote = &loop->call[number];
+
+  dbgprintf(1, "LOOPBACK: Call %u connected to %s\n", number,
+            call->remote_number ? call->remote_number : "(unknown)");
+
+  g_mutex_lock(isdn->data_lock);
+  memset(&call->tx.stats, 0, sizeof(call->tx.stats));
+  g_mutex_unlock(isdn->data_lock);
+
+  /* this thread is the reader of the echo queue */
+  ringbuf_discard(&remote->echo);
+  isdn_speed_init(&call->in_speed, ISDN_SPEED);
+
+  remote->event_time = 0;
+  remote->hangup_time = isdn_loop_config.hangup ?
+                        now + isdn_loop_config.hangup * (uint64_t) 1000000 : 0;
+  remote->data_start = now;
+  remote->blocks = 0;
+  remote->data_next = isdn_loop_block_time(loop, remote, 1);
+
+  if (isdn_loop_config.waiting && !loop->waiting_time)
+    loop->waiting_time = now + isdn_loop_config.waiting * (uint64_t) 1000000;
+
+  call->state = ISDN_CONNECTED;
+  isdn->callback->info_connected(isdn->cb_context, number,
+                                 call->remote_number);
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Terminate the simulated connection (isdn->lock held).
+ *
+ * @param isdn ISDN handle.
+ * @param loop loopback state.
+ * @param call call to disconnect.
+ * @param now current time.
+ */
+static void isdn_loop_disconnect(isdn_t *isdn, isdn_loop_t *loop,
+                                 isdn_call_t *call, uint64_t now)
+{
+  unsigned int number = ISDN_CALL_NUMBER(isdn, call);
+  isdn_loop_call_t *remote = &loop->call[number];
+
+  dbgprintf(1, "LOOPBACK: Call %u disconnected\n", number);
+
+  remote->event_time = 0;
+  remote->hangup_time = 0;
+
+  call->state = ISDN_IDLE;
+  if (isdn_is_idle(isdn))
+    loop->ring_time = isdn_loop_config.ring ?
+                      now + isdn_loop_config.ring * (uint64_t) 1000000 : 0;
+
+  isdn->callback->info_disconnected(isdn->cb_context, number);
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Process due signalling events (isdn->lock held).
+ *
+ * @param isdn ISDN handle.
+ * @param loop loopback state.
+ * @param now current time.
+ */
+static void isdn_loop_signalling(isdn_t *isdn, isdn_loop_t *loop, uint64_t now)
+{
+  isdn_call_t *call;
+  isdn_loop_call_t *remote;
+  unsigned int i;
+
+  if (loop->active && loop->ring_time && now >= loop->ring_time &&
+      isdn_is_idle(isdn)) {
+    loop->ring_time = 0;
+    isdn_loop_ring(isdn);
+  }
+  if (loop->active && loop->waiting_time && now >= loop->waiting_time) {
+    loop->waiting_time = 0;
+    if (isdn_loop_ring(isdn) < 0)
+      dbgprintf(1, "LOOPBACK: No call free for waiting call\n");
+  }
+
+  for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+    call = &isdn->call[i];
+    remote = &loop->call[i];
+
+    switch (call->state) {
+    case ISDN_CONNECT_WAIT:
+    case ISDN_INCOMING_WAIT:
+      if (now >= remote->event_time)
+        isdn_loop_connect(isdn, loop, call, now);
+      break;
+
+    case ISDN_CONNECTED:
+      if (remote->hangup_time && now >= remote->hangup_time) {
+        dbgprintf(1, "LOOPBACK: Remote side of call %u hangs up\n", i);
+        isdn_loop_disconnect(isdn, loop, call, now);
+      }
+      break;
+
+    case ISDN_DISCONNECT_WAIT:
+      if (now >= remote->event_time)
+        isdn_loop_disconnect(isdn, loop, call, now);
+      break;
+
+    default:
+      break;
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Deliver one data block (without isdn->lock, like DATA_B3_IND).
+ *
+ * @param isdn ISDN handle.
+ * @param loop loopback state.
+ * @param call connected call.
+ */
+static void isdn_loop_deliver(isdn_t *isdn, isdn_loop_t *loop,
+                              isdn_call_t *call)
+{
+  unsigned int number = ISDN_CALL_NUMBER(isdn, call);
+  isdn_loop_call_t *remote = &loop->call[number];
+  unsigned int length;
+
+  length = ringbuf_read(&remote->echo, loop->block, ISDN_FRAGMENT_SIZE);
+  if (length < ISDN_FRAGMENT_SIZE)
+    memset(loop->block + length, ISDN_LOOP_SILENCE,
+           ISDN_FRAGMENT_SIZE - length);
+
+  isdn_speed_addsamples(&call->in_speed, ISDN_FRAGMENT_SIZE);
+  isdn->callback->info_data(isdn->cb_context, number,
+                            loop->block, ISDN_FRAGMENT_SIZE);
+
+  remote->blocks++;
+  remote->data_next = isdn_loop_block_time(loop, remote, remote->blocks + 1);
+
+  if (debug > 1) {
+    isdn_speed_debug(&call->in_speed, 2, "LOOPBACK: in");
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Thread simulating the remote side and the network.
+ *
+ * @param param ISDN handle.
+ */
+static gpointer isdn_loop_thread(gpointer param)
+{
+  isdn_t *isdn = (isdn_t*) param;
+  isdn_loop_t *loop = (isdn_loop_t*) isdn->backend_data;
+  isdn_call_t *call;
+  isdn_loop_call_t *remote;
+  uint64_t now, wake;
+  unsigned int i;
+
+  while (!thread_is_stopping(&isdn->reply_thread)) {
+    now = media_time();
+
+    g_mutex_lock(isdn->lock);
+    isdn_loop_signalling(isdn, loop, now);
+    g_mutex_unlock(isdn->lock);
+
+    /* sleep until next event, requests wake us up earlier */
+    wake = now + 1000000;
+    if (loop->ring_time && loop->ring_time < wake)
+      wake = loop->ring_time;
+    if (loop->waiting_time && loop->waiting_time < wake)
+      wake = loop->waiting_time;
+
+    for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+      call = &isdn->call[i];
+      remote = &loop->call[i];
+
+      /* B-channel data */
+      if (call->state == ISDN_CONNECTED) {
+        if (now > remote->data_next + ISDN_LOOP_MAX_LAG) {
+          dbgprintf(1, "LOOPBACK: Data delivery late, resetting schedule\n");
+          remote->data_start = now;
+          remote->blocks = 0;
+          remote->data_next = now;
+        }
+        while (now >= remote->data_next && call->state == ISDN_CONNECTED) {
+          isdn_loop_deliver(isdn, loop, call);
+          now = media_time();
+        }
+        if (remote->data_next < wake)
+          wake = remote->data_next;
+      }
+
+      if (remote->event_time && remote->event_time < wake)
+        wake = remote->event_time;
+      if (remote->hangup_time && remote->hangup_time < wake)
+        wake = remote->hangup_time;
+    }
+
+    if (wake > now)
+      thread_sleep(&isdn->reply_thread, (int) ((wake - now + 999) / 1000));
+  }
+
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int isdn_loop_open(isdn_t *isdn)
+{
+  isdn_loop_t *loop;
+  unsigned int i;
+
+  loop = (isdn_loop_t*) calloc(1, sizeof(isdn_loop_t));
+  if (!loop) {
+    errprintf("LOOPBACK: Cannot allocate loopback state\n");
+    return -1;
+  }
+  for (i = 0; i < ISDN_MAX_CALLS; ++i) {
+    if (ringbuf_init(&loop->call[i].echo, ISDN_LOOP_ECHO_SIZE) < 0) {
+      errprintf("LOOPBACK: Cannot allocate loopback state\n");
+      while (i-- > 0)
+        ringbuf_free(&loop->call[i].echo);
+      free(loop);
+      return -1;
+    }
+  }
+
+  loop->seed = (unsigned int) time(NULL);
+  isdn->backend_data = loop;
+  isdn->ctrl_count = 1;
+  memset(isdn->ctrl, 0, sizeof(isdn->ctrl));
+  isdn->ctrl[0].b_channels = ISDN_MAX_CALLS;
+  isdn->ctrl[0].voice = 1;
+
+  dbgprintf(1, "LOOPBACK: answer %u ms, ring %u s, hangup %u s, "
+            "waiting %u s, jitter %u us, skew %d ppm\n",
+            isdn_loop_config.answer, isdn_loop_config.ring,
+            isdn_loop_config.hangup, isdn_loop_config.waiting,
+            isdn_loop_config.jitter, isdn_loop_config.skew);
+
+  isdn_loop_activate(isdn, 1);
+  thread_start(&isdn->reply_thread, isdn_loop_thread, isdn);
+
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int isdn_loop_close(isdn_t *isdn)
+{
+  isdn_loop_t *loop = (isdn_loop_t*) isdn->backend_data;
+  unsigned int i;
+
+  /* the thread uses the state */
+  thread_stop(&isdn->reply_thread);
+
+  if (loop) {
+    for (i = 0; i < ISDN_MAX_CALLS; ++i)
+      ringbuf_free(&loop->call[i].echo);
+    free(loop);
+    isdn->backend_data = NULL;
+  }
+
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int isdn_loop_activate(isdn_t *isdn, unsigned int active)
+{
+  isdn_loop_t *loop = (isdn_loop_t*) isdn->backend_data;
+
+  dbgprintf(1, "LOOPBACK: activate %d\n", active);
+
+  g_mutex_lock(isdn->lock);
+  loop->active = active;
+  loop->ring_time = active && isdn_loop_config.ring ?
+    media_time() + isdn_loop_config.ring * (uint64_t) 1000000 : 0;
+  loop->waiting_time = 0;
+  g_mutex_unlock(isdn->lock);
+
+  thread_wakeup(&isdn->reply_thread);
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int isdn_loop_dial(isdn_t *isdn, unsigned int controller _U_,
+                          char *number)
+{
+  isdn_loop_t *loop = (isdn_loop_t*) isdn->backend_data;
+  isdn_call_t *call;
+  int result;
+
+  g_mutex_lock(isdn->lock);
+
+  if (!loop->active) {
+    errprintf("LOOPBACK: Cannot dial, ISDN deactivated\n");
+    result = -1;
+  } else if (!(call = isdn_loop_call_alloc(isdn))) {
+    errprintf("ISDN: All %d calls in use, cannot dial\n", ISDN_MAX_CALLS);
+    result = -1;
+  } else {
+    result = ISDN_CALL_NUMBER(isdn, call);
+    dbgprintf(1, "LOOPBACK: Dialing %s, call %d\n", number, result);
+    isdn_loop_set_number(&call->remote_number, number);
+    loop->call[result].event_time = media_time() +
+                                    isdn_loop_config.answer * (uint64_t) 1000;
+    loop->ring_time = 0;
+    call->state = ISDN_CONNECT_WAIT;
+  }
+
+  g_mutex_unlock(isdn->lock);
+
+  thread_wakeup(&isdn->reply_thread);
+  return result;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int isdn_loop_hangup(isdn_t *isdn, unsigned int number)
+{
+  isdn_loop_t *loop = (isdn_loop_t*) isdn->backend_data;
+  isdn_call_t *call = &isdn->call[number];
+  int result = 0;
+
+  g_mutex_lock(isdn->lock);
+
+  if (call->state == ISDN_IDLE) {
+    errprintf("ISDN hangup called, even if call %u idle\n", number);
+    result = -1;
+  } else if (call->state != ISDN_DISCONNECT_WAIT) {
+    /* disconnect indication comes from the loopback thread */
+    loop->call[number].event_time = media_time();
+    call->state = ISDN_DISCONNECT_WAIT;
+  }
+
+  g_mutex_unlock(isdn->lock);
+
+  thread_wakeup(&isdn->reply_thread);
+  return result;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int isdn_loop_pickup(isdn_t *isdn, unsigned int number)
+{
+  isdn_loop_t *loop = (isdn_loop_t*) isdn->backend_data;
+  isdn_call_t *call = &isdn->call[number];
+  int result = 0;
+
+  g_mutex_lock(isdn->lock);
+
+  if (call->state != ISDN_RINGING) {
+    errprintf("ISDN pickup called, even if call %u not ringing\n", number);
+    result = -1;
+  } else {
+    /* connect indication comes from the loopback thread */
+    loop->call[number].event_time = media_time();
+    call->state = ISDN_INCOMING_WAIT;
+  }
+
+  g_mutex_unlock(isdn->lock);
+
+  thread_wakeup(&isdn->reply_thread);
+  return result;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int isdn_loop_send_data(isdn_t *isdn, unsigned int number,
+                               unsigned char *data, unsigned int datalen)
+{
+  isdn_loop_t *loop = (isdn_loop_t*) isdn->backend_data;
+  isdn_call_t *call = &isdn->call[number];
+  unsigned int written;
+
+  if (call->state != ISDN_CONNECTED) {
+    dbgprintf(3, "ISDN data send while not connected (call %u state %d)\n",
+              number, call->state);
+    return -1;
+  }
+
+  /* the remote side plays back what it receives */
+  written = ringbuf_write(&loop->call[number].echo, data, datalen);
+
+  /* data is on the wire at once */
+  if (call->latency) {
+    latency_add(call->latency, LATENCY_TX_QUEUE, 0);
+    if (call->latency->tx_origin)
+      latency_add(call->latency, LATENCY_MOUTH_TO_WIRE,
+                  media_time() - call->latency->tx_origin);
+  }
+
+  /* each request is a block which is confirmed at once */
+  g_mutex_lock(isdn->data_lock);
+  call->tx.stats.blocks_sent++;
+  call->tx.stats.blocks_confirmed++;
+  call->tx.stats.bytes_dropped += datalen - written;
+  g_mutex_unlock(isdn->data_lock);
+
+  if (written < datalen) {
+    dbgprintf(2, "LOOPBACK: Echo queue full, dropping %d bytes\n",
+              datalen - written);
+    return -1;
+  }
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
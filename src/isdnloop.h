@@ -0,0 +1,68 @@
+/*
+ * Loopback ISDN backend, simulates calls without ISDN hardware
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ANT_ISDNLOOP_H
+#define _ANT_ISDNLOOP_H
+
+#include "isdn.h"
+
+/*!
+ * @brief Default delay until the remote side answers an outgoing call (ms).
+ */
+#define ISDN_LOOP_DEFAULT_ANSWER 1000
+
+/*!
+ * @brief Default number of the simulated caller of incoming calls.
+ */
+#define ISDN_LOOP_DEFAULT_CALLER "100"
+
+/*!
+ * @brief Bit-inverse A-law silence, sent when there is nothing to echo.
+ */
+#define ISDN_LOOP_SILENCE 0xAB
+
+/*!
+ * @brief Size of the echo queue (bytes), 0.5 s at ISDN speed.
+ */
+#define ISDN_LOOP_ECHO_SIZE 4096
+
+/*!
+ * @brief Loopback ISDN backend.
+ *
+ * Simulates a remote party on a plain Linux box. Outgoing calls are
+ * answered after a delay, incoming calls can ring periodically. While
+ * connected, B-channel data is delivered in blocks of ISDN_FRAGMENT_SIZE
+ * bytes at exactly 8 kHz of the remote clock, the content is the data
+ * sent to the backend (echo) or silence.
+ *
+ * Options (isdn_set_backend("loopback:name=value,...")):
+ *  - answer=MS   delay until outgoing calls are answered (default 1000)
+ *  - ring=SEC    ring every SEC seconds while idle (default 0 = never)
+ *  - hangup=SEC  remote side hangs up after SEC seconds (default 0 = never)
+ *  - waiting=SEC second incoming call (call waiting) SEC seconds after a
+ *                call is connected (default 0 = never)
+ *  - jitter=MS   random additional delay of each data block (default 0)
+ *  - skew=PPM    remote clock deviation in ppm, may be negative (default 0)
+ *  - caller=NR   number of the simulated caller (default 100)
+ */
+extern const isdn_backend_t isdn_loop_backend;
+
+#endif /* _ANT_ISDNLOOP_H */
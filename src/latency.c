@@ -0,0 +1,266 @@
+/*
+ * Per-stage latency histograms of the call pipeline
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#ifdef HAVE_STDLIB_H
+  #include <stdlib.h>
+#endif
+#include <time.h>
+
+#include "globals.h"
+#include "latency.h"
+#include "util.h"
+
+/*!
+ * @brief Stage names for output.
+ */
+static const char *latency_stage_names[LATENCY_STAGES] = {
+  "tx-capture",
+  "tx-convert",
+  "tx-queue",
+  "rx-queue",
+  "rx-convert",
+  "rx-write",
+  "rx-playback",
+  "mouth-to-wire",
+  "wire-to-ear"
+};
+
+/*!
+ * @brief Get bucket index of a value.
+ *
+ * Values below 2^(LATENCY_SUB_BITS+1) have a bucket each, above each power
+ * of two is split into 2^LATENCY_SUB_BITS linear buckets.
+ *
+ * @param value value in microseconds.
+ * @return bucket index.
+ */
+static unsigned int latency_index(unsigned int value)
+{
+  unsigned int bits, shift = 0;
+
+  if (value >= 1U << LATENCY_MAX_BITS)
+    value = (1U << LATENCY_MAX_BITS) - 1;
+
+  bits = g_bit_storage(value);
+  if (bits > LATENCY_SUB_BITS + 1)
+    shift = bits - LATENCY_SUB_BITS - 1;
+
+  return (shift << LATENCY_SUB_BITS) + (value >> shift);
+}
+
+/*!
+ * @brief Get lowest value of a bucket.
+ *
+ * @param index bucket index.
+ * @param width returns number of values in the bucket.
+ * @return value in microseconds.
+ */
+static unsigned int latency_value(unsigned int index, unsigned int *width)
+{
+  unsigned int shift = 0;
+
+  if (index >= 2U << LATENCY_SUB_BITS)
+    shift = (index >> LATENCY_SUB_BITS) - 1;
+
+  *width = 1U << shift;
+  return (index - (shift << LATENCY_SUB_BITS)) << shift;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void latency_reset(latency_t *latency)
+{
+  int i;
+
+  memset(latency, 0, sizeof(latency_t));
+  for (i = 0; i < LATENCY_STAGES; ++i)
+    latency->stage[i].min = G_MAXINT;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void latency_add(latency_t *latency, latency_stage_t stage, int64_t value)
+{
+  latency_histogram_t *histogram = &latency->stage[stage];
+  gint old;
+
+  if (value < 0)
+    value = 0;
+  else if (value > G_MAXINT)
+    value = G_MAXINT;
+
+  g_atomic_int_inc(&histogram->buckets[latency_index((unsigned int) value)]);
+  g_atomic_int_inc(&histogram->count);
+
+  do {
+    old = g_atomic_int_get(&histogram->min);
+  } while (value < old &&
+           !g_atomic_int_compare_and_exchange(&histogram->min, old, value));
+  do {
+    old = g_atomic_int_get(&histogram->max);
+  } while (value > old &&
+           !g_atomic_int_compare_and_exchange(&histogram->max, old, value));
+}
+
+/*--------------------------------------------------------------------------*/
+
+int latency_percentile(latency_histogram_t *histogram, double fraction)
+{
+  unsigned int i, width, value;
+  gint count, limit, sum = 0;
+
+  count = g_atomic_int_get(&histogram->count);
+  if (count == 0)
+    return 0;
+
+  limit = (gint) (fraction * count + 0.5);
+  if (limit < 1)
+    limit = 1;
+
+  for (i = 0; i < LATENCY_BUCKETS; ++i) {
+    sum += g_atomic_int_get(&histogram->buckets[i]);
+    if (sum >= limit) {
+      value = latency_value(i, &width);
+      return value + width - 1;
+    }
+  }
+  return g_atomic_int_get(&histogram->max);
+}
+
+/*--------------------------------------------------------------------------*/
+
+void latency_dump(latency_t *latency, FILE *file, int distribution)
+{
+  latency_histogram_t *histogram;
+  unsigned int i, j, width, value;
+  gint count, n, sum;
+  double mean;
+
+  fprintf(file, "%-14s %8s %8s %8s %8s %8s %8s %8s %8s\n", "stage (us)",
+          "count", "min", "mean", "50%", "90%", "99%", "99.9%", "max");
+
+  for (i = 0; i < LATENCY_STAGES; ++i) {
+    histogram = &latency->stage[i];
+    count = g_atomic_int_get(&histogram->count);
+    if (count == 0) {
+      fprintf(file, "%-14s %8d\n", latency_stage_names[i], 0);
+      continue;
+    }
+
+    /* mean from bucket midpoints, precise enough for the bucket widths */
+    mean = 0.0;
+    for (j = 0; j < LATENCY_BUCKETS; ++j) {
+      n = g_atomic_int_get(&histogram->buckets[j]);
+      if (n) {
+        value = latency_value(j, &width);
+        mean += n * (value + (width - 1) / 2.0);
+      }
+    }
+    mean /= count;
+
+    fprintf(file, "%-14s %8d %8d %8.0f %8d %8d %8d %8d %8d\n",
+            latency_stage_names[i], count,
+            g_atomic_int_get(&histogram->min), mean,
+            latency_percentile(histogram, 0.5),
+            latency_percentile(histogram, 0.9),
+            latency_percentile(histogram, 0.99),
+            latency_percentile(histogram, 0.999),
+            g_atomic_int_get(&histogram->max));
+  }
+
+  if (!distribution)
+    return;
+
+  for (i = 0; i < LATENCY_STAGES; ++i) {
+    histogram = &latency->stage[i];
+    count = g_atomic_int_get(&histogram->count);
+    if (count == 0)
+      continue;
+
+    fprintf(file, "\n# %s\n# %10s %10s %10s\n", latency_stage_names[i],
+            "value (us)", "percentile", "count");
+    sum = 0;
+    for (j = 0; j < LATENCY_BUCKETS; ++j) {
+      n = g_atomic_int_get(&histogram->buckets[j]);
+      if (n) {
+        sum += n;
+        value = latency_value(j, &width);
+        fprintf(file, "%12d %10.6f %10d\n", value + width - 1,
+                (double) sum / count, sum);
+      }
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+int latency_save(latency_t *latency, const char *name)
+{
+  char *homedir;
+  char *fn;
+  FILE *file;
+  int i;
+
+  for (i = 0; i < LATENCY_STAGES; ++i) {
+    if (g_atomic_int_get(&latency->stage[i].count))
+      break;
+  }
+  if (i == LATENCY_STAGES)
+    return 0; /* no data */
+
+  touch_dotdir();
+
+  if (!(homedir = get_homedir())) {
+    errprintf("LATENCY: Couldn't get home dir.\n");
+    return -1;
+  }
+  if (asprintf(&fn, "%s/." PACKAGE "/" LATENCY_DIRNAME, homedir) < 0) {
+    errprintf("LATENCY: Couldn't allocate memory for directory name.\n");
+    return -1;
+  }
+  if (touch_dir(fn) < 0) {
+    errprintf("LATENCY: Can't reach directory %s.\n", fn);
+    free(fn);
+    return -1;
+  }
+  free(fn);
+
+  if (asprintf(&fn, "%s/." PACKAGE "/" LATENCY_DIRNAME "/%s.txt",
+               homedir, name) < 0) {
+    errprintf("LATENCY: Couldn't allocate memory for file name.\n");
+    return -1;
+  }
+  if (!(file = fopen(fn, "w"))) {
+    errprintf("LATENCY: Can't write %s.\n", fn);
+    free(fn);
+    return -1;
+  }
+
+  latency_dump(latency, file, 1);
+  fclose(file);
+
+  dbgprintf(1, "LATENCY: Saved histograms to %s\n", fn);
+  free(fn);
+  return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Per-stage latency histograms of the call pipeline
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ANT_LATENCY_H
+#define _ANT_LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* GTK */
+#include <gtk/gtk.h>
+
+/*!
+ * @brief Number of bits for linear sub-buckets of each power of two.
+ *
+ * Values are recorded with a relative precision of 1/2^LATENCY_SUB_BITS
+ * (about 3 %).
+ */
+#define LATENCY_SUB_BITS 5
+
+/*!
+ * @brief Highest power of two of recorded values (us), larger ones are
+ * clamped (2^24 us is about 16 s).
+ */
+#define LATENCY_MAX_BITS 24
+
+/*!
+ * @brief Number of buckets of a histogram.
+ */
+#define LATENCY_BUCKETS \
+  ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+/*!
+ * @brief Subdirectory of the settings directory for per-call histograms.
+ */
+#define LATENCY_DIRNAME "latency"
+
+/*!
+ * @brief Measured stages of the call pipeline.
+ */
+typedef enum {
+  LATENCY_TX_CAPTURE = 0,   /*!< age of oldest sample at capture read */
+  LATENCY_TX_CONVERT,       /*!< capture read to A-law conversion done */
+  LATENCY_TX_QUEUE,         /*!< conversion done to DATA_B3_REQ */
+  LATENCY_RX_QUEUE,         /*!< DATA_B3_IND to start of conversion */
+  LATENCY_RX_CONVERT,       /*!< conversion to audio format */
+  LATENCY_RX_WRITE,         /*!< conversion done to ALSA write done */
+  LATENCY_RX_PLAYBACK,      /*!< ALSA buffer delay until first sample plays */
+  LATENCY_MOUTH_TO_WIRE,    /*!< capture of oldest sample to DATA_B3_REQ */
+  LATENCY_WIRE_TO_EAR,      /*!< DATA_B3_IND to playback of first sample */
+  LATENCY_STAGES
+} latency_stage_t;
+
+/*!
+ * @brief Log-linear (HDR-style) histogram of latencies in microseconds.
+ *
+ * All fields are updated with atomic operations only, so any thread may
+ * record without locking.
+ */
+typedef struct {
+  volatile gint count;                    /*!< number of recorded values */
+  volatile gint min;                      /*!< minimum value (us) */
+  volatile gint max;                      /*!< maximum value (us) */
+  volatile gint buckets[LATENCY_BUCKETS]; /*!< counts per bucket */
+} latency_histogram_t;
+
+/*!
+ * @brief Latency statistics of a call.
+ */
+typedef struct {
+  latency_histogram_t stage[LATENCY_STAGES]; /*!< histogram per stage */
+  uint64_t tx_origin;       /*!< capture time of the oldest sample of the
+                                 data currently passed to isdn_send_data(),
+                                 0 if unknown (used by the sending thread) */
+} latency_t;
+
+/*!
+ * @brief Clear all histograms.
+ *
+ * @param latency latency statistics.
+ */
+void latency_reset(latency_t *latency);
+
+/*!
+ * @brief Record a value (lock-free).
+ *
+ * @param latency latency statistics.
+ * @param stage pipeline stage.
+ * @param value latency in microseconds, negative values count as 0.
+ */
+void latency_add(latency_t *latency, latency_stage_t stage, int64_t value);
+
+/*!
+ * @brief Get the value below which the given fraction of values lies.
+ *
+ * @param histogram histogram.
+ * @param fraction fraction of values (0.0 .. 1.0).
+ * @return value in microseconds (highest value of the bucket), 0 if empty.
+ */
+int latency_percentile(latency_histogram_t *histogram, double fraction);
+
+/*!
+ * @brief Print a summary line per stage.
+ *
+ * @param latency latency statistics.
+ * @param file output file.
+ * @param distribution if set, also print the percentile distribution of
+ *        each stage (one line per non-empty bucket).
+ */
+void latency_dump(latency_t *latency, FILE *file, int distribution);
+
+/*!
+ * @brief Save histograms in the settings directory.
+ *
+ * The file is LATENCY_DIRNAME/name.txt, nothing is written if no value
+ * has been recorded.
+ *
+ * @param latency latency statistics.
+ * @param name file name without extension.
+ * @return 0 on success, -1 on error.
+ */
+int latency_save(latency_t *latency, const char *name);
+
+#endif /* _ANT_LATENCY_H */
@@ -0,0 +1,437 @@
+/*
+ * Asynchronous message logger
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_STDLIB_H
+  #include <stdlib.h>
+#endif
+#include <time.h>
+
+#include "globals.h"
+#include "logger.h"
+#include "thread.h"
+
+/*!
+ * @brief Argument types of format conversions.
+ */
+typedef enum {
+  LOGGER_ARG_NONE = 0,      /*!< no argument (%%) */
+  LOGGER_ARG_INT,           /*!< int and shorter */
+  LOGGER_ARG_LONG,          /*!< long */
+  LOGGER_ARG_LLONG,         /*!< long long, intmax_t */
+  LOGGER_ARG_SIZE,          /*!< size_t, ptrdiff_t */
+  LOGGER_ARG_DOUBLE,        /*!< double */
+  LOGGER_ARG_PTR,           /*!< pointer */
+  LOGGER_ARG_STRING,        /*!< string, copied into the record */
+  LOGGER_ARG_INVALID        /*!< not supported, format at once */
+} logger_arg_type_t;
+
+/*!
+ * @brief List of rings of all threads which ever logged (never shrinks).
+ */
+static logger_ring_t * volatile logger_rings = NULL;
+
+/*!
+ * @brief Ring of the calling thread.
+ */
+static GStaticPrivate logger_ring_key = G_STATIC_PRIVATE_INIT;
+
+/*!
+ * @brief Formatter thread.
+ */
+static thread_t logger_thread;
+
+/*!
+ * @brief Nonzero while the formatter thread is running.
+ */
+static volatile gint logger_running = 0;
+
+/*!
+ * @brief Parse one conversion specification.
+ *
+ * @param format format, just after the '%'.
+ * @param type returns type of the argument.
+ * @return pointer to the character after the conversion.
+ */
+static const char *logger_parse(const char *format, logger_arg_type_t *type)
+{
+  int length = 0; /* -1 = short, 1 = long, 2 = long long, 3 = size, 4 = long double */
+
+  while (*format && strchr("-+ #0'", *format))
+    format++;
+  while (*format == '.' || (*format >= '0' && *format <= '9'))
+    format++;
+  if (*format == '*') {
+    *type = LOGGER_ARG_INVALID;
+    return format;
+  }
+
+  switch (*format) {
+  case 'h':
+    length = -1;
+    while (*format == 'h')
+      format++;
+    break;
+  case 'l':
+    length = 1;
+    if (*++format == 'l') {
+      length = 2;
+      format++;
+    }
+    break;
+  case 'q': case 'j':
+    length = 2;
+    format++;
+    break;
+  case 'z': case 't':
+    length = 3;
+    format++;
+    break;
+  case 'L':
+    length = 4;
+    format++;
+    break;
+  }
+
+  switch (*format) {
+  case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+    *type = length == 1 ? LOGGER_ARG_LONG :
+            length == 2 ? LOGGER_ARG_LLONG :
+            length == 3 ? LOGGER_ARG_SIZE :
+            length == 4 ? LOGGER_ARG_INVALID : LOGGER_ARG_INT;
+    break;
+  case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+    *type = length == 4 ? LOGGER_ARG_INVALID : LOGGER_ARG_DOUBLE;
+    break;
+  case 'p':
+    *type = LOGGER_ARG_PTR;
+    break;
+  case 's':
+    *type = length ? LOGGER_ARG_INVALID : LOGGER_ARG_STRING;
+    break;
+  case '%':
+    *type = LOGGER_ARG_NONE;
+    break;
+  default:
+    *type = LOGGER_ARG_INVALID;
+    return format;
+  }
+  return format + 1;
+}
+
+/*!
+ * @brief Release ring of a terminating thread for reuse by another thread.
+ *
+ * @param data ring.
+ */
+static void logger_ring_release(gpointer data)
+{
+  logger_ring_t *ring = (logger_ring_t*) data;
+
+  g_atomic_int_set(&ring->in_use, 0);
+}
+
+/*!
+ * @brief Get ring of the calling thread, claim or allocate one if needed.
+ *
+ * @return ring, NULL on error.
+ */
+static logger_ring_t *logger_ring_get(void)
+{
+  logger_ring_t *ring;
+
+  ring = (logger_ring_t*) g_static_private_get(&logger_ring_key);
+  if (ring)
+    return ring;
+
+  /* reuse the ring of a terminated thread (engine threads come and go) */
+  for (ring = logger_rings; ring; ring = ring->next) {
+    if (g_atomic_int_compare_and_exchange(&ring->in_use, 0, 1))
+      break;
+  }
+
+  if (!ring) {
+    ring = (logger_ring_t*) calloc(1, sizeof(logger_ring_t));
+    if (!ring)
+      return NULL;
+    ring->in_use = 1;
+    do {
+      ring->next = logger_rings;
+    } while (!g_atomic_pointer_compare_and_exchange(
+               (volatile gpointer*) &logger_rings, ring->next, ring));
+  }
+
+  g_static_private_set(&logger_ring_key, ring, logger_ring_release);
+  return ring;
+}
+
+/*!
+ * @brief Format a record.
+ *
+ * @param record record.
+ * @param line output buffer.
+ * @param size size of output buffer.
+ */
+static void logger_format(logger_record_t *record, char *line, size_t size)
+{
+  const char *format, *spec;
+  char conversion[32];
+  logger_arg_type_t type;
+  logger_arg_t *arg = record->args;
+  size_t pos = 0, length;
+  int n;
+
+  if (!record->format) {
+    snprintf(line, size, "%s", record->text);
+    return;
+  }
+
+  line[0] = '\0';
+  for (format = record->format; *format && pos < size - 1; ) {
+    if (*format != '%') {
+      line[pos++] = *format++;
+      line[pos] = '\0';
+      continue;
+    }
+
+    spec = format;
+    format = logger_parse(format + 1, &type);
+    length = format - spec;
+    if (length >= sizeof(conversion))
+      length = sizeof(conversion) - 1;
+    memcpy(conversion, spec, length);
+    conversion[length] = '\0';
+
+    switch (type) {
+    case LOGGER_ARG_NONE:
+      n = snprintf(line + pos, size - pos, "%%");
+      break;
+    case LOGGER_ARG_INT:
+      n = snprintf(line + pos, size - pos, conversion, (int) (arg++)->i);
+      break;
+    case LOGGER_ARG_LONG:
+      n = snprintf(line + pos, size - pos, conversion, (long) (arg++)->i);
+      break;
+    case LOGGER_ARG_LLONG:
+      n = snprintf(line + pos, size - pos, conversion, (arg++)->i);
+      break;
+    case LOGGER_ARG_SIZE:
+      n = snprintf(line + pos, size - pos, conversion, (size_t) (arg++)->i);
+      break;
+    case LOGGER_ARG_DOUBLE:
+      n = snprintf(line + pos, size - pos, conversion, (arg++)->d);
+      break;
+    case LOGGER_ARG_PTR:
+      n = snprintf(line + pos, size - pos, conversion, (arg++)->p);
+      break;
+    case LOGGER_ARG_STRING:
+      n = snprintf(line + pos, size - pos, conversion,
+                   record->text + (arg++)->i);
+      break;
+    default:
+      n = 0;
+      break;
+    }
+
+    if (n < 0)
+      break;
+    pos += n;
+    if (pos >= size)
+      pos = size - 1;
+  }
+}
+
+/*!
+ * @brief Print all queued messages, ordered by time across threads.
+ */
+static void logger_flush(void)
+{
+  logger_ring_t *ring, *oldest;
+  logger_record_t *record;
+  char line[1024];
+  gint head, dropped;
+
+  for (;;) {
+    /* pick the ring with the oldest pending record */
+    oldest = NULL;
+    for (ring = logger_rings; ring; ring = ring->next) {
+      head = g_atomic_int_get(&ring->head);
+      if (head == g_atomic_int_get(&ring->tail))
+        continue;
+      if (!oldest ||
+          ring->record[(guint) head % LOGGER_RING_SIZE].time <
+          oldest->record[(guint) oldest->head % LOGGER_RING_SIZE].time)
+        oldest = ring;
+    }
+    if (!oldest)
+      break;
+
+    head = oldest->head;
+    record = &oldest->record[(guint) head % LOGGER_RING_SIZE];
+    logger_format(record, line, sizeof(line));
+    g_atomic_int_set(&oldest->head, (gint) ((guint) head + 1));
+
+    fputs(line, stderr);
+  }
+
+  for (ring = logger_rings; ring; ring = ring->next) {
+    dropped = g_atomic_int_get(&ring->dropped);
+    if (dropped) {
+      g_atomic_int_add(&ring->dropped, -dropped);
+      fprintf(stderr, "LOG: %d messages dropped\n", dropped);
+    }
+  }
+  fflush(stderr);
+}
+
+/*!
+ * @brief Formatter thread.
+ *
+ * @param data unused.
+ */
+static gpointer logger_thread_main(gpointer data _U_)
+{
+  while (!thread_sleep(&logger_thread, LOGGER_FLUSH_INTERVAL)) {
+    thread_wakeup_clear(&logger_thread);
+    logger_flush();
+  }
+  logger_flush();
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------*/
+
+int logger_init(void)
+{
+  thread_init(&logger_thread);
+  if (thread_start(&logger_thread, logger_thread_main, NULL) < 0) {
+    thread_deinit(&logger_thread);
+    return -1;
+  }
+  g_atomic_int_set(&logger_running, 1);
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void logger_deinit(void)
+{
+  if (!g_atomic_int_get(&logger_running))
+    return;
+
+  g_atomic_int_set(&logger_running, 0);
+  thread_deinit(&logger_thread); /* flushes */
+}
+
+/*--------------------------------------------------------------------------*/
+
+int logger_vlog(int level, const char *format, va_list args)
+{
+  logger_ring_t *ring;
+  logger_record_t *record;
+  logger_arg_type_t type;
+  const char *p, *s;
+  struct timespec ts;
+  size_t text = 0, length;
+  unsigned int n = 0;
+  gint tail;
+  va_list copy;
+
+  if (!g_atomic_int_get(&logger_running) || !(ring = logger_ring_get()))
+    return -1;
+
+  tail = ring->tail;
+  if ((guint) tail - (guint) g_atomic_int_get(&ring->head) >= LOGGER_RING_SIZE) {
+    g_atomic_int_inc(&ring->dropped);
+    return 0;
+  }
+
+  va_copy(copy, args);
+  record = &ring->record[(guint) tail % LOGGER_RING_SIZE];
+  record->format = format;
+  record->level = level;
+
+  /* capture arguments as the format says */
+  for (p = strchr(format, '%'); p; p = strchr(p, '%')) {
+    p = logger_parse(p + 1, &type);
+    if (type == LOGGER_ARG_NONE)
+      continue;
+    if (type == LOGGER_ARG_INVALID || n == LOGGER_MAX_ARGS) {
+      record->format = NULL;
+      break;
+    }
+
+    switch (type) {
+    case LOGGER_ARG_INT:
+      record->args[n].i = va_arg(args, int);
+      break;
+    case LOGGER_ARG_LONG:
+      record->args[n].i = va_arg(args, long);
+      break;
+    case LOGGER_ARG_LLONG:
+      record->args[n].i = va_arg(args, long long);
+      break;
+    case LOGGER_ARG_SIZE:
+      record->args[n].i = va_arg(args, size_t);
+      break;
+    case LOGGER_ARG_DOUBLE:
+      record->args[n].d = va_arg(args, double);
+      break;
+    case LOGGER_ARG_PTR:
+      record->args[n].p = va_arg(args, void*);
+      break;
+    case LOGGER_ARG_STRING:
+      s = va_arg(args, const char*);
+      if (!s)
+        s = "(null)";
+      length = strlen(s);
+      if (length > LOGGER_TEXT_SIZE - 1 - text)
+        length = LOGGER_TEXT_SIZE - 1 - text; /* truncate */
+      memcpy(record->text + text, s, length);
+      record->text[text + length] = '\0';
+      record->args[n].i = text;
+      text += length;
+      if (text < LOGGER_TEXT_SIZE - 1)
+        text++;
+      break;
+    default:
+      break;
+    }
+    n++;
+  }
+
+  if (!record->format) {
+    /* not supported, queue the formatted message */
+    vsnprintf(record->text, LOGGER_TEXT_SIZE, format, copy);
+  }
+  va_end(copy);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  record->time = ts.tv_sec * ((uint64_t) 1000000000) + ts.tv_nsec;
+  g_atomic_int_set(&ring->tail, (gint) ((guint) tail + 1));
+
+  if (level == 0)
+    thread_wakeup(&logger_thread);
+  return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Asynchronous message logger
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ANT_LOGGER_H
+#define _ANT_LOGGER_H
+
+#include <stdarg.h>
+#include <stdint.h>
+
+/* GTK */
+#include <gtk/gtk.h>
+
+/*!
+ * @brief Number of records in the ring of each thread.
+ */
+#define LOGGER_RING_SIZE 256
+
+/*!
+ * @brief Maximum number of arguments of a message.
+ */
+#define LOGGER_MAX_ARGS 8
+
+/*!
+ * @brief Space for string arguments (or a preformatted message) of a record.
+ */
+#define LOGGER_TEXT_SIZE 128
+
+/*!
+ * @brief How often the formatter thread writes pending messages (ms).
+ *
+ * Errors are written at once.
+ */
+#define LOGGER_FLUSH_INTERVAL 20
+
+/*!
+ * @brief Argument of a message, as captured from the caller.
+ */
+typedef union {
+  long long i;              /*!< any integer type, offset of string in text */
+  double d;                 /*!< floating point */
+  const void *p;            /*!< pointer */
+} logger_arg_t;
+
+/*!
+ * @brief Binary message record.
+ *
+ * The format string (a literal) identifies the message, arguments are
+ * kept binary until the formatter thread prints them.
+ */
+typedef struct {
+  uint64_t time;                    /*!< monotonic time (ns) for ordering */
+  const char *format;               /*!< format, NULL if text is the message */
+  int level;                        /*!< message level */
+  logger_arg_t args[LOGGER_MAX_ARGS]; /*!< arguments */
+  char text[LOGGER_TEXT_SIZE];      /*!< copied string arguments */
+} logger_record_t;
+
+/*!
+ * @brief Single-writer, single-reader ring of a thread.
+ *
+ * Only the owning thread writes and only the formatter thread reads, both
+ * indices are accessed atomically, so no lock is needed.
+ */
+typedef struct logger_ring_t {
+  logger_record_t record[LOGGER_RING_SIZE]; /*!< records */
+  volatile gint head;       /*!< next record to read (formatter) */
+  volatile gint tail;       /*!< next record to write (owner) */
+  volatile gint dropped;    /*!< records dropped because ring was full */
+  volatile gint in_use;     /*!< ring is owned by a thread */
+  struct logger_ring_t *next; /*!< next ring in list of all rings */
+} logger_ring_t;
+
+/*!
+ * @brief Start the formatter thread, messages are queued from now on.
+ *
+ * @return 0 on success, -1 on error (messages are printed directly).
+ */
+int logger_init(void);
+
+/*!
+ * @brief Write all pending messages and stop the formatter thread.
+ *
+ * Messages are printed directly afterwards. Suitable for atexit().
+ */
+void logger_deinit(void);
+
+/*!
+ * @brief Queue a message in the ring of the calling thread.
+ *
+ * Never blocks and never allocates except once per thread. Arguments are
+ * captured according to the format, strings are copied (truncated to
+ * LOGGER_TEXT_SIZE in total). Formats the logger cannot capture ('*'
+ * width or precision, long double, too many arguments) are formatted at
+ * once instead (truncated to LOGGER_TEXT_SIZE).
+ *
+ * @param level message level (0=error, 1..n=debug).
+ * @param format printf-like format, must stay valid (string literal).
+ * @param args arguments.
+ * @return 0 if queued or dropped, -1 if the logger is not running.
+ */
+int logger_vlog(int level, const char *format, va_list args);
+
+#endif /* _ANT_LOGGER_H */
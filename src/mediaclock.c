@@ -0,0 +1,107 @@
+/*
+ * Media clock: one monotonic timebase for all timing of the media path
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "config.h"
+
+#include <time.h>
+
+#include "mediaclock.h"
+
+/*!
+ * @brief Clock of the coarse path, same timebase as CLOCK_MONOTONIC.
+ */
+#ifdef CLOCK_MONOTONIC_COARSE
+  #define MEDIA_CLOCK_COARSE CLOCK_MONOTONIC_COARSE
+#else
+  #define MEDIA_CLOCK_COARSE CLOCK_MONOTONIC
+#endif
+
+/*--------------------------------------------------------------------------*/
+
+uint64_t media_time(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * ((uint64_t) 1000000) + ts.tv_nsec / 1000;
+}
+
+/*--------------------------------------------------------------------------*/
+
+uint64_t media_time_coarse(void)
+{
+  struct timespec ts;
+
+  clock_gettime(MEDIA_CLOCK_COARSE, &ts);
+  return ts.tv_sec * ((uint64_t) 1000000) + ts.tv_nsec / 1000;
+}
+
+/*--------------------------------------------------------------------------*/
+
+int media_pcm_time(snd_pcm_t *pcm, snd_pcm_sframes_t *delay, uint64_t *time)
+{
+  snd_pcm_status_t *status;
+  snd_htimestamp_t ts;
+  uint64_t stamp, now;
+
+  snd_pcm_status_alloca(&status);
+  if (snd_pcm_status(pcm, status) < 0)
+    return -1;
+
+  snd_pcm_status_get_htstamp(status, &ts);
+  if (ts.tv_sec == 0 && ts.tv_nsec == 0)
+    return -1; /* no timestamps */
+
+  /* older ALSA or drivers stamp with gettimeofday(), years apart */
+  stamp = ts.tv_sec * ((uint64_t) 1000000) + ts.tv_nsec / 1000;
+  now = media_time();
+  if (stamp > now || now - stamp > MEDIA_PCM_TIME_MAX_SKEW)
+    return -1;
+
+  *delay = snd_pcm_status_get_delay(status);
+  *time = stamp;
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+int media_pcm_trigger_time(snd_pcm_t *pcm, uint64_t *time)
+{
+  snd_pcm_status_t *status;
+  snd_htimestamp_t ts;
+  uint64_t stamp, now;
+
+  snd_pcm_status_alloca(&status);
+  if (snd_pcm_status(pcm, status) < 0)
+    return -1;
+
+  snd_pcm_status_get_trigger_htstamp(status, &ts);
+  if (ts.tv_sec == 0 && ts.tv_nsec == 0)
+    return -1;
+
+  stamp = ts.tv_sec * ((uint64_t) 1000000) + ts.tv_nsec / 1000;
+  now = media_time();
+  if (stamp > now || now - stamp > MEDIA_PCM_TIME_MAX_SKEW)
+    return -1;
+
+  *time = stamp;
+  return 0;
+}
@@ -0,0 +1,85 @@
+/*
+ * Media clock: one monotonic timebase for all timing of the media path
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ANT_MEDIACLOCK_H
+#define _ANT_MEDIACLOCK_H
+
+#include <stdint.h>
+
+/* ALSA */
+#include <alsa/asoundlib.h>
+
+/*!
+ * @brief Maximum difference between a PCM timestamp and the media clock
+ * (us). Larger differences mean the PCM uses another timebase.
+ */
+#define MEDIA_PCM_TIME_MAX_SKEW 1000000
+
+/*!
+ * @brief Get media time.
+ *
+ * All timing of the media path (latency histograms, rate estimation,
+ * recorder, traces, simulated devices) uses this timebase. It is
+ * CLOCK_MONOTONIC: it never jumps with settimeofday() or NTP steps, and
+ * the C library reads it without a system call (vDSO).
+ *
+ * @return time in microseconds since an arbitrary start point.
+ */
+uint64_t media_time(void);
+
+/*!
+ * @brief Get media time cheaply, with tick resolution.
+ *
+ * Same timebase as media_time(), but the time of the last timer tick the
+ * kernel keeps anyway (CLOCK_MONOTONIC_COARSE, 1-10 ms resolution). For
+ * consumers which are called often and tolerate that resolution.
+ *
+ * @return time in microseconds since the start point of media_time().
+ */
+uint64_t media_time_coarse(void);
+
+/*!
+ * @brief Get PCM delay together with the time it was measured.
+ *
+ * Uses the timestamp ALSA takes with the status (see sound.c for the
+ * timestamp mode), which is closer to the hardware than reading the clock
+ * after snd_pcm_delay(). Fails if the PCM has no timestamps in the media
+ * timebase (e.g. "file:" devices), the caller measures itself then.
+ *
+ * @param pcm PCM handle.
+ * @param delay filled with the delay in frames.
+ * @param time filled with the media time of the measurement.
+ * @return 0 on success, -1 if no usable timestamp.
+ */
+int media_pcm_time(snd_pcm_t *pcm, snd_pcm_sframes_t *delay, uint64_t *time);
+
+/*!
+ * @brief Get the time a PCM was started (or stopped) by the driver.
+ *
+ * Same timebase and restrictions as media_pcm_time().
+ *
+ * @param pcm PCM handle.
+ * @param time filled with the media time of the last trigger.
+ * @return 0 on success, -1 if no usable timestamp.
+ */
+int media_pcm_trigger_time(snd_pcm_t *pcm, uint64_t *time);
+
+#endif /* _ANT_MEDIACLOCK_H */
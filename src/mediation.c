@@ -66,6 +66,11 @@
  */
 static unsigned char bitinverse(unsigned char c);
 
+/*!
+ * @brief Shared conversion table sets, see mediation_getLUT().
+ */
+static mediation_LUT_t *mediation_LUTs = NULL;
+
 /*--------------------------------------------------------------------------*/
 
 static unsigned char bitinverse(unsigned char c)
@@ -226,6 +231,57 @@ int mediation_makeLUT(int format_in, unsigned char **LUT_in,
 
 /*--------------------------------------------------------------------------*/
 
+const mediation_LUT_t *mediation_getLUT(int format_in, int format_out)
+{
+  mediation_LUT_t *set;
+
+  for (set = mediation_LUTs; set; set = set->next) {
+    if (set->format_in == format_in && set->format_out == format_out)
+      return set;
+  }
+
+  if (!(set = (mediation_LUT_t *) calloc(1, sizeof(mediation_LUT_t))))
+    return NULL;
+  set->format_in = format_in;
+  set->format_out = format_out;
+  if (mediation_makeLUT(format_in, &set->LUT_in, format_out, &set->LUT_out,
+                        &set->LUT_generate, &set->LUT_analyze,
+                        &set->LUT_alaw2short)) {
+    free(set->LUT_in);
+    free(set->LUT_out);
+    free(set->LUT_generate);
+    free(set->LUT_analyze);
+    free(set->LUT_alaw2short);
+    free(set);
+    return NULL;
+  }
+  dbgprintf(1, "MEDIATION: Built conversion tables for formats %d/%d\n",
+            format_in, format_out);
+
+  set->next = mediation_LUTs;
+  mediation_LUTs = set;
+  return set;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void mediation_freeLUTs(void)
+{
+  mediation_LUT_t *set;
+
+  while ((set = mediation_LUTs)) {
+    mediation_LUTs = set->next;
+    free(set->LUT_in);
+    free(set->LUT_out);
+    free(set->LUT_generate);
+    free(set->LUT_analyze);
+    free(set->LUT_alaw2short);
+    free(set);
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
 /* XXX: smooth samples when converting speeds in next 2 functions */
 
 void convert_isdn_to_audio(session_t *session,
@@ -24,6 +24,40 @@
 
 #include "session.h"
 
+/*!
+ * @brief Conversion tables of one (in, out) format pair.
+ *
+ * Built once per process by mediation_getLUT() and never changed
+ * afterwards, so any number of users may point into them.
+ */
+typedef struct mediation_LUT_t {
+  int format_in;                      /*!< audio output format (ISDN in) */
+  int format_out;                     /*!< audio input format (ISDN out) */
+  unsigned char *LUT_in;              /*!< A-law -> audio */
+  unsigned char *LUT_out;             /*!< audio -> A-law */
+  unsigned char *LUT_generate;        /*!< 8 bit unsigned -> A-law */
+  unsigned char *LUT_analyze;         /*!< A-law -> 8 bit unsigned */
+  short *LUT_alaw2short;              /*!< A-law -> short */
+  struct mediation_LUT_t *next;       /*!< next set */
+} mediation_LUT_t;
+
+/*!
+ * @brief Get the shared conversion tables of a format pair, building
+ * them on first use.
+ *
+ * Main thread only. The tables stay valid until mediation_freeLUTs().
+ *
+ * @param format_in audio input format, as for mediation_makeLUT().
+ * @param format_out audio output format, as for mediation_makeLUT().
+ * @return tables, NULL on error.
+ */
+const mediation_LUT_t *mediation_getLUT(int format_in, int format_out);
+
+/*!
+ * @brief Free all shared conversion tables (at exit).
+ */
+void mediation_freeLUTs(void);
+
 /*!
  * @brief Generate audio sample conversion tables.
  *
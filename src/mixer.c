@@ -0,0 +1,281 @@
+/*
+ * Conference mixer
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "globals.h"
+#include "mixer.h"
+#include "g711.h"
+
+/*!
+ * @brief Headroom above the knee, the clipped signal approaches the knee
+ * plus this value asymptotically.
+ */
+#define MIXER_CLIP_RANGE (32767 - MIXER_CLIP_KNEE)
+
+/*!
+ * @brief Reverse bit order of a byte (A-law <-> ISDN bit-inverse A-law).
+ *
+ * @param c byte.
+ * @return reversed byte.
+ */
+static unsigned char mixer_bitinverse(unsigned char c);
+
+/*!
+ * @brief Read the next block of a party, handling prefill, underrun and
+ * excess delay.
+ *
+ * @param mixer mixer.
+ * @param p party number.
+ * @param block destination, MIXER_BLOCK samples.
+ * @return 1 if a block was read, 0 if the party contributes silence.
+ */
+static int mixer_read(mixer_t *mixer, unsigned int p, unsigned char *block);
+
+/*!
+ * @brief Soft clip a sample: linear up to the knee, then compressed
+ * into the remaining range with a rational curve.
+ *
+ * @param v sample, may exceed 16 bit.
+ * @return sample in -32767..32767.
+ */
+static int32_t mixer_clip(int32_t v);
+
+/*!
+ * @brief Compute and encode the output block of one party (sum of all
+ * other parties).
+ *
+ * @param mixer mixer with sum and input blocks filled in.
+ * @param p party number.
+ */
+static void mixer_output(mixer_t *mixer, unsigned int p);
+
+/*--------------------------------------------------------------------------*/
+
+static unsigned char mixer_bitinverse(unsigned char c)
+{
+  return
+      ((c >> 7) & 0x1) |
+      ((c >> 5) & 0x2) |
+      ((c >> 3) & 0x4) |
+      ((c >> 1) & 0x8) |
+      ((c << 1) & 0x10) |
+      ((c << 3) & 0x20) |
+      ((c << 5) & 0x40) |
+      ((c << 7) & 0x80);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int mixer_init(mixer_t *mixer)
+{
+  unsigned int i;
+
+  memset(mixer, 0, sizeof(mixer_t));
+
+  for (i = 0; i < 256; ++i)
+    mixer->decode[i] = alaw2linear(mixer_bitinverse(i));
+  /* quantize to the middle of each 8-step interval */
+  for (i = 0; i < sizeof(mixer->encode); ++i)
+    mixer->encode[i] = mixer_bitinverse(linear2alaw((int) i * 8 - 32768 + 4));
+
+  for (i = 0; i < MIXER_MAX_PARTIES; ++i) {
+    if (ringbuf_init(&mixer->party[i].queue, MIXER_QUEUE_SIZE) < 0) {
+      errprintf("MIXER: Cannot allocate queue\n");
+      mixer_free(mixer);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void mixer_free(mixer_t *mixer)
+{
+  unsigned int i;
+
+  for (i = 0; i < MIXER_MAX_PARTIES; ++i)
+    ringbuf_free(&mixer->party[i].queue);
+}
+
+/*--------------------------------------------------------------------------*/
+
+void mixer_set_party(mixer_t *mixer, unsigned int party, int active)
+{
+  mixer_party_t *p = &mixer->party[party];
+
+  if (active) {
+    ringbuf_discard(&p->queue);
+    p->filling = 1;
+    p->underruns = 0;
+    p->dropped = 0;
+  } else if (g_atomic_int_get(&p->active)) {
+    dbgprintf(1, "MIXER: Party %u left, %lu underruns, %lu samples dropped\n",
+              party, p->underruns, p->dropped);
+  }
+  g_atomic_int_set(&p->active, active ? 1 : 0);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int mixer_party_active(mixer_t *mixer, unsigned int party)
+{
+  return party < MIXER_MAX_PARTIES &&
+         g_atomic_int_get(&mixer->party[party].active);
+}
+
+/*--------------------------------------------------------------------------*/
+
+void mixer_put(mixer_t *mixer, unsigned int party,
+               const unsigned char *data, unsigned int length)
+{
+  if (ringbuf_write(&mixer->party[party].queue, data, length) < length)
+    dbgprintf(2, "MIXER: Queue of party %u full, dropping data\n", party);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int mixer_read(mixer_t *mixer, unsigned int p, unsigned char *block)
+{
+  mixer_party_t *party = &mixer->party[p];
+  unsigned int used = ringbuf_used(&party->queue);
+  unsigned int n;
+
+  if (p == MIXER_LOCAL) {
+    /* the clock of the mixer, always has a block */
+    ringbuf_read(&party->queue, block, MIXER_BLOCK);
+    return 1;
+  }
+
+  if (used > MIXER_MAX_DELAY) {
+    /* remote clock runs ahead, trim to the prefill level */
+    party->dropped += used - MIXER_PREFILL;
+    while (used > MIXER_PREFILL) {
+      n = used - MIXER_PREFILL;
+      if (n > MIXER_BLOCK)
+        n = MIXER_BLOCK;
+      used -= ringbuf_read(&party->queue, block, n);
+    }
+  }
+
+  if (party->filling) {
+    if (used < MIXER_PREFILL)
+      return 0;
+    party->filling = 0;
+  }
+
+  if (used < MIXER_BLOCK) {
+    /* remote clock runs behind or a block is late, rebuild the margin */
+    party->underruns++;
+    party->filling = 1;
+    return 0;
+  }
+
+  ringbuf_read(&party->queue, block, MIXER_BLOCK);
+  return 1;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int32_t mixer_clip(int32_t v)
+{
+  int64_t e;
+
+  if (v > MIXER_CLIP_KNEE) {
+    e = v - MIXER_CLIP_KNEE;
+    return MIXER_CLIP_KNEE +
+           (int32_t) (e * MIXER_CLIP_RANGE / (e + MIXER_CLIP_RANGE));
+  } else if (v < -MIXER_CLIP_KNEE) {
+    e = -v - MIXER_CLIP_KNEE;
+    return -MIXER_CLIP_KNEE -
+           (int32_t) (e * MIXER_CLIP_RANGE / (e + MIXER_CLIP_RANGE));
+  }
+  return v;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void mixer_output(mixer_t *mixer, unsigned int p)
+{
+  const int32_t *sum = mixer->sum;
+  const short *in = mixer->in[p];
+  int32_t *mix = mixer->mix;
+  unsigned char *out = mixer->out[p];
+  int32_t over = 0;
+  int i;
+
+  /* straight loops without branches, the compiler vectorizes these */
+  for (i = 0; i < MIXER_BLOCK; ++i) {
+    mix[i] = sum[i] - in[i];
+    over |= (mix[i] > MIXER_CLIP_KNEE) | (mix[i] < -MIXER_CLIP_KNEE);
+  }
+
+  /* rare: only loud blocks pay for clipping */
+  if (over) {
+    for (i = 0; i < MIXER_BLOCK; ++i)
+      mix[i] = mixer_clip(mix[i]);
+  }
+
+  for (i = 0; i < MIXER_BLOCK; ++i)
+    out[i] = mixer->encode[(mix[i] + 32768) >> 3];
+}
+
+/*--------------------------------------------------------------------------*/
+
+int mixer_mix(mixer_t *mixer)
+{
+  unsigned char block[MIXER_BLOCK];
+  int32_t *sum = mixer->sum;
+  short *in;
+  unsigned int p;
+  int i;
+
+  if (ringbuf_used(&mixer->party[MIXER_LOCAL].queue) < MIXER_BLOCK)
+    return -1;
+
+  for (i = 0; i < MIXER_BLOCK; ++i)
+    sum[i] = 0;
+
+  for (p = 0; p < MIXER_MAX_PARTIES; ++p) {
+    if (!mixer_party_active(mixer, p))
+      continue;
+
+    in = mixer->in[p];
+    if (!mixer_read(mixer, p, block)) {
+      memset(in, 0, sizeof(mixer->in[p]));
+      continue;
+    }
+
+    for (i = 0; i < MIXER_BLOCK; ++i)
+      in[i] = mixer->decode[block[i]];
+    for (i = 0; i < MIXER_BLOCK; ++i)
+      sum[i] += in[i];
+  }
+
+  for (p = 0; p < MIXER_MAX_PARTIES; ++p) {
+    if (mixer_party_active(mixer, p))
+      mixer_output(mixer, p);
+  }
+  return 0;
+}
@@ -0,0 +1,168 @@
+/*
+ * Conference mixer
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ANT_MIXER_H
+#define _ANT_MIXER_H
+
+#include <stdint.h>
+
+/* GTK */
+#include <gtk/gtk.h>
+
+#include "ringbuf.h"
+#include "isdn.h"
+
+/*!
+ * @brief Number of parties: the local user and every ISDN call.
+ */
+#define MIXER_MAX_PARTIES (ISDN_MAX_CALLS + 1)
+
+/*!
+ * @brief Party number of the local user (audio devices).
+ */
+#define MIXER_LOCAL 0
+
+/*!
+ * @brief Party number of an ISDN call.
+ */
+#define MIXER_PARTY(call) ((call) + 1)
+
+/*!
+ * @brief Samples mixed at once (one CAPI block).
+ */
+#define MIXER_BLOCK ISDN_FRAGMENT_SIZE
+
+/*!
+ * @brief Samples a remote party buffers before it is mixed in, and again
+ * after an underrun. Absorbs the jitter of CAPI block delivery.
+ */
+#define MIXER_PREFILL (2 * ISDN_FRAGMENT_SIZE)
+
+/*!
+ * @brief Maximum samples buffered per remote party, more are dropped
+ * down to MIXER_PREFILL (remote clock faster than the local one).
+ */
+#define MIXER_MAX_DELAY (8 * ISDN_FRAGMENT_SIZE)
+
+/*!
+ * @brief Size of the receive queue of each party in bytes.
+ */
+#define MIXER_QUEUE_SIZE (16 * ISDN_FRAGMENT_SIZE)
+
+/*!
+ * @brief Soft clipping starts above this magnitude.
+ */
+#define MIXER_CLIP_KNEE 24576
+
+/*!
+ * @brief One party of the conference.
+ */
+typedef struct {
+  ringbuf_t queue;          /*!< received bit-inverse A-law, written by the
+                              ISDN thread (local party: by the engine) */
+  volatile gint active;     /*!< nonzero if the party takes part */
+  int filling;              /*!< waiting for MIXER_PREFILL samples */
+  unsigned long underruns;  /*!< blocks padded with silence */
+  unsigned long dropped;    /*!< samples dropped for excess delay */
+} mixer_party_t;
+
+/*!
+ * @brief N-1 conference mixer.
+ *
+ * Every party hears the sum of all other parties. Mixing is done in
+ * fixed point on blocks of MIXER_BLOCK samples and clocked by the local
+ * party, i.e. by audio capture in the engine thread. Remote parties are
+ * padded with silence when they run dry and trimmed when they run ahead.
+ */
+typedef struct {
+  mixer_party_t party[MIXER_MAX_PARTIES];       /*!< parties */
+  short decode[256];                            /*!< bit-inverse A-law to
+                                                  linear */
+  unsigned char encode[8192];                   /*!< (linear + 32768) >> 3
+                                                  to bit-inverse A-law */
+  short in[MIXER_MAX_PARTIES][MIXER_BLOCK];     /*!< decoded input block */
+  int32_t sum[MIXER_BLOCK];                     /*!< sum of all inputs */
+  int32_t mix[MIXER_BLOCK];                     /*!< N-1 sum of one party */
+  unsigned char out[MIXER_MAX_PARTIES][MIXER_BLOCK]; /*!< encoded output
+                                                  block of each party */
+} mixer_t;
+
+/*!
+ * @brief Initialize mixer, no party active (constructor).
+ *
+ * @param mixer mixer.
+ * @return 0 on success, -1 on error.
+ */
+int mixer_init(mixer_t *mixer);
+
+/*!
+ * @brief Free mixer (destructor).
+ *
+ * @param mixer mixer.
+ */
+void mixer_free(mixer_t *mixer);
+
+/*!
+ * @brief Add a party to or remove it from the conference.
+ *
+ * Adding a party discards its queue, so it must only be done while the
+ * engine thread doesn't run. Removing a party is allowed any time.
+ *
+ * @param mixer mixer.
+ * @param party party number.
+ * @param active nonzero to add the party.
+ */
+void mixer_set_party(mixer_t *mixer, unsigned int party, int active);
+
+/*!
+ * @brief Check if a party takes part in the conference (any thread).
+ *
+ * @param mixer mixer.
+ * @param party party number.
+ * @return nonzero if active.
+ */
+int mixer_party_active(mixer_t *mixer, unsigned int party);
+
+/*!
+ * @brief Queue data received from a party (writer of that party only).
+ *
+ * Never blocks, data which doesn't fit is dropped.
+ *
+ * @param mixer mixer.
+ * @param party party number.
+ * @param data bit-inverse A-law samples.
+ * @param length number of samples.
+ */
+void mixer_put(mixer_t *mixer, unsigned int party,
+               const unsigned char *data, unsigned int length);
+
+/*!
+ * @brief Mix the next block, if the local party has queued enough.
+ *
+ * On success, mixer->out[p] holds MIXER_BLOCK bit-inverse A-law samples
+ * for every active party p. Engine thread only.
+ *
+ * @param mixer mixer.
+ * @return 0 if a block was mixed, -1 if the local party needs more data.
+ */
+int mixer_mix(mixer_t *mixer);
+
+#endif /* _ANT_MIXER_H */
@@ -0,0 +1,60 @@
+/*
+ * USDT (user level statically defined tracing) probe points
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ANT_PROBES_H
+#define _ANT_PROBES_H
+
+#include "config.h"
+
+/*
+ * Probes of provider "ant_phone", see doc/bpftrace/ for examples.
+ *
+ * A disabled probe is a single nop in the code; arguments are only
+ * evaluated into registers, so they must be cheap and free of side effects.
+ *
+ *   session_state(old, new)              session_set_state()
+ *   capi_message(command, subcommand, msgno)
+ *                                        every CAPI message received
+ *   data_b3_req(handle, length, in_flight)
+ *                                        DATA_B3_REQ sent
+ *   data_b3_conf(handle, info)           DATA_B3_CONF received
+ *   data_b3_ind(handle, length, flags)   DATA_B3_IND received
+ *   pcm_recover(output, err)             ALSA xrun/suspend recovery
+ *   recording_underflow(start, current)  recorder skipped samples
+ *   remote_call_invoke(fnc)              remote call queued to a thread
+ *   remote_call_dispatch(fnc)            remote call about to run
+ */
+
+#ifdef HAVE_SYS_SDT_H
+  #include <sys/sdt.h>
+  #define ANT_PROBE1(name, a) \
+    DTRACE_PROBE1(ant_phone, name, a)
+  #define ANT_PROBE2(name, a, b) \
+    DTRACE_PROBE2(ant_phone, name, a, b)
+  #define ANT_PROBE3(name, a, b, c) \
+    DTRACE_PROBE3(ant_phone, name, a, b, c)
+#else
+  #define ANT_PROBE1(name, a) do {} while (0)
+  #define ANT_PROBE2(name, a, b) do {} while (0)
+  #define ANT_PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+#endif /* _ANT_PROBES_H */
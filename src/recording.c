@@ -38,12 +38,15 @@
 #include "isdn.h"
 #include "recording.h"
 #include "util.h"
+#include "mediaclock.h"
+#include "probes.h"
 
 /*--------------------------------------------------------------------------*/
 
 int recording_init(struct recorder_t *recorder)
 {
   memset(recorder, 0, sizeof(struct recorder_t));
+  recorder->clock = media_time_coarse;
   return 0;
 }
 
@@ -110,7 +113,7 @@ int recording_open(struct recorder_t *recorder, char *filename,
   memset(&recorder->channel_remote, 0, sizeof(rec_channel_t));
 
   /* NOTE: this has to be the last assignment, as it starts recording */
-  recorder->start_time = microsec_time();
+  recorder->start_time = recorder->clock();
   return 0;
 }
 
@@ -148,7 +151,7 @@ int recording_write(struct recorder_t *recorder, short *buf, int size,
   }
 
   /* compute position where to start write */
-  current = microsec_time() - start;
+  current = recorder->clock() - start;
   if (current < 0)
     return 0; /* should never happen! */
   int64_t endpos = current * ISDN_SPEED / 1000000LL;
@@ -201,7 +204,7 @@ int recording_flush(struct recorder_t *recorder, unsigned int last)
   int64_t maxposition = recorder->channel_local.position;
   int64_t tmp = recorder->channel_remote.position;
   int64_t startposition = recorder->last_write;
-  short recbuf[RECORDING_BUFSIZE * 2];  /* sample buffer */
+  short *recbuf = recorder->flushbuf; /* sample buffer */
   int srcptr, dstptr, size;
 
   if (recorder->start_time == 0)
@@ -212,6 +215,7 @@ int recording_flush(struct recorder_t *recorder, unsigned int last)
 
   if (startposition + (RECORDING_BUFSIZE * 7 / 8) < maxposition) {
     /* underflow, skip samples */
+    ANT_PROBE2(recording_underflow, startposition, maxposition);
     dbgprintf(2, "RECORD: recording_flush: underflow detected, start %lld, current %lld\n",
               (long long) startposition, (long long) maxposition);
     startposition = maxposition - (RECORDING_BUFSIZE * 7 / 8);
@@ -103,6 +103,9 @@ struct recorder_t {
   rec_channel_t channel_local;      /*!< recoding data channel for local data */
   rec_channel_t channel_remote;     /*!< recoding data channel for remote data */
   int64_t last_write;               /*!< position of last known write */
+  uint64_t (*clock)(void);          /*!< time source in microseconds,
+                                         media_time_coarse() by default */
+  short flushbuf[RECORDING_BUFSIZE * 2]; /*!< interleaved samples for flush */
 };
 
 /*!
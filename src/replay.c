@@ -0,0 +1,392 @@
+/*
+ * Offline replay of a call media trace through the media code
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "config.h"
+
+/* regular GNU system includes */
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+  #include <stdlib.h>
+#endif
+#ifdef HAVE_UNISTD_H
+  #include <unistd.h>
+#endif
+#include <string.h>
+#include <time.h>
+
+/* libsndfile */
+#include <sndfile.h>
+
+/* own header files */
+#include "globals.h"
+#include "session.h"
+#include "sound.h"
+#include "mediation.h"
+#include "recording.h"
+#include "trace.h"
+
+/*!
+ * @brief Replayed time of the first event (us), recording needs nonzero.
+ */
+#define REPLAY_CLOCK_BASE 1000000ULL
+
+/*!
+ * @brief Interval of recording flushes in replayed time (us), as the
+ * session timer does.
+ */
+#define REPLAY_FLUSH_INTERVAL 100000ULL
+
+/*!
+ * @brief Largest converted block (ISDN to 48 kHz 16 bit, with reserve).
+ */
+#define REPLAY_AUDIO_SIZE (TRACE_MAX_PAYLOAD * 6 * 2 + 64)
+
+/*!
+ * @brief Output stream of the replay with checksum.
+ */
+typedef struct {
+  const char *name;         /*!< stream name */
+  FILE *file;               /*!< output file, NULL if not written */
+  uint64_t hash;            /*!< FNV-1a hash of all data */
+  unsigned long bytes;      /*!< bytes of data */
+} replay_stream_t;
+
+static session_t replay_session;
+
+static uint64_t replay_now;
+
+static unsigned char payload[TRACE_MAX_PAYLOAD];
+static unsigned char audio_buf[REPLAY_AUDIO_SIZE];
+static unsigned char isdn_buf[TRACE_MAX_PAYLOAD + 64];
+static short rec_buf[REPLAY_AUDIO_SIZE / 2];
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Time source of the recorder: the time of the replayed event.
+ */
+static uint64_t replay_clock(void)
+{
+  return replay_now;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static uint64_t replay_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Open output stream.
+ *
+ * @param stream stream.
+ * @param name stream name, also file name suffix.
+ * @param prefix output file prefix, NULL for checksum only.
+ * @return 0 on success, -1 on error.
+ */
+static int replay_stream_open(replay_stream_t *stream, const char *name,
+                              const char *prefix)
+{
+  char *fn;
+
+  stream->name = name;
+  stream->file = NULL;
+  stream->hash = 14695981039346656037ULL;
+  stream->bytes = 0;
+
+  if (!prefix)
+    return 0;
+  if (asprintf(&fn, "%s.%s", prefix, name) < 0)
+    return -1;
+  stream->file = fopen(fn, "wb");
+  if (!stream->file)
+    fprintf(stderr, "Cannot write %s\n", fn);
+  free(fn);
+  return stream->file ? 0 : -1;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void replay_stream_write(replay_stream_t *stream,
+                                const unsigned char *data, unsigned int size)
+{
+  unsigned int i;
+
+  for (i = 0; i < size; ++i) {
+    stream->hash ^= data[i];
+    stream->hash *= 1099511628211ULL;
+  }
+  stream->bytes += size;
+  if (stream->file)
+    fwrite(data, 1, size, stream->file);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void replay_stream_close(replay_stream_t *stream)
+{
+  printf("%-8s %10lu bytes  fnv1a %016llx\n", stream->name, stream->bytes,
+         (unsigned long long) stream->hash);
+  if (stream->file)
+    fclose(stream->file);
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Set up session for the formats of the trace.
+ *
+ * @param header trace header.
+ * @return 0 on success, -1 on error.
+ */
+static int replay_session_setup(trace_header_t *header)
+{
+  session_t *s = &replay_session;
+  const mediation_LUT_t *lut;
+
+  s->audio_format_in = header->format_in;
+  s->audio_format_out = header->format_out;
+  s->audio_speed_in = header->speed_in;
+  s->audio_speed_out = header->speed_out;
+  s->ratio_in = (double) s->audio_speed_out / ISDN_SPEED;
+  s->ratio_out = (double) ISDN_SPEED / s->audio_speed_in;
+
+  if (!(lut = mediation_getLUT(s->audio_format_out, s->audio_format_in)))
+    return -1;
+  s->audio_LUT_in = lut->LUT_in;
+  s->audio_LUT_out = lut->LUT_out;
+  s->audio_LUT_generate = lut->LUT_generate;
+  s->audio_LUT_analyze = lut->LUT_analyze;
+  s->audio_LUT_alaw2short = lut->LUT_alaw2short;
+
+  s->audio_sample_size_in = sample_size_from_format(s->audio_format_in);
+  s->audio_sample_size_out = sample_size_from_format(s->audio_format_out);
+  s->option_muted = header->flags & TRACE_MUTED ? 1 : 0;
+  s->option_record_local = header->flags & TRACE_RECORD_LOCAL ? 1 : 0;
+  s->option_record_remote = header->flags & TRACE_RECORD_REMOTE ? 1 : 0;
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Open recording output like recording_open() does.
+ *
+ * @param prefix output file prefix.
+ * @return 0 on success, -1 on error.
+ */
+static int replay_recording_open(const char *prefix)
+{
+  struct recorder_t *recorder;
+  SF_INFO sfinfo;
+  char *fn;
+
+  recorder = (struct recorder_t*) malloc(sizeof(struct recorder_t));
+  if (!recorder || asprintf(&fn, "%s.wav", prefix) < 0) {
+    free(recorder);
+    return -1;
+  }
+
+  recording_init(recorder);
+  recorder->clock = replay_clock;
+  memset(&sfinfo, 0, sizeof(sfinfo));
+  sfinfo.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+  sfinfo.channels = 2;
+  sfinfo.samplerate = ISDN_SPEED;
+  recorder->sf = sf_open(fn, SFM_WRITE, &sfinfo);
+  if (!recorder->sf) {
+    fprintf(stderr, "Cannot write %s: %s\n", fn, sf_strerror(NULL));
+    free(fn);
+    free(recorder);
+    return -1;
+  }
+  free(fn);
+
+  recorder->start_time = recorder->clock();
+  replay_session.recorder = recorder;
+  replay_session.option_record = 1;
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [-o PREFIX] [-v] TRACEFILE\n"
+          "\n"
+          "Feeds a call trace (ant-phone --trace) through the media code at\n"
+          "full speed and prints checksums of the produced streams.\n"
+          "\n"
+          "  -o PREFIX  write PREFIX.isdn (sent A-law), PREFIX.audio (played\n"
+          "             audio) and, if the call was recorded, PREFIX.wav\n"
+          "  -v         print every event\n", name);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+  const char *prefix = NULL;
+  int verbose = 0;
+  FILE *file;
+  trace_header_t header;
+  trace_record_t record;
+  replay_stream_t isdn_out, audio_out;
+  unsigned long events[TRACE_AUDIO_WRITE + 1];
+  unsigned long samples = 0, write_frames = 0, write_short = 0;
+  unsigned long write_errors = 0;
+  uint64_t last_flush = 0, busy = 0, start;
+  unsigned int size;
+  int32_t result, frames;
+  int c, err;
+
+  while ((c = getopt(argc, argv, "o:vh")) != -1) {
+    switch (c) {
+    case 'o':
+      prefix = optarg;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return c == 'h' ? 0 : 1;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (!(file = fopen(argv[optind], "rb"))) {
+    perror(argv[optind]);
+    return 1;
+  }
+  if (trace_read_header(file, &header) < 0)
+    return 1;
+
+  printf("Trace: capture format %d %u Hz, playback format %d %u Hz%s%s\n",
+         header.format_in, header.speed_in,
+         header.format_out, header.speed_out,
+         header.flags & TRACE_RECORD ? ", recorded" : "",
+         header.flags & TRACE_MUTED ? ", muted" : "");
+
+  if (replay_session_setup(&header) < 0) {
+    fprintf(stderr, "Unsupported audio format\n");
+    return 1;
+  }
+  replay_now = REPLAY_CLOCK_BASE;
+  if ((header.flags & TRACE_RECORD) && prefix &&
+      replay_recording_open(prefix) < 0)
+    return 1;
+  if (replay_stream_open(&isdn_out, "isdn", prefix) < 0 ||
+      replay_stream_open(&audio_out, "audio", prefix) < 0)
+    return 1;
+
+  memset(events, 0, sizeof(events));
+  while ((err = trace_read_record(file, &record, payload)) > 0) {
+    replay_now = REPLAY_CLOCK_BASE + record.time;
+    if (record.event <= TRACE_AUDIO_WRITE)
+      events[record.event]++;
+
+    switch (record.event) {
+    case TRACE_CAPI_MESSAGE:
+      if (verbose && record.length >= 6)
+        printf("%10llu CAPI command 0x%02x/0x%02x length %u\n",
+               (unsigned long long) record.time,
+               payload[4], payload[5], record.length);
+      break;
+
+    case TRACE_ISDN_DATA:
+      if (verbose)
+        printf("%10llu DATA_B3_IND %u bytes\n",
+               (unsigned long long) record.time, record.length);
+      start = replay_ns();
+      convert_isdn_to_audio(&replay_session, payload, record.length,
+                            audio_buf, &size, rec_buf, 1);
+      busy += replay_ns() - start;
+      samples += record.length;
+      replay_stream_write(&audio_out, audio_buf, size);
+      break;
+
+    case TRACE_AUDIO_READ:
+      memcpy(&result, payload, sizeof(result));
+      if (verbose)
+        printf("%10llu read %d\n", (unsigned long long) record.time, result);
+      if (result <= 0)
+        break;
+      start = replay_ns();
+      convert_audio_to_isdn(&replay_session, payload + sizeof(result),
+                            record.length - sizeof(result),
+                            isdn_buf, &size, rec_buf);
+      busy += replay_ns() - start;
+      samples += size;
+      replay_stream_write(&isdn_out, isdn_buf, size);
+      break;
+
+    case TRACE_AUDIO_WRITE:
+      memcpy(&frames, payload, sizeof(frames));
+      memcpy(&result, payload + sizeof(frames), sizeof(result));
+      if (verbose)
+        printf("%10llu write %d -> %d\n", (unsigned long long) record.time,
+               frames, result);
+      write_frames += frames;
+      if (result < 0)
+        write_errors++;
+      else if (result < frames)
+        write_short++;
+      break;
+
+    default:
+      break;
+    }
+
+    if (replay_session.recorder &&
+        replay_now - last_flush >= REPLAY_FLUSH_INTERVAL) {
+      recording_flush(replay_session.recorder, 0);
+      last_flush = replay_now;
+    }
+  }
+  fclose(file);
+
+  if (replay_session.recorder)
+    recording_close(replay_session.recorder);
+
+  printf("Events: %lu CAPI, %lu ISDN data, %lu reads, %lu writes "
+         "(%lu frames, %lu short, %lu errors)\n",
+         events[TRACE_CAPI_MESSAGE], events[TRACE_ISDN_DATA],
+         events[TRACE_AUDIO_READ], events[TRACE_AUDIO_WRITE],
+         write_frames, write_short, write_errors);
+  printf("Duration %.3f s, conversion %.3f ms (%.2f ns/sample)\n",
+         (replay_now - REPLAY_CLOCK_BASE) / 1e6, busy / 1e6,
+         samples ? (double) busy / samples : 0.0);
+  replay_stream_close(&isdn_out);
+  replay_stream_close(&audio_out);
+  mediation_freeLUTs();
+
+  return err < 0 ? 1 : 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * Lock-free single producer / single consumer byte ring buffer.
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#ifdef HAVE_STDLIB_H
+  #include <stdlib.h>
+#endif
+
+#include "ringbuf.h"
+
+/*--------------------------------------------------------------------------*/
+
+int ringbuf_init(ringbuf_t *rb, unsigned int size)
+{
+  unsigned int real_size = 1;
+
+  while (real_size < size)
+    real_size <<= 1;
+
+  rb->data = (unsigned char*) malloc(real_size);
+  if (!rb->data) {
+    rb->size = 0;
+    return -1;
+  }
+  rb->size = real_size;
+  g_atomic_int_set(&rb->head, 0);
+  g_atomic_int_set(&rb->tail, 0);
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void ringbuf_free(ringbuf_t *rb)
+{
+  free(rb->data);
+  rb->data = NULL;
+  rb->size = 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void ringbuf_discard(ringbuf_t *rb)
+{
+  g_atomic_int_set(&rb->tail, g_atomic_int_get(&rb->head));
+}
+
+/*--------------------------------------------------------------------------*/
+
+unsigned int ringbuf_used(ringbuf_t *rb)
+{
+  return (unsigned int) g_atomic_int_get(&rb->head) -
+         (unsigned int) g_atomic_int_get(&rb->tail);
+}
+
+/*--------------------------------------------------------------------------*/
+
+unsigned int ringbuf_space(ringbuf_t *rb)
+{
+  return rb->size - ringbuf_used(rb);
+}
+
+/*--------------------------------------------------------------------------*/
+
+unsigned int ringbuf_write(ringbuf_t *rb, const void *data, unsigned int length)
+{
+  unsigned int head = (unsigned int) g_atomic_int_get(&rb->head);
+  unsigned int space = ringbuf_space(rb);
+  unsigned int pos, first;
+
+  if (length > space)
+    length = space;
+  if (length == 0)
+    return 0;
+
+  /* copy in at most two pieces (wrap-around) */
+  pos = head & (rb->size - 1);
+  first = rb->size - pos;
+  if (first > length)
+    first = length;
+  memcpy(rb->data + pos, data, first);
+  memcpy(rb->data, (const unsigned char*) data + first, length - first);
+
+  /* publish the data (atomic set implies memory barrier) */
+  g_atomic_int_set(&rb->head, (gint) (head + length));
+  return length;
+}
+
+/*--------------------------------------------------------------------------*/
+
+unsigned int ringbuf_read(ringbuf_t *rb, void *data, unsigned int length)
+{
+  unsigned int tail = (unsigned int) g_atomic_int_get(&rb->tail);
+  unsigned int used = ringbuf_used(rb);
+  unsigned int pos, first;
+
+  if (length > used)
+    length = used;
+  if (length == 0)
+    return 0;
+
+  pos = tail & (rb->size - 1);
+  first = rb->size - pos;
+  if (first > length)
+    first = length;
+  memcpy(data, rb->data + pos, first);
+  memcpy((unsigned char*) data + first, rb->data, length - first);
+
+  /* release the space to the writer */
+  g_atomic_int_set(&rb->tail, (gint) (tail + length));
+  return length;
+}
+
+/*--------------------------------------------------------------------------*/
@@ -0,0 +1,101 @@
+/*
+ * Lock-free single producer / single consumer byte ring buffer.
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ANT_RINGBUF_H
+#define _ANT_RINGBUF_H
+
+/* GTK */
+#include <gtk/gtk.h>
+
+/*!
+ * @brief Ring buffer passing bytes from exactly one writer thread to
+ *        exactly one reader thread without locking.
+ *
+ * Read and write positions are free-running counters, the size is
+ * a power of two.
+ */
+typedef struct {
+  unsigned char *data;    /*!< buffer memory */
+  unsigned int size;      /*!< buffer size in bytes (power of two) */
+  volatile gint head;     /*!< write position, only changed by the writer */
+  volatile gint tail;     /*!< read position, only changed by the reader */
+} ringbuf_t;
+
+/*!
+ * @brief Initialize ring buffer (constructor).
+ *
+ * @param rb ring buffer to initialize.
+ * @param size requested size in bytes, rounded up to a power of two.
+ * @return 0 on success, -1 on error.
+ */
+int ringbuf_init(ringbuf_t *rb, unsigned int size);
+
+/*!
+ * @brief Free ring buffer memory (destructor).
+ *
+ * @param rb ring buffer.
+ */
+void ringbuf_free(ringbuf_t *rb);
+
+/*!
+ * @brief Discard all data currently in the ring buffer (reader thread only).
+ *
+ * @param rb ring buffer.
+ */
+void ringbuf_discard(ringbuf_t *rb);
+
+/*!
+ * @brief Get number of bytes available for reading.
+ *
+ * @param rb ring buffer.
+ * @return number of bytes.
+ */
+unsigned int ringbuf_used(ringbuf_t *rb);
+
+/*!
+ * @brief Get number of bytes available for writing.
+ *
+ * @param rb ring buffer.
+ * @return number of bytes.
+ */
+unsigned int ringbuf_space(ringbuf_t *rb);
+
+/*!
+ * @brief Write data to the ring buffer (writer thread only).
+ *
+ * @param rb ring buffer.
+ * @param data data to write.
+ * @param length number of bytes to write.
+ * @return number of bytes written (less than length if buffer full).
+ */
+unsigned int ringbuf_write(ringbuf_t *rb, const void *data, unsigned int length);
+
+/*!
+ * @brief Read data from the ring buffer (reader thread only).
+ *
+ * @param rb ring buffer.
+ * @param data destination buffer.
+ * @param length maximum number of bytes to read.
+ * @return number of bytes read.
+ */
+unsigned int ringbuf_read(ringbuf_t *rb, void *data, unsigned int length);
+
+#endif /* _ANT_RINGBUF_H */
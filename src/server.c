@@ -36,6 +36,7 @@
 #include "server.h"
 #include "session.h"
 #include "util.h"
+#include "latency.h"
 
 /*
  * returns the name of the local socket file
@@ -99,6 +100,23 @@ int server_init(session_t *session) {
   return 0;
 }
 
+/*
+ * write latency histograms of current or last call to socket
+ */
+static void server_reply_latency(session_t *session, int sock) {
+  FILE *file;
+  int fd;
+
+  if ((fd = dup(sock)) < 0 || !(file = fdopen(fd, "w"))) {
+    perror("local reply");
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+  latency_dump(&session->call->latency, file, 0);
+  fclose(file);
+}
+
 /*
  * callback for local input on session->local_socket
  */
@@ -132,6 +150,14 @@ void server_handle_local_input(gpointer data, gint fd _U_,
         dbgprintf(1, "Request (%d bytes): wake up ISDN.\n", bytes);
         session_activate_isdn(session, 1);
         break;
+      case LOCAL_MSG_LATENCY:
+        dbgprintf(1, "Request (%d bytes): latency histograms.\n", bytes);
+        server_reply_latency(session, sock);
+        break;
+      case LOCAL_MSG_RELEASE:
+        dbgprintf(1, "Request (%d bytes): release audio.\n", bytes);
+        session_release_audio(session);
+        break;
     }
   } else if (bytes < 0) { /* error */
     perror("local read");
@@ -35,7 +35,9 @@
 enum local_msg_t {
   LOCAL_MSG_CALL,
   LOCAL_MSG_SUSPEND,
-  LOCAL_MSG_WAKEUP
+  LOCAL_MSG_WAKEUP,
+  LOCAL_MSG_LATENCY,        /*!< reply with latency histograms */
+  LOCAL_MSG_RELEASE         /*!< release audio devices kept in standby */
 };
 
 char *server_local_socket_name(void);
@@ -46,6 +46,7 @@
 /* own header files */
 #include "globals.h"
 #include "session.h"
+#include "engine.h"
 #include "sound.h"
 #include "isdn.h"
 #include "mediation.h"
@@ -54,9 +55,8 @@
 #include "callerid.h"
 #include "llcheck.h"
 #include "settings.h"
-#include "fxgenerator.h"
 #include "server.h"
-#include "g711.h"
+#include "probes.h"
 
 /*!
  * @brief This is our session. Currently just one globally.
@@ -71,38 +71,50 @@ struct state_data_t state_data[STATE_NUMBER] = {
 {N_("RING"),          N_("Answer"), 1,N_("Reject"), 1},/* STATE_RINGING       */
 {N_("RING"),          N_("Answer"), 1,N_("Reject"), 1},/* STATE_RINGING_QUIET */
 {N_("Dialing"),       N_("Pick up"),0,N_("Cancel"), 1},/* STATE_DIALING       */
-{N_("B-Channel open"),N_("Pick up"),0,N_("Hang up"),1},/* STATE_CONVERSATION  */
+{N_("B-Channel open"),N_("Hold"),   1,N_("Hang up"),1},/* STATE_CONVERSATION  */
 {N_("Setup"),         N_("Pick up"),0,N_("Hang up"),0},/* STATE_SERVICE       */
 {N_("Playback"),      N_("Pick up"),0,
 	                              /* TRANSLATORS: A Stop button (like playback) */
-                                      N_("Stop")   ,1} /* STATE_PLAYBACK      */
+                                      N_("Stop")   ,1},/* STATE_PLAYBACK      */
+{N_("On hold"),       N_("Retrieve"),1,N_("Hang up"),1} /* STATE_HOLD          */
 };
 
+/*!
+ * @brief Data passed from the ISDN callbacks to the session thread.
+ */
+typedef struct {
+  unsigned int call;    /*!< ISDN call number */
+  unsigned int error;   /*!< CAPI error code, 0 for no error */
+  char *number;         /*!< remote party number (may be NULL) */
+  char *called;         /*!< called (our) number (may be NULL) */
+} session_isdn_msg_t;
+
 /*!
  * @brief Callback executed in session thread after hang up.
  *
  * @param context session object.
- * @param error ISDN error code cast to pointer, 0 for no error.
+ * @param data session_isdn_msg_t with call and error.
  */
-static void isdn_hangup_callback(void *context, void *error);
+static void isdn_hangup_callback(void *context, void *data);
 
 /*!
  * @brief Callback executed in session thread after ISDN connected.
  *
  * @param context session object.
- * @param number remote number which has been connected.
+ * @param data session_isdn_msg_t with call and remote number.
  */
-static void isdn_connect_callback(void *context, void *number);
+static void isdn_connect_callback(void *context, void *data);
 
 /*!
- * @brief Thread main routine for audio input thread.
+ * @brief Callback executed in session thread after DTMF digits received.
  *
- * @param data session.
+ * @param context session object.
+ * @param data session_isdn_msg_t with call and digits (as number).
  */
-static gpointer handler_audio_input(gpointer data);
+static void isdn_dtmf_callback(void *context, void *data);
 
 /*!
- * @brief Stop conversation threads.
+ * @brief Stop conversation audio of the audio call.
  *
  * @param session session.
  * @param self_hangup if nonzero, hung up by our side, otherwise by remote side.
@@ -110,68 +122,196 @@ static gpointer handler_audio_input(gpointer data);
 static void session_deinit_conversation(session_t *session, int self_hangup);
 
 /*!
- * @brief Opens audio devices for specified session.
+ * @brief Close recording and keep latency statistics of a connected call.
  *
  * @param session session.
- * @return 0 on success, -1 on error.
+ * @param call call which ended.
  */
-static int session_audio_open(session_t *session);
+static void session_finish_call(session_t *session, call_t *call);
 
 /*!
- * @brief Closes audio devices for specified session.
+ * @brief Make a call the one using the audio devices (engine stopped).
+ *
+ * @param session session.
+ * @param call call.
+ */
+static void session_select_call(session_t *session, call_t *call);
+
+/*!
+ * @brief Get a ringing call besides the audio call (call waiting).
+ *
+ * @param session session.
+ * @return waiting call, NULL if there is none.
+ */
+static call_t *session_waiting_call(session_t *session);
+
+/*!
+ * @brief Put the audio call on hold.
+ *
+ * The B-channel stays open, only the audio is disconnected. A conference
+ * is split, all its calls go on hold.
+ *
+ * @param session session in STATE_CONVERSATION.
+ */
+static void session_hold(session_t *session);
+
+/*!
+ * @brief Count the members of the conference.
+ *
+ * @param session session.
+ * @return number of calls in the conference.
+ */
+static unsigned int session_conference_count(session_t *session);
+
+/*!
+ * @brief Dissolve the conference, all calls but the audio call go on
+ * hold (engine stopped).
+ *
+ * @param session session.
+ */
+static void session_conference_end(session_t *session);
+
+/*!
+ * @brief Keep audio going after a member has left the conference.
+ *
+ * Another member takes over the audio devices if the audio call left,
+ * a conference with only one member left becomes a plain call.
+ *
+ * @param session session.
+ * @param call released call.
+ * @return 1 if audio continues with the conference, 0 otherwise.
+ */
+static int session_conference_left(session_t *session, call_t *call);
+
+/*!
+ * @brief Connect audio to a call, holding the current audio call.
+ *
+ * @param session session.
+ * @param call connected call.
+ * @return 0 on success, -1 if audio can't be started.
+ */
+static int session_resume(session_t *session, call_t *call);
+
+/*!
+ * @brief Answer a waiting call, holding the current audio call.
+ *
+ * @param session session.
+ * @param call waiting call.
+ */
+static void session_answer_waiting(session_t *session, call_t *call);
+
+/*!
+ * @brief Release a call which has ended and continue with the remaining
+ * calls (conference, held, waiting), or go to STATE_READY.
+ *
+ * @param session session.
+ * @param call call, free afterwards.
+ * @param reason hangup reason for the caller id line.
+ * @param error nonzero if the call ended with an error.
+ */
+static void session_call_ended(session_t *session, call_t *call,
+                               char *reason, int error);
+
+/*!
+ * @brief Answer a ringing call, releasing it if the answer can't be sent.
+ *
+ * @param session session.
+ * @param call ringing call.
+ * @return 0 on success, -1 if the call was released.
+ */
+static int session_pickup(session_t *session, call_t *call);
+
+/*!
+ * @brief Let the audio call ring (it is the only call).
+ *
+ * @param session session.
+ */
+static void session_ring(session_t *session);
+
+/*!
+ * @brief Check if an effect belongs to a state, i.e. may keep playing
+ * when the session enters it.
+ *
+ * @param state session state.
+ * @param effect effect.
+ * @return 1 if the effect belongs to the state, 0 otherwise.
+ */
+static int session_state_effect(enum state_t state, enum effect_t effect);
+
+/*!
+ * @brief Dial number from dial number entry as new call.
+ *
+ * @param session session in STATE_READY or STATE_HOLD.
+ */
+static void session_dial(session_t *session);
+
+/*!
+ * @brief Set pick up and hang up buttons for state and calls.
+ *
+ * @param session session.
+ */
+static void session_update_buttons(session_t *session);
+
+/*!
+ * @brief Opens audio devices for specified session.
  *
  * @param session session.
  * @return 0 on success, -1 on error.
  */
-static int session_audio_close(session_t *session);
+static int session_audio_open(session_t *session);
 
 /*!
- * @brief Recover from audio error.
+ * @brief Closes audio devices for specified session.
  *
  * @param session session.
- * @param audio PCM handle.
- * @param err ALSA error code.
- * @return 0 on success, ALSA error code on error.
+ * @return 0 on success, -1 on error.
  */
-static int session_snd_pcm_recover(session_t *session _U_, snd_pcm_t *audio, int err);
+static int session_audio_close(session_t *session);
 
 /*!
  * @brief Callback when connection established (in ISDN thread).
  *
  * @param context session.
+ * @param call ISDN call number.
  * @param number remote party number (may be NULL).
  */
-static void session_isdn_connected(void *context, char *number);
+static void session_isdn_connected(void *context, unsigned int call,
+                                   char *number);
 
 /*!
  * @brief Callback when ISDN data received (in ISDN thread).
  *
  * @param context session.
+ * @param call ISDN call number.
  * @param data pointer to received data.
  * @param length length of received data (in bytes).
  */
-static void session_isdn_data(void *context, void *data, unsigned int length);
+static void session_isdn_data(void *context, unsigned int call,
+                              void *data, unsigned int length);
 
 /*!
  * @brief Callback when connection disconnected (in ISDN thread).
  *
  * @param context session.
+ * @param call ISDN call number.
  */
-static void session_isdn_disconnected(void *context);
+static void session_isdn_disconnected(void *context, unsigned int call);
 
 /*!
  * @brief Callback when connection attempt fails with an error (in ISDN thread).
  *
  * @param context session.
+ * @param call ISDN call number.
  * @param error CAPI error number.
  */
-static void session_isdn_error(void *context, unsigned int error);
+static void session_isdn_error(void *context, unsigned int call,
+                               unsigned int error);
 
 /*!
  * @brief Callback called on RING from other side (in session thread).
  *
  * @param context session.
- * @param data structure with callee and called numbers.
+ * @param data session_isdn_msg_t with call, callee and called numbers.
  */
 static void isdn_ring_callback(void *context, void *data);
 
@@ -179,10 +319,21 @@ static void isdn_ring_callback(void *context, void *data);
  * @brief Callback called on RING from other side (in ISDN thread).
  *
  * @param context session.
+ * @param call ISDN call number.
  * @param callee remote party number (may be NULL).
  * @param called called (our) number (may be NULL).
  */
-static void session_isdn_ring(void *context, char *callee, char *called);
+static void session_isdn_ring(void *context, unsigned int call,
+                              char *callee, char *called);
+
+/*!
+ * @brief Callback when the controller detected DTMF digits (in ISDN thread).
+ *
+ * @param context session.
+ * @param call ISDN call number.
+ * @param digits received digits.
+ */
+static void session_isdn_dtmf(void *context, unsigned int call, char *digits);
 
 /*!
  * @brief Init ISDN device for session.
@@ -193,20 +344,20 @@ static void session_isdn_ring(void *context, char *callee, char *called);
 static int session_isdn_init(session_t *session);
 
 /*!
- * @brief Init recording related things in session.
+ * @brief Init call table (recorders, latency statistics) of session.
  *
  * @param session session.
  * @return 0 on success, -1 otherwise.
  */
-static int session_recording_init(session_t *session);
+static int session_calls_init(session_t *session);
 
 /*!
- * @brief Clean up recording related things in session.
+ * @brief Clean up call table of session.
  *
  * @param session session.
  * @return 0 on success, -1 otherwise.
  */
-static int session_recording_deinit(session_t *session);
+static int session_calls_deinit(session_t *session);
 
 /*!
  * @brief Close isdn device and clean up (deallocate buffers).
@@ -221,10 +372,17 @@ static int session_isdn_deinit(session_t *session);
  *
  * Includes state transition.
  *
- * @param session session to use.
+ * @param session session to use, the connected call is the audio call.
  */
 static void session_start_conversation(session_t *session);
 
+/*!
+ * @brief Start media trace of the calls, named like the first recording.
+ *
+ * @param session session with audio in conversation.
+ */
+static void session_start_trace(session_t *session);
+
 /*!
  * @brief Repeatedly called function to update various stuff.
  *
@@ -234,11 +392,20 @@ static void session_start_conversation(session_t *session);
 static gboolean session_timer_func(gpointer data);
 
 /*!
- * @brief Effect thread main function.
+ * @brief Timer function releasing audio devices at the end of standby.
  *
  * @param data session.
+ * @return FALSE (one shot).
  */
-static gpointer handler_effect(gpointer data);
+static gboolean session_standby_timeout(gpointer data);
+
+/*!
+ * @brief Hang up after the engine reported failed audio (idle function).
+ *
+ * @param data session.
+ * @return FALSE (one shot).
+ */
+static gboolean session_audio_failed_idle(gpointer data);
 
 /*!
  * @brief Sets status bar for audio state (e.g. "AUDIO OFF").
@@ -263,6 +430,17 @@ static void session_history_normalize(session_t *session);
 static int session_audio_open(session_t *session)
 {
     dbgprintf(1, "SESSION: Opening audio device(s).\n");
+  session->audio_mmap_in = 1;
+  session->audio_mmap_out = 1;
+  audio_latency_timing(session->option_latency_mode,
+                       &session->audio_timing_in);
+  if (session->option_latency_mode == AUDIO_LATENCY_LOW)
+    settings_latency_read(session->audio_device_name_in,
+                          session->audio_device_name_out,
+                          &session->audio_timing_in);
+  session->audio_timing_out = session->audio_timing_in;
+  session->audio_linked = 0;
+  session->audio_duplex_delay = 0;
   if (open_audio_devices(session->audio_device_name_in,
 			 session->audio_device_name_out,
 			 1,
@@ -274,7 +452,11 @@ static int session_audio_open(session_t *session)
 			 &session->audio_format_in,
 			 &session->audio_format_out,
 			 &session->audio_speed_in,
-			 &session->audio_speed_out)) {
+			 &session->audio_speed_out,
+			 &session->audio_mmap_in,
+			 &session->audio_mmap_out,
+			 &session->audio_timing_in,
+			 &session->audio_timing_out)) {
     return -1;
   }
   return 0;
@@ -285,7 +467,7 @@ static int session_audio_open(session_t *session)
 static int session_audio_close(session_t *session)
 {
   dbgprintf(1, "SESSION: Closing audio device(s)\n");
-  thread_stop(&session->thread_audio_input);
+  engine_stop(session);
   if (close_audio_devices(session->audio_in, session->audio_out)) {
     return -1;
   }
@@ -294,39 +476,32 @@ static int session_audio_close(session_t *session)
 
 /*--------------------------------------------------------------------------*/
 
-static int session_snd_pcm_recover(session_t *session _U_, snd_pcm_t *audio, int err)
-{
-  int err2;
-  if (err == -EBADFD) {
-    dbgprintf(1, "AUDIO: Preparing audio for I/O\n");
-    return snd_pcm_prepare(audio);
-  } else {
-    err2 = snd_pcm_recover(audio, err, 1);
-    if (err2 != 0)
-      return err2;
-    dbgprintf(2, "AUDIO: snd_pcm_recover from error %s on %s\n",
-              snd_strerror(err),
-              (audio == session->audio_out) ? "output" : "input");
-    return 0;
-  }
-}
-
-/*--------------------------------------------------------------------------*/
-
 int session_set_audio_state(session_t *session, enum audio_t state)
 {
   enum audio_t oldstate = session->audio_state;
+  const mediation_LUT_t *lut;
 
   if (state == oldstate) {
     return 0;
   }
 
-  if (oldstate == AUDIO_EFFECT) {
-    // stop effect first
-    thread_stop(&session->thread_effect);
+  if (session->gtk_standby_timer_tag) {
+    gtk_timeout_remove(session->gtk_standby_timer_tag);
+    session->gtk_standby_timer_tag = 0;
+  }
+
+  if (oldstate == AUDIO_EFFECT || oldstate == AUDIO_CONVERSATION) {
+    // stop effect or conversation audio first
+    engine_stop(session);
   }
 
   if (session->audio_state == AUDIO_DISCONNECTED) {
+    if (thread_is_running(&session->thread_calibrate)) {
+      /* the session goes first, e.g. ringing for an incoming call */
+      dbgprintf(1, "SESSION: Stopping device calibration\n");
+      thread_stop(&session->thread_calibrate);
+    }
+
     /* message: open audio device(s) */
     if (debug) {
       if (strcmp(session->audio_device_name_in, session->audio_device_name_out))
@@ -358,51 +533,58 @@ int session_set_audio_state(session_t *session, enum audio_t state)
     session->ratio_in = (double)session->audio_speed_out / ISDN_SPEED;
     session->ratio_out = (double)ISDN_SPEED / session->audio_speed_in;
 
-    if (mediation_makeLUT(session->audio_format_out, &session->audio_LUT_in,
-                          session->audio_format_in, &session->audio_LUT_out,
-                          &session->audio_LUT_generate,
-                          &session->audio_LUT_analyze,
-                          &session->audio_LUT_alaw2short)) {
+    if (!(lut = mediation_getLUT(session->audio_format_out,
+                                 session->audio_format_in))) {
       errprintf("AUDIO: Error building conversion look-up-table.\n");
       return -1;
     }
+    session->audio_LUT_in = lut->LUT_in;
+    session->audio_LUT_out = lut->LUT_out;
+    session->audio_LUT_generate = lut->LUT_generate;
+    session->audio_LUT_analyze = lut->LUT_analyze;
+    session->audio_LUT_alaw2short = lut->LUT_alaw2short;
 
     session->audio_sample_size_in =
       sample_size_from_format(session->audio_format_in);
     session->audio_sample_size_out =
       sample_size_from_format(session->audio_format_out);
-  } else if (state == AUDIO_DISCONNECTED) {
-    /* close devices */
 
-    /* free allocated buffers */
-    free(session->audio_LUT_in);
-    free(session->audio_LUT_out);
-    free(session->audio_LUT_generate);
-    free(session->audio_LUT_analyze);
-    free(session->audio_LUT_alaw2short);
+    if (engine_pool_init(session)) {
+      errprintf("AUDIO: Error allocating audio buffers.\n");
+      return -1;
+    }
+  } else if (state == AUDIO_DISCONNECTED) {
+    /* close devices, the conversion tables stay for the next open */
 
     /* close audio device(s) */
     if (session_audio_close(session)) {
       errprintf("AUDIO: Error closing sound device(s).\n");
       return -1;
     }
+
+    /* engine is stopped now */
+    engine_pool_free(session);
+  }
+
+  if (state == AUDIO_STANDBY) {
+    /* keep devices, formats and tables, ready to start at once */
+    audio_prepare(session->audio_in, session->audio_out);
+    if (session->option_standby_time)
+      session->gtk_standby_timer_tag =
+        gtk_timeout_add(session->option_standby_time * 1000,
+                        session_standby_timeout, (gpointer) session);
   }
 
   /* set new state on session */
   session->audio_state = state;
 
   if (state == AUDIO_CONVERSATION) {
-    /* start thread handling audio input during conversation */
-    if (!thread_is_running(&session->thread_audio_input)) {
-      if (thread_start(&session->thread_audio_input, handler_audio_input, session) < 0) {
-        errprintf("AUDIO: Cannot start audio input thread\n");
-        session->audio_state = AUDIO_IDLE;
-        return -1;
-      }
+    /* start audio engine handling conversation */
+    if (engine_start(session) < 0) {
+      errprintf("AUDIO: Cannot start audio engine thread\n");
+      session->audio_state = AUDIO_IDLE;
+      return -1;
     }
-  } else {
-    /* no conversation, shut down input, if any */
-    thread_stop(&session->thread_audio_input);
   }
 
   return 0;
@@ -410,124 +592,119 @@ int session_set_audio_state(session_t *session, enum audio_t state)
 
 /*--------------------------------------------------------------------------*/
 
-static void session_isdn_connected(void *context, char *number)
+int session_release_audio(session_t *session)
 {
-  session_t *session = (session_t*) context;
+  if (session->audio_state != AUDIO_STANDBY)
+    return 0; /* in use or released already */
 
-  remote_call_invoke(&session->rem_port, isdn_connect_callback, session, number);
+  dbgprintf(1, "SESSION: Releasing audio device(s) from standby\n");
+  if (session_set_audio_state(session, AUDIO_DISCONNECTED) < 0)
+    return -1;
+  session_audio_notify(session, _("Audio OFF"));
+  return 0;
 }
 
 /*--------------------------------------------------------------------------*/
 
-static void session_isdn_data(void *context, void *data, unsigned int length)
+static gboolean session_standby_timeout(gpointer data)
 {
-  session_t *session = (session_t*) context;
-  unsigned int ptr, outsize, framesize, size;
-  unsigned char outbuffer[16384];
-  short recbuffer[8192];
-  int err;
-#if 0
-  double factor;
-#endif
+  session_t *session = (session_t *) data;
 
-  convert_isdn_to_audio(session,
-                        data, length,
-                        outbuffer, &outsize,
-                        recbuffer,
-                        1);
-
-  framesize = sample_size_from_format(session->audio_format_out);
-  outsize /= framesize;
-
-  /* dump the ISDN data to audio and/or recording */
-  ptr = 0;
-  while (ptr < outsize) {
-    size = outsize - ptr;
-    err = snd_pcm_writei(session->audio_out,
-                         outbuffer + ptr * framesize,
-                         size);
-    if (err < 0) {
-      if (err != -EAGAIN) {
-        err = session_snd_pcm_recover(session, session->audio_out, err);
-        if (err >= 0) {
-          /* write one frame doubled to catch up */
-          snd_pcm_writei(session->audio_out,
-                         outbuffer + ptr * framesize,
-                         size);
-          continue; /* retry */
-        }
-        /* TODO: handle error better and/or stop audio */
-        errprintf("AUDIO: Error writing to audio: %s\n", snd_strerror(err));
-        break;
-      } else {
-        /* non-blocking write failed */
-        dbgprintf(2, "AUDIO: Clock unsynchronized, skipping audio buffer\n");
-        isdn_speed_addsamples(&session->audio_out_speed, size);
-        break;
-      }
-    } else {
-      /* some data written */
-      ptr += err;
-      isdn_speed_addsamples(&session->audio_out_speed, err);
+  session->gtk_standby_timer_tag = 0; /* removed by returning FALSE */
+  session_release_audio(session);
+  return FALSE;
+}
 
-      if (debug > 1) {
-        isdn_speed_debug(&session->audio_out_speed, 2, "AUDIO: out");
-      }
+/*--------------------------------------------------------------------------*/
 
-#if 0
-      /* NOTE: even though ISDN and audio should both run at 8000Hz, they don't.
-         At least not exactly. This code experiment tries to adjust audio speed
-         to match ISDN speed to prevent underruns and frame drops. Someone
-         might try to take it from here... */
-      snd_pcm_sframes_t delay;
-      if (snd_pcm_delay(session->audio_out, &delay) == 0) {
-        /* reevaluate the audio speed */
+void session_audio_failed(session_t *session)
+{
+  g_atomic_int_set(&session->audio_failed, 1);
+  g_idle_add(session_audio_failed_idle, session);
+}
 
-        /* now compute factor to speed up/down the audio to meet optimum delay */
-        factor = (4*session->fragment_size_out - delay) / 3000.0 + 1.0;
+/*--------------------------------------------------------------------------*/
 
-        /* normalize to ISDN speed */
-        factor *= ISDN_SPEED / ((double)session->audio_speed_out);
+static gboolean session_audio_failed_idle(gpointer data)
+{
+  session_t *session = (session_t *) data;
+  unsigned int i;
 
-        if (factor < 0.95)
-          factor = 0.95;
-        else if (factor > 1.05)
-          factor = 1.05;
+  /* cleared when the engine was started again */
+  if (!g_atomic_int_get(&session->audio_failed))
+    return FALSE;
+  g_atomic_int_set(&session->audio_failed, 0);
+  if (session->audio_state != AUDIO_CONVERSATION)
+    return FALSE;
+
+  errprintf("SESSION: Conversation audio failed, hanging up\n");
+  for (i = 0; i < ISDN_MAX_CALLS; i++) {
+    if (&session->calls.call[i] == session->call ||
+        (session->conference && session->calls.call[i].conference)) {
+      session->calls.call[i].hangup_reason = _("(AUDIO ERROR)");
+      isdn_hangup(&session->isdn, i);
+    }
+  }
+  show_audio_error_dialog();
+  return FALSE;
+}
 
-        factor *= ((double)session->audio_speed_out / ISDN_SPEED);
+/*--------------------------------------------------------------------------*/
 
-        session->ratio_in = (session->ratio_in + factor) / 2.0;
+static void session_isdn_connected(void *context, unsigned int call,
+                                   char *number)
+{
+  session_t *session = (session_t*) context;
+  session_isdn_msg_t msg;
 
-        dbgprintf(3, "AUDIO: out delay: %d, fragment %d, ratio %.3f\n",
-                  (int) delay, (int) session->fragment_size_out,
-                  session->ratio_in);
-      }
-#endif
-    }
-  }
+  memset(&msg, 0, sizeof(msg));
+  msg.call = call;
+  msg.number = number;
 
+  remote_call_invoke(&session->rem_port, isdn_connect_callback, session, &msg);
 }
 
 /*--------------------------------------------------------------------------*/
 
-static void session_isdn_disconnected(void *context)
+static void session_isdn_data(void *context, unsigned int call,
+                              void *data, unsigned int length)
 {
   session_t *session = (session_t*) context;
 
-  dbgprintf(1, "SESSION: Disconnected callback\n");
+  /* playback is done by the audio engine */
+  engine_isdn_data(session, call, data, length);
+}
+
+/*--------------------------------------------------------------------------*/
 
-  remote_call_invoke(&session->rem_port, isdn_hangup_callback, session, NULL);
+static void session_isdn_disconnected(void *context, unsigned int call)
+{
+  session_t *session = (session_t*) context;
+  session_isdn_msg_t msg;
+
+  dbgprintf(1, "SESSION: Disconnected callback, call %u\n", call);
+
+  memset(&msg, 0, sizeof(msg));
+  msg.call = call;
+
+  remote_call_invoke(&session->rem_port, isdn_hangup_callback, session, &msg);
 }
 
 /*--------------------------------------------------------------------------*/
 
-static void session_isdn_error(void *context, unsigned int error)
+static void session_isdn_error(void *context, unsigned int call,
+                               unsigned int error)
 {
   session_t *session = (session_t*) context;
+  session_isdn_msg_t msg;
+
+  dbgprintf(1, "SESSION: Error callback, call %u, 0x%x\n", call, error);
 
-  dbgprintf(1, "SESSION: Error callback, 0x%x\n", error);
+  memset(&msg, 0, sizeof(msg));
+  msg.call = call;
+  msg.error = error;
 
-  remote_call_invoke(&session->rem_port, isdn_hangup_callback, session, (void*) (long) error);
+  remote_call_invoke(&session->rem_port, isdn_hangup_callback, session, &msg);
 }
 
 /*--------------------------------------------------------------------------*/
@@ -535,58 +712,89 @@ static void session_isdn_error(void *context, unsigned int error)
 static void isdn_ring_callback(void *context, void *data)
 {
   session_t *session = (session_t*) context;
-  struct msg {
-    char *callee;
-    char *called;
-  } *numbers = (struct msg*) data;
-  char *callee = numbers->callee;
-  char *called = numbers->called;
-  char buffer[256];
-  gint w, h;
-
-  /* caller id update */
-  session->ring_time = time(NULL);
+  session_isdn_msg_t *msg = (session_isdn_msg_t*) data;
+  int waiting = call_count(&session->calls) > 0;
+  call_t *call;
 
   /* save callee's number */
-  free(session->from);
-  free(session->to);
-  session->from = strdup(callee ? (char*) callee : _("(no caller ID)"));
-  session->to = strdup(called ? (char*) called : _("(no caller ID)"));
+  if (!(call = call_open(&session->calls, msg->call, CALL_RINGING,
+                         msg->number ? msg->number : _("(no caller ID)"),
+                         msg->called ? msg->called : _("(no caller ID)"))))
+    return;
 
-  cid_add_line(session, CALL_IN, session->from, session->to);
+  /* caller id update */
+  call->cid_row = cid_add_line(session, CALL_IN, call->from, call->to);
 
-  snprintf(buffer, sizeof(buffer), _("<b>Call from: %s</b>"), session->from);
-  gtk_label_set_markup(GTK_LABEL(session->call_info_number), buffer);
+  if (waiting) {
+    /* don't disturb the other calls, just offer to answer */
+    char buffer[256];
 
-  /* set position of the incoming call window */
-  gtk_window_get_size(GTK_WINDOW(session->call_window), &w, &h);
-  gtk_window_move(GTK_WINDOW(session->call_window), gdk_screen_width() - w, gdk_screen_height() - h);
+    snprintf(buffer, sizeof(buffer), _("<b>Call waiting: %s</b>"),
+             call->from);
+    gtk_label_set_markup(GTK_LABEL(session->call_info_number), buffer);
+    session_update_buttons(session);
+    return;
+  }
 
-  if (session_set_state(session, STATE_RINGING))
-    session_set_state(session, STATE_RINGING_QUIET);
+  session_select_call(session, call);
+  session_ring(session);
 }
 
 /*--------------------------------------------------------------------------*/
 
-static void session_isdn_ring(void *context, char *callee, char *called)
+static void session_isdn_ring(void *context, unsigned int call,
+                              char *callee, char *called)
 {
   session_t *session = (session_t*) context;
-  struct {
-    char *callee;
-    char *called;
-  } msg;
-  msg.callee = callee;
+  session_isdn_msg_t msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.call = call;
+  msg.number = callee;
   msg.called = called;
 
-  dbgprintf(1, "SESSION: Ring callback from '%s' to '%s'\n",
+  dbgprintf(1, "SESSION: Ring callback from '%s' to '%s', call %u\n",
             callee ? callee : "(no number)",
-            called ? called : "(no number)");
+            called ? called : "(no number)", call);
 
   remote_call_invoke(&session->rem_port, isdn_ring_callback, session, &msg);
 }
 
 /*--------------------------------------------------------------------------*/
 
+static void session_isdn_dtmf(void *context, unsigned int call, char *digits)
+{
+  session_t *session = (session_t*) context;
+  session_isdn_msg_t msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.call = call;
+  msg.number = digits;
+
+  remote_call_invoke(&session->rem_port, isdn_dtmf_callback, session, &msg);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void session_ring(session_t *session)
+{
+  char buffer[256];
+  gint w, h;
+
+  snprintf(buffer, sizeof(buffer), _("<b>Call from: %s</b>"),
+           session->call->from);
+  gtk_label_set_markup(GTK_LABEL(session->call_info_number), buffer);
+
+  /* set position of the incoming call window */
+  gtk_window_get_size(GTK_WINDOW(session->call_window), &w, &h);
+  gtk_window_move(GTK_WINDOW(session->call_window), gdk_screen_width() - w, gdk_screen_height() - h);
+
+  if (session_set_state(session, STATE_RINGING))
+    session_set_state(session, STATE_RINGING_QUIET);
+}
+
+/*--------------------------------------------------------------------------*/
+
 static int session_isdn_init(session_t *session)
 {
   static isdn_callback_t callbacks = {
@@ -594,8 +802,10 @@ static int session_isdn_init(session_t *session)
     session_isdn_data,
     session_isdn_disconnected,
     session_isdn_error,
-    session_isdn_ring
+    session_isdn_ring,
+    session_isdn_dtmf
   };
+  unsigned int i;
 
   /* open and init isdn device */
   dbgprintf(1, "SESSION: Initializing ISDN device...\n");
@@ -605,12 +815,19 @@ static int session_isdn_init(session_t *session)
     return -1;
   }
 
-  if (isdn_setMSN(&session->isdn, session->msn) ||
-      isdn_setMSNs(&session->isdn, session->msns)) {
+  if (isdn_setMSN(&session->isdn, session->msn)) {
     errprintf("SESSION: Error setting MSN properties.\n");
     close_isdn_device(&session->isdn);
     return -1;
   }
+  if (isdn_setMSNs(&session->isdn, session->msns)) {
+    /* the valid entries are used, fix the rest in the settings dialog */
+    errprintf("SESSION: Invalid entries in MSNs to listen on.\n");
+  }
+  /* ISDN calls and the call table share call numbers */
+  for (i = 0; i < ISDN_MAX_CALLS; ++i)
+    session->isdn.call[i].latency = &session->calls.call[i].latency;
+  session->isdn.trace = &session->trace;
 
   session->isdn_active = 1;
   return 0;
@@ -632,11 +849,19 @@ int session_activate_isdn(session_t *session, unsigned int activate)
     if (session->isdn_active) {
       /* make sure the connection is closed */
       session->isdn_active = 0;
-      if (session->isdn.state == ISDN_IDLE) {
+      if (isdn_is_idle(&session->isdn)) {
         result = activate_isdn_device(&session->isdn, 0);
       } else {
-        session->hangup_reason = _("(ABORTED)");
-        isdn_hangup(&session->isdn);
+        unsigned int i;
+        call_t *call;
+
+        for (i = 0; i < ISDN_MAX_CALLS; i++) {
+          call = &session->calls.call[i];
+          if (call->state != CALL_FREE) {
+            call->hangup_reason = _("(ABORTED)");
+            isdn_hangup(&session->isdn, i);
+          }
+        }
       }
     }
   }
@@ -646,23 +871,23 @@ int session_activate_isdn(session_t *session, unsigned int activate)
 
 /*--------------------------------------------------------------------------*/
 
-static int session_recording_init(session_t *session)
+static int session_calls_init(session_t *session)
 {
-  /* mediation recording stuff */
-
-  if (!(session->recorder =
-	(struct recorder_t *)malloc(sizeof(struct recorder_t)))) {
+  /* mediation recording stuff, one recorder per call */
+  if (call_table_init(&session->calls) < 0)
     return -1;
-  }
-  return recording_init(session->recorder);
+
+  session_select_call(session, &session->calls.call[0]);
+  return 0;
 }
 
 /*--------------------------------------------------------------------------*/
 
-static int session_recording_deinit(session_t *session)
+static int session_calls_deinit(session_t *session)
 {
-  free(session->recorder);
-  session->recorder = 0;
+  call_table_deinit(&session->calls);
+  session->call = NULL;
+  session->recorder = NULL;
   return 0;
 }
 
@@ -699,6 +924,8 @@ int session_init(session_t *session,
   /* options defaults */
   session->option_save_options = 1; /* save options automatically (on exit) */
   session->option_release_devices = 1;
+  session->option_latency_mode = AUDIO_LATENCY_SAFE;
+  session->option_standby_time = SESSION_STANDBY_TIME;
   session->option_show_llcheck = 1;
   session->option_show_callerid = 1;
   session->option_show_controlpad = 1;
@@ -725,10 +952,8 @@ int session_init(session_t *session,
   session->msn = strdup(msn);
   session->msns = strdup(msns);
 
-  session->from = strdup("");
-  session->to = strdup("");
-
   settings_options_read(session); /* override defaults analyzing options file */
+  settings_devices_read();
 
   /* command line configurable parameters: set to hard coded defaults
      if no setting was made (either at command line or in options file) */
@@ -754,12 +979,13 @@ int session_init(session_t *session,
   session->touchtone_countdown_isdn = 0;
   session->touchtone_countdown_audio = 0;
   session->touchtone_index = 0;
+  session->dtmf_received[0] = '\0';
 
-  session->ring_time = 0;
   session->unanswered = 0;
 
   session->gtk_local_input_tag = 0;
   session->gtk_updater_timer_tag = 0;
+  session->gtk_standby_timer_tag = 0;
 
   /* create communication pipe for communicating events from thread to main */
   if (remote_call_init(&session->rem_port) < 0) {
@@ -769,18 +995,23 @@ int session_init(session_t *session,
 
   /* setup audio and isdn */
   session->audio_state = AUDIO_DISCONNECTED;
-  thread_init(&session->thread_audio_input);
+  trace_init(&session->trace);
+  thread_init(&session->thread_calibrate);
+  if (engine_init(session) < 0) {
+    errprintf("SESSION: Cannot initialize audio engine\n");
+    return -1;
+  }
 
   session->state = STATE_READY; /* initial state */
-  thread_init(&session->thread_effect);
   session->effect = EFFECT_NONE;
 
+  /* calls before ISDN, which may ring at once */
+  if (session_calls_init(session) < 0)
+    return -1;
   if (!session->option_release_devices)
     session_set_audio_state(session, AUDIO_IDLE);
   if (session_isdn_init(session) < 0)
     return -1;
-  if (session_recording_init(session) < 0)
-    return -1;
 
   /* init server functionality */
   if (server_init(session) < 0)
@@ -828,13 +1059,20 @@ int session_deinit(session_t *session) {
   g_list_foreach(session->dial_number_history, free_g_list_element, NULL);
   g_list_free(session->dial_number_history);
 
+  /* a running calibration still has the devices */
+  thread_deinit(&session->thread_calibrate);
+
   /* close devices and clean up (buffers) */
   if (session_isdn_deinit(session) < 0)
     return -1;
   if (session_set_audio_state(session, AUDIO_DISCONNECTED) < 0)
     return -1;
+  engine_deinit(session);
+  trace_deinit(&session->trace);
+  settings_devices_write();
+  mediation_freeLUTs();
 
-  if (session_recording_deinit(session) < 0) return -1;
+  if (session_calls_deinit(session) < 0) return -1;
 
   free(session->exec_on_incoming);
 
@@ -849,71 +1087,6 @@ int session_deinit(session_t *session) {
     free(session->preset_names[i]);
     free(session->preset_numbers[i]);
   }
-  free(session->from);
-  free(session->to);
-
-  return 0;
-}
-
-/*--------------------------------------------------------------------------*/
-
-static gpointer handler_audio_input(gpointer data) {
-  session_t *session = (session_t*) data;
-
-  unsigned char inbuffer[16384];    /* audio input buffer */
-  unsigned char outbuffer[16384];   /* ISDN output buffer */
-  short recbuffer[16384];
-  int err, bytes_per_frame;
-
-  dbgprintf(1, "AUDIO: Starting audio input thread\n");
-
-  /* set blocking mode for audio input */
-  snd_pcm_nonblock(session->audio_in, 0);
-
-  isdn_speed_init(&session->audio_out_speed);
-  isdn_speed_init(&session->audio_in_speed);
-
-  bytes_per_frame = sample_size_from_format(session->audio_format_in);
-
-  while (!thread_is_stopping(&session->thread_audio_input)) {
-    for (;;) {
-      err = snd_pcm_readi(session->audio_in, inbuffer, session->fragment_size_in/*sizeof(inbuffer)*/);
-      if (err < 0) {
-        err = session_snd_pcm_recover(session, session->audio_in, err);
-        if (err >= 0)
-          continue;
-        switch (err) {
-        case -EAGAIN:
-          break;
-        default:
-          errprintf("AUDIO: Unrecoverable PCM read error %s, terminating\n",
-                    snd_strerror(err));
-          // TODO: trigger hangup
-          return (gpointer) 5;
-        }
-      } else {
-        err *= bytes_per_frame;
-        isdn_speed_addsamples(&session->audio_in_speed, err);
-
-        /* process the data */
-        unsigned int outsize;
-        convert_audio_to_isdn(session,
-                              inbuffer, err,
-                              outbuffer, &outsize,
-                              recbuffer);
-
-        /* dump the audio to ISDN */
-        isdn_send_data(&session->isdn, outbuffer, outsize);
-
-        if (debug > 1) {
-          isdn_speed_debug(&session->audio_in_speed, 1, "AUDIO: in");
-        }
-      }
-      break;
-    }
-  }
-
-  dbgprintf(1, "AUDIO: Stopping audio input thread\n");
 
   return 0;
 }
@@ -925,7 +1098,7 @@ int session_start_recording(session_t *session)
   char *digits = NULL;
   int result = 0;
 
-  if ((digits = util_digitstime(&session->vcon_time))) {
+  if ((digits = util_digitstime(&session->call->vcon_time))) {
     if (recording_open(session->recorder, digits,
         session->option_recording_format))
     {
@@ -936,7 +1109,8 @@ int session_start_recording(session_t *session)
                                    session->call_record_checkbutton), FALSE);
       result = -1;
     } else {
-      cid_row_mark_record(session, session->cid_num - 1);
+      cid_row_mark_record(session, cid_row_find(session,
+                                                session->call->cid_row));
     }
     free(digits);
   } else {
@@ -950,40 +1124,243 @@ int session_start_recording(session_t *session)
   return result;
 }
 
+static void session_start_trace(session_t *session)
+{
+  trace_header_t header;
+  char *digits;
+
+  memset(&header, 0, sizeof(header));
+  header.format_in = session->audio_format_in;
+  header.format_out = session->audio_format_out;
+  header.speed_in = session->audio_speed_in;
+  header.speed_out = session->audio_speed_out;
+  header.flags = (session->option_record ? TRACE_RECORD : 0) |
+                 (session->option_record_local ? TRACE_RECORD_LOCAL : 0) |
+                 (session->option_record_remote ? TRACE_RECORD_REMOTE : 0) |
+                 (session->option_muted ? TRACE_MUTED : 0);
+
+  if ((digits = util_digitstime(&session->call->vcon_time))) {
+    if (trace_open(&session->trace, digits, &header) < 0)
+      errprintf("SESSION: Error opening media trace.\n");
+    free(digits);
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
 static void session_start_conversation(session_t *session)
 {
-  session->vcon_time = time(NULL); /* for caller id monitor */
-  session->hangup_reason = NULL;
-  cid_set_date(session, session->vcon_time);
+  call_t *call = session->call;
+
+  call->vcon_time = time(NULL); /* for caller id monitor */
+  call->hangup_reason = NULL;
+  cid_set_date(session, cid_row_find(session, call->cid_row), call->vcon_time);
   session_effect_stop(session);
-  session_set_state(session, STATE_CONVERSATION);
+  latency_reset(&call->latency);
   if (session->option_record) {
     session_start_recording(session);
   }
 
-  session_io_handlers_stop(session);
-  if (session_set_audio_state(session, AUDIO_CONVERSATION) < 0) {
+  if (session_resume(session, call) < 0) {
     /* TODO: stop conversation, as no audio possible */
     return;
   }
+  /* one trace for all calls until the last one ends */
+  if (session->option_trace && !session->trace.file)
+    session_start_trace(session);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void session_select_call(session_t *session, call_t *call)
+{
+  session->call = call;
+  session->recorder = call->recorder;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static call_t *session_waiting_call(session_t *session)
+{
+  return call_find(&session->calls, CALL_RINGING, session->call);
+}
+
+/*--------------------------------------------------------------------------*/
 
-  /* set non-blocking mode for audio output */
-  snd_pcm_nonblock(session->audio_out, 1);
+static void session_hold(session_t *session)
+{
+  dbgprintf(1, "SESSION: Call %u on hold\n",
+            call_id(&session->calls, session->call));
+
+  /* B-channel stays open, the remote side gets no more data */
+  session_set_audio_state(session, AUDIO_IDLE);
+  if (session->conference)
+    session_conference_end(session);
+  call_set_state(&session->calls, session->call, CALL_HELD);
+  session_set_state(session, STATE_HOLD);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int session_resume(session_t *session, call_t *call)
+{
+  dbgprintf(1, "SESSION: Audio to call %u\n", call_id(&session->calls, call));
 
+  if (call != session->call && session->call->state == CALL_ACTIVE) {
+    /* toggle: engine must not touch the call while switching */
+    session_set_audio_state(session, AUDIO_IDLE);
+    call_set_state(&session->calls, session->call, CALL_HELD);
+  }
+  session_select_call(session, call);
+  call_set_state(&session->calls, call, CALL_ACTIVE);
+  session_set_state(session, STATE_CONVERSATION);
+
+  session_io_handlers_stop(session);
+  if (session_set_audio_state(session, AUDIO_CONVERSATION) < 0) {
+    return -1;
+  }
   session_io_handlers_start(session);
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static unsigned int session_conference_count(session_t *session)
+{
+  unsigned int i, count = 0;
+
+  for (i = 0; i < ISDN_MAX_CALLS; i++) {
+    if (session->calls.call[i].conference)
+      count++;
+  }
+  return count;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void session_conference_end(session_t *session)
+{
+  call_t *call;
+  unsigned int i;
+
+  dbgprintf(1, "SESSION: Conference ends\n");
+
+  session->conference = 0;
+  mixer_set_party(&session->mixer, MIXER_LOCAL, 0);
+  for (i = 0; i < ISDN_MAX_CALLS; i++) {
+    call = &session->calls.call[i];
+    if (call->conference) {
+      call->conference = 0;
+      mixer_set_party(&session->mixer, MIXER_PARTY(i), 0);
+      if (call != session->call)
+        call_set_state(&session->calls, call, CALL_HELD);
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int session_conference_left(session_t *session, call_t *call)
+{
+  call_t *next;
+
+  if (!session->conference)
+    return 0;
+
+  if (call != session->call) {
+    if (session_conference_count(session) < 2) {
+      /* only the audio call left, continue without mixer */
+      session_set_audio_state(session, AUDIO_IDLE);
+      session_conference_end(session);
+      session_resume(session, session->call);
+    }
+    return 1;
+  }
+
+  /* engine is stopped already, another member takes over */
+  next = call_find(&session->calls, CALL_ACTIVE, NULL);
+  if (!next || session_conference_count(session) < 2)
+    session_conference_end(session);
+  if (!next)
+    return 0;
+  session_resume(session, next);
+  return 1;
+}
+
+/*--------------------------------------------------------------------------*/
+
+int session_set_conference(session_t *session, int conference)
+{
+  call_t *call;
+  unsigned int i;
+
+  if (!conference == !session->conference)
+    return 0;
+  if (session->state != STATE_CONVERSATION)
+    return -1;
+
+  if (!conference) {
+    session_set_audio_state(session, AUDIO_IDLE);
+    session_conference_end(session);
+    return session_resume(session, session->call);
+  }
+
+  if (!call_find(&session->calls, CALL_HELD, NULL))
+    return -1; /* nobody to talk to but the audio call */
+
+  dbgprintf(1, "SESSION: Conference starts\n");
+
+  /* the engine must not run while the parties change */
+  session_set_audio_state(session, AUDIO_IDLE);
+  for (i = 0; i < ISDN_MAX_CALLS; i++) {
+    call = &session->calls.call[i];
+    if (call->state == CALL_ACTIVE || call->state == CALL_HELD) {
+      call->conference = 1;
+      call_set_state(&session->calls, call, CALL_ACTIVE);
+      mixer_set_party(&session->mixer, MIXER_PARTY(i), 1);
+    }
+  }
+  mixer_set_party(&session->mixer, MIXER_LOCAL, 1);
+  session->conference = 1;
+  return session_resume(session, session->call);
 }
 
 /*--------------------------------------------------------------------------*/
 
-static void isdn_hangup_callback(void *context, void *error)
+static void session_answer_waiting(session_t *session, call_t *call)
+{
+  if (session->state == STATE_CONVERSATION)
+    session_hold(session);
+
+  /* the connect callback makes it the audio call */
+  if (session_pickup(session, call) < 0) {
+    errprintf("SESSION: Error answering call.\n");
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void isdn_hangup_callback(void *context, void *data)
 {
   session_t *session = (session_t*) context;
+  session_isdn_msg_t *msg = (session_isdn_msg_t*) data;
+  call_t *call = call_get(&session->calls, msg->call);
+  char *reason;
 
-  // NOTE: error contains no pointer, but error code from CAPI
+  if (!call || call->state == CALL_FREE) {
+    errprintf("SESSION: Hangup of unknown call %u\n", msg->call);
+    return;
+  }
+
+  if (call->conference) {
+    /* the engine stops sending to it right away */
+    call->conference = 0;
+    mixer_set_party(&session->mixer, MIXER_PARTY(msg->call), 0);
+  }
 
-  char *reason = session->hangup_reason;
-  if (error) {
-    unsigned long e = (unsigned long) error;
+  reason = call->hangup_reason;
+  if (msg->error) {
+    unsigned long e = msg->error;
     reason = _("ERROR");
     switch (e) {
       case 0x3301:
@@ -1089,20 +1466,54 @@ static void isdn_hangup_callback(void *context, void *error)
     }
   }
 
-  if (session->state == STATE_CONVERSATION) {
+  session_call_ended(session, call, reason, msg->error ? 1 : 0);
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void session_call_ended(session_t *session, call_t *call,
+                               char *reason, int error)
+{
+  call_t *next;
+  int row;
+
+  row = cid_row_find(session, call->cid_row);
+  if (call == session->call && session->state == STATE_CONVERSATION) {
     session_deinit_conversation(session, error ? 0 : 1);
-  } else if (session->state == STATE_RINGING ||
-             session->state == STATE_RINGING_QUIET) {
+  } else if (call->state == CALL_RINGING) {
     reason = _("(MISSED)");
-    cid_mark_row(session, session->cid_num - 1, 1);
+    if (row >= 0)
+      cid_mark_row(session, row, 1);
   }
-  session_set_state(session, STATE_READY);
-  cid_set_duration(session, reason);
+  if (call->vcon_time)
+    session_finish_call(session, call);
+  cid_set_duration(session, row, call->vcon_time, reason);
+  call_free(call);
+
+  if (call == session->call) {
+    /* continue with the remaining calls */
+    if (session_conference_left(session, call)) {
+      /* conference goes on */
+    } else if ((next = call_find(&session->calls, CALL_HELD, NULL))) {
+      session_select_call(session, next);
+      session_set_state(session, STATE_HOLD);
+    } else if ((next = call_find(&session->calls, CALL_RINGING, NULL))) {
+      session_select_call(session, next);
+      session_ring(session);
+    } else {
+      session_set_state(session, STATE_READY);
+    }
+  } else {
+    session_conference_left(session, call);
+    session_update_buttons(session);
+  }
+  if (!call_count(&session->calls))
+    trace_close(&session->trace);
 
   settings_history_write(session); /* write history */
   settings_callerid_write(session); /* write callerid history */
 
-  if (!session->isdn_active) {
+  if (!session->isdn_active && isdn_is_idle(&session->isdn)) {
     /* we were asked to deactivate ISDN */
     activate_isdn_device(&session->isdn, 0);
   }
@@ -1110,21 +1521,77 @@ static void isdn_hangup_callback(void *context, void *error)
 
 /*--------------------------------------------------------------------------*/
 
-static void isdn_connect_callback(void *context, void *number)
+static int session_pickup(session_t *session, call_t *call)
+{
+  if (isdn_pickup(&session->isdn, call_id(&session->calls, call)) < 0) {
+    /* the ISDN call is gone, so is ours */
+    session_call_ended(session, call, _("ERROR"), 1);
+    return -1;
+  }
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void isdn_connect_callback(void *context, void *data)
 {
   session_t *session = (session_t*) context;
+  session_isdn_msg_t *msg = (session_isdn_msg_t*) data;
+  call_t *call = call_get(&session->calls, msg->call);
 
-  if (session->state == STATE_RINGING || session->state == STATE_RINGING_QUIET) {
-    char *old = session->from;
-    session->from = strdup(number ? (char*) number : _("(no caller ID)"));
-    free(old);
+  if (!call || call->state == CALL_FREE) {
+    errprintf("SESSION: Connect of unknown call %u\n", msg->call);
+    return;
+  }
+
+  if (call->state == CALL_RINGING) {
+    call_set_from(call, msg->number ? msg->number : _("(no caller ID)"));
   }
 
+  if (call != session->call && session->state == STATE_CONVERSATION)
+    session_hold(session);
+  session_select_call(session, call);
   session_start_conversation(session); /* including state transition */
 }
 
 /*--------------------------------------------------------------------------*/
 
+static void isdn_dtmf_callback(void *context, void *data)
+{
+  session_t *session = (session_t*) context;
+  session_isdn_msg_t *msg = (session_isdn_msg_t*) data;
+  char buffer[256];
+  size_t len, add;
+
+  dbgprintf(1, "SESSION: DTMF '%s' received, call %u\n", msg->number,
+            msg->call);
+
+  if (session->state != STATE_CONVERSATION ||
+      call_get(&session->calls, msg->call) != session->call)
+    return;
+
+  /* keep the latest digits */
+  len = strlen(session->dtmf_received);
+  add = strlen(msg->number);
+  if (len + add > ISDN_DTMF_MAX_DIGITS) {
+    memmove(session->dtmf_received,
+            session->dtmf_received + len + add - ISDN_DTMF_MAX_DIGITS,
+            ISDN_DTMF_MAX_DIGITS - add + 1);
+    len = ISDN_DTMF_MAX_DIGITS - add;
+  }
+  strcpy(session->dtmf_received + len, msg->number);
+
+  snprintf(buffer, sizeof(buffer), _("%s  DTMF: %s"),
+           _(state_data[session->state].status_bar),
+           session->dtmf_received);
+  gtk_statusbar_pop(GTK_STATUSBAR(session->status_bar),
+                    session->phone_context_id);
+  gtk_statusbar_push(GTK_STATUSBAR(session->status_bar),
+                     session->phone_context_id, buffer);
+}
+
+/*--------------------------------------------------------------------------*/
+
 static gboolean session_timer_func(gpointer data)
 {
   session_t *session = (session_t *) data;
@@ -1221,8 +1688,6 @@ static void session_deinit_conversation(session_t *session, int self_hangup _U_)
 {
   /* stop audio thread */
   session_set_audio_state(session, AUDIO_IDLE);
-  /* stop recording, if used */
-  recording_close(session->recorder);
 
   session_io_handlers_stop(session);
   session_reset_audio(session);
@@ -1231,151 +1696,20 @@ static void session_deinit_conversation(session_t *session, int self_hangup _U_)
 
 /*--------------------------------------------------------------------------*/
 
-static gpointer handler_effect(gpointer data)
+static void session_finish_call(session_t *session _U_, call_t *call)
 {
-  session_t *session = (session_t *) data;
-  unsigned int i;
-  int err;
-  unsigned long effectpos = 0;        /* position within effect in frames */
-  short buffer[2048];                 /* buffer for sound file samples */
-  int just_read;                      /* read count from sndfile */
-  int sample;                         /* linear sample to convert to A-law */
-  unsigned char alawbuffer[4096];     /* buffer for alaw samples */
-  unsigned int alawcount;             /* count of samples to play */
-  unsigned char sndbuffer[12*4096];   /* sound data buffer */
-  short recbuffer[4096];              /* temporary */
-  unsigned int sndcount;              /* count of bytes in sound buffer */
-  unsigned int ptr;                   /* playback pointer */
-  unsigned int size;                  /* playback frame size */
-  unsigned int framesize;             /* frame/sample size (1 or 2B) */
-  int term_retry;                     /* retry count on termination */
-
-  dbgprintf(1, "EFFECT: Starting effect thread\n");
-
-  /* set blocking mode */
-  snd_pcm_nonblock(session->audio_out, 0);
-  /* set non-blocking mode */
-  snd_pcm_nonblock(session->audio_in, 1);
-
-  framesize = sample_size_from_format(session->audio_format_out);
-
-  while (!thread_is_stopping(&session->thread_effect)) {
-    switch (session->effect) {
-    case EFFECT_SOUNDFILE:
-      just_read = sf_readf_short(session->effect_sndfile,
-                                 buffer,
-                                 sizeof(buffer) / 4);
-      if (just_read > 0) {
-        /* convert samples to alaw */
-        for (i = 0; i < (unsigned int) just_read; ++i) {
-          /* convert to ALAW */
-          sample = ((int) buffer[2*i]) + ((int) buffer[2*i+1]);
-          if (sample < -32768)
-            sample = -32768;
-          else if (sample > 32767)
-            sample = 32767;
-          alawbuffer[i] = linear2alaw(sample);
-        }
-        alawcount = just_read;
-      } else {
-        alawcount = 0;
-      }
-      break;
-
-    case EFFECT_RING:     /* somebody's calling */
-    case EFFECT_RINGING:  /* waiting for the other end to pick up the phone */
-    case EFFECT_TEST:     /* play test sound (e.g. line level check) */
-    case EFFECT_TOUCHTONE:/* play a touchtone */
-    case EFFECT_EMPTY:    /* silence for llcheck */
-      for (i = 0; i < sizeof(alawbuffer) / 4; ++i)
-        alawbuffer[i] = fxgenerate(session,
-                                   session->effect,
-                                   session->touchtone_index,
-                                   effectpos++ / 8000.0);
-      alawcount = sizeof(alawbuffer) / 4;
-      break;
-
-    default:
-      errprintf("EFFECT: Unknown effect %d to play, exiting thread\n",
-              session->effect);
-      return (gpointer) 1;
-    }
-
-    if (alawcount == 0) {
-      /* end of file */
-      dbgprintf(1 ,"EFFECT: End-of-file reached, stopping playback\n");
-
-      /* set non-blocking mode */
-      snd_pcm_nonblock(session->audio_out, 1);
-      /* drain output buffer in order not to cut last seconds of playback */
-      snd_pcm_drain(session->audio_out);
-      term_retry = 15;
-      while (!thread_is_stopping(&session->thread_effect) && term_retry--) {
-        usleep(20);
-      }
-      /* drop the rest, if any, and quit effect thread */
-      snd_pcm_drop(session->audio_out);
-      break;
-    }
+  char *digits;
 
-    /* convert A-law to audio */
-    convert_isdn_to_audio(session,
-                          alawbuffer, alawcount,
-                          sndbuffer, &sndcount,
-                          recbuffer, 0);
-    sndcount /= framesize;
-
-    /* play it! */
-    ptr = 0;
-    err = 0;
-    while (ptr < sndcount && !thread_is_stopping(&session->thread_effect)) {
-      size = sndcount - ptr;
-      if (size > 512) /* limit to 512B/syscall to allow timely stopping */
-        size = 512;
-      if ((err = snd_pcm_writei(session->audio_out,
-                                sndbuffer + ptr * framesize,
-                                size)) < 0) {
-        err = session_snd_pcm_recover(session, session->audio_out, err);
-        if (err >= 0)
-          continue; /* retry */
-        errprintf("EFFECT: Error writing effect to audio device: %s\n",
-                snd_strerror(err));
-        break;
-      } else {
-        ptr += err;
-
-        /* try to read some audio to adjust line level for input */
-        err = snd_pcm_readi(session->audio_in, sndbuffer, size);
-        if (err < 0) {
-          /* restart audio input (it slipped) */
-          err = session_snd_pcm_recover(session, session->audio_in, err);
-        } else if (err > 0) {
-          /* convert read data, this updates llcheck */
-          convert_audio_to_isdn(session, sndbuffer, err, alawbuffer, &alawcount, recbuffer);
-        }
-        err = 0;
-      }
-    }
-    if (err < 0)
-      break;
-  }
+  /* stop recording, if used */
+  recording_close(call->recorder);
 
-  if (session->effect == EFFECT_SOUNDFILE) {
-    /* signalise we have stopped playback */
-    sf_close(session->effect_sndfile);
-    session->effect_sndfile = 0;
+  /* keep latency histograms of the call */
+  if ((digits = util_digitstime(&call->vcon_time))) {
+    latency_save(&call->latency, digits);
+    free(digits);
   }
-  session->effect = EFFECT_NONE;
-
-  /* set non-blocking mode */
-  snd_pcm_nonblock(session->audio_out, 1);
-
-  /* playback stopped, reset audio (devices closed elsewhere) */
-  audio_stop(session->audio_in, session->audio_out);
-
-  dbgprintf(1, "EFFECT: Stopping effect thread\n");
-
-  return (gpointer) 0;
+  if (debug)
+    latency_dump(&call->latency, stdout, 0);
 }
 
 /*--------------------------------------------------------------------------*/
@@ -1402,14 +1736,17 @@ void session_effect_start(session_t *session, enum effect_t kind)
 
   session->effect = kind;
   session->effect_pos = 0;
-  thread_start(&session->thread_effect, handler_effect, session);
+  if (engine_start(session) < 0) {
+    errprintf("EFFECT: Cannot start audio engine thread\n");
+  }
 }
 
 /*--------------------------------------------------------------------------*/
 
 void session_effect_stop(session_t *session)
 {
-  thread_stop(&session->thread_effect);
+  if (session->audio_state == AUDIO_EFFECT)
+    engine_stop(session);
   if (session->effect != EFFECT_NONE) { /* stop only if already playing */
     session->effect = EFFECT_NONE;
   }
@@ -1441,21 +1778,49 @@ static void session_audio_notify(session_t *session, char *note)
 
 /*--------------------------------------------------------------------------*/
 
+static int session_state_effect(enum state_t state, enum effect_t effect)
+{
+  switch (state) {
+  case STATE_DIALING:
+    return effect == EFFECT_RINGING;
+  case STATE_RINGING:
+    return effect == EFFECT_RING;
+  case STATE_SERVICE:
+    return effect == EFFECT_TEST || effect == EFFECT_EMPTY;
+  case STATE_PLAYBACK:
+    return effect == EFFECT_SOUNDFILE;
+  default:
+    return 0;
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
 int session_set_state(session_t *session, enum state_t state)
 {
   int result = 0;
 
+  ANT_PROBE2(session_state, session->state, state);
+
   /* open / close audio when needed, set state */
   session_io_handlers_stop(session);
   if (state == STATE_READY && state != session->state && session->state != STATE_RINGING_QUIET) {
     /* release audio if going to idle state */
     session_effect_stop(session);
     if (session->option_release_devices) {
-      session_set_audio_state(session, AUDIO_DISCONNECTED);
+      session_set_audio_state(session, session->option_standby_time ?
+                              AUDIO_STANDBY : AUDIO_DISCONNECTED);
     } else {
       session_set_audio_state(session, AUDIO_IDLE);
     }
   }
+  if (session->effect != EFFECT_NONE &&
+      !session_state_effect(state, session->effect)) {
+    /* e.g. ringback of a call which hung up, with another one on hold */
+    session_effect_stop(session);
+    if (session->audio_state == AUDIO_EFFECT)
+      session_set_audio_state(session, AUDIO_IDLE);
+  }
   session->state = state;
   session_io_handlers_start(session);
 
@@ -1498,8 +1863,12 @@ int session_set_state(session_t *session, enum state_t state)
   case STATE_CONVERSATION:
     session->touchtone_countdown_isdn = 0;
     session->touchtone_countdown_audio = 0;
+    session->dtmf_received[0] = '\0';
     dbgprintf(1, "SESSION: New state: STATE_CONVERSATION\n");
     break;
+  case STATE_HOLD:
+    dbgprintf(1, "SESSION: New state: STATE_HOLD\n");
+    break;
   case STATE_SERVICE:
     dbgprintf(1, "SESSION: New state: STATE_SERVICE\n");
     break;
@@ -1517,8 +1886,10 @@ int session_set_state(session_t *session, enum state_t state)
   /* audio on / off notify */
   if (session->option_release_devices) {
     session_audio_notify(session,
-			 state == STATE_READY || state == STATE_RINGING_QUIET ?
-			 _("Audio OFF") : _("Audio ON"));
+			 state != STATE_READY && state != STATE_RINGING_QUIET ?
+			 _("Audio ON") :
+			 session->audio_state == AUDIO_STANDBY ?
+			 _("Audio STANDBY") : _("Audio OFF"));
   } else {
     session_audio_notify(session, "");
   }
@@ -1530,12 +1901,37 @@ int session_set_state(session_t *session, enum state_t state)
                      session->phone_context_id,
 		     _(state_data[state].status_bar));
 
-  gtk_label_set_text(GTK_LABEL(session->pick_up_label),
-		     _(state_data[state].pick_up_label));
-  gtk_widget_set_sensitive(session->pick_up_button,
-			   state_data[state].pick_up_state);
-  gtk_widget_set_sensitive(session->call_pick_up_button,
-                           state_data[state].pick_up_state);
+  session_update_buttons(session);
+
+  if (state == STATE_READY) {
+    llcheck_bar_reset(session->llcheck_in);
+    llcheck_bar_reset(session->llcheck_out);
+  }
+
+  return result;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static void session_update_buttons(session_t *session)
+{
+  enum state_t state = session->state;
+  call_t *waiting = session_waiting_call(session);
+  const char *label = _(state_data[state].pick_up_label);
+  int sensitive = state_data[state].pick_up_state;
+
+  if (state == STATE_CONVERSATION || state == STATE_HOLD) {
+    /* answer waiting call, toggle between calls or hold */
+    if (waiting)
+      label = _("Answer");
+    else if (state == STATE_CONVERSATION &&
+             call_find(&session->calls, CALL_HELD, NULL))
+      label = _("Toggle");
+  }
+
+  gtk_label_set_text(GTK_LABEL(session->pick_up_label), label);
+  gtk_widget_set_sensitive(session->pick_up_button, sensitive);
+  gtk_widget_set_sensitive(session->call_pick_up_button, sensitive);
 
   gtk_label_set_text(GTK_LABEL(session->hang_up_label),
 		     _(state_data[state].hang_up_label));
@@ -1544,91 +1940,136 @@ int session_set_state(session_t *session, enum state_t state)
   gtk_widget_set_sensitive(session->call_hang_up_button,
                            state_data[state].hang_up_state);
 
-  if (state == STATE_READY) {
-    llcheck_bar_reset(session->llcheck_in);
-    llcheck_bar_reset(session->llcheck_out);
+  /* a conference needs calls on hold to join */
+  gtk_widget_set_sensitive(session->conference_button,
+                           state == STATE_CONVERSATION &&
+                           (session->conference ||
+                            call_find(&session->calls, CALL_HELD, NULL)));
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(session->conference_button),
+                               session->conference);
+
+  if (state != STATE_RINGING && state != STATE_RINGING_QUIET) {
+    /* incoming call window shows a waiting call */
+    gtk_status_icon_set_blinking(session->status_icon, waiting != NULL);
+    if (waiting)
+      gtk_widget_show(session->call_window);
+    else
+      gtk_widget_hide(session->call_window);
   }
-
-  return result;
 }
 
 /*--------------------------------------------------------------------------*/
 
 void session_make_call(session_t *session, char *number)
 {
-  if (session->state == STATE_READY || session->state == STATE_PLAYBACK) {
+  if (session->state == STATE_READY || session->state == STATE_PLAYBACK ||
+      session->state == STATE_HOLD) {
     gtk_entry_set_text(GTK_ENTRY(GTK_COMBO(session->dial_number_box)->entry),
                       number);
-    gtk_button_clicked(GTK_BUTTON(session->pick_up_button));
+    gtk_handle_dial_entry(NULL, session);
   }
 }
 
 /*--------------------------------------------------------------------------*/
 
-void gtk_handle_pick_up_button(GtkWidget *widget _U_, gpointer data)
+static void session_dial(session_t *session)
 {
-  session_t *session = (session_t *) data;
   const char *number; /* the number to dial "inside" gtk (entry) */
   char *clear_number; /* number after un_vanity() */
-  
-  switch (session->state) {
-  case STATE_READY: /* we are in command mode and want to dial */
-    session_activate_isdn(session, 1);
-    number = gtk_entry_get_text(GTK_ENTRY(GTK_COMBO(session->dial_number_box)
-					  ->entry));
-    /* replace letters with numbers ("Vanity" Numbers) */
-    clear_number = un_vanity(strdup(number));
-    if (strcmp(clear_number, "") != 0 && session->isdn_active) {
-      if (!session_set_state(session, STATE_DIALING)) {
-	/* dial only if audio is on etc. */
-        if (isdn_dial(&session->isdn, 0, clear_number) < 0) {
-          errprintf("SESSION: Error dialing number '%s'.\n", clear_number);
-	} else {
-	  /* update dial combo box */
-	  session_history_add(session, number);
-
-	  /* caller id update */
-	  session->ring_time = time(NULL);
-	  cid_add_line(session, CALL_OUT, session->msn, clear_number);
-
-	  /* save caller's and callee's number */
-	  free(session->from);
-	  session->from = strdup(session->msn);
-	  free(session->to);
-	  session->to = strdup(clear_number);
-	}
+  enum state_t state = session->state;
+  call_t *call;
+  int id;
+
+  session_activate_isdn(session, 1);
+  number = gtk_entry_get_text(GTK_ENTRY(GTK_COMBO(session->dial_number_box)
+					->entry));
+  /* replace letters with numbers ("Vanity" Numbers) */
+  clear_number = un_vanity(strdup(number));
+  if (strcmp(clear_number, "") != 0 && session->isdn_active) {
+    if (!session_set_state(session, STATE_DIALING)) {
+      /* dial only if audio is on etc. */
+      if ((id = isdn_dial(&session->isdn, 0, clear_number)) < 0) {
+        errprintf("SESSION: Error dialing number '%s'.\n", clear_number);
+        session_set_state(session, state);
       } else {
-	show_audio_error_dialog();
+        /* update dial combo box */
+        session_history_add(session, number);
+
+        /* save caller's and callee's number, caller id update */
+        call = call_open(&session->calls, id, CALL_DIALING,
+                         session->msn, clear_number);
+        call->cid_row = cid_add_line(session, CALL_OUT,
+                                     call->from, call->to);
+        session_select_call(session, call);
       }
+    } else {
+      show_audio_error_dialog();
     }
+  }
+
+  free(clear_number);
+}
 
-    free(clear_number);
+/*--------------------------------------------------------------------------*/
+
+void gtk_handle_dial_entry(GtkWidget *widget _U_, gpointer data)
+{
+  session_t *session = (session_t *) data;
+
+  if (session->state == STATE_HOLD) {
+    /* consultation call, pick up button retrieves */
+    session_dial(session);
+  } else {
+    gtk_button_clicked(GTK_BUTTON(session->pick_up_button));
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+void gtk_handle_pick_up_button(GtkWidget *widget _U_, gpointer data)
+{
+  session_t *session = (session_t *) data;
+  call_t *call;
+  
+  switch (session->state) {
+  case STATE_READY: /* we are in command mode and want to dial */
+    session_dial(session);
     break;
 
   case STATE_DIALING: /* already dialing! */
     break;
   case STATE_RINGING: /* we want to pick up the phone while it rings */
-    if (isdn_pickup(&session->isdn) < 0) {
+    if (session_pickup(session, session->call) < 0) {
       errprintf("SESSION: Error answering call.\n");
-      session_set_state(session, STATE_READY);
     }
     break;
   case STATE_RINGING_QUIET:
     if (!session_set_state(session, STATE_RINGING)) {
-      if (isdn_pickup(&session->isdn) < 0) {
+      if (session_pickup(session, session->call) < 0) {
         errprintf("SESSION: Error answering call.\n");
-        session_set_state(session, STATE_READY);
       }
     } else {
-      if (isdn_pickup(&session->isdn) < 0) {
+      if (session_pickup(session, session->call) < 0) {
         errprintf("SESSION: Error rejecting call due to audio problems.\n");
-        session_set_state(session, STATE_READY);
       }
       show_audio_error_dialog();
     }
     break;
-  case STATE_CONVERSATION: /* channel already working */
-    errprintf("SESSION: Non-sense warning: Pick up button pressed in conversation mode\n");
+  case STATE_CONVERSATION: /* answer waiting call, toggle or hold */
+    if ((call = session_waiting_call(session))) {
+      session_answer_waiting(session, call);
+    } else if ((call = call_find(&session->calls, CALL_HELD, NULL))) {
+      session_resume(session, call);
+    } else {
+      session_hold(session);
+    }
+    break;
+  case STATE_HOLD: /* answer waiting call or retrieve */
+    if ((call = session_waiting_call(session))) {
+      session_answer_waiting(session, call);
+    } else if ((call = call_find(&session->calls, CALL_HELD, NULL))) {
+      session_resume(session, call);
+    }
     break;
   case STATE_SERVICE:
     errprintf("SESSION: Non-sense warning: Pick up button pressed in service mode\n");
@@ -1643,27 +2084,56 @@ void gtk_handle_pick_up_button(GtkWidget *widget _U_, gpointer data)
 
 /*--------------------------------------------------------------------------*/
 
-void gtk_handle_hang_up_button(GtkWidget *widget _U_, gpointer data)
+void gtk_handle_hang_up_button(GtkWidget *widget, gpointer data)
 {
   session_t *session = (session_t *) data;
+  call_t *call = session->call;
+  unsigned int id = call_id(&session->calls, call);
+  unsigned int i;
+
+  if (!widget) {
+    /* exit: hang up the other calls, then the audio call */
+    for (i = 0; i < ISDN_MAX_CALLS; i++) {
+      if (session->calls.call[i].state != CALL_FREE && i != id) {
+        session->calls.call[i].hangup_reason = _("(ABORTED)");
+        isdn_hangup(&session->isdn, i);
+      }
+    }
+  } else if (widget == session->call_hang_up_button &&
+             session->state != STATE_RINGING &&
+             session->state != STATE_RINGING_QUIET &&
+             (call = session_waiting_call(session))) {
+    /* reject waiting call shown in incoming call window */
+    call->hangup_reason = _("(REJECTED)");
+    isdn_hangup(&session->isdn, call_id(&session->calls, call));
+    return;
+  }
 
   switch (session->state) {
   case STATE_READY: /* we are already in command mode */
     break;
   case STATE_DIALING:/* abort dialing */
     /* TRANSLATORS: A status info about an aborted phone call */
-    session->hangup_reason = _("(ABORTED)");
-    isdn_hangup(&session->isdn);
+    call->hangup_reason = _("(ABORTED)");
+    isdn_hangup(&session->isdn, id);
     break;
   case STATE_RINGING: /* reject call */
   case STATE_RINGING_QUIET: /* reject call */
     /* TRANSLATORS: A status info about an aborted phone call */
-    session->hangup_reason = _("(REJECTED)");
-    isdn_hangup(&session->isdn);
+    call->hangup_reason = _("(REJECTED)");
+    isdn_hangup(&session->isdn, id);
     break;
   case STATE_CONVERSATION: /* hang up (while b-channel is open) */
-    session->hangup_reason = NULL;
-    isdn_hangup(&session->isdn);
+  case STATE_HOLD: /* hang up last held call */
+    call->hangup_reason = NULL;
+    if (session->conference && widget) {
+      /* the whole conference */
+      for (i = 0; i < ISDN_MAX_CALLS; i++) {
+        if (session->calls.call[i].conference && i != id)
+          isdn_hangup(&session->isdn, i);
+      }
+    }
+    isdn_hangup(&session->isdn, id);
     break;
   case STATE_SERVICE:
     errprintf("SESSION: Non-sense warning: Hang up button pressed in service mode\n");
@@ -42,9 +42,21 @@
 #include "recording.h"
 #include "isdn.h"
 #include "thread.h"
+#include "ringbuf.h"
+#include "bufpool.h"
+#include "latency.h"
+#include "trace.h"
+#include "call.h"
+#include "mixer.h"
+#include "sound.h"
 
 #define SESSION_PRESET_SIZE 4
 
+/*!
+ * @brief Default seconds released audio devices stay in standby.
+ */
+#define SESSION_STANDBY_TIME 300
+
 
 /*!
  * @brief Session states.
@@ -57,6 +69,7 @@ enum state_t {
   STATE_CONVERSATION,   /*!< we are talking */
   STATE_SERVICE,        /*!< special mode (llcheck) */
   STATE_PLAYBACK,       /*!< sound playback, usually recorded conversation */
+  STATE_HOLD,           /*!< all connected calls are on hold */
 
   STATE_NUMBER          /*!< dummy to calculate size */
 };
@@ -79,6 +92,9 @@ enum effect_t {
  */
 enum audio_t {
   AUDIO_DISCONNECTED,   /*!< audio is disconnected */
+  AUDIO_STANDBY,        /*!< audio is connected and prepared, but not used;
+                             released on request or after
+                             option_standby_time */
   AUDIO_IDLE,           /*!< audio is connected, but idle */
   AUDIO_EFFECT,         /*!< audio is playing an effect */
   AUDIO_CONVERSATION    /*!< audio is used for conversation */
@@ -119,20 +135,46 @@ typedef struct {
   int audio_format_out;               /*!< used audio out format */
   int audio_sample_size_in;           /*!< number of bytes of an input audio sample */
   int audio_sample_size_out;          /*!< number of bytes of an output audio sample */
+  int audio_mmap_in;                  /*!< input device uses mmap access */
+  int audio_mmap_out;                 /*!< output device uses mmap access */
+  audio_timing_t audio_timing_in;     /*!< negotiated input buffer and period
+                                         time */
+  audio_timing_t audio_timing_out;    /*!< negotiated output buffer and
+                                         period time */
+  int audio_linked;                   /*!< capture and playback are linked
+                                         during conversation (engine only) */
+  unsigned int audio_duplex_delay;    /*!< round trip through the devices in
+                                         microseconds, fixed when the
+                                         conversation starts */
+  volatile gint audio_failed;         /*!< engine reported a fatal audio
+                                         error, not handled yet */
   isdn_speed_t audio_out_speed;       /*!< actual audio out speed */
   isdn_speed_t audio_in_speed;        /*!< actual audio in speed */
-  thread_t thread_audio_input;        /*!< audio data input thread */
+  thread_t thread_audio;              /*!< audio engine thread (conversation and effects) */
+  thread_t thread_calibrate;          /*!< device calibration, holds the
+                                         devices while running */
+  ringbuf_t isdn_rx;                  /*!< queue of received ISDN data blocks
+                                         (buffer_t*) waiting for playback */
+  bufpool_t isdn_pool;                /*!< buffers for received ISDN data */
+  bufpool_t audio_pool;               /*!< engine working buffers, sized for
+                                         the opened audio devices */
+  trace_t trace;                      /*!< media event trace of the calls */
+  mixer_t mixer;                      /*!< conference mixer */
+  int conference;                     /*!< engine mixes the conference calls
+                                         (only changed with engine stopped) */
 
   /* ISDN data */
   isdn_t isdn;                        /*!< ISDN handle */
   unsigned int isdn_active;           /*!< flag for active CAPI connection */
 
-  char *from;                         /*!< caller's number */
-  char *to;                           /*!< callee's number */
-  char *hangup_reason;                /*!< reason for hangup */
+  /* call data */
+  call_table_t calls;                 /*!< all calls, by ISDN call number */
+  call_t *call;                       /*!< call using the audio devices (or
+                                         the last one), never NULL */
 
   /* mediation data */
   /* Look-up-tables for audio <-> isdn conversion: */
+  /* conversion tables, shared (see mediation_getLUT()) */
   unsigned char *audio_LUT_in;        /*!< lookup table ISDN -> audio */
   unsigned char *audio_LUT_out;       /*!< lookup table audio -> ISDN */
   unsigned char *audio_LUT_generate;  /*!< lookup table 8 bit unsigned -> ISDN */
@@ -142,12 +184,14 @@ typedef struct {
   double ratio_out;                   /*!< ratio: ISDN output rate / audio input rate */
 
   /* recording data */
-  struct recorder_t *recorder;        /*!< recorder internal data */
+  struct recorder_t *recorder;        /*!< recorder of the audio call */
 
   /* level check data */
   double llcheck_in_state;            /*!< current input value for level check */
   double llcheck_out_state;           /*!< current output value for level check */
   guint gtk_updater_timer_tag;        /*!< GTK timer tag for updating levels */
+  guint gtk_standby_timer_tag;        /*!< GTK timer tag for releasing audio
+                                         devices from standby */
 
   remote_call_port_t rem_port;        /*!< remote call port to call functions in session thread */
 
@@ -180,6 +224,7 @@ typedef struct {
   GtkWidget *controlpad;              /*!< key pad etc. */
   GtkWidget *controlpad_check_menu_item; /*!< display state of control pad */
   GtkWidget *mute_button;             /*!< mute toggle button */
+  GtkWidget *conference_button;       /*!< conference toggle button */
   GtkWidget *muted_warning;           /*!< show in status bar if muted */
   gint muted_context_id;              /*!< a context for mute in the status bar */
 
@@ -195,8 +240,6 @@ typedef struct {
   GtkWidget *cid_scrolled_window;     /*!< the home of the clist with adjustments */
   gint cid_num;                       /*!< number of rows in list */
   gint cid_num_max;                   /*!< maximum number of rows in list */
-  time_t vcon_time;                   /*!< the start of conversation mode (for duration calc.) */
-  time_t ring_time;                   /*!< the first sign of the conversation (dial/ring) */
   /* the symbols for the CList */
   GdkPixmap *symbol_in_pixmap;
   GdkBitmap *symbol_in_bitmap;
@@ -209,7 +252,6 @@ typedef struct {
   GtkWidget *menuitem_line_check;
 
   /* ringing etc. */
-  thread_t thread_effect;             /*!< effect thread, e.g., for ringing */
   enum effect_t effect;               /*!< which effect is currently been played? */
   unsigned int effect_pos;            /*!< sample position in effect */
   char* effect_filename;              /*!< the file to play back */
@@ -219,6 +261,9 @@ typedef struct {
   int touchtone_countdown_isdn;       /*!< number of samples yet to play */
   int touchtone_countdown_audio;      /*!< number of samples yet to play */
   int touchtone_index;                /*!< which touchtone */
+  char dtmf_received[ISDN_DTMF_MAX_DIGITS + 1]; /*!< latest DTMF digits
+                                         the controller detected in this
+                                         conversation */
 
   /* phone specific */
   enum state_t state;                 /*!< which state we are currently in */
@@ -231,6 +276,10 @@ typedef struct {
   /* some options (useful for options file handling) */
   int option_save_options;            /*!< save options on exit */
   int option_release_devices;         /*!< close sound devices while not needed */
+  audio_latency_t option_latency_mode; /*!< buffering of the sound devices */
+  unsigned int option_standby_time;   /*!< seconds to keep released sound
+                                         devices in standby, 0 to close them
+                                         at once */
   int option_show_llcheck;            /*!< show line level checks in main window  */
   int option_show_callerid;           /*!< show callerid part in main window */
   int option_show_controlpad;         /*!< show control pad (key pad etc.) */
@@ -239,6 +288,8 @@ typedef struct {
   int option_record_local;            /*!< record local channel */
   int option_record_remote;           /*!< record remote channel */
   enum recording_format_t option_recording_format; /*!< recording file format */
+  int option_trace;                   /*!< write a media trace of each call
+                                         (command line only) */
 
   int option_calls_merge;             /*!< merge isdnlog */
   int option_calls_merge_max_days;
@@ -308,6 +359,25 @@ void session_io_handlers_stop(session_t *session);
  */
 int session_set_audio_state(session_t *session, enum audio_t state);
 
+/*!
+ * @brief Release audio devices kept in standby, so other applications
+ * can use them.
+ *
+ * @param session session.
+ * @return 0 on success (or if the devices are in use), -1 otherwise.
+ */
+int session_release_audio(session_t *session);
+
+/*!
+ * @brief Report that conversation audio failed for good (engine thread).
+ *
+ * The audio call (with a conference, all of its calls) is hung up from
+ * the GTK thread, unless the engine was restarted meanwhile.
+ *
+ * @param session session.
+ */
+void session_audio_failed(session_t *session);
+
 /*!
  * @brief Resets audio devices by closing and reopening.
  *
@@ -379,10 +449,22 @@ int session_start_recording(session_t *session);
 
 
 
+/*!
+ * @brief Join all connected calls to a conference, or split it.
+ *
+ * Splitting keeps the audio call, the others go on hold.
+ *
+ * @param session session.
+ * @param conference nonzero to start the conference.
+ * @return 0 on success, -1 if not possible in the current state.
+ */
+int session_set_conference(session_t *session, int conference);
+
 /*!
  * @brief Initiates dialing to specified number.
  *
- * Changes contents of dial entry and simulates pick up button.
+ * Changes contents of dial entry and simulates pick up button. While calls
+ * are on hold, a consultation call is made.
  *
  * @param session session.
  * @param number number to dial.
@@ -397,10 +479,21 @@ void session_make_call(session_t *session, char *number);
  */
 void gtk_handle_pick_up_button(GtkWidget *widget, gpointer data);
 
+/*!
+ * @brief Callback from GTK on enter in dial number entry.
+ *
+ * Dials a consultation call while calls are on hold, otherwise same as
+ * pick up button.
+ *
+ * @param widget the entry.
+ * @param data session.
+ */
+void gtk_handle_dial_entry(GtkWidget *widget, gpointer data);
+
 /*!
  * @brief Callback from GTK on hang up button clicked.
  *
- * @note Also called on exit.
+ * @note Also called on exit, then hangs up all calls.
  *
  * @param widget the button, NULL when called directly (on exit).
  * @param data session.
@@ -152,6 +152,14 @@ void settings_option_set(session_t *session, char *option, char *value) {
     if (!strcmp(option, "ReleaseAudioDevices")) {
       session->option_release_devices = (i_value == 0 ? 0 : 1);
     }
+    if (!strcmp(option, "AudioStandbyTime")) {
+      session->option_standby_time = i_value < 0 ? 0 : i_value;
+    }
+    if (!strcmp(option, "LatencyMode")) {
+      int mode = audio_latency_parse(value);
+      if (mode >= 0)
+        session->option_latency_mode = mode;
+    }
     if (!strcmp(option, "IdentifyingMSN") &&
 	!strcmp(session->msn, "")) { /* may be overridden */
       free(session->msn);
@@ -344,6 +352,17 @@ void settings_options_write(session_t *session) {
 	    "(when not needed)\n#\n");
     fprintf(f, "ReleaseAudioDevices = %d\n\n",session->option_release_devices);
 
+    fprintf(f, "#\n# Seconds released audio devices stay open in standby "
+	    "for a quick\n# start, \"ant-phone --release-audio\" releases "
+	    "them earlier\n# (0 to release at once)\n#\n");
+    fprintf(f, "AudioStandbyTime = %u\n\n", session->option_standby_time);
+
+    fprintf(f, "#\n# Audio buffering (\"low\" uses the calibrated values "
+	    "of the devices,\n# \"normal\" or \"safe\" for larger "
+	    "buffers)\n#\n");
+    fprintf(f, "LatencyMode = \"%s\"\n\n",
+	    audio_latency_name(session->option_latency_mode));
+
     fprintf(f, "#\n# MSN (Multiple Subscriber Number) to send to identify\n"
 	    "# ourselves at called party\n#\n");
     fprintf(f, "IdentifyingMSN = %s\n\n", session->msn);
@@ -595,3 +614,225 @@ void settings_callerid_write(session_t *session) {
 
 }
 
+
+/*
+ * get the calibrated timing of a device pair from the calibration file
+ * returns 0 if found (timing set), -1 otherwise (timing unchanged)
+ */
+int settings_latency_read(const char *in_device, const char *out_device,
+                          audio_timing_t *timing) {
+  char *homedir;
+  char *filename;
+  FILE *f;
+  char in[256], out[256];
+  char *lineptr = NULL;
+  size_t linesize = 0;
+  audio_timing_t t;
+  int result = -1;
+
+  if (!(homedir = get_homedir())) {
+    errprintf("Warning: Couldn't get home dir.\n");
+    return -1;
+  }
+
+  if (asprintf(&filename, "%s/." PACKAGE "/%s",
+	       homedir, SETTINGS_CALIBRATION_FILENAME) < 0) {
+    errprintf(
+	    "Warning: Couldn't allocate memory for calibration filename.\n");
+    return -1;
+  }
+
+  if ((f = fopen(filename, "r"))) {
+    while (getline(&lineptr, &linesize, f) > 0) {
+      if (lineptr[0] != '#' &&
+	  sscanf(lineptr, "%255s %255s %u %u", in, out,
+		 &t.buffer_time, &t.period_time) == 4 &&
+	  !strcmp(in, in_device) && !strcmp(out, out_device)) {
+	*timing = t;
+	result = 0;
+      }
+    }
+
+    if (fclose(f) == EOF) {
+      errprintf("Warning: Couldn't close calibration file.\n");
+    }
+  } else {
+    dbgprintf(1, "Warning: No calibration file available.\n");
+  }
+
+  if (!result) {
+    dbgprintf(1, "Info: Calibrated latency of %s/%s: %u/%u us.\n",
+	      in_device, out_device, timing->buffer_time, timing->period_time);
+  } else {
+    dbgprintf(1, "Info: %s/%s not calibrated.\n", in_device, out_device);
+  }
+
+  free(filename);
+  if (lineptr) free(lineptr);
+  return result;
+}
+
+/*
+ * store the calibrated timing of a device pair in the calibration file,
+ * replacing an older entry of the same pair
+ */
+void settings_latency_write(const char *in_device, const char *out_device,
+                            const audio_timing_t *timing) {
+  char *homedir;
+  char *filename;
+  FILE *f;
+  char in[256], out[256];
+  char *lineptr = NULL;
+  size_t linesize = 0;
+  GString *keep = g_string_new("");
+
+  if (!(homedir = get_homedir())) {
+    errprintf("Warning: Couldn't get home dir.\n");
+    g_string_free(keep, TRUE);
+    return;
+  }
+
+  if (touch_dotdir()) {
+    g_string_free(keep, TRUE);
+    return;
+  }
+
+  if (asprintf(&filename, "%s/." PACKAGE "/%s",
+	       homedir, SETTINGS_CALIBRATION_FILENAME) < 0) {
+    errprintf(
+	    "Warning: Couldn't allocate memory for calibration filename.\n");
+    g_string_free(keep, TRUE);
+    return;
+  }
+
+  /* entries of other device pairs */
+  if ((f = fopen(filename, "r"))) {
+    while (getline(&lineptr, &linesize, f) > 0) {
+      if (lineptr[0] != '#' &&
+	  sscanf(lineptr, "%255s %255s", in, out) == 2 &&
+	  (strcmp(in, in_device) || strcmp(out, out_device)))
+	g_string_append(keep, lineptr);
+    }
+    fclose(f);
+  }
+
+  if ((f = fopen(filename, "w"))) {
+    fprintf(f, "# " PACKAGE " calibrated latency\n");
+    fprintf(f, "# input device, output device, "
+	       "buffer time (us), period time (us)\n");
+    fputs(keep->str, f);
+    fprintf(f, "%s %s %u %u\n", in_device, out_device,
+	    timing->buffer_time, timing->period_time);
+
+    if (fclose(f) == EOF) {
+      errprintf("Warning: Couldn't close calibration file.\n");
+    }
+  } else {
+    dbgprintf(1, "Warning: Can't write to calibration file.\n");
+  }
+
+  free(filename);
+  if (lineptr) free(lineptr);
+  g_string_free(keep, TRUE);
+}
+
+/*
+ * read the sound device capability cache (see audio_caps_t)
+ */
+void settings_devices_read(void) {
+  char *homedir;
+  char *filename;
+  FILE *f;
+  char dir[16], format[32];
+  char *lineptr = NULL;
+  size_t linesize = 0;
+  audio_caps_t caps;
+
+  if (!(homedir = get_homedir())) {
+    errprintf("Warning: Couldn't get home dir.\n");
+    return;
+  }
+
+  if (asprintf(&filename, "%s/." PACKAGE "/%s",
+	       homedir, SETTINGS_DEVICES_FILENAME) < 0) {
+    errprintf(
+	    "Warning: Couldn't allocate memory for devices filename.\n");
+    return;
+  }
+
+  if ((f = fopen(filename, "r"))) {
+    while (getline(&lineptr, &linesize, f) > 0) {
+      memset(&caps, 0, sizeof(caps));
+      if (lineptr[0] == '#' ||
+	  sscanf(lineptr, "%15s %127s %u %31s %u %d %u", dir, caps.name,
+		 &caps.speed_req, format, &caps.speed, &caps.mmap,
+		 &caps.period_time) != 7)
+	continue;
+      caps.dir = strcmp(dir, "playback") ? AUDIO_DIR_CAPTURE :
+	AUDIO_DIR_PLAYBACK;
+      if ((caps.format = snd_pcm_format_value(format)) >= 0) {
+	dbgprintf(1, "Info: Cached %s device %s: %s, %u Hz.\n",
+		  dir, caps.name, format, caps.speed);
+	audio_caps_set(&caps);
+      }
+    }
+
+    if (fclose(f) == EOF) {
+      errprintf("Warning: Couldn't close devices file.\n");
+    }
+  } else {
+    dbgprintf(1, "Warning: No devices file available.\n");
+  }
+
+  free(filename);
+  if (lineptr) free(lineptr);
+}
+
+/*
+ * write the sound device capability cache
+ */
+void settings_devices_write(void) {
+  char *homedir;
+  char *filename;
+  FILE *f;
+  audio_caps_t caps;
+  unsigned int i;
+
+  if (!(homedir = get_homedir())) {
+    errprintf("Warning: Couldn't get home dir.\n");
+    return;
+  }
+
+  if (touch_dotdir())
+    return;
+
+  if (asprintf(&filename, "%s/." PACKAGE "/%s",
+	       homedir, SETTINGS_DEVICES_FILENAME) < 0) {
+    errprintf(
+	    "Warning: Couldn't allocate memory for devices filename.\n");
+    return;
+  }
+
+  if ((f = fopen(filename, "w"))) {
+    fprintf(f, "# " PACKAGE " sound device capabilities, "
+	       "rewritten on exit\n");
+    fprintf(f, "# direction, device, requested rate, format, rate, "
+	       "mmap, period time (us)\n");
+    for (i = 0; i < AUDIO_CAPS_MAX; i++) {
+      if (audio_caps_get(i, &caps) || strchr(caps.name, ' '))
+	continue;
+      fprintf(f, "%s %s %u %s %u %d %u\n",
+	      caps.dir == AUDIO_DIR_PLAYBACK ? "playback" : "capture",
+	      caps.name, caps.speed_req, snd_pcm_format_name(caps.format),
+	      caps.speed, caps.mmap, caps.period_time);
+    }
+
+    if (fclose(f) == EOF) {
+      errprintf("Warning: Couldn't close devices file.\n");
+    }
+  } else {
+    dbgprintf(1, "Warning: Can't write to devices file.\n");
+  }
+
+  free(filename);
+}
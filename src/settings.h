@@ -27,6 +27,8 @@
 #define SETTINGS_OPTIONS_FILENAME "options"
 #define SETTINGS_HISTORY_FILENAME "history"
 #define SETTINGS_CALLERID_HISTORY_FILENAME "callerid"
+#define SETTINGS_CALIBRATION_FILENAME "calibration"
+#define SETTINGS_DEVICES_FILENAME "devices"
 
 
 void settings_option_set(session_t *session, char *option, char *value);
@@ -38,3 +40,11 @@ void settings_history_write(session_t *session);
 
 void settings_callerid_read(session_t *session);
 void settings_callerid_write(session_t *session);
+
+int settings_latency_read(const char *in_device, const char *out_device,
+                          audio_timing_t *timing);
+void settings_latency_write(const char *in_device, const char *out_device,
+                            const audio_timing_t *timing);
+
+void settings_devices_read(void);
+void settings_devices_write(void);
@@ -46,6 +46,8 @@
 /* own header files */
 #include "globals.h"
 #include "sound.h"
+#include "filepcm.h"
+#include "mediaclock.h"
 
 /* try formats in this order */
 int default_audio_priorities[] = {SND_PCM_FORMAT_S16_LE,
@@ -59,6 +61,95 @@ int default_audio_priorities[] = {SND_PCM_FORMAT_S16_LE,
                                   SND_PCM_FORMAT_MU_LAW,
                                   0}; /* end of list */
 
+/*!
+ * @brief Default timing of each latency mode (audio_latency_t order).
+ */
+static const audio_timing_t audio_latency_timings[] = {
+  {  40000, 10000 },  /* low */
+  {  80000, 20000 },  /* normal */
+  { 150000, 25000 }   /* safe */
+};
+
+/*!
+ * @brief Names of the latency modes (audio_latency_t order).
+ */
+static const char *audio_latency_names[] = { "low", "normal", "safe" };
+
+/*!
+ * @brief Timings probed by audio_calibrate(), largest first.
+ */
+static const audio_timing_t audio_calibrate_timings[] = {
+  { 80000, 20000 },
+  { 40000, 10000 },
+  { 20000,  5000 },
+  { 10000,  2500 }
+};
+
+/*!
+ * @brief Capability cache, filled by audio_negotiate() and the settings.
+ */
+static audio_caps_t audio_caps[AUDIO_CAPS_MAX];
+
+/*!
+ * @brief Next slot of audio_caps to reuse when the cache is full.
+ */
+static unsigned int audio_caps_next;
+
+/*!
+ * @brief Lock of audio_caps and audio_caps_next.
+ */
+static GStaticMutex audio_caps_mutex = G_STATIC_MUTEX_INIT;
+
+/*!
+ * @brief Find a cache entry, audio_caps_mutex must be held.
+ *
+ * @param name device name.
+ * @param dir stream direction.
+ * @param speed_req requested sampling rate.
+ * @return entry, NULL if there is none.
+ */
+static audio_caps_t *audio_caps_find(const char *name, audio_direction_t dir,
+                                     unsigned int speed_req);
+
+/*!
+ * @brief Negotiate format, rate and access of an opened device, trying
+ * the cached capabilities first.
+ *
+ * @param audio PCM handle.
+ * @param name device name (cache key).
+ * @param dir stream direction.
+ * @param channels number of channels.
+ * @param format_priorities 0-terminated list of formats to probe.
+ * @param format filled with the format used.
+ * @param speed requested/actual sampling rate (in/out).
+ * @param fragment_size requested/actual fragment size (in/out).
+ * @param mmap try/use mmap access (in/out).
+ * @param timing requested/negotiated buffer and period time (in/out).
+ * @return 0 if successful, non-zero otherwise.
+ */
+static int audio_negotiate(snd_pcm_t *audio, const char *name,
+                           audio_direction_t dir, int channels,
+                           int *format_priorities, int *format,
+                           unsigned int *speed, int *fragment_size,
+                           int *mmap, audio_timing_t *timing);
+
+/*!
+ * @brief Run one calibration step on opened devices.
+ *
+ * @param audio_in capture PCM.
+ * @param audio_out playback PCM.
+ * @param format_in capture format.
+ * @param format_out playback format.
+ * @param frames period size in frames.
+ * @param period_time period time in microseconds.
+ * @param thread calibrating thread, the step ends early when it is stopped.
+ * @return 0 if no xrun occurred, -1 otherwise.
+ */
+static int audio_calibrate_run(snd_pcm_t *audio_in, snd_pcm_t *audio_out,
+                               int format_in, int format_out,
+                               unsigned int frames, unsigned int period_time,
+                               thread_t *thread);
+
 /*--------------------------------------------------------------------------*/
 
 int audio_enum_devices(audio_enum_fnc_t callback,
@@ -139,6 +230,9 @@ int audio_enum_devices(audio_enum_fnc_t callback,
  * @param channels number of PCM channels.
  * @param speed requested/actual sampling rate (in/out).
  * @param fragment_size requested/actual fragment size (in/out).
+ * @param mmap nonzero to try mmap access (in), nonzero if mmap access is
+ *        used (out).
+ * @param timing requested/negotiated buffer and period time (in/out).
  *
  * @return 0 if successful, non-zero otherwise.
  */
@@ -146,7 +240,9 @@ static int init_audio_device(snd_pcm_t *audio,
                              int format,
                              int channels,
                              unsigned int *speed,
-		             int *fragment_size)
+		             int *fragment_size,
+                             int *mmap,
+                             audio_timing_t *timing)
 {
   int err;
   unsigned int rspeed;
@@ -190,14 +286,14 @@ static int init_audio_device(snd_pcm_t *audio,
     /*return -EINVAL;*/
   }
 
-  buffer_time = 150000;
+  buffer_time = timing->buffer_time;
   if ((err = snd_pcm_hw_params_set_buffer_time_near(audio, hwparams, &buffer_time, &dir)) < 0) {
     errprintf("AUDIO: Unable to set audio buffer time %d: %s\n",
               buffer_time, snd_strerror(err));
     return err;
   }
 
-  period_time = 25000;
+  period_time = timing->period_time;
   if ((err = snd_pcm_hw_params_set_period_time_near(audio, hwparams, &period_time, &dir)) < 0) {
     errprintf("AUDIO: Unable to set audio period time %d: %s\n",
               period_time, snd_strerror(err));
@@ -211,7 +307,16 @@ static int init_audio_device(snd_pcm_t *audio,
   }
   *fragment_size = period_size;
 
-  if ((err = snd_pcm_hw_params_set_access(audio, hwparams, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+  /* mmap lets the engine convert in place in the device buffer */
+  if (*mmap &&
+      (err = snd_pcm_hw_params_set_access(audio, hwparams, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0) {
+    dbgprintf(1, "AUDIO: No mmap access (%s), using read/write\n",
+              snd_strerror(err));
+    *mmap = 0;
+  }
+
+  if (!*mmap &&
+      (err = snd_pcm_hw_params_set_access(audio, hwparams, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
     errprintf("AUDIO: Unable to set audio access mode: %s\n",
               snd_strerror(err));
     return err;
@@ -223,6 +328,13 @@ static int init_audio_device(snd_pcm_t *audio,
     return err;
   }
 
+  if (snd_pcm_hw_params_get_buffer_time(hwparams, &buffer_time, &dir) >= 0)
+    timing->buffer_time = buffer_time;
+  if (snd_pcm_hw_params_get_period_time(hwparams, &period_time, &dir) >= 0)
+    timing->period_time = period_time;
+  dbgprintf(1, "AUDIO: Buffer time %u us, period time %u us\n",
+            timing->buffer_time, timing->period_time);
+
   if ((err = snd_pcm_sw_params_current(audio, swparams)) < 0) {
     errprintf("AUDIO: Unable to determine current swparams for audio: %s\n",
               snd_strerror(err));
@@ -274,6 +386,18 @@ static int init_audio_device(snd_pcm_t *audio,
   }
   */
 
+  /* timestamps in the media clock's timebase, see media_pcm_time() */
+  if ((err = snd_pcm_sw_params_set_tstamp_mode(audio, swparams, SND_PCM_TSTAMP_ENABLE)) < 0) {
+    errprintf("AUDIO: Unable to enable timestamps: %s\n",
+              snd_strerror(err));
+  }
+#if SND_LIB_VERSION >= 0x01001d
+  if ((err = snd_pcm_sw_params_set_tstamp_type(audio, swparams, SND_PCM_TSTAMP_TYPE_MONOTONIC)) < 0) {
+    dbgprintf(1, "AUDIO: No monotonic timestamps: %s\n",
+              snd_strerror(err));
+  }
+#endif
+
   if ((err = snd_pcm_sw_params(audio, swparams)) < 0) {
     printf("Unable to set sw params for audio (optional): %s\n", snd_strerror(err));
     /*return err;*/
@@ -291,20 +415,151 @@ static int init_audio_device(snd_pcm_t *audio,
 
 /*--------------------------------------------------------------------------*/
 
+static audio_caps_t *audio_caps_find(const char *name, audio_direction_t dir,
+                                     unsigned int speed_req)
+{
+  unsigned int i;
+
+  for (i = 0; i < AUDIO_CAPS_MAX; i++) {
+    if (audio_caps[i].name[0] && audio_caps[i].dir == dir &&
+        audio_caps[i].speed_req == speed_req &&
+        !strcmp(audio_caps[i].name, name))
+      return &audio_caps[i];
+  }
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void audio_caps_set(const audio_caps_t *caps)
+{
+  audio_caps_t *entry;
+
+  if (!caps->name[0] || strlen(caps->name) >= AUDIO_CAPS_NAME_MAX)
+    return;
+  g_static_mutex_lock(&audio_caps_mutex);
+  if (!(entry = audio_caps_find(caps->name, caps->dir, caps->speed_req))) {
+    entry = &audio_caps[audio_caps_next];
+    audio_caps_next = (audio_caps_next + 1) % AUDIO_CAPS_MAX;
+  }
+  *entry = *caps;
+  g_static_mutex_unlock(&audio_caps_mutex);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int audio_caps_get(unsigned int index, audio_caps_t *caps)
+{
+  int result = -1;
+
+  if (index >= AUDIO_CAPS_MAX)
+    return -1;
+  g_static_mutex_lock(&audio_caps_mutex);
+  if (audio_caps[index].name[0]) {
+    *caps = audio_caps[index];
+    result = 0;
+  }
+  g_static_mutex_unlock(&audio_caps_mutex);
+  return result;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int audio_negotiate(snd_pcm_t *audio, const char *name,
+                           audio_direction_t dir, int channels,
+                           int *format_priorities, int *format,
+                           unsigned int *speed, int *fragment_size,
+                           int *mmap, audio_timing_t *timing)
+{
+  audio_caps_t *entry;
+  audio_caps_t cached;
+  int have_cached;
+  audio_caps_t caps;
+  unsigned int speed_req = *speed;
+  int mmap_req = *mmap;
+  audio_timing_t timing_req = *timing;
+  int *priority;
+  int result = -1;
+
+  /* what worked last time, if it is still wanted */
+  g_static_mutex_lock(&audio_caps_mutex);
+  if ((have_cached = (entry = audio_caps_find(name, dir, speed_req)) != NULL))
+    cached = *entry;
+  g_static_mutex_unlock(&audio_caps_mutex);
+  if (have_cached) {
+    for (priority = format_priorities;
+         *priority && *priority != cached.format; priority++)
+      ;
+    if (*priority) {
+      *format = cached.format;
+      *mmap = mmap_req && cached.mmap;
+      result = init_audio_device(audio, *format, channels, speed,
+                                 fragment_size, mmap, timing);
+      if (result)
+        dbgprintf(1, "AUDIO: Cached format of %s failed, probing\n", name);
+    }
+  }
+
+  for (priority = format_priorities; result && *priority; priority++) {
+    *format = *priority;
+    *speed = speed_req;
+    *mmap = mmap_req;
+    *timing = timing_req;
+    result = init_audio_device(audio, *format, channels, speed,
+                               fragment_size, mmap, timing);
+  }
+
+  if (!result) {
+    memset(&caps, 0, sizeof(caps));
+    strncpy(caps.name, name, AUDIO_CAPS_NAME_MAX - 1);
+    caps.dir = dir;
+    caps.speed_req = speed_req;
+    caps.format = *format;
+    caps.speed = *speed;
+    /* mmap is only known to fail if it was tried */
+    caps.mmap = mmap_req ? *mmap : (have_cached ? cached.mmap : 1);
+    caps.period_time = timing->period_time;
+    audio_caps_set(&caps);
+  }
+  return result;
+}
+
+/*--------------------------------------------------------------------------*/
+
+/*!
+ * @brief Open ALSA PCM or file-backed stand-in (FILEPCM_PREFIX).
+ *
+ * @param audio PCM handle to return.
+ * @param name device name.
+ * @param stream stream direction.
+ * @param mode open mode.
+ * @return 0 on success, ALSA error code otherwise.
+ */
+static int audio_pcm_open(snd_pcm_t **audio, const char *name,
+                          snd_pcm_stream_t stream, int mode)
+{
+  if (!strncmp(name, FILEPCM_PREFIX, strlen(FILEPCM_PREFIX)))
+    return filepcm_open(audio, name + strlen(FILEPCM_PREFIX), stream, mode);
+  return snd_pcm_open(audio, name, stream, mode);
+}
+
+/*--------------------------------------------------------------------------*/
+
 int open_audio_devices(char *in_audio_device_name,
 		       char *out_audio_device_name,
 		       int channels, int *format_priorities,
 		       snd_pcm_t **audio_in, snd_pcm_t **audio_out,
 		       int *fragment_size_in, int *fragment_size_out,
 		       int *format_in, int *format_out,
-                       unsigned int *speed_in, unsigned int *speed_out)
+                       unsigned int *speed_in, unsigned int *speed_out,
+                       int *mmap_in, int *mmap_out,
+                       audio_timing_t *timing_in, audio_timing_t *timing_out)
 {
   int err;
   int initresult;
-  int *priority;
   
   /* try to open the sound device */
-  if ((err = snd_pcm_open(audio_in, in_audio_device_name, SND_PCM_STREAM_CAPTURE, 0/*SND_PCM_NONBLOCK*/)) < 0) {
+  if ((err = audio_pcm_open(audio_in, in_audio_device_name, SND_PCM_STREAM_CAPTURE, 0/*SND_PCM_NONBLOCK*/)) < 0) {
     errprintf("AUDIO: Audio recording device '%s' open error: %s, trying default\n",
             in_audio_device_name, snd_strerror(err));
     if ((err = snd_pcm_open(audio_in, "default", SND_PCM_STREAM_CAPTURE, 0/*SND_PCM_NONBLOCK*/)) < 0) {
@@ -313,7 +568,7 @@ int open_audio_devices(char *in_audio_device_name,
       return -1;
     }
   }
-  if ((err = snd_pcm_open(audio_out, out_audio_device_name, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK)) < 0) {
+  if ((err = audio_pcm_open(audio_out, out_audio_device_name, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK)) < 0) {
     errprintf("AUDIO: Audio playback device '%s' open error: %s, trying default\n",
             out_audio_device_name, snd_strerror(err));
     if ((err = snd_pcm_open(audio_out, "default", SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK)) < 0) {
@@ -324,31 +579,17 @@ int open_audio_devices(char *in_audio_device_name,
   }
 
   /* set format and sampling rate */
-  for (initresult = -1, priority = format_priorities;
-       initresult && *priority; priority++) {
-
-    *format_in = *priority;
-    initresult = init_audio_device(*audio_in, *format_in, channels, speed_in, fragment_size_in);
-  }
-
+  initresult = audio_negotiate(*audio_in, in_audio_device_name,
+                               AUDIO_DIR_CAPTURE, channels, format_priorities,
+                               format_in, speed_in, fragment_size_in,
+                               mmap_in, timing_in);
   if (initresult)
     return initresult; /* no chance */
 
-  for (initresult = -1, priority = format_priorities;
-       initresult && priority; priority++) {
-
-    *format_out = *priority;
-    initresult = init_audio_device(*audio_out, *format_out, channels, speed_out, fragment_size_out);
-  }
-
-#if 0
-  /* not implemented in ALSA */
-  if ((err = snd_pcm_link(*audio_out, *audio_in)) < 0) {
-    errprintf("AUDIO: Error linking in/out devices: %s\n",
-              snd_strerror(err));
-    return -1;
-  }
-#endif
+  initresult = audio_negotiate(*audio_out, out_audio_device_name,
+                               AUDIO_DIR_PLAYBACK, channels, format_priorities,
+                               format_out, speed_out, fragment_size_out,
+                               mmap_out, timing_out);
 
   if (debug > 2) {
     /* TODO: redirect output to dbgprintf */
@@ -363,6 +604,158 @@ int open_audio_devices(char *in_audio_device_name,
   return initresult;
 }
 
+/*--------------------------------------------------------------------------*/
+
+void audio_latency_timing(audio_latency_t mode, audio_timing_t *timing)
+{
+  if ((unsigned int) mode > AUDIO_LATENCY_SAFE)
+    mode = AUDIO_LATENCY_SAFE;
+  *timing = audio_latency_timings[mode];
+}
+
+/*--------------------------------------------------------------------------*/
+
+const char *audio_latency_name(audio_latency_t mode)
+{
+  if ((unsigned int) mode > AUDIO_LATENCY_SAFE)
+    mode = AUDIO_LATENCY_SAFE;
+  return audio_latency_names[mode];
+}
+
+/*--------------------------------------------------------------------------*/
+
+int audio_latency_parse(const char *name)
+{
+  int mode;
+
+  for (mode = AUDIO_LATENCY_LOW; mode <= AUDIO_LATENCY_SAFE; mode++) {
+    if (!strcasecmp(name, audio_latency_names[mode]))
+      return mode;
+  }
+  return -1;
+}
+
+/*--------------------------------------------------------------------------*/
+
+static int audio_calibrate_run(snd_pcm_t *audio_in, snd_pcm_t *audio_out,
+                               int format_in, int format_out,
+                               unsigned int frames, unsigned int period_time,
+                               thread_t *thread)
+{
+  unsigned char *in, *out;
+  snd_pcm_sframes_t got;
+  uint64_t start, now, busy;
+  int result = 0;
+
+  in = (unsigned char *) malloc(frames * sample_size_from_format(format_in));
+  out = (unsigned char *) malloc(2 * frames * sample_size_from_format(format_out));
+  if (!in || !out) {
+    errprintf("AUDIO: Cannot allocate calibration buffers\n");
+    free(in);
+    free(out);
+    return -1;
+  }
+  snd_pcm_format_set_silence(format_out, out, 2 * frames);
+
+  /* two periods of playback margin, then answer each captured period */
+  snd_pcm_prepare(audio_in);
+  snd_pcm_prepare(audio_out);
+  if (snd_pcm_writei(audio_out, out, 2 * frames) < 0 ||
+      snd_pcm_start(audio_in) < 0) {
+    result = -1;
+  }
+
+  start = now = media_time();
+  while (!result && !thread_is_stopping(thread) &&
+         now - start < AUDIO_CALIBRATE_SECONDS * 1000000ULL) {
+    if ((got = snd_pcm_readi(audio_in, in, frames)) < 0) {
+      dbgprintf(1, "AUDIO: Calibration capture failed: %s\n",
+                snd_strerror(got));
+      result = -1;
+      break;
+    }
+
+    /* the engine's share of the period */
+    busy = media_time() + (uint64_t) period_time * AUDIO_CALIBRATE_LOAD / 100;
+    while ((now = media_time()) < busy)
+      ;
+
+    got = snd_pcm_writei(audio_out, out, got);
+    if (got < 0 && got != -EAGAIN) {
+      dbgprintf(1, "AUDIO: Calibration playback failed: %s\n",
+                snd_strerror(got));
+      result = -1;
+    }
+  }
+
+  audio_stop(audio_in, audio_out);
+  free(in);
+  free(out);
+  return result;
+}
+
+/*--------------------------------------------------------------------------*/
+
+int audio_calibrate(char *in_audio_device_name, char *out_audio_device_name,
+                    int *format_priorities, unsigned int speed,
+                    audio_timing_t *timing, thread_t *thread)
+{
+  snd_pcm_t *audio_in, *audio_out;
+  int fragment_size_in, fragment_size_out;
+  int format_in, format_out;
+  unsigned int speed_in, speed_out;
+  int mmap_in, mmap_out;
+  audio_timing_t timing_in, timing_out;
+  unsigned int i;
+  int err, result = -1;
+
+  for (i = 0; i < sizeof(audio_calibrate_timings) / sizeof(audio_timing_t);
+       i++) {
+    dbgprintf(1, "AUDIO: Calibrating buffer time %u us, period time %u us\n",
+              audio_calibrate_timings[i].buffer_time,
+              audio_calibrate_timings[i].period_time);
+
+    audio_in = audio_out = NULL;
+    fragment_size_in = fragment_size_out = DEFAULT_FRAGMENT_SIZE;
+    speed_in = speed_out = speed;
+    mmap_in = mmap_out = 0;
+    timing_in = timing_out = audio_calibrate_timings[i];
+    err = open_audio_devices(in_audio_device_name, out_audio_device_name,
+                             1, format_priorities, &audio_in, &audio_out,
+                             &fragment_size_in, &fragment_size_out,
+                             &format_in, &format_out, &speed_in, &speed_out,
+                             &mmap_in, &mmap_out, &timing_in, &timing_out);
+    if (!err)
+      err = audio_calibrate_run(audio_in, audio_out, format_in, format_out,
+                                fragment_size_in, timing_in.period_time,
+                                thread);
+    if (audio_in)
+      snd_pcm_close(audio_in);
+    if (audio_out)
+      snd_pcm_close(audio_out);
+
+    if (thread_is_stopping(thread)) {
+      /* an unfinished step proves nothing */
+      dbgprintf(1, "AUDIO: Calibration stopped\n");
+      return -1;
+    }
+    if (err) {
+      dbgprintf(1, "AUDIO: Calibration step failed\n");
+      break;
+    }
+    /* the requested values reproduce the negotiation */
+    *timing = audio_calibrate_timings[i];
+    result = 0;
+  }
+
+  if (!result)
+    dbgprintf(1, "AUDIO: Calibrated buffer time %u us, period time %u us\n",
+              timing->buffer_time, timing->period_time);
+  return result;
+}
+
+/*--------------------------------------------------------------------------*/
+
 int audio_stop(snd_pcm_t *audio_in, snd_pcm_t *audio_out) {
 
   int err, err0;
@@ -381,6 +774,43 @@ int audio_stop(snd_pcm_t *audio_in, snd_pcm_t *audio_out) {
 
 /*--------------------------------------------------------------------------*/
 
+int audio_prepare(snd_pcm_t *audio_in, snd_pcm_t *audio_out)
+{
+  int err, err0;
+
+  err = 0;
+  if ((err0 = snd_pcm_prepare(audio_in)) < 0) {
+    errprintf("AUDIO: Unable to prepare audio capture: %s\n", snd_strerror(err0));
+    err = -1;
+  }
+  if ((err0 = snd_pcm_prepare(audio_out)) < 0) {
+    errprintf("AUDIO: Unable to prepare audio playback: %s\n", snd_strerror(err0));
+    err = -1;
+  }
+  return err;
+}
+
+/*--------------------------------------------------------------------------*/
+
+int audio_same_card(snd_pcm_t *audio_in, snd_pcm_t *audio_out)
+{
+  snd_pcm_info_t *info;
+  int card_in, card_out;
+
+  snd_pcm_info_alloca(&info);
+  if (snd_pcm_info(audio_in, info) < 0)
+    return 0;
+  card_in = snd_pcm_info_get_card(info);
+  if (snd_pcm_info(audio_out, info) < 0)
+    return 0;
+  card_out = snd_pcm_info_get_card(info);
+
+  /* plugins without hardware (file, null) have no card */
+  return card_in >= 0 && card_in == card_out;
+}
+
+/*--------------------------------------------------------------------------*/
+
 int close_audio_devices(snd_pcm_t *audio_in, snd_pcm_t *audio_out)
 {
 
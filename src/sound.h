@@ -21,14 +21,48 @@
  *
  */
 
+#ifndef _ANT_SOUND_H
+#define _ANT_SOUND_H
+
 #include <alsa/asoundlib.h>
 
+#include "thread.h"
+
 #define DEFAULT_FRAGMENT_SIZE 128
 #define DEFAULT_AUDIO_DEVICE_NAME_IN "default"
 #define DEFAULT_AUDIO_DEVICE_NAME_OUT "default"
 
 extern int default_audio_priorities[];
 
+/*!
+ * @brief Seconds each setting must run without xrun during calibration.
+ */
+#define AUDIO_CALIBRATE_SECONDS 5
+
+/*!
+ * @brief Share of each period the calibration spends busy before it
+ * answers the capture (percent), standing in for the engine's work and
+ * scheduling delay.
+ */
+#define AUDIO_CALIBRATE_LOAD 50
+
+/*!
+ * @brief Latency modes, trading playout delay against robustness.
+ */
+typedef enum {
+  AUDIO_LATENCY_LOW,    /*!< calibrated buffer, small periods if uncalibrated */
+  AUDIO_LATENCY_NORMAL, /*!< moderate buffer */
+  AUDIO_LATENCY_SAFE    /*!< large buffer, works with every device */
+} audio_latency_t;
+
+/*!
+ * @brief Buffer and period time of a PCM.
+ */
+typedef struct {
+  unsigned int buffer_time;   /*!< buffer time in microseconds */
+  unsigned int period_time;   /*!< period time in microseconds */
+} audio_timing_t;
+
 /*!
  * @brief Audio direction.
  */
@@ -37,6 +71,30 @@ typedef enum {
   AUDIO_DIR_PLAYBACK    /*!< Audio playback */
 } audio_direction_t;
 
+/*!
+ * @brief Maximum number of devices in the capability cache.
+ */
+#define AUDIO_CAPS_MAX 16
+
+/*!
+ * @brief Maximum length of a device name in the capability cache.
+ */
+#define AUDIO_CAPS_NAME_MAX 128
+
+/*!
+ * @brief Negotiated capabilities of a device, kept across opens.
+ */
+typedef struct {
+  char name[AUDIO_CAPS_NAME_MAX]; /*!< device name, "" for an unused slot */
+  audio_direction_t dir;          /*!< stream direction */
+  unsigned int speed_req;         /*!< requested sampling rate */
+  int format;                     /*!< sample format which worked */
+  unsigned int speed;             /*!< sampling rate the device gave */
+  int mmap;                       /*!< nonzero unless mmap access failed */
+  unsigned int period_time;       /*!< negotiated period time in
+                                       microseconds */
+} audio_caps_t;
+
 /*!
  * @brief Callback function to enumerate sound devices.
  *
@@ -57,9 +115,80 @@ int audio_enum_devices(audio_enum_fnc_t callback,
                        audio_direction_t dir,
                        void *context);
 
+/*!
+ * @brief Enter capabilities into the cache, replacing an entry of the
+ * same device, direction and requested rate.
+ *
+ * open_audio_devices() keeps the cache up to date, this is for loading
+ * it from the settings. The cache is locked, device calibration updates
+ * it from its own thread.
+ *
+ * @param caps capabilities.
+ */
+void audio_caps_set(const audio_caps_t *caps);
+
+/*!
+ * @brief Get a copy of an entry of the capability cache (for saving it).
+ *
+ * @param index entry number, 0..AUDIO_CAPS_MAX-1.
+ * @param caps filled with the entry.
+ * @return 0 on success, -1 if the slot is unused or index is out of range.
+ */
+int audio_caps_get(unsigned int index, audio_caps_t *caps);
+
+/*!
+ * @brief Get the default timing of a latency mode.
+ *
+ * @param mode latency mode.
+ * @param timing filled with buffer and period time.
+ */
+void audio_latency_timing(audio_latency_t mode, audio_timing_t *timing);
+
+/*!
+ * @brief Get the name of a latency mode (as used in the options file).
+ *
+ * @param mode latency mode.
+ * @return "low", "normal" or "safe".
+ */
+const char *audio_latency_name(audio_latency_t mode);
+
+/*!
+ * @brief Get a latency mode by name.
+ *
+ * @param name "low", "normal" or "safe" (case insensitive).
+ * @return latency mode, -1 if name is unknown.
+ */
+int audio_latency_parse(const char *name);
+
+/*!
+ * @brief Find the smallest buffer the devices sustain in full duplex.
+ *
+ * Probes decreasing buffer and period times, each for
+ * AUDIO_CALIBRATE_SECONDS of capture answered by playback, with
+ * AUDIO_CALIBRATE_LOAD percent of every period spent busy. Stops at the
+ * first setting with an xrun. The devices must not be open elsewhere.
+ * Runs in the given thread, which can cut it short with thread_stop().
+ *
+ * @param in_audio_device_name name of input device.
+ * @param out_audio_device_name name of output device.
+ * @param format_priorities list of sound formats as for open_audio_devices().
+ * @param speed sampling rate.
+ * @param timing filled with the smallest xrun-free timing.
+ * @param thread thread running the calibration.
+ * @return 0 if successful, -1 if the devices fail even the largest setting
+ *         or the calibration was stopped.
+ */
+int audio_calibrate(char *in_audio_device_name, char *out_audio_device_name,
+                    int *format_priorities, unsigned int speed,
+                    audio_timing_t *timing, thread_t *thread);
+
 /*!
  * @brief Opens the audio device(s).
  *
+ * The format, rate and access of each device are first tried as they
+ * were negotiated last time (see audio_caps_t). Only if that fails, the
+ * whole format list is probed.
+ *
  * @param in_audio_device_name name of input device.
  * @param out_audio_device_name name of output device.
  * @param channels requestes number of channels (1/2).
@@ -71,6 +200,12 @@ int audio_enum_devices(audio_enum_fnc_t callback,
  * @param fragment_size_out in/out fragment size for output.
  * @param speed_in in/out requested/actual input speed.
  * @param speed_out in/out requested/actual output speed.
+ * @param mmap_in in/out try/use mmap access for input, with fallback to
+ *        read/write access.
+ * @param mmap_out in/out try/use mmap access for output.
+ * @param timing_in in/out requested/negotiated input buffer and period time.
+ * @param timing_out in/out requested/negotiated output buffer and period
+ *        time.
  * @return 0 if successful, -1 on error.
 */
 int open_audio_devices(char *in_audio_device_name,
@@ -79,7 +214,9 @@ int open_audio_devices(char *in_audio_device_name,
 		       snd_pcm_t **audio_in, snd_pcm_t **audio_out,
 		       int *fragment_size_in, int *fragment_size_out,
 		       int *format_in, int *format_out,
-                       unsigned int *speed_in, unsigned int *speed_out);
+                       unsigned int *speed_in, unsigned int *speed_out,
+                       int *mmap_in, int *mmap_out,
+                       audio_timing_t *timing_in, audio_timing_t *timing_out);
 
 /*!
  * @brief Close audio devices..
@@ -99,6 +236,25 @@ int close_audio_devices(snd_pcm_t *audio_in, snd_pcm_t *audio_out);
  */
 int audio_stop(snd_pcm_t *audio_in, snd_pcm_t *audio_out);
 
+/*!
+ * @brief Prepares stopped audio devices, so they start without delay.
+ *
+ * @param audio_in input device to prepare.
+ * @param audio_out output device to prepare.
+ * @return 0 if successful, -1 on error.
+ */
+int audio_prepare(snd_pcm_t *audio_in, snd_pcm_t *audio_out);
+
+/*!
+ * @brief Checks if capture and playback are on the same sound card, so
+ * they can be linked to start on the same period boundary.
+ *
+ * @param audio_in input device.
+ * @param audio_out output device.
+ * @return 1 if on the same card, 0 otherwise (or unknown, e.g. files).
+ */
+int audio_same_card(snd_pcm_t *audio_in, snd_pcm_t *audio_out);
+
 /*!
  * @brief Get number of bytes per sample for the specified format.
  *
@@ -106,3 +262,5 @@ int audio_stop(snd_pcm_t *audio_in, snd_pcm_t *audio_out);
  * @return >= 1 on success, 0 otherwise (when format not supported).
  */
 int sample_size_from_format(int format);
+
+#endif /* _ANT_SOUND_H */
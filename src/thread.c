@@ -26,9 +26,15 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
 
 #include "thread.h"
 #include "globals.h"
+#include "util.h"
+#include "mediaclock.h"
+#include "probes.h"
 
 /*--------------------------------------------------------------------------*/
 
@@ -60,6 +66,31 @@ void thread_init(thread_t *thread)
 
   thread->thread = NULL;
   thread->stop_flag = 0;
+  thread->stop_latency = 0;
+  thread->stop_latency_max = 0;
+
+  if (pipe(thread->wakeup) < 0) {
+    errprintf("THREAD: Cannot create wake-up pipe, stopping will be slow\n");
+    thread->wakeup[0] = -1;
+    thread->wakeup[1] = -1;
+  } else {
+    /* a full pipe means the thread will wake up anyway */
+    fcntl(thread->wakeup[0], F_SETFL, O_NONBLOCK);
+    fcntl(thread->wakeup[1], F_SETFL, O_NONBLOCK);
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+void thread_deinit(thread_t *thread)
+{
+  thread_stop(thread);
+  if (thread->wakeup[0] >= 0) {
+    close(thread->wakeup[0]);
+    close(thread->wakeup[1]);
+    thread->wakeup[0] = -1;
+    thread->wakeup[1] = -1;
+  }
 }
 
 /*--------------------------------------------------------------------------*/
@@ -86,6 +117,7 @@ int thread_start(thread_t *thread, gpointer (*handler)(gpointer), gpointer param
 
   if (thread->thread == NULL) {
     thread->stop_flag = 0;
+    thread_wakeup_clear(thread);
     thread->thread = g_thread_create(handler, param, TRUE, NULL);
     if (thread->thread) {
       return 0;
@@ -103,13 +135,76 @@ int thread_start(thread_t *thread, gpointer (*handler)(gpointer), gpointer param
 void thread_stop(thread_t *thread)
 {
   GThread *tostop = thread->thread;
+  uint64_t start;
+
   if (tostop != NULL)
   {
+    start = media_time();
     thread->stop_flag = 1;
     thread->thread = NULL;
+    thread_wakeup(thread);
     g_thread_join(tostop);
     thread->stop_flag = 0;
+
+    thread->stop_latency = media_time() - start;
+    if (thread->stop_latency > thread->stop_latency_max)
+      thread->stop_latency_max = thread->stop_latency;
+    dbgprintf(2, "THREAD: Thread stopped in %lu us (worst %lu us)\n",
+              (unsigned long) thread->stop_latency,
+              (unsigned long) thread->stop_latency_max);
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+int thread_wakeup_fd(thread_t *thread)
+{
+  return thread->wakeup[0];
+}
+
+/*--------------------------------------------------------------------------*/
+
+void thread_wakeup(thread_t *thread)
+{
+  char c = 0;
+
+  if (thread->wakeup[1] >= 0) {
+    if (write(thread->wakeup[1], &c, 1) < 0 && errno != EAGAIN) {
+      errprintf("THREAD: Cannot wake up thread\n");
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+void thread_wakeup_clear(thread_t *thread)
+{
+  char buf[64];
+
+  if (thread->wakeup[0] >= 0) {
+    while (read(thread->wakeup[0], buf, sizeof(buf)) > 0)
+      ;
+  }
+}
+
+/*--------------------------------------------------------------------------*/
+
+int thread_sleep(thread_t *thread, int msec)
+{
+  struct pollfd fd;
+
+  if (thread_is_stopping(thread))
+    return 1;
+
+  if (thread->wakeup[0] >= 0) {
+    fd.fd = thread->wakeup[0];
+    fd.events = POLLIN;
+    if (poll(&fd, 1, msec) > 0)
+      thread_wakeup_clear(thread);
+  } else {
+    usleep(msec * 1000);
   }
+  return thread_is_stopping(thread);
 }
 
 /*--------------------------------------------------------------------------*/
@@ -181,6 +276,7 @@ int remote_call_invoke(remote_call_port_t *port, remote_call_fnc func, void *con
   event.context = context;
   event.data = data;
 
+  ANT_PROBE1(remote_call_invoke, func);
   if (write(port->fd[1], &event, sizeof(event)) == sizeof(event)) {
     if (port->condition) {
       /* wait for reply from thread */
@@ -199,6 +295,7 @@ int remote_call_invoke(remote_call_port_t *port, remote_call_fnc func, void *con
 
 static int remote_call_process(remote_call_port_t *port, remote_call_t *event)
 {
+  ANT_PROBE1(remote_call_dispatch, event->fnc);
   event->fnc(event->context, event->data);
   if (port->condition) {
     /* wake up the thread which signalled main */
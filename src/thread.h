@@ -24,6 +24,8 @@
 #ifndef _ANT_THREAD_H
 #define _ANT_THREAD_H
 
+#include <stdint.h>
+
 /* GTK */
 #include <gtk/gtk.h>
 
@@ -33,6 +35,9 @@
 typedef struct {
   GThread *thread;        /*!< thread handle */
   unsigned int stop_flag; /*!< flag to stop the thread */
+  int wakeup[2];          /*!< pipe to wake up the thread, poll on wakeup[0] */
+  uint64_t stop_latency;  /*!< duration of last thread_stop() in microseconds */
+  uint64_t stop_latency_max; /*!< worst duration of thread_stop() in microseconds */
 } thread_t;
 
 /*!
@@ -72,6 +77,13 @@ typedef struct __remote_call {
  */
 void thread_init(thread_t *thread);
 
+/*!
+ * @brief Stop thread, if running, and free thread handle resources (destructor).
+ *
+ * @param thread thread handle.
+ */
+void thread_deinit(thread_t *thread);
+
 /*!
  * @brief Check if thread is still running.
  *
@@ -101,10 +113,49 @@ int thread_start(thread_t *thread, gpointer (*handler)(gpointer), gpointer param
 /*!
  * @brief Stop a thread.
  *
+ * Sets the stop flag, wakes up the thread and waits for it to terminate.
+ * The time needed is stored in stop_latency / stop_latency_max.
+ *
  * @param thread thread handle.
  */
 void thread_stop(thread_t *thread);
 
+/*!
+ * @brief Get file descriptor to poll on for wake-up of the thread.
+ *
+ * Threads should include this descriptor (POLLIN) in all blocking waits,
+ * so thread_stop() and thread_wakeup() take effect immediately.
+ *
+ * @param thread thread handle.
+ * @return file descriptor, -1 if not available.
+ */
+int thread_wakeup_fd(thread_t *thread);
+
+/*!
+ * @brief Wake up a thread waiting on thread_wakeup_fd().
+ *
+ * Never blocks, may be called from any thread.
+ *
+ * @param thread thread handle.
+ */
+void thread_wakeup(thread_t *thread);
+
+/*!
+ * @brief Clear pending wake-ups (called by the woken thread).
+ *
+ * @param thread thread handle.
+ */
+void thread_wakeup_clear(thread_t *thread);
+
+/*!
+ * @brief Sleep in the thread until timeout, wake-up or stop request.
+ *
+ * @param thread handle of the calling thread.
+ * @param msec timeout in milliseconds.
+ * @return zero, if not stopping, nonzero otherwise.
+ */
+int thread_sleep(thread_t *thread, int msec);
+
 
 
 /*!
@@ -0,0 +1,285 @@
+/*
+ * Binary trace of the media event stream of a call
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#ifdef HAVE_STDLIB_H
+  #include <stdlib.h>
+#endif
+#include <time.h>
+#include <sys/time.h>
+
+#include "globals.h"
+#include "trace.h"
+#include "util.h"
+#include "mediaclock.h"
+
+/*!
+ * @brief Write buffered records to the file.
+ *
+ * The buffer is swapped under the lock, so writing doesn't block tracing
+ * threads for longer than a memcpy.
+ *
+ * @param trace trace writer.
+ * @param spare spare buffer of TRACE_BUFFER_SIZE bytes, swapped with the
+ *        trace buffer.
+ * @return new spare buffer.
+ */
+static unsigned char *trace_flush(trace_t *trace, unsigned char *spare)
+{
+  unsigned char *data;
+  unsigned int length;
+  unsigned long dropped;
+
+  g_mutex_lock(trace->lock);
+  data = trace->buffer;
+  length = trace->length;
+  dropped = trace->dropped;
+  trace->buffer = spare;
+  trace->length = 0;
+  trace->dropped = 0;
+  g_mutex_unlock(trace->lock);
+
+  if (length && fwrite(data, 1, length, trace->file) != length)
+    errprintf("TRACE: Error writing trace file\n");
+  if (dropped)
+    dbgprintf(1, "TRACE: Buffer full, %lu events dropped\n", dropped);
+  return data;
+}
+
+/*!
+ * @brief Thread writing the trace buffer.
+ *
+ * @param data trace writer.
+ */
+static gpointer trace_thread(gpointer data)
+{
+  trace_t *trace = (trace_t*) data;
+  unsigned char *spare;
+
+  spare = (unsigned char*) malloc(TRACE_BUFFER_SIZE);
+  if (!spare) {
+    errprintf("TRACE: Cannot allocate buffer, tracing stopped\n");
+    g_atomic_int_set(&trace->active, 0);
+    return NULL;
+  }
+
+  while (!thread_sleep(&trace->thread, TRACE_FLUSH_INTERVAL))
+    spare = trace_flush(trace, spare);
+  spare = trace_flush(trace, spare);
+
+  free(spare);
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void trace_init(trace_t *trace)
+{
+  memset(trace, 0, sizeof(trace_t));
+  trace->lock = g_mutex_new();
+  thread_init(&trace->thread);
+}
+
+/*--------------------------------------------------------------------------*/
+
+void trace_deinit(trace_t *trace)
+{
+  trace_close(trace);
+  thread_deinit(&trace->thread);
+  g_mutex_free(trace->lock);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int trace_open(trace_t *trace, const char *name, trace_header_t *header)
+{
+  char *homedir;
+  char *fn;
+  struct timeval tv;
+
+  trace_close(trace);
+
+  touch_dotdir();
+
+  if (!(homedir = get_homedir())) {
+    errprintf("TRACE: Couldn't get home dir.\n");
+    return -1;
+  }
+  if (asprintf(&fn, "%s/." PACKAGE "/" TRACE_DIRNAME, homedir) < 0) {
+    errprintf("TRACE: Couldn't allocate memory for directory name.\n");
+    return -1;
+  }
+  if (touch_dir(fn) < 0) {
+    errprintf("TRACE: Can't reach directory %s.\n", fn);
+    free(fn);
+    return -1;
+  }
+  free(fn);
+
+  if (asprintf(&fn, "%s/." PACKAGE "/" TRACE_DIRNAME "/%s.trace",
+               homedir, name) < 0) {
+    errprintf("TRACE: Couldn't allocate memory for file name.\n");
+    return -1;
+  }
+
+  trace->file = fopen(fn, "wb");
+  trace->buffer = (unsigned char*) malloc(TRACE_BUFFER_SIZE);
+  if (!trace->file || !trace->buffer) {
+    errprintf("TRACE: Can't write %s.\n", fn);
+    free(fn);
+    if (trace->file)
+      fclose(trace->file);
+    free(trace->buffer);
+    trace->file = NULL;
+    trace->buffer = NULL;
+    return -1;
+  }
+
+  memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+  header->version = TRACE_VERSION;
+  gettimeofday(&tv, NULL);
+  header->start = tv.tv_sec * ((uint64_t) 1000000) + tv.tv_usec;
+  fwrite(header, sizeof(trace_header_t), 1, trace->file);
+
+  trace->length = 0;
+  trace->dropped = 0;
+  trace->start = media_time();
+
+  if (thread_start(&trace->thread, trace_thread, trace) < 0) {
+    errprintf("TRACE: Cannot start trace thread.\n");
+    fclose(trace->file);
+    free(trace->buffer);
+    trace->file = NULL;
+    trace->buffer = NULL;
+    free(fn);
+    return -1;
+  }
+
+  dbgprintf(1, "TRACE: Tracing to %s\n", fn);
+  free(fn);
+
+  g_atomic_int_set(&trace->active, 1);
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void trace_close(trace_t *trace)
+{
+  if (!trace->file)
+    return;
+
+  g_mutex_lock(trace->lock);
+  g_atomic_int_set(&trace->active, 0);
+  g_mutex_unlock(trace->lock);
+
+  thread_stop(&trace->thread); /* writes the rest */
+
+  fclose(trace->file);
+  free(trace->buffer);
+  trace->file = NULL;
+  trace->buffer = NULL;
+}
+
+/*--------------------------------------------------------------------------*/
+
+void trace_event(trace_t *trace, trace_event_t event,
+                 const void *data1, unsigned int length1,
+                 const void *data2, unsigned int length2)
+{
+  trace_record_t record;
+  unsigned char *p;
+
+  if (!g_atomic_int_get(&trace->active))
+    return;
+
+  record.event = event;
+  record.length = length1 + length2;
+  record.time = media_time() - trace->start;
+  if (record.length > TRACE_MAX_PAYLOAD)
+    return;
+
+  g_mutex_lock(trace->lock);
+  if (!trace->active || !trace->buffer) {
+    g_mutex_unlock(trace->lock);
+    return;
+  }
+  if (trace->length + sizeof(record) + record.length > TRACE_BUFFER_SIZE) {
+    trace->dropped++;
+    g_mutex_unlock(trace->lock);
+    return;
+  }
+
+  p = trace->buffer + trace->length;
+  memcpy(p, &record, sizeof(record));
+  p += sizeof(record);
+  if (length1)
+    memcpy(p, data1, length1);
+  if (length2)
+    memcpy(p + length1, data2, length2);
+  trace->length += sizeof(record) + record.length;
+  g_mutex_unlock(trace->lock);
+}
+
+/*--------------------------------------------------------------------------*/
+
+int trace_read_header(FILE *file, trace_header_t *header)
+{
+  if (fread(header, sizeof(trace_header_t), 1, file) != 1 ||
+      memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic))) {
+    errprintf("TRACE: Not a trace file\n");
+    return -1;
+  }
+  if (header->version != TRACE_VERSION) {
+    errprintf("TRACE: Unsupported trace version %u\n", header->version);
+    return -1;
+  }
+  return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+
+int trace_read_record(FILE *file, trace_record_t *record,
+                      unsigned char *payload)
+{
+  if (fread(record, sizeof(trace_record_t), 1, file) != 1)
+    return feof(file) ? 0 : -1;
+
+  if (record->length > TRACE_MAX_PAYLOAD ||
+      (record->length &&
+       fread(payload, 1, record->length, file) != record->length)) {
+    errprintf("TRACE: Truncated trace record\n");
+    return -1;
+  }
+
+  /* readers rely on the fixed part of audio records */
+  if ((record->event == TRACE_AUDIO_READ &&
+       record->length < sizeof(int32_t)) ||
+      (record->event == TRACE_AUDIO_WRITE &&
+       record->length < 2 * sizeof(int32_t))) {
+    errprintf("TRACE: Corrupt trace record (event %u, %u bytes)\n",
+              (unsigned int) record->event, (unsigned int) record->length);
+    return -1;
+  }
+  return 1;
+}
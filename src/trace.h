@@ -0,0 +1,195 @@
+/*
+ * Binary trace of the media event stream of a call
+ *
+ * This file is part of ANT (Ant is Not a Telephone)
+ *
+ * ANT is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * ANT is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with ANT; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#ifndef _ANT_TRACE_H
+#define _ANT_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* GTK */
+#include <gtk/gtk.h>
+
+#include "thread.h"
+
+/*!
+ * @brief Magic at the start of a trace file.
+ */
+#define TRACE_MAGIC "ANTTRACE"
+
+/*!
+ * @brief Version of the trace format.
+ */
+#define TRACE_VERSION 1
+
+/*!
+ * @brief Subdirectory of the settings directory for traces.
+ */
+#define TRACE_DIRNAME "traces"
+
+/*!
+ * @brief Size of the in-memory buffer in front of the file (bytes).
+ *
+ * Holds several seconds of events, events which don't fit are dropped.
+ */
+#define TRACE_BUFFER_SIZE (1 << 20)
+
+/*!
+ * @brief How often the trace thread writes the buffer to the file (ms).
+ */
+#define TRACE_FLUSH_INTERVAL 100
+
+/*!
+ * @brief Maximum payload of a trace record.
+ */
+#define TRACE_MAX_PAYLOAD 65536
+
+/*!
+ * @brief Recorded events.
+ */
+typedef enum {
+  TRACE_CAPI_MESSAGE = 1,   /*!< raw CAPI message as received */
+  TRACE_ISDN_DATA,          /*!< DATA_B3_IND payload (bit-inverse A-law) */
+  TRACE_AUDIO_READ,         /*!< int32 snd_pcm_readi() result, captured data */
+  TRACE_AUDIO_WRITE         /*!< int32 frames to write, int32 snd_pcm_writei() result */
+} trace_event_t;
+
+/*!
+ * @brief Flags of trace_header_t.
+ */
+enum {
+  TRACE_RECORD = 1,         /*!< recording was on */
+  TRACE_RECORD_LOCAL = 2,   /*!< local channel was recorded */
+  TRACE_RECORD_REMOTE = 4,  /*!< remote channel was recorded */
+  TRACE_MUTED = 8           /*!< microphone was muted */
+};
+
+/*!
+ * @brief Trace file header (native byte order).
+ */
+typedef struct {
+  char magic[8];            /*!< TRACE_MAGIC */
+  uint32_t version;         /*!< TRACE_VERSION */
+  int32_t format_in;        /*!< ALSA capture format */
+  int32_t format_out;       /*!< ALSA playback format */
+  uint32_t speed_in;        /*!< capture rate */
+  uint32_t speed_out;       /*!< playback rate */
+  uint32_t flags;           /*!< TRACE_RECORD etc. */
+  uint64_t start;           /*!< start time (us, wall clock) */
+} trace_header_t;
+
+/*!
+ * @brief Trace record header, followed by length bytes of payload.
+ */
+typedef struct {
+  uint32_t event;           /*!< trace_event_t */
+  uint32_t length;          /*!< payload length */
+  uint64_t time;            /*!< time since start of trace (us) */
+} trace_record_t;
+
+/*!
+ * @brief Trace writer.
+ *
+ * Events are appended to a memory buffer under a short lock and written
+ * to the file by a separate thread, so tracing threads never wait for
+ * disk I/O.
+ */
+typedef struct {
+  volatile gint active;     /*!< nonzero while tracing */
+  FILE *file;               /*!< trace file */
+  GMutex *lock;             /*!< lock protecting the buffer */
+  unsigned char *buffer;    /*!< buffered records */
+  unsigned int length;      /*!< bytes in buffer */
+  unsigned long dropped;    /*!< records dropped (buffer full) */
+  uint64_t start;           /*!< start time (us, monotonic) */
+  thread_t thread;          /*!< thread writing the buffer */
+} trace_t;
+
+/*!
+ * @brief Initialize trace writer (inactive).
+ *
+ * @param trace trace writer.
+ */
+void trace_init(trace_t *trace);
+
+/*!
+ * @brief Free trace writer, closes the trace if active.
+ *
+ * @param trace trace writer.
+ */
+void trace_deinit(trace_t *trace);
+
+/*!
+ * @brief Start a trace file TRACE_DIRNAME/name.trace in the settings
+ * directory.
+ *
+ * @param trace trace writer.
+ * @param name file name without extension.
+ * @param header header to write (magic, version and start are set here).
+ * @return 0 on success, -1 on error.
+ */
+int trace_open(trace_t *trace, const char *name, trace_header_t *header);
+
+/*!
+ * @brief Write remaining events and close the trace file.
+ *
+ * @param trace trace writer.
+ */
+void trace_close(trace_t *trace);
+
+/*!
+ * @brief Record an event, if tracing (any thread).
+ *
+ * @param trace trace writer.
+ * @param event event type.
+ * @param data1 first part of payload.
+ * @param length1 length of first part.
+ * @param data2 second part of payload, may be NULL.
+ * @param length2 length of second part.
+ */
+void trace_event(trace_t *trace, trace_event_t event,
+                 const void *data1, unsigned int length1,
+                 const void *data2, unsigned int length2);
+
+/*!
+ * @brief Read and check the header of a trace file.
+ *
+ * @param file trace file.
+ * @param header header to fill.
+ * @return 0 on success, -1 on error.
+ */
+int trace_read_header(FILE *file, trace_header_t *header);
+
+/*!
+ * @brief Read the next record of a trace file.
+ *
+ * Audio records too short for their fixed fields are rejected, so the
+ * payload of a successfully read record can be decoded without checks.
+ *
+ * @param file trace file.
+ * @param record record header to fill.
+ * @param payload buffer of TRACE_MAX_PAYLOAD bytes for the payload.
+ * @return 1 if a record was read, 0 at end of file, -1 on error.
+ */
+int trace_read_record(FILE *file, trace_record_t *record,
+                      unsigned char *payload);
+
+#endif /* _ANT_TRACE_H */
@@ -363,12 +363,3 @@ int output_codeset_set(char* codeset) {
 
 /*--------------------------------------------------------------------------*/
 
-uint64_t microsec_time()
-{
-  /* TODO: optimize this using HR timer, since gettimeofday is expensive */
-  struct timeval tv;
-  gettimeofday(&tv, 0);
-  return tv.tv_sec * ((uint64_t) 1000000) + tv.tv_usec;
-}
-
-/*--------------------------------------------------------------------------*/
@@ -55,11 +55,4 @@ char* filename_extension(char* fn);
 int output_codeset_save(void);
 int output_codeset_set(char* codeset);
 
-/*!
- * @brief Get time in microsecond.
- *
- * @return time in microseconds since arbitrary start point.
- */
-uint64_t microsec_time();
-
 #endif /* util.h */